@@ -0,0 +1,245 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _BACKFILL_DRIVER_H
+#define	_BACKFILL_DRIVER_H
+
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+
+#include "binlog_driver.h"
+#include "spsc_bounded_buffer.h"
+
+/**
+ * The number of decoded events each file being dumped can hold before
+ * its connection waits for the application.
+ */
+#define BACKFILL_QUEUE_SIZE 4096
+
+/**
+ * How long a connection waits for events before it checks whether it
+ * should stop, in milliseconds.
+ */
+#define BACKFILL_POLL_MS 100
+
+/**
+ * How many times in a row a connection which fails without receiving an
+ * event is opened again before the file ends with an error.
+ */
+#define BACKFILL_RETRIES 3
+
+namespace mysql {
+namespace system {
+
+/**
+ * Receives the binlog from a master over several connections at once,
+ * each dumping another one of the files listed by SHOW BINARY LOGS. The
+ * application gets the events of the files in order, so they arrive as
+ * from a single Binlog_tcp_driver, while receiving and decoding them is
+ * spread over the connections.
+ *
+ * Each connection runs on a thread of its own and reads inline with a
+ * Binlog_tcp_driver. It registers with a server id of its own, counting
+ * up from the one given, since the master ends a dump when another one
+ * is requested with the same server id. A historical file ends at its
+ * Rotate event. The file which was the last one when the driver
+ * connected is not ended; its connection goes on into the files written
+ * later, like a single dump does, so the driver keeps up with the master
+ * once the backlog is read. A connection which fails in the middle of a
+ * file is opened again at the position after the last event received.
+ *
+ * A connection only starts on a file when there are fewer than twice the
+ * number of connections files between it and the file the application
+ * is reading, which bounds the memory used to that many queues.
+ */
+class Binlog_backfill_driver
+  : public Binary_log_driver
+{
+public:
+  /**
+   * @param connections The number of files dumped at the same time
+   * @param server_id The server id of the first connection, or 0 for
+   *                  LIBREPLICATION_SERVER_ID from the environment or 1
+   * @param compress Use the compressed protocol if the server supports
+   *                 it
+   */
+  Binlog_backfill_driver(const std::string& user, const std::string& passwd,
+                         const std::string& host, unsigned long port,
+                         unsigned int connections,
+                         boost::uint32_t server_id= 0, bool compress= false)
+    : Binary_log_driver("", 4), m_user(user), m_passwd(passwd),
+      m_host(host), m_port(port),
+      m_connections(connections > 0 ? connections : 1),
+      m_server_id(server_id), m_compress(compress), m_current(0),
+      m_position(4), m_error(0), m_next_file(0), m_first_file(0),
+      m_first_position(0), m_stop(false)
+  {
+  }
+
+  ~Binlog_backfill_driver();
+
+  /**
+   * Fetches the list of binlog files from the master. The dumps start
+   * when the first event is waited for, at the first file or at the
+   * position set in between.
+   */
+  int connect();
+  int disconnect();
+  int wait_for_next_event(mysql::Binary_log_event **event);
+
+  /**
+   * Takes up to max_events events which have been received. Only waits
+   * if there are none.
+   */
+  int wait_for_next_events(std::vector<mysql::Binary_log_event *> *events,
+                           std::size_t max_events,
+                           unsigned long timeout_ms= WAIT_FOREVER);
+
+  /**
+   * Restarts the dumps at a file listed by the master. The list is
+   * fetched again if the file is not in it.
+   */
+  int set_position(const std::string &str, unsigned long position);
+  int get_position(std::string *str, unsigned long *position);
+
+  const std::string& user() const { return m_user; }
+  const std::string& password() const { return m_passwd; }
+  const std::string& host() const { return m_host; }
+  unsigned long port() const { return m_port; }
+  unsigned int connections() const { return m_connections; }
+  boost::uint32_t server_id() const { return m_server_id; }
+  bool compress() const { return m_compress; }
+
+  /**
+   * The binlog files listed by the master when it was last asked.
+   */
+  const std::vector<std::string> &files() const { return m_files; }
+
+private:
+  /**
+   * A decoded event and the position after it. The last entry of each
+   * file has no event and holds the result of reading past its end.
+   */
+  struct Scanned_event
+  {
+    Binary_log_event *event;
+    unsigned long position;
+    int result;
+  };
+
+  typedef spsc_bounded_buffer<Scanned_event> Scan_queue;
+
+  /**
+   * Ask the master for its binlog files.
+   */
+  int fetch_files(std::vector<std::string> *files);
+
+  /**
+   * Start the connections at the given file and position.
+   */
+  void start(std::size_t file, unsigned long position);
+
+  /**
+   * Stop the connections and drop the events they received.
+   */
+  void stop();
+
+  /**
+   * Run by each thread, dumping one file after another.
+   *
+   * @param slot Numbers the thread, to give its connection a server id
+   *             of its own
+   */
+  void scan(unsigned int slot);
+
+  /**
+   * Dump a file into its queue over a connection of its own.
+   */
+  void scan_file(unsigned int slot, std::size_t file, unsigned long position,
+                 Scan_queue *queue);
+
+  /**
+   * Take the entries left in the queues, and delete their events, so
+   * connections waiting for room go on.
+   */
+  void drain();
+
+  /**
+   * The queue of the file the application reads, waiting until a
+   * connection has started on it.
+   */
+  Scan_queue *current_queue();
+
+  /**
+   * Hand a received event to the application.
+   */
+  void event_taken(const Scanned_event &entry);
+
+  /**
+   * Called when the last entry of the current file has been taken.
+   *
+   * @return false if the file ended with an error.
+   */
+  bool next_file(const Scanned_event &last);
+
+  std::string m_user;
+  std::string m_passwd;
+  std::string m_host;
+  unsigned long m_port;
+  unsigned int m_connections;
+  boost::uint32_t m_server_id;
+  bool m_compress;
+
+  std::vector<std::string> m_files;
+
+  /*
+    The file the application reads, the position after the last event it
+    got, and the error which ended the file if it is not the last one.
+  */
+  std::size_t m_current;
+  unsigned long m_position;
+  int m_error;
+
+  std::vector<Scanned_event> m_batch;
+
+  /*
+    The connections and the state they share with the application, which
+    is protected by m_mutex except for the queues themselves.
+  */
+  std::vector<boost::thread *> m_pool;
+  boost::mutex m_mutex;
+  boost::condition m_changed;
+  std::vector<Scan_queue *> m_queues;
+  std::size_t m_next_file;
+  std::size_t m_first_file;
+  unsigned long m_first_position;
+
+  /*
+    Also read by the connections without the mutex, between events.
+  */
+  boost::atomic<bool> m_stop;
+};
+
+} // namespace mysql::system
+} // namespace mysql
+
+#endif	/* _BACKFILL_DRIVER_H */
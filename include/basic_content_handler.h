@@ -40,6 +40,9 @@ public:
  * common case.
  */
 
+template <class H1, class H2, class H3, class H4, class H5>
+class Static_pipeline;
+
 class Content_handler {
 public:
   Content_handler();
@@ -60,21 +63,70 @@ public:
    */
   virtual mysql::Binary_log_event *process_event(mysql::Binary_log_event *ev);
 
+  /**
+    Tells whether events of a type are passed to the handler. Binary_log
+    asks this for every type when the pipeline changes and then skips
+    the handler for the types it doesn't handle, so a handler which
+    overrides only some process_event() functions should say so here.
+    The answers must not change while the handler is in a pipeline.
+
+    The default handles all types.
+   */
+  virtual bool handles(mysql::Log_event_type type) const;
+
 protected:
   /**
    * The Injection queue is emptied before any new event is pulled from
    * the Binary_log_driver. Injected events will pass through all content
    * handlers. The Injection_queue is a derived std::list.
    */
-  Injection_queue *get_injection_queue();
+  Injection_queue *get_injection_queue() { return m_reinject_queue; }
 
 private:
   Injection_queue *m_reinject_queue;
-  void set_injection_queue(Injection_queue *injection_queue);
+  void set_injection_queue(Injection_queue *injection_queue)
+  {
+    m_reinject_queue= injection_queue;
+  }
   mysql::Binary_log_event *internal_process_event(mysql::Binary_log_event *ev);
 
   friend class Binary_log;
+  template <class H1, class H2, class H3, class H4, class H5>
+  friend class Static_pipeline;
 };
 
+/**
+ * Passes an event to the process_event() function of a handler for its
+ * type. Where this is inlined for a handler object of a known type the
+ * compiler can resolve the call without virtual dispatch.
+ */
+template <class Handler>
+inline mysql::Binary_log_event *dispatch_event(Handler &handler,
+                                               mysql::Binary_log_event *ev)
+{
+  /* Through the base, so no overload is hidden by the handler. */
+  Content_handler &base= handler;
+  switch (ev->header()->type_code) {
+  case mysql::QUERY_EVENT:
+    return base.process_event(static_cast<mysql::Query_event *>(ev));
+  case mysql::WRITE_ROWS_EVENT:
+  case mysql::UPDATE_ROWS_EVENT:
+  case mysql::DELETE_ROWS_EVENT:
+    return base.process_event(static_cast<mysql::Row_event *>(ev));
+  case mysql::USER_VAR_EVENT:
+    return base.process_event(static_cast<mysql::User_var_event *>(ev));
+  case mysql::ROTATE_EVENT:
+    return base.process_event(static_cast<mysql::Rotate_event *>(ev));
+  case mysql::INCIDENT_EVENT:
+    return base.process_event(static_cast<mysql::Incident_event *>(ev));
+  case mysql::XID_EVENT:
+    return base.process_event(static_cast<mysql::Xid *>(ev));
+  case mysql::TABLE_MAP_EVENT:
+    return base.process_event(static_cast<mysql::Table_map_event *>(ev));
+  default:
+    return base.process_event(ev);
+  }
+}
+
 } // end namespace
 #endif	/* BASIC_CONTENT_HANDLER_H */
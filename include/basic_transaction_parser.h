@@ -67,6 +67,7 @@ public:
   mysql::Binary_log_event *process_event(mysql::Table_map_event *ev);
   mysql::Binary_log_event *process_event(mysql::Xid *ev);
   mysql::Binary_log_event *process_event(mysql::Binary_log_event *ev) {return ev; }
+  bool handles(mysql::Log_event_type type) const;
 
 private:
   boost::uint32_t m_start_time;
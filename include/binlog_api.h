@@ -34,12 +34,25 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 #include "binlog_driver.h"
 #include "tcp_driver.h"
 #include "file_driver.h"
+#include "mmap_driver.h"
+#include "parallel_driver.h"
+#include "catchup_driver.h"
+#include "backfill_driver.h"
+#include "replay_driver.h"
+#include "time_index.h"
 #include "basic_content_handler.h"
 #include "basic_transaction_parser.h"
+#include "static_pipeline.h"
 #include "field_iterator.h"
 #include "rowset.h"
 #include "access_method_factory.h"
 
+/**
+ * The number of event type codes, which is the size of the dispatch
+ * table of Binary_log.
+ */
+#define DISPATCH_TYPES 256
+
 namespace io = boost::iostreams;
 
 namespace mysql
@@ -92,6 +105,62 @@ private:
   Content_handler_pipeline m_content_handlers;
   unsigned long m_binlog_position;
   std::string m_binlog_file;
+
+  /**
+   * Events fetched from the driver by wait_for_next_events()
+   */
+  std::vector<Binary_log_event *> m_batch;
+
+  /**
+   * Events are not handed out from the first transaction which starts at
+   * or after this time, or 0 for no limit.
+   */
+  boost::uint32_t m_until;
+
+  /**
+   * True if the next event from the driver starts a transaction.
+   */
+  bool m_at_boundary;
+
+  /**
+   * True once the transaction at m_until has been reached.
+   */
+  bool m_until_reached;
+
+  /**
+   * Checks an event from the driver against m_until.
+   *
+   * @return true if the event starts the first transaction at or after
+   * m_until.
+   */
+  bool reached_until(Binary_log_event *event);
+
+  /**
+   * The content handlers which handle each event type, in pipeline
+   * order. Those for type t are m_dispatch[m_dispatch_index[t]] up to
+   * m_dispatch[m_dispatch_index[t + 1]].
+   */
+  std::vector<Content_handler *> m_dispatch;
+  std::vector<std::size_t> m_dispatch_index;
+
+  /**
+   * The pipeline the dispatch table was built for.
+   */
+  std::vector<Content_handler *> m_dispatch_pipeline;
+
+  /**
+   * Builds the dispatch table again if the pipeline has changed.
+   */
+  void update_dispatch();
+
+  /**
+   * Runs an event through the content handlers.
+   *
+   * @return The event to hand to the application, or 0 if a handler
+   * consumed it.
+   */
+  Binary_log_event *process_event(Binary_log_event *event,
+                                  Injection_queue *reinjection_queue);
 public:
   Binary_log(system::Binary_log_driver *drv);
   ~Binary_log() {}
@@ -103,6 +172,25 @@ public:
    */
   int wait_for_next_event(Binary_log_event **event);
 
+  /**
+   * Blocking attempt to get a batch of binlog events from the stream.
+   * All events which are ready, up to max_events, are fetched from the
+   * driver at once and run through the content handlers. The events
+   * which come out of the handlers, including injected ones, are
+   * appended to events. Handlers which inject events can make this more
+   * than max_events.
+   *
+   * @param timeout_ms How long to wait for events in milliseconds, or
+   *                   WAIT_FOREVER.
+   *
+   * @return Error_code
+   *  @retval ERR_OK Events were appended, or the timeout expired.
+   *  @retval ERR_EOF There are no more events and none were appended.
+   */
+  int wait_for_next_events(std::vector<Binary_log_event *> *events,
+                           std::size_t max_events,
+                           unsigned long timeout_ms= WAIT_FOREVER);
+
 
   /**
    * Inserts/removes content handlers in and out of the chain
@@ -131,6 +219,24 @@ public:
    */
   int set_position(unsigned long position);
 
+  /**
+   * Set the binlog position to the first transaction which starts at or
+   * after a point in time. File drivers use the time index of the
+   * binlog files, see build_time_index(), where there is one.
+   *
+   * @param start The point in time, in seconds since the epoch
+   * @param until If not 0, the events of the first transaction which
+   *              starts at or after this time, and the ones after it,
+   *              are not handed out. wait_for_next_event() returns
+   *              ERR_EOF instead until the position is set again.
+   *
+   * @return Error_code
+   *  @retval ERR_OK The position is updated.
+   *  @retval ERR_EOF All transactions start before that time
+   *  @retval >= ERR_CODE_COUNT An unspecified error occurred
+   */
+  int set_position_by_time(boost::uint32_t start, boost::uint32_t until= 0);
+
   /**
    * Fetch the binlog position for the current file
    */
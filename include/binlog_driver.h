@@ -22,6 +22,12 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 #define	_BINLOG_DRIVER_H
 #include "binlog_event.h"
 #include "protocol.h"
+#include <vector>
+
+/**
+ * A timeout for wait_for_next_events() which never expires.
+ */
+#define WAIT_FOREVER ((unsigned long) -1)
 
 namespace mysql {
 namespace system {
@@ -35,7 +41,11 @@ public:
   {
   }
 
-  ~Binary_log_driver() {}
+  /**
+   * Drivers are handed out by create_transport() and deleted through
+   * this class, which stops and joins any threads of their own.
+   */
+  virtual ~Binary_log_driver() {}
 
   /**
    * Connect to the binary log using previously declared connection parameters
@@ -52,6 +62,30 @@ public:
    */
   virtual int wait_for_next_event(mysql::Binary_log_event **event)= 0;
 
+  /**
+   * Blocking attempt to get a batch of binlog events from the stream.
+   * Events which are ready are handed over together; the call only waits
+   * if there are none.
+   *
+   * The default implementation fetches a single event with
+   * wait_for_next_event() and ignores the timeout: it blocks until the
+   * driver has an event or an error, however long that takes. Drivers
+   * which can wait for a limited time override it, and callers which
+   * depend on the timeout, like the first stage of a Staged_pipeline,
+   * need such a driver.
+   *
+   * @param events [out] The events are appended to this vector.
+   * @param max_events The largest number of events to append.
+   * @param timeout_ms How long to wait for the first event, in
+   *                   milliseconds, or WAIT_FOREVER.
+   *
+   * @retval 0 Success; no events are appended if the timeout expired.
+   * @retval >0 Error code. No events are appended.
+   */
+  virtual int wait_for_next_events(std::vector<mysql::Binary_log_event *> *events,
+                                   std::size_t max_events,
+                                   unsigned long timeout_ms= WAIT_FOREVER);
+
   /**
    * Set the reader position
    * @param str The file name
@@ -72,8 +106,51 @@ public:
    */
   virtual int get_position(std::string *filename_ptr, unsigned long *position_ptr) = 0;
 
+  /**
+   * Set the reader position to the first transaction which starts at or
+   * after a point in time.
+   *
+   * The default implementation can't search and fails.
+   *
+   * @param when The point in time, in seconds since the epoch
+   *
+   * @retval 0 Success
+   * @retval ERR_EOF All transactions start before that time
+   * @retval >0 Error code
+   */
+  virtual int set_position_by_time(boost::uint32_t when);
+
+  /**
+   * Decode the body of an event from a stream. The body is read in one
+   * block and handed to the buffer based parse_event() below.
+   */
   Binary_log_event* parse_event(std::istream &sbuff, Log_event_header *header);
 
+  /**
+   * Decode the body of an event from a contiguous buffer.
+   *
+   * @param buf The first byte after the event header
+   * @param length The number of bytes available at buf
+   * @param header The already decoded event header
+   *
+   * @return A newly allocated event which the caller owns. If the body is
+   * shorter than the header claims an Incident_event is returned instead.
+   *
+   * @note The bytes are copied into the event.
+   */
+  Binary_log_event* parse_event(const boost::uint8_t *buf, std::size_t length,
+                                Log_event_header *header);
+
+  /**
+   * Decode the body of an event from a contiguous buffer which is kept
+   * alive by owner. Row images and table map descriptors in the returned
+   * event refer to the buffer instead of copying it, and hold a reference
+   * to owner until the event is deleted.
+   */
+  Binary_log_event* parse_event(const Buffer_owner &owner,
+                                const boost::uint8_t *buf, std::size_t length,
+                                Log_event_header *header);
+
 protected:
   /**
    * Used each time the client reconnects to the server to specify an
@@ -25,6 +25,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 #include <boost/asio.hpp>
 #include <boost/function.hpp>
 #include <vector>
+#include "byte_view.h"
 
 namespace mysql
 {
@@ -107,6 +108,13 @@ const char* get_event_type_str(Log_event_type type);
 } // end namespace system
 
 #define LOG_EVENT_HEADER_SIZE 20
+
+/**
+ * Set in the flags of an event the master makes up while it sends the
+ * binlog, like the Rotate event a binlog dump starts with, rather than
+ * reads from a binlog file.
+ */
+#define LOG_EVENT_ARTIFICIAL_F 0x20
 class Log_event_header
 {
 public:
@@ -212,6 +220,10 @@ public:
     std::string value; /* encoded in binary speak, depends on .type */
 };
 
+/**
+  The column descriptors are views into the buffer the event was received
+  in; the buffer is kept alive for as long as the event exists.
+*/
 class Table_map_event: public Binary_log_event
 {
 public:
@@ -220,11 +232,15 @@ public:
     boost::uint16_t flags;
     std::string db_name;
     std::string table_name;
-    std::vector<uint8_t> columns;
-    std::vector<uint8_t> metadata;
-    std::vector<uint8_t> null_bits;
+    Byte_view columns;
+    Byte_view metadata;
+    Byte_view null_bits;
 };
 
+/**
+  The column bitmaps and row images are views into the buffer the event was
+  received in; the buffer is kept alive for as long as the event exists.
+*/
 class Row_event: public Binary_log_event
 {
 public:
@@ -233,9 +249,9 @@ public:
     boost::uint16_t flags;
     boost::uint64_t columns_len;
     boost::uint32_t null_bits_len;
-    std::vector<boost::uint8_t> columns_before_image;
-    std::vector<uint8_t> used_columns;
-    std::vector<uint8_t> row;
+    Byte_view columns_before_image;
+    Byte_view used_columns;
+    Byte_view row;
 };
 
 class Int_var_event: public Binary_log_event
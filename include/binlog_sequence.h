@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _BINLOG_SEQUENCE_H
+#define	_BINLOG_SEQUENCE_H
+
+#include <string>
+#include <vector>
+#include "binlog_event.h"
+
+/**
+ * How much of the next binlog file is read ahead while the current one
+ * is consumed.
+ */
+#define BINLOG_PREFETCH_SIZE (16 * 1024 * 1024)
+
+namespace mysql {
+namespace system {
+
+/**
+ * Decides which binlog file a file driver reads after the current one.
+ * The files are either the ones listed in a binlog index file, such as
+ * <code>mysql-bin.index</code>, the numbered binlog files in a directory
+ * of archived copies, or the ones named by the Rotate events at the end
+ * of each file.
+ *
+ * A binlog file which is not there is read from a compressed copy of it,
+ * with the suffix <code>.gz</code> or <code>.zst</code>, if there is one.
+ */
+class Binlog_sequence
+{
+public:
+  Binlog_sequence() : m_follow(false), m_directory(false) {}
+
+  /**
+   * Start a sequence.
+   *
+   * @param path An index file, recognized by its <code>.index</code>
+   *             suffix, a directory or the first binlog file
+   * @param follow Whether to follow Rotate events from a binlog file;
+   *               an index file or a directory is always followed
+   * @param first [out] The first binlog file to read
+   *
+   * @retval ERR_OK Success
+   * @retval ERR_FAIL The index file or directory can't be read or holds
+   *                  no binlog files
+   */
+  int open(const std::string &path, bool follow, std::string *first);
+
+  /**
+   * True if the driver continues with another file after the current one.
+   */
+  bool enabled() const { return m_follow || !m_index_path.empty(); }
+
+  /**
+   * The binlog files listed in the index file or found in the directory,
+   * or none if Rotate events are followed.
+   */
+  const std::vector<std::string> &files() const { return m_files; }
+
+  /**
+   * Look at each event read, to notice a Rotate event at the end of a file.
+   */
+  void event_read(const Binary_log_event *event);
+
+  /**
+   * The file to read after current, or an empty string if there is none
+   * yet. An index file or a directory is read again when current is its
+   * last file.
+   */
+  std::string next(const std::string &current);
+
+  /**
+   * Resolve a file name given to set_position() the way the names in the
+   * index file or in Rotate events are resolved.
+   */
+  std::string resolve(const std::string &current, const std::string &name) const;
+
+  /**
+   * Ask the kernel to read the beginning of the file expected after
+   * current into the page cache. This returns at once and the reading
+   * is done in the background.
+   */
+  void prefetch(const std::string &current);
+
+private:
+  /**
+   * Read the file names from the index file or the directory.
+   */
+  int load();
+
+  /**
+   * List the binlog files in the directory, which are the files whose
+   * name ends with a number, in the order MySQL wrote them.
+   */
+  int list_directory();
+
+  /*
+    The index file or the directory, with a trailing slash, or empty when
+    following Rotate events.
+  */
+  std::string m_index_path;
+  std::vector<std::string> m_files;
+  bool m_follow;
+  bool m_directory;
+
+  /*
+    The file named by the last event read if it was a Rotate event.
+  */
+  std::string m_rotate_file;
+};
+
+} // namespace mysql::system
+} // namespace mysql
+
+#endif	/* _BINLOG_SEQUENCE_H */
@@ -0,0 +1,111 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+#ifndef _BYTE_VIEW_H
+#define	_BYTE_VIEW_H
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/checked_delete.hpp>
+#include <vector>
+
+namespace mysql
+{
+
+/**
+ * Keeps a block of received bytes alive. Any kind of storage can be the
+ * owner; the block is freed when the last reference goes away.
+ */
+typedef boost::shared_ptr<const void> Buffer_owner;
+
+/**
+ * Allocate an uninitialized block of bytes owned by a reference count.
+ */
+inline boost::shared_ptr<boost::uint8_t> make_buffer(std::size_t size)
+{
+  return boost::shared_ptr<boost::uint8_t>(new boost::uint8_t[size],
+                                           boost::checked_array_deleter<boost::uint8_t>());
+}
+
+/**
+ * A read-only window into a block of bytes which may be shared by several
+ * events. It has the read interface of the std::vector it replaces in the
+ * event classes.
+ */
+class Byte_view
+{
+public:
+  typedef boost::uint8_t value_type;
+  typedef std::size_t size_type;
+  typedef const boost::uint8_t *const_iterator;
+  typedef const_iterator iterator;
+
+  Byte_view() : m_data(0), m_size(0) {}
+
+  /**
+   * View size bytes at data, which must stay inside the block held by owner.
+   */
+  Byte_view(const Buffer_owner &owner, const boost::uint8_t *data,
+            size_type size)
+    : m_owner(owner), m_data(data), m_size(size)
+  {
+  }
+
+  /**
+   * View a private copy of the bytes [first, last).
+   */
+  Byte_view(const_iterator first, const_iterator last)
+    : m_data(0), m_size(0)
+  {
+    assign(first, last);
+  }
+
+  void assign(const_iterator first, const_iterator last)
+  {
+    boost::shared_ptr<std::vector<boost::uint8_t> >
+      copy(new std::vector<boost::uint8_t>(first, last));
+    m_owner= copy;
+    m_data= copy->empty() ? 0 : &(*copy)[0];
+    m_size= copy->size();
+  }
+
+  const_iterator begin() const { return m_data; }
+  const_iterator end() const { return m_data + m_size; }
+  size_type size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  const boost::uint8_t *data() const { return m_data; }
+  const boost::uint8_t &operator[](size_type index) const
+  {
+    return m_data[index];
+  }
+
+  /**
+   * The reference which keeps the viewed bytes alive.
+   */
+  const Buffer_owner &owner() const { return m_owner; }
+
+private:
+  Buffer_owner m_owner;
+  const boost::uint8_t *m_data;
+  size_type m_size;
+};
+
+} // end namespace mysql
+
+#endif	/* _BYTE_VIEW_H */
@@ -0,0 +1,136 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _CATCHUP_DRIVER_H
+#define	_CATCHUP_DRIVER_H
+
+#include <string>
+#include <vector>
+
+#include "binlog_driver.h"
+
+namespace mysql {
+namespace system {
+
+class Binlog_file_driver;
+class Binlog_tcp_driver;
+
+/**
+ * Serves the binlog from local copies of the master's binlog files for as
+ * long as they reach, and then goes on with a binlog dump from the master
+ * at the position where the copies end. A listener which is far behind
+ * so catches up from disk instead of loading the master.
+ *
+ * The copies are read with Binlog_file_driver following Rotate events,
+ * so they can be given as an index file, a directory of archived files
+ * or the first binlog file. They are matched to the master's files by
+ * their base name. The copy of the active file may be cut anywhere; an
+ * incomplete event at its end is received from the master instead.
+ *
+ * The dump starts right after the last event read from the copies, or at
+ * the file named by a Rotate event if that was the last one, so no event
+ * is missed or read twice. The artificial Rotate event and the repeated
+ * Format description event which the master sends at the start of a dump
+ * are dropped, since the copies have already delivered the real ones.
+ *
+ * Positions are the base name of a binlog file and an offset in it, in
+ * both parts, and set_position() only returns to the copies as long as
+ * the driver has not switched to the master yet.
+ */
+class Binlog_catchup_driver
+  : public Binary_log_driver
+{
+public:
+  /**
+   * @param local An index file, a directory or the first binlog file
+   * @param remote The driver for the master, which is connected at the
+   *               switch. The catch-up driver takes ownership of it.
+   */
+  Binlog_catchup_driver(const std::string &local, Binlog_tcp_driver *remote);
+  ~Binlog_catchup_driver();
+
+  int connect();
+  int wait_for_next_event(mysql::Binary_log_event **event);
+  int wait_for_next_events(std::vector<mysql::Binary_log_event *> *events,
+                           std::size_t max_events,
+                           unsigned long timeout_ms= WAIT_FOREVER);
+
+  /**
+   * Reads from the copies if they hold the position, and from the master
+   * otherwise.
+   */
+  int set_position(const std::string &str, unsigned long position);
+  int get_position(std::string *str, unsigned long *position);
+
+  /**
+   * Searches the copies, and reads from them or, after the switch, from
+   * the master at the position found.
+   */
+  int set_position_by_time(boost::uint32_t when);
+
+  /**
+   * True once events are received from the master.
+   */
+  bool live() const { return m_live; }
+
+  const Binlog_tcp_driver *remote() const { return m_remote; }
+
+private:
+  /**
+   * Start the binlog dump at the position after the last event read.
+   */
+  int switch_to_remote();
+
+  /**
+   * Note the position after an event read from the copies.
+   */
+  void local_event_read(const Binary_log_event *event);
+
+  /**
+   * Note the position after an event received from the master.
+   *
+   * @return false if the event is part of the dump preamble and is
+   *         dropped.
+   */
+  bool remote_event_read(Binary_log_event *event);
+
+  Binlog_file_driver *m_local;
+  Binlog_tcp_driver *m_remote;
+
+  bool m_live;
+
+  /*
+    Set from the start of a dump until the first event that is not part
+    of its preamble.
+  */
+  bool m_skip_preamble;
+
+  /*
+    The position after the last event handed to the application, with
+    the base name of the binlog file.
+  */
+  std::string m_file;
+  unsigned long m_position;
+};
+
+} // namespace mysql::system
+} // namespace mysql
+
+#endif	/* _CATCHUP_DRIVER_H */
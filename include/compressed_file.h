@@ -0,0 +1,263 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _COMPRESSED_FILE_H
+#define	_COMPRESSED_FILE_H
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+/**
+ * Suffixes of the compressed binlog files which are read as they are.
+ */
+#define GZIP_SUFFIX ".gz"
+#define ZSTD_SUFFIX ".zst"
+
+/**
+ * Appended to the name of a compressed binlog file to get the name of its
+ * access point index.
+ */
+#define ACCESS_INDEX_SUFFIX ".zidx"
+
+/**
+ * Default distance in uncompressed bytes between the access points of a
+ * compressed file.
+ */
+#define ACCESS_POINT_SPAN (8 * 1024 * 1024)
+
+namespace mysql {
+namespace system {
+
+/**
+ * A place in a compressed file where decompressing can start, so a read
+ * position after it is reached without decompressing what is before it.
+ */
+struct Access_point
+{
+  /*
+    The position in the compressed file and the matching position in the
+    uncompressed data.
+  */
+  boost::uint64_t in;
+  boost::uint64_t out;
+
+  /*
+    The number of bits of the byte before in which belong to the data
+    after the point, for a gzip file, where the point may be in the
+    middle of a byte.
+  */
+  int bits;
+
+  /*
+    The uncompressed data before the point which the data after it may
+    refer to, for a gzip file.
+  */
+  std::vector<boost::uint8_t> window;
+};
+
+/**
+ * Reads a compressed binlog file, compressed with gzip or zstd, as the
+ * plain binlog file it holds, without writing that out anywhere.
+ *
+ * While reading, the file notes an access point every span bytes of
+ * uncompressed data, so seeking back or to a place read before only
+ * decompresses from the last point before the position. A gzip file can
+ * be entered at any deflate block; the point then keeps the 32 KB
+ * window the block may refer to. A zstd file can only be entered at the
+ * start of a frame, so a file compressed as a single frame is always
+ * decompressed from its beginning.
+ *
+ * The access points can be saved next to the file with
+ * build_access_index(), which makes the first seek into a file cheap as
+ * well.
+ */
+class Compressed_file
+{
+public:
+  virtual ~Compressed_file();
+
+  /**
+   * Open a compressed file, and its access point index if it has a valid
+   * one.
+   *
+   * @param path A file whose name ends with a compression suffix
+   * @param span The distance between the access points noted while
+   *             reading
+   *
+   * @return The file, or 0 if it can't be read or its name has no
+   *         compression suffix
+   */
+  static Compressed_file *open(const std::string &path,
+                               unsigned long span= ACCESS_POINT_SPAN);
+
+  /**
+   * True if the name of the file ends with a compression suffix.
+   */
+  static bool is_compressed(const std::string &path);
+
+  /**
+   * The name of the file without its compression suffix, which is the
+   * name of the binlog file it holds.
+   */
+  static std::string plain_name(const std::string &path);
+
+  /**
+   * Copy up to size bytes from the read position on into buffer.
+   *
+   * @return The number of bytes copied, which is less than size only at
+   *         the end of the file, or -1 if the file is corrupt.
+   */
+  long read(void *buffer, std::size_t size);
+
+  /**
+   * Move the read position.
+   *
+   * @retval ERR_OK Success
+   * @retval ERR_FAIL The file ends before position or is corrupt
+   */
+  int seek(boost::uint64_t position);
+
+  /**
+   * The position in the uncompressed data of the next byte read.
+   */
+  boost::uint64_t position() const { return m_position; }
+
+  /**
+   * True if all of the data has been read. This may decompress the next
+   * bytes to find out.
+   */
+  bool at_end();
+
+  const std::vector<Access_point> &access_points() const { return m_points; }
+
+protected:
+  Compressed_file(int fd, unsigned long span);
+
+  /**
+   * Decompress the next bytes into [output, output + size).
+   *
+   * @return The number of bytes produced, 0 at the end of the data, or -1
+   *         if the data is corrupt.
+   */
+  virtual long decompress(boost::uint8_t *output, std::size_t size)= 0;
+
+  /**
+   * Prepare to decompress from an access point, or from the beginning of
+   * the file if point is 0.
+   */
+  virtual int restart(const Access_point *point)= 0;
+
+  /**
+   * True if an access point at out would be at least the span after the
+   * last one, so it is worth noting.
+   */
+  bool point_due(boost::uint64_t out) const;
+
+  /**
+   * Note an access point after the ones noted before.
+   */
+  void add_point(const Access_point &point);
+
+  /**
+   * Fill the input buffer again if it is empty.
+   *
+   * @return false at the end of the file or on a read error.
+   */
+  bool fill_input();
+
+  /**
+   * Start reading the compressed file at offset.
+   */
+  int seek_input(boost::uint64_t offset);
+
+  /**
+   * The position in the compressed file of the next input byte.
+   */
+  boost::uint64_t input_position() const
+  {
+    return m_input_offset - (m_input_end - m_input_begin);
+  }
+
+  /**
+   * The position in the uncompressed data of the next byte decompressed.
+   */
+  boost::uint64_t output_position() const
+  {
+    return m_position + (m_output_end - m_output_begin);
+  }
+
+  int m_fd;
+  std::vector<boost::uint8_t> m_input;
+  std::size_t m_input_begin;
+  std::size_t m_input_end;
+  bool m_input_eof;
+
+  /*
+    The offset in the compressed file just after the input buffer.
+  */
+  boost::uint64_t m_input_offset;
+
+private:
+  Compressed_file(const Compressed_file &);
+  Compressed_file &operator=(const Compressed_file &);
+
+  /**
+   * Decompress more data if the output buffer is used up.
+   *
+   * @return false at the end of the data or if it is corrupt.
+   */
+  bool fill_output();
+
+  /**
+   * Read the access point index of path, if it matches the file.
+   */
+  void load_index(const std::string &path);
+
+  std::vector<boost::uint8_t> m_output;
+  std::size_t m_output_begin;
+  std::size_t m_output_end;
+  bool m_corrupt;
+
+  boost::uint64_t m_position;
+  unsigned long m_span;
+  std::vector<Access_point> m_points;
+
+  friend int build_access_index(const std::string &, unsigned long);
+};
+
+/**
+ * Read a compressed binlog file from beginning to end and save its access
+ * points in a file next to it with the suffix ACCESS_INDEX_SUFFIX. The
+ * index is only used as long as the file keeps its size.
+ *
+ * @param path The compressed binlog file
+ * @param span The distance in uncompressed bytes between access points
+ *
+ * @retval ERR_OK Success
+ * @retval ERR_FAIL The file can't be read or the index can't be written
+ */
+int build_access_index(const std::string &path,
+                       unsigned long span= ACCESS_POINT_SPAN);
+
+} // namespace mysql::system
+} // namespace mysql
+
+#endif	/* _COMPRESSED_FILE_H */
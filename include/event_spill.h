@@ -0,0 +1,236 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _EVENT_SPILL_H
+#define	_EVENT_SPILL_H
+
+#include <deque>
+#include <fstream>
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include "byte_view.h"
+
+/**
+ * Default size at which a Disk_spill starts a new segment file.
+ */
+#define SPILL_SEGMENT_SIZE (64 * 1024 * 1024)
+
+/**
+ * Default limit of the disk space used by a Disk_spill.
+ */
+#define SPILL_MAX_BYTES (1024 * 1024 * 1024)
+
+namespace mysql {
+namespace system {
+
+/**
+ * Storage for events which arrive while the event queue of a driver is
+ * full. Instead of waiting for the application the driver keeps reading
+ * and spills the raw events here. They are decoded and queued, in order,
+ * once the application has made room.
+ *
+ * A spill is only used by the thread receiving the events; the spills of
+ * different drivers may be used at the same time.
+ */
+class Event_spill
+{
+public:
+  virtual ~Event_spill() {}
+
+  /**
+   * Store an event after the ones already spilled.
+   *
+   * @param event The event, starting with the event header
+   *
+   * @retval true The event is stored
+   * @retval false There is no room; the driver waits for the application
+   *               instead.
+   */
+  virtual bool write(const Byte_view &event)= 0;
+
+  /**
+   * Look at the oldest spilled event without removing it.
+   *
+   * @retval false There are no spilled events, or, if depth() is not 0,
+   *               they can't be read back.
+   */
+  virtual bool front(Byte_view *event)= 0;
+
+  /**
+   * Remove the oldest spilled event.
+   */
+  virtual void pop()= 0;
+
+  /**
+   * The number of spilled events.
+   */
+  virtual std::size_t depth() const= 0;
+
+  /**
+   * The number of bytes held by the spilled events.
+   */
+  virtual boost::uint64_t bytes() const= 0;
+
+  /**
+   * Drop all spilled events.
+   */
+  virtual void clear()= 0;
+};
+
+/**
+ * Spills events to memory. The events keep referring to the buffers they
+ * were received into, so nothing is copied, but memory use is not
+ * bounded.
+ */
+class Memory_spill : public Event_spill
+{
+public:
+  Memory_spill() : m_bytes(0) {}
+
+  bool write(const Byte_view &event)
+  {
+    m_events.push_back(event);
+    m_bytes+= event.size();
+    return true;
+  }
+
+  bool front(Byte_view *event)
+  {
+    if (m_events.empty())
+      return false;
+    *event= m_events.front();
+    return true;
+  }
+
+  void pop()
+  {
+    m_bytes-= m_events.front().size();
+    m_events.pop_front();
+  }
+
+  std::size_t depth() const { return m_events.size(); }
+  boost::uint64_t bytes() const { return m_bytes; }
+
+  void clear()
+  {
+    m_events.clear();
+    m_bytes= 0;
+  }
+
+private:
+  std::deque<Byte_view> m_events;
+  boost::uint64_t m_bytes;
+};
+
+/**
+ * Spills events to segment files in a directory. Events are appended to
+ * the newest segment, which is closed once it reaches the segment size,
+ * and read back from the oldest one. A segment is removed as soon as all
+ * of its events have been read, so the files only take the room of the
+ * events still spilled, rounded up to whole segments.
+ *
+ * Each spilled event is stored as a 4 byte little endian length followed
+ * by the event.
+ */
+class Disk_spill : public Event_spill
+{
+public:
+  /**
+   * @param directory Where to create the segment files
+   * @param max_bytes The largest amount of disk space to use, or 0 for
+   *                  no limit
+   * @param segment_size The size at which a new segment is started
+   */
+  Disk_spill(const std::string &directory,
+             boost::uint64_t max_bytes= SPILL_MAX_BYTES,
+             boost::uint64_t segment_size= SPILL_SEGMENT_SIZE);
+  ~Disk_spill();
+
+  bool write(const Byte_view &event);
+  bool front(Byte_view *event);
+  void pop();
+  std::size_t depth() const { return m_depth; }
+  boost::uint64_t bytes() const { return m_bytes; }
+  void clear();
+
+  /**
+   * The disk space taken by the segment files.
+   */
+  boost::uint64_t disk_bytes() const { return m_disk_bytes; }
+
+  /**
+   * The number of segment files.
+   */
+  std::size_t segments() const { return m_segments.size(); }
+
+  const std::string &directory() const { return m_directory; }
+
+private:
+  struct Segment
+  {
+    std::string path;
+    boost::uint64_t size;
+  };
+
+  /**
+   * Cuts a torn record off the newest segment after a failed write.
+   */
+  void truncate_segment();
+
+  /**
+   * Closes and removes the oldest segment.
+   */
+  void remove_segment();
+
+  std::string m_directory;
+  boost::uint64_t m_max_bytes;
+  boost::uint64_t m_segment_size;
+
+  /**
+   * The segments from the oldest, which is read, to the newest, which is
+   * written.
+   */
+  std::deque<Segment> m_segments;
+  std::ofstream m_writer;
+  std::ifstream m_reader;
+  boost::uint64_t m_read_offset;
+
+  /**
+   * The oldest event when it has been read but not popped yet.
+   */
+  Byte_view m_front;
+  bool m_has_front;
+
+  std::size_t m_depth;
+  boost::uint64_t m_bytes;
+  boost::uint64_t m_disk_bytes;
+
+  /**
+   * Numbers the segment files of all spills in the process. Spills of
+   * different drivers take numbers from their own threads.
+   */
+  static boost::atomic<unsigned long> s_segment_count;
+};
+
+} // namespace mysql::system
+} // namespace mysql
+
+#endif	/* _EVENT_SPILL_H */
@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 
 #include <iostream>
 #include <fstream>
+#include <boost/thread/thread_time.hpp>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -30,31 +31,155 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 #include "binlog_api.h"
 #include "binlog_driver.h"
 #include "protocol.h"
+#include "binlog_sequence.h"
+#include "compressed_file.h"
 
 #define MAGIC_NUMBER_SIZE 4
 
 namespace mysql {
 namespace system {
 
+/**
+ * Reads a binlog file, or a sequence of them.
+ *
+ * If the file name ends with <code>.index</code> it is taken as a binlog
+ * index file and all binlog files listed in it are read as one stream.
+ * A directory, such as one holding archived copies, is read the same way
+ * with the numbered binlog files in it as the index.
+ * Otherwise a single file is read, or with follow set also the files
+ * named by the Rotate events at their ends. get_position() reports the
+ * binlog file currently read.
+ *
+ * In tail mode the driver behaves like <code>tail -f</code> on the
+ * active binlog. At the end of the last file it waits for the file to
+ * grow, or for the next file to appear, instead of returning ERR_EOF.
+ * The waiting is done with inotify on the file, its directory and the
+ * index file. Rotate events are always followed in tail mode.
+ *
+ * Files compressed with gzip or zstd, named with the suffix
+ * <code>.gz</code> or <code>.zst</code>, are decompressed while they
+ * are read, and stand in for the binlog files of the same name without
+ * the suffix. Positions are those in the uncompressed file. A compressed
+ * file is taken to be complete, so only the file after it is waited for
+ * in tail mode.
+ */
 class Binlog_file_driver
   : public Binary_log_driver
 {
 public:
   template <class TFilename>
   Binlog_file_driver(const TFilename& filename = TFilename(),
-                     unsigned int offset = 0)
-    : Binary_log_driver(filename, offset)
+                     unsigned int offset = 0, bool follow= false,
+                     bool tail= false)
+    : Binary_log_driver(filename, offset), m_path(filename),
+      m_follow(follow || tail), m_tail(tail), m_inotify(-1), m_file_watch(-1),
+      m_binlog_file_size(0), m_bytes_read(0), m_compressed(0)
   {
   }
 
+  ~Binlog_file_driver();
+
     int connect();
     int disconnect();
     int wait_for_next_event(mysql::Binary_log_event **event);
+
+    /**
+     * Reads up to max_events events. Only in tail mode the driver waits,
+     * at most timeout_ms for the first event; otherwise reading a file
+     * never waits and the timeout is not used.
+     */
+    int wait_for_next_events(std::vector<mysql::Binary_log_event *> *events,
+                             std::size_t max_events,
+                             unsigned long timeout_ms= WAIT_FOREVER);
+    /**
+     * Fails if the file is missing or shorter than position, so the
+     * position can't be served from the files at hand.
+     */
     int set_position(const std::string &str, unsigned long position);
     int get_position(std::string *str, unsigned long *position);
 
+    /**
+     * Searches the files of the sequence, or the file read if there is no
+     * index file, with find_position_by_time().
+     */
+    int set_position_by_time(boost::uint32_t when);
+
+    bool follow() const { return m_follow; }
+    bool tail() const { return m_tail; }
+
 private:
 
+    /**
+     * Start reading the binlog file name after its magic number.
+     */
+    int open_file(const std::string &name);
+
+    /**
+     * Read the next event, waiting in tail mode until timeout_ms
+     * milliseconds have passed.
+     *
+     * @retval ERR_OK An event is read, or none if the timeout expired
+     */
+    int read_event(mysql::Binary_log_event **event, unsigned long timeout_ms);
+
+    /**
+     * Read the event at the read position, of which at least the header
+     * is in the file.
+     *
+     * @retval ERR_EOF The event is not complete in tail mode
+     */
+    int read_complete_event(mysql::Binary_log_event **event);
+
+    /**
+     * Read size bytes of the file, throwing like the stream does if they
+     * are not all there.
+     */
+    void read_bytes(void *buffer, std::size_t size);
+
+    /**
+     * Watch the binlog file being read, and the first time also its
+     * directory, for changes.
+     */
+    int watch_file();
+
+    /**
+     * Update the size of the file being read.
+     *
+     * @return true if the file has grown.
+     */
+    bool refresh_size();
+
+    /**
+     * Wait until a watched file changes or the deadline passes.
+     *
+     * @retval 1 Something changed
+     * @retval 0 The deadline passed
+     * @retval -1 Error
+     */
+    int wait_for_change(const boost::system_time &deadline, bool forever);
+
+    /*
+      The file name the driver was created with, which may be an index.
+    */
+    std::string m_path;
+
+    /*
+      The binlog file being read. m_binlog_file_name is changed by Rotate
+      events before the next file is opened.
+    */
+    std::string m_file;
+    bool m_follow;
+    Binlog_sequence m_sequence;
+
+    bool m_tail;
+
+    /*
+      The inotify instance used in tail mode, and the watch on the file
+      being read.
+    */
+    int m_inotify;
+    int m_file_watch;
+
     unsigned long m_binlog_file_size;
 
     /*
@@ -65,7 +190,20 @@ private:
 
     std::ifstream m_binlog_file;
 
+    /*
+      The file being read if it is compressed, instead of m_binlog_file.
+      Its size is not known until all of it is read, so
+      m_binlog_file_size is unlimited then.
+    */
+    Compressed_file *m_compressed;
+
     Log_event_header m_event_log_header;
+
+    /*
+      The body of events which are copied out while decoding. It is
+      reused so it only grows to the size of the largest such event.
+    */
+    std::vector<boost::uint8_t> m_event_buffer;
 };
 
 } // namespace mysql::system
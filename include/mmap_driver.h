@@ -0,0 +1,140 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _MMAP_DRIVER_H
+#define	_MMAP_DRIVER_H
+
+#include <boost/shared_ptr.hpp>
+
+#include "binlog_api.h"
+#include "binlog_driver.h"
+#include "protocol.h"
+#include "binlog_sequence.h"
+
+/**
+ * How far the reader of a mapped binlog gets ahead of the pages it has
+ * already given back to the kernel.
+ */
+#define MMAP_RELEASE_SIZE (16 * 1024 * 1024)
+
+namespace mysql {
+namespace system {
+
+/**
+ * Reads a binlog file through a read-only memory mapping. Events are
+ * decoded directly from the mapping, which the events refer to instead
+ * of copying it, so a mapping is only unmapped when the driver and the
+ * last event referring to it are gone.
+ *
+ * The mapping is read sequentially, and once the reader is
+ * MMAP_RELEASE_SIZE past the pages it released last, the pages behind it
+ * are released as well. Events which still refer to released pages read
+ * them again from the file.
+ *
+ * Sequences of files are read as by Binlog_file_driver.
+ */
+class Binlog_mmap_driver
+  : public Binary_log_driver
+{
+public:
+  template <class TFilename>
+  Binlog_mmap_driver(const TFilename& filename = TFilename(),
+                     unsigned int offset = 0, bool follow= false)
+    : Binary_log_driver(filename, offset), m_path(filename),
+      m_follow(follow), m_data(0), m_size(0), m_bytes_read(0), m_released(0)
+  {
+  }
+
+  ~Binlog_mmap_driver();
+
+  int connect();
+  int disconnect();
+  int wait_for_next_event(mysql::Binary_log_event **event);
+
+  /**
+   * Reads up to max_events events. Reading a file never waits, so the
+   * timeout is not used.
+   */
+  int wait_for_next_events(std::vector<mysql::Binary_log_event *> *events,
+                           std::size_t max_events,
+                           unsigned long timeout_ms= WAIT_FOREVER);
+  int set_position(const std::string &str, unsigned long position);
+  int get_position(std::string *str, unsigned long *position);
+
+  /**
+   * Searches the files of the sequence, or the file read if there is no
+   * index file, with find_position_by_time().
+   */
+  int set_position_by_time(boost::uint32_t when);
+
+  bool follow() const { return m_follow; }
+
+private:
+
+  /**
+   * Map the binlog file name and start reading after its magic number.
+   */
+  int open_file(const std::string &name);
+
+  /**
+   * Gives the pages before the read position back to the kernel once
+   * there are MMAP_RELEASE_SIZE bytes of them.
+   */
+  void release_pages();
+
+  /*
+    The file name the driver was created with, which may be an index.
+  */
+  std::string m_path;
+
+  /*
+    The binlog file being read. m_binlog_file_name is changed by Rotate
+    events before the next file is opened.
+  */
+  std::string m_file;
+  bool m_follow;
+  Binlog_sequence m_sequence;
+
+  /*
+    The mapping of the whole file, unmapped when the last reference to
+    it goes away.
+  */
+  Buffer_owner m_mapping;
+  const boost::uint8_t *m_data;
+  unsigned long m_size;
+
+  /*
+    Bytes that has been read so for from the file.
+    Updated after every event is read.
+  */
+  unsigned long m_bytes_read;
+
+  /*
+    The pages before this offset have been released.
+  */
+  unsigned long m_released;
+
+  Log_event_header m_event_log_header;
+};
+
+} // namespace mysql::system
+} // namespace mysql
+
+#endif	/* _MMAP_DRIVER_H */
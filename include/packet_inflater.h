@@ -0,0 +1,104 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _PACKET_INFLATER_H
+#define	_PACKET_INFLATER_H
+
+#include <boost/cstdint.hpp>
+#include <cstddef>
+
+struct z_stream_s;
+
+/**
+ * Size of the header of a packet in the compressed protocol.
+ */
+#define COMPRESSED_HEADER_SIZE 7
+
+/**
+ * Packets shorter than this are sent without compressing them.
+ */
+#define MIN_COMPRESS_LENGTH 50
+
+namespace mysql {
+namespace system {
+
+/**
+ * Turns the packets of the compressed client/server protocol back into
+ * the stream of plain packets they carry.
+ *
+ * A compressed packet starts with a 3 byte length, a sequence number and
+ * the 3 byte length of the payload before compression, which is 0 if it
+ * was sent as is. The plain packets are not aligned to compressed ones;
+ * one of them may span several compressed packets and the other way
+ * around.
+ *
+ * The input may be handed over in pieces of any size, and the output
+ * written to any number of buffers, so nothing has to be collected first.
+ */
+class Packet_inflater
+{
+public:
+  Packet_inflater();
+  ~Packet_inflater();
+
+  /**
+   * Inflates bytes from [*input, input_end) into output, stopping when
+   * either is used up. *input is moved past the bytes used.
+   *
+   * @param produced [out] The number of bytes written to output
+   *
+   * @retval true Success
+   * @retval false The input is not valid compressed protocol
+   */
+  bool inflate(const boost::uint8_t **input, const boost::uint8_t *input_end,
+               boost::uint8_t *output, std::size_t output_size,
+               std::size_t *produced);
+
+  /**
+   * Forget any partly inflated packet, for example after reconnecting.
+   */
+  void reset();
+
+private:
+  Packet_inflater(const Packet_inflater&);
+  Packet_inflater& operator=(const Packet_inflater&);
+
+  z_stream_s *m_stream;
+
+  /**
+   * The header of the next packet, which may arrive in pieces.
+   */
+  boost::uint8_t m_header[COMPRESSED_HEADER_SIZE];
+  std::size_t m_header_used;
+
+  /**
+   * The input and output bytes left of the current packet, if
+   * m_in_packet is set.
+   */
+  bool m_in_packet;
+  bool m_stored;
+  std::size_t m_input_left;
+  std::size_t m_output_left;
+};
+
+} // namespace mysql::system
+} // namespace mysql
+
+#endif	/* _PACKET_INFLATER_H */
@@ -0,0 +1,188 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _PARALLEL_DRIVER_H
+#define	_PARALLEL_DRIVER_H
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+
+#include "binlog_api.h"
+#include "binlog_driver.h"
+#include "binlog_sequence.h"
+#include "spsc_bounded_buffer.h"
+
+/**
+ * The number of decoded events each file being scanned can hold before
+ * its scanner waits for the application.
+ */
+#define PARALLEL_QUEUE_SIZE 4096
+
+namespace mysql {
+namespace system {
+
+/**
+ * Reads the binlog files listed in an index file by decoding several of
+ * them at the same time on a pool of threads. Each file is decoded by a
+ * driver of its own, so any state kept while decoding stays within the
+ * file, and into a queue of its own. The application gets the events
+ * from the queues in file order, so they arrive in the same order as
+ * from Binlog_file_driver.
+ *
+ * A scanner only starts on a file when there are fewer than twice the
+ * number of threads files between it and the file the application is
+ * reading, which bounds the memory used to that many queues.
+ */
+class Binlog_parallel_driver
+  : public Binary_log_driver
+{
+public:
+  /**
+   * @param index The binlog index file
+   * @param threads The number of files decoded at the same time
+   * @param mmap Read the files with Binlog_mmap_driver instead of
+   *             Binlog_file_driver
+   */
+  Binlog_parallel_driver(const std::string &index, unsigned int threads,
+                         bool mmap= false)
+    : Binary_log_driver(index, 0), m_path(index),
+      m_threads(threads > 0 ? threads : 1), m_mmap(mmap), m_current(0),
+      m_position(0), m_error(0), m_next_file(0), m_first_file(0),
+      m_first_position(0), m_stop(false)
+  {
+  }
+
+  ~Binlog_parallel_driver();
+
+  int connect();
+  int disconnect();
+  int wait_for_next_event(mysql::Binary_log_event **event);
+
+  /**
+   * Takes up to max_events events which have been decoded. Only waits if
+   * there are none.
+   */
+  int wait_for_next_events(std::vector<mysql::Binary_log_event *> *events,
+                           std::size_t max_events,
+                           unsigned long timeout_ms= WAIT_FOREVER);
+  int set_position(const std::string &str, unsigned long position);
+  int get_position(std::string *str, unsigned long *position);
+
+  /**
+   * Searches the files of the sequence, or the file read if there is no
+   * index file, with find_position_by_time().
+   */
+  int set_position_by_time(boost::uint32_t when);
+
+  unsigned int threads() const { return m_threads; }
+  bool mmap() const { return m_mmap; }
+
+private:
+  /**
+   * A decoded event and the position after it. The last entry of each
+   * file has no event and holds the result of reading past its end.
+   */
+  struct Scanned_event
+  {
+    Binary_log_event *event;
+    unsigned long position;
+    int result;
+  };
+
+  typedef spsc_bounded_buffer<Scanned_event> Scan_queue;
+
+  /**
+   * Start the scanners at the given file and position.
+   */
+  void start(std::size_t file, unsigned long position);
+
+  /**
+   * Stop the scanners and drop the events they decoded.
+   */
+  void stop();
+
+  /**
+   * Run by each thread of the pool, decoding one file after another.
+   */
+  void scan();
+
+  /**
+   * Decode a file into its queue with the given driver.
+   */
+  void scan_file(Binary_log_driver *driver, const std::string &name,
+                 unsigned long position, Scan_queue *queue);
+
+  /**
+   * Take the entries left in the queues, and delete their events, so
+   * scanners waiting for room go on.
+   */
+  void drain();
+
+  /**
+   * The queue of the file the application reads, waiting until a scanner
+   * has started on it.
+   */
+  Scan_queue *current_queue();
+
+  /**
+   * Called when the last entry of the current file has been taken.
+   *
+   * @return false if the file ended with an error.
+   */
+  bool next_file(const Scanned_event &last);
+
+  std::string m_path;
+  unsigned int m_threads;
+  bool m_mmap;
+  Binlog_sequence m_sequence;
+
+  /*
+    The file the application reads, the position after the last event it
+    got, and the error which ended the file if it is not the last one.
+  */
+  std::size_t m_current;
+  unsigned long m_position;
+  int m_error;
+
+  std::vector<Scanned_event> m_batch;
+
+  /*
+    The scanners and the state they share with the application, which is
+    protected by m_mutex except for the queues themselves.
+  */
+  std::vector<boost::thread *> m_pool;
+  boost::mutex m_mutex;
+  boost::condition m_changed;
+  std::vector<Scan_queue *> m_queues;
+  std::size_t m_next_file;
+  std::size_t m_first_file;
+  unsigned long m_first_position;
+
+  /*
+    Also read by the scanners without the mutex, between events.
+  */
+  boost::atomic<bool> m_stop;
+};
+
+} // namespace mysql::system
+} // namespace mysql
+
+#endif	/* _PARALLEL_DRIVER_H */
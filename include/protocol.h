@@ -22,7 +22,9 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 
 #include <boost/asio.hpp>
 #include <list>
+#include <cstring>
 #include "binlog_event.h"
+#include "packet_inflater.h"
 
 using boost::asio::ip::tcp;
 namespace mysql {
@@ -335,6 +337,7 @@ public:
     }
 private:
     friend std::istream &operator>>(std::istream &is, Protocol_chunk_string &str);
+    friend buffer_source &operator>>(buffer_source &src, Protocol_chunk_string &str);
     std::string *m_str;
 };
 
@@ -357,6 +360,7 @@ public:
     }
 private:
     friend std::istream &operator>>(std::istream &is, Protocol_chunk_vector &chunk);
+    friend buffer_source &operator>>(buffer_source &src, Protocol_chunk_vector &chunk);
     std::vector<boost::uint8_t> *m_vec;
     unsigned long m_size;
 };
@@ -364,23 +368,116 @@ private:
 
 std::istream &operator>>(std::istream &is, Protocol_chunk_vector &chunk);
 
+/**
+ * A chunk of size bytes which is not copied out of the source buffer but
+ * referenced by a Byte_view. If the source has no owner the bytes are
+ * copied into storage private to the view.
+ */
+class Protocol_chunk_view
+{
+public:
+    Protocol_chunk_view(Byte_view &view, unsigned long size)
+    {
+        m_view= &view;
+        m_size= size;
+    }
+
+    unsigned int size() const { return m_size; }
+private:
+    friend buffer_source &operator>>(buffer_source &src, Protocol_chunk_view &chunk);
+    Byte_view *m_view;
+    unsigned long m_size;
+};
+
+/**
+ * A bounded read cursor over a contiguous block of memory.
+ *
+ * Protocol chunks are extracted with the same operator>> grammar as from
+ * a std::istream, but every read is a single bounds-checked memcpy. If a
+ * read would pass the end of the buffer nothing is copied and the source
+ * enters a failed state which is sticky; check good() after a sequence of
+ * extractions.
+ */
 class buffer_source
 {
 public:
 
-    buffer_source(const char *src, int sz)
+    buffer_source(const char *src, std::size_t sz)
     {
         m_src= src;
         m_size= sz;
         m_ptr= 0;
+        m_fail= false;
+    }
+
+    buffer_source(const boost::uint8_t *src, std::size_t sz)
+    {
+        m_src= reinterpret_cast<const char *>(src);
+        m_size= sz;
+        m_ptr= 0;
+        m_fail= false;
     }
 
+    /**
+     * A source over memory kept alive by owner. Protocol_chunk_view
+     * extractions share the memory instead of copying it.
+     */
+    buffer_source(const Buffer_owner &owner, const boost::uint8_t *src,
+                  std::size_t sz)
+    {
+        m_owner= owner;
+        m_src= reinterpret_cast<const char *>(src);
+        m_size= sz;
+        m_ptr= 0;
+        m_fail= false;
+    }
+
+    /**
+     * Copy the next length bytes to dst and advance the cursor.
+     *
+     * @retval true The bytes were copied
+     * @retval false There were fewer than length bytes left
+     */
+    bool read(void *dst, std::size_t length)
+    {
+        if (m_fail || length > m_size - m_ptr)
+        {
+            m_fail= true;
+            return false;
+        }
+        memcpy(dst, m_src + m_ptr, length);
+        m_ptr+= length;
+        return true;
+    }
+
+    /**
+     * Return a pointer to the next length bytes and advance the cursor,
+     * or 0 if there are fewer than length bytes left.
+     */
+    const char *consume(std::size_t length)
+    {
+        if (m_fail || length > m_size - m_ptr)
+        {
+            m_fail= true;
+            return 0;
+        }
+        const char *ptr= m_src + m_ptr;
+        m_ptr+= length;
+        return ptr;
+    }
+
+    std::size_t position() const { return m_ptr; }
+    std::size_t remaining() const { return m_size - m_ptr; }
+    bool good() const { return !m_fail; }
+    const Buffer_owner &owner() const { return m_owner; }
+
     friend buffer_source &operator>>(buffer_source &src, Protocol &chunk);
 private:
+    Buffer_owner m_owner;
     const char *m_src;
-    int m_size;
-    int m_ptr;
-
+    std::size_t m_size;
+    std::size_t m_ptr;
+    bool m_fail;
 };
 
 class Protocol_chunk_string_len
@@ -393,10 +490,16 @@ public:
 
 private:
     friend std::istream &operator>>(std::istream &is, Protocol_chunk_string_len &lenstr);
+    friend buffer_source &operator>>(buffer_source &src, Protocol_chunk_string_len &lenstr);
     std::string *m_storage;
 };
 
 buffer_source &operator>>(buffer_source &src, Protocol &chunk);
+buffer_source &operator>>(buffer_source &src, std::string &str);
+buffer_source &operator>>(buffer_source &src, Protocol_chunk_string_len &lenstr);
+buffer_source &operator>>(buffer_source &src, Protocol_chunk_string &str);
+buffer_source &operator>>(buffer_source &src, Protocol_chunk_vector &chunk);
+buffer_source &operator>>(buffer_source &src, Protocol_chunk_view &chunk);
 /** TODO assert that the correct endianess is used */
 std::istream &operator>>(std::istream &is, Protocol &chunk);
 std::istream &operator>>(std::istream &is, std::string &str);
@@ -411,7 +514,8 @@ int proto_read_package_header(tcp::socket *socket, unsigned long *packet_length,
  * @retval 0 Success
  * @retval >0 An error occurred
  */
-int proto_read_package_header(tcp::socket *socket, boost::asio::streambuf &buff, unsigned long *packet_length, unsigned char *packet_no);
+int proto_read_package_header(tcp::socket *socket, boost::asio::streambuf &buff, unsigned long *packet_length, unsigned char *packet_no,
+                              Packet_inflater *inflater= 0);
 
 /**
  * Get one complete packet from the server
@@ -419,26 +523,46 @@ int proto_read_package_header(tcp::socket *socket, boost::asio::streambuf &buff,
  * @param socket Pointer to the active tcp-socket
  * @param buff A reference to a stream buffer
  * @param packet_no [out] The number of the packet as given by the server
+ * @param inflater Inflates the packets if the connection uses the
+ *                 compressed protocol, 0 otherwise. The same inflater
+ *                 must be used for all packets of a response.
  *
  * @return the size of the packet or 0 to indicate an error
  */
-int proto_get_one_package(tcp::socket *socket, boost::asio::streambuf &buff, boost::uint8_t *packet_no);
+int proto_get_one_package(tcp::socket *socket, boost::asio::streambuf &buff, boost::uint8_t *packet_no,
+                          Packet_inflater *inflater= 0);
+
+/**
+ * Send the contents of buff as one packet, wrapped in a compressed
+ * packet if the connection uses the compressed protocol.
+ *
+ * @throw boost::system::system_error
+ */
+void proto_write_packet(tcp::socket *socket, boost::asio::streambuf &buff,
+                        boost::uint8_t packet_no, bool compressed= false);
 void prot_parse_error_message(std::istream &is, struct st_error_package &err, int packet_length);
 void prot_parse_ok_message(std::istream &is, struct st_ok_package &ok, int packet_length);
 void prot_parse_eof_message(std::istream &is, struct st_eof_package &eof);
 void proto_get_handshake_package(std::istream &is, struct st_handshake_package &p, int packet_length);
 
+/**
+  Read the 19 byte event header which prefixes every binlog event.
+*/
+void proto_event_header(buffer_source &src, Log_event_header *header);
+
 /**
   Allocates a new event and copy the header. The caller must be responsible for
   releasing the allocated memory.
+
+  The source must be positioned at the first byte after the event header.
 */
-Query_event *proto_query_event(std::istream &is, Log_event_header *header);
-Rotate_event *proto_rotate_event(std::istream &is, Log_event_header *header);
-Incident_event *proto_incident_event(std::istream &is, Log_event_header *header);
-Row_event *proto_rows_event(std::istream &is, Log_event_header *header);
-Table_map_event *proto_table_map_event(std::istream &is, Log_event_header *header);
-Int_var_event *proto_intvar_event(std::istream &is, Log_event_header *header);
-User_var_event *proto_uservar_event(std::istream &is, Log_event_header *header);
+Query_event *proto_query_event(buffer_source &src, Log_event_header *header);
+Rotate_event *proto_rotate_event(buffer_source &src, Log_event_header *header);
+Incident_event *proto_incident_event(buffer_source &src, Log_event_header *header);
+Row_event *proto_rows_event(buffer_source &src, Log_event_header *header);
+Table_map_event *proto_table_map_event(buffer_source &src, Log_event_header *header);
+Int_var_event *proto_intvar_event(buffer_source &src, Log_event_header *header);
+User_var_event *proto_uservar_event(buffer_source &src, Log_event_header *header);
 
 } // end namespace system
 } // end namespace mysql
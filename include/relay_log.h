@@ -0,0 +1,222 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _RELAY_LOG_H
+#define	_RELAY_LOG_H
+
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition.hpp>
+#include "binlog_event.h"
+
+/**
+ * Size of the buffer events are collected in before they are written to
+ * the relay log files.
+ */
+#define RELAY_BUFFER_SIZE (256 * 1024)
+
+namespace mysql {
+namespace system {
+
+/**
+ * Writes the binlog stream a driver receives into local copies of the
+ * master's binlog files, with an index file listing them, so the events
+ * can be read again with a file driver after a restart instead of being
+ * dumped by the master once more.
+ *
+ * The files get the names of the master's files and hold the same bytes,
+ * so a position in one of them is the same position on the master. A new
+ * file is started where the master starts one. A binlog dump which starts
+ * in the middle of a file continues the local copy of it, cut to the
+ * position of the dump, or, if that is missing or too short, is only
+ * written from the next file on. The events the master makes up during a
+ * dump, like heartbeats, are not written.
+ *
+ * Events are collected in a buffer and written to the file each time the
+ * driver has handled the data it has received. A thread of the relay log
+ * syncs the files: while it syncs, more events are written, and the next
+ * sync takes all of them at once. Syncing thus never holds up the driver,
+ * and the syncs are as frequent as the disk allows or as the sync
+ * interval permits.
+ *
+ * Only the thread receiving the events writes to a relay log.
+ */
+class Relay_log
+{
+public:
+  /**
+   * @param directory Where to write the files, which must exist
+   * @param sync_interval_ms The shortest time between the starts of two
+   *                         syncs, or 0 to sync again as soon as there
+   *                         is something to sync
+   */
+  Relay_log(const std::string &directory, unsigned long sync_interval_ms= 0);
+
+  /**
+   * Writes and syncs what is left.
+   */
+  ~Relay_log();
+
+  /**
+   * Write an event received from the master.
+   *
+   * @param event The event, starting with the event header
+   * @param length The size of the event
+   * @param header The decoded event header
+   *
+   * @retval false Writing failed. Nothing more is written until the next
+   *               binlog file starts, and false is only returned for the
+   *               first event which is lost.
+   */
+  bool write(const boost::uint8_t *event, std::size_t length,
+             const Log_event_header *header);
+
+  /**
+   * Hand the events written so far to the file system, so they are part
+   * of the next sync.
+   */
+  void flush();
+
+  /**
+   * Wait until all events written so far are synced to disk, at most
+   * timeout_ms milliseconds.
+   *
+   * @retval true The events are on disk.
+   */
+  bool wait_synced(unsigned long timeout_ms);
+
+  /**
+   * The binlog file and position up to which the relay log is on disk.
+   * The file is empty before the first sync.
+   */
+  void synced_position(std::string *file, unsigned long *position);
+
+  /**
+   * The number of syncs done so far.
+   */
+  unsigned long syncs() const { return m_syncs.load(); }
+
+  const std::string &directory() const { return m_directory; }
+  unsigned long sync_interval() const { return m_sync_interval; }
+
+private:
+  Relay_log(const Relay_log &);
+  Relay_log &operator=(const Relay_log &);
+
+  /**
+   * Continue with the binlog file name from position on, as a Rotate
+   * event says.
+   */
+  void switch_file(const std::string &name, unsigned long position);
+
+  /**
+   * Open the copy of the binlog file name, to be written from position
+   * on.
+   *
+   * @retval ERR_OK Success
+   * @retval ERR_FAIL There is no copy to continue, or it can't be opened
+   */
+  int open_file(const std::string &name, unsigned long position);
+
+  /**
+   * Add a new file to the index file.
+   */
+  int list_file(const std::string &name);
+
+  /**
+   * Append bytes to the buffer, writing it out when it is full.
+   */
+  bool append(const boost::uint8_t *data, std::size_t length);
+
+  /**
+   * Write the buffer to the file.
+   */
+  bool write_buffer();
+
+  /**
+   * Drop what is not written yet and stop writing until the next file
+   * starts.
+   */
+  void fail();
+
+  /**
+   * Leave the file being written to the sync thread, which closes it
+   * after its last sync.
+   */
+  void retire_file();
+
+  /**
+   * The sync thread.
+   */
+  void sync_files();
+
+  std::string m_directory;
+  unsigned long m_sync_interval;
+
+  /*
+    Used by the thread writing the events only. m_failed is set when an
+    event is lost, until write() has reported it.
+  */
+  int m_fd;
+  std::string m_file;
+  unsigned long m_offset;
+  bool m_writing;
+  bool m_failed;
+  std::vector<boost::uint8_t> m_buffer;
+  std::size_t m_buffer_used;
+  std::string m_index_path;
+  std::set<std::string> m_listed;
+
+  /*
+    The bytes appended to the relay log since it was created, in the
+    buffer or not.
+  */
+  boost::atomic<boost::uint64_t> m_appended;
+
+  /*
+    Shared with the sync thread, under m_mutex: the files to sync and
+    how far they have been written and synced.
+  */
+  boost::mutex m_mutex;
+  boost::condition m_changed;
+  int m_sync_fd;
+  std::vector<int> m_retired;
+  int m_index_fd;
+  bool m_index_changed;
+  boost::uint64_t m_flushed;
+  std::string m_flushed_file;
+  unsigned long m_flushed_position;
+  boost::uint64_t m_synced;
+  std::string m_synced_file;
+  unsigned long m_synced_position;
+  bool m_stop;
+
+  boost::atomic<unsigned long> m_syncs;
+  boost::thread m_thread;
+};
+
+} // namespace mysql::system
+} // namespace mysql
+
+#endif	/* _RELAY_LOG_H */
@@ -0,0 +1,140 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _REPLAY_DRIVER_H
+#define	_REPLAY_DRIVER_H
+
+#include <string>
+#include <vector>
+#include <boost/thread/thread_time.hpp>
+
+#include "binlog_driver.h"
+
+namespace mysql {
+namespace system {
+
+class Binlog_file_driver;
+
+/**
+ * Replays binlog files with the pacing they were written with, to load a
+ * pipeline with the traffic of a master without running one.
+ *
+ * The events are read and decoded by a Binlog_file_driver. Each event is
+ * held back until as much time has passed since the first one as lies
+ * between their timestamps, divided by the speed. A speed of 2 replays
+ * twice as fast as the master wrote the events, and a speed of 0 hands
+ * them out as fast as they can be read. Timestamps only have a
+ * resolution of a second, so the events of one second come together.
+ * Events without a timestamp and events with an earlier one than the
+ * event before are not held back.
+ *
+ * If the application takes the events later than they are due, the
+ * replay does not make up for it by speeding up; behind() tells how late
+ * the last event was taken, so a pipeline which can't keep up with the
+ * speed shows as a growing delay.
+ */
+class Binlog_replay_driver
+  : public Binary_log_driver
+{
+public:
+  /**
+   * @param source The driver reading the files. The replay driver takes
+   *               ownership of it.
+   * @param speed How many times faster than written to replay, or 0 for
+   *              no pacing
+   */
+  Binlog_replay_driver(Binlog_file_driver *source, double speed= 1);
+  ~Binlog_replay_driver();
+
+  int connect();
+  int wait_for_next_event(mysql::Binary_log_event **event);
+
+  /**
+   * Takes the events which are due, up to max_events. Waits at most
+   * timeout_ms for the first one.
+   */
+  int wait_for_next_events(std::vector<mysql::Binary_log_event *> *events,
+                           std::size_t max_events,
+                           unsigned long timeout_ms= WAIT_FOREVER);
+
+  /**
+   * Moves the source and starts the pacing over at the next event.
+   */
+  int set_position(const std::string &str, unsigned long position);
+  int get_position(std::string *str, unsigned long *position);
+  int set_position_by_time(boost::uint32_t when);
+
+  double speed() const { return m_speed; }
+
+  /**
+   * How many milliseconds after it was due the last event was taken.
+   */
+  unsigned long behind() const { return m_behind; }
+
+  const Binlog_file_driver *source() const { return m_source; }
+
+private:
+  /**
+   * Drop the event read ahead and start the pacing over.
+   */
+  void restart();
+
+  /**
+   * The time at which an event is due, starting the pacing with it if
+   * it is the first one.
+   */
+  boost::system_time due_time(Binary_log_event *event);
+
+  Binlog_file_driver *m_source;
+  double m_speed;
+
+  /*
+    The event read from the source which is not due yet, and the time it
+    is due at.
+  */
+  Binary_log_event *m_pending;
+  boost::system_time m_pending_due;
+
+  /*
+    The position after the last event handed to the application, taken
+    before the pending event is read.
+  */
+  std::string m_file;
+  unsigned long m_position;
+
+  /*
+    The timestamp of the first paced event and when it was handed out,
+    or not_a_date_time before it.
+  */
+  boost::uint32_t m_start_timestamp;
+  boost::system_time m_start_time;
+
+  /*
+    The latest timestamp seen, so events don't wait for earlier ones.
+  */
+  boost::uint32_t m_last_timestamp;
+
+  unsigned long m_behind;
+};
+
+} // namespace mysql::system
+} // namespace mysql
+
+#endif	/* _REPLAY_DRIVER_H */
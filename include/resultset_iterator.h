@@ -72,8 +72,16 @@ public:
     typedef Result_set_iterator<Row_of_fields > iterator;
     typedef Result_set_iterator<Row_of_fields const > const_iterator;
 
-    Result_set(tcp::socket *socket) { source(socket); }
-    void source(tcp::socket *socket) { m_socket= socket; digest_row_set(); }
+    /**
+     * Reads a result set from the server.
+     *
+     * @param compressed True if the connection uses the compressed
+     *                   protocol
+     */
+    Result_set(tcp::socket *socket, bool compressed= false)
+    { source(socket, compressed); }
+    void source(tcp::socket *socket, bool compressed= false)
+    { m_socket= socket; m_compressed= compressed; digest_row_set(); }
     iterator begin();
     iterator end();
     const_iterator begin() const;
@@ -89,6 +97,7 @@ private:
     std::vector<Row_of_fields > m_rows;
     String_storage m_storage;
     tcp::socket *m_socket;
+    bool m_compressed;
     typedef enum { RESULT_HEADER,
                    FIELD_PACKETS,
                    MARKER,
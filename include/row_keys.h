@@ -0,0 +1,98 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _ROW_KEYS_H
+#define	_ROW_KEYS_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+
+#include "binlog_event.h"
+#include "row_of_fields.h"
+
+namespace mysql {
+
+/**
+ * The primary key columns of tables, by their index in the table map,
+ * and hashes of the keys of rows.
+ *
+ * Table maps don't name the key, so the columns are given with
+ * set_key(), or found by the function set with set_key_lookup() the
+ * first time a table is asked for. A row of a table without a known key
+ * hashes like the table name, so it stands for any row of the table.
+ */
+class Row_keys
+{
+public:
+  /**
+   * Finds the key columns of a table, by their index in the table map.
+   *
+   * @return false if the table has no key.
+   */
+  typedef boost::function<bool (const Table_map_event &table,
+                                std::vector<unsigned int> *columns)>
+    Key_lookup;
+
+  /**
+   * Set the key columns of a table.
+   */
+  void set_key(const std::string &db_name, const std::string &table_name,
+               const std::vector<unsigned int> &columns);
+
+  void set_key_lookup(const Key_lookup &lookup) { m_key_lookup= lookup; }
+
+  /**
+   * The key columns of a table, none if it has no known key.
+   */
+  const std::vector<unsigned int> &key(const Table_map_event &table);
+
+  /**
+   * A hash of the table name.
+   */
+  static std::size_t table_hash(const Table_map_event &table);
+
+  /**
+   * A hash of the table name and the key of a row image. If the image
+   * doesn't have all key columns it is the hash of the table name.
+   *
+   * @param table_hash The table_hash() of the table
+   */
+  static std::size_t row_hash(std::size_t table_hash,
+                              const std::vector<unsigned int> &key,
+                              const Row_of_fields &row);
+
+private:
+  typedef std::map<std::pair<std::string, std::string>,
+                   std::vector<unsigned int> > Key_map;
+
+  /*
+    The key columns by database and table name. Tables without a key
+    which have been looked up have no columns.
+  */
+  Key_map m_keys;
+  Key_lookup m_key_lookup;
+  std::vector<unsigned int> m_no_key;
+};
+
+} // end namespace
+
+#endif	/* _ROW_KEYS_H */
@@ -0,0 +1,201 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _SHARDED_APPLIER_H
+#define	_SHARDED_APPLIER_H
+
+#include <map>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "basic_content_handler.h"
+#include "row_keys.h"
+#include "spsc_bounded_buffer.h"
+
+/**
+ * The number of rows which can wait for each worker of a Sharded_applier
+ * before the handler waits for it.
+ */
+#define SHARD_QUEUE_SIZE 1024
+
+namespace mysql {
+
+/**
+ * A row handed to a worker of a Sharded_applier. The values refer to
+ * the row event, which is kept alive with the row.
+ */
+struct Sharded_row
+{
+  /**
+   * WRITE_ROWS_EVENT, UPDATE_ROWS_EVENT or DELETE_ROWS_EVENT.
+   */
+  Log_event_type type;
+  boost::shared_ptr<Table_map_event> table;
+  boost::shared_ptr<Row_event> event;
+
+  /**
+   * The image before an update or delete.
+   */
+  Row_of_fields before;
+
+  /**
+   * The image after a write or update.
+   */
+  Row_of_fields after;
+};
+
+/**
+ * A content handler which applies the rows of row events on a number of
+ * worker threads. Each row goes to the worker picked by a hash of its
+ * primary key, so all changes to one row are applied in order by the
+ * same worker while rows with other keys are applied in parallel.
+ *
+ * The key columns of a table are given with set_key(), or found by the
+ * function set with set_key_lookup() when the first table map for the
+ * table passes, see Row_keys. The rows of a table with no known key all
+ * go to one worker, picked by the table name. An
+ * update which moves a row to another worker waits until the rows
+ * before it are applied, and the rows after it wait until it is
+ * applied.
+ *
+ * Row events are consumed. Each of their rows is handed to the apply
+ * function on the thread of its worker, which must not throw. Table maps
+ * are copied and passed on, like all other events.
+ *
+ * With transaction barriers the handler waits for all rows to be
+ * applied before it passes on an XID event or a query other than BEGIN.
+ * Events after a commit then only reach the application once the
+ * transaction is applied, so its position can be saved. Without them
+ * rows of later transactions may be applied before those of earlier
+ * ones when their keys differ.
+ */
+class Sharded_applier : public Content_handler
+{
+public:
+  /**
+   * Applies a row on the given worker, numbered from 0.
+   */
+  typedef boost::function<void (unsigned int worker, const Sharded_row &row)>
+    Row_applier;
+
+  typedef Row_keys::Key_lookup Key_lookup;
+
+  /**
+   * @param workers The number of worker threads
+   * @param apply Called for each row on its worker
+   * @param transaction_barriers Apply all rows before passing on the
+   *                             end of a transaction
+   * @param queue_size The number of rows which can wait for each worker
+   */
+  Sharded_applier(unsigned int workers, const Row_applier &apply,
+                  bool transaction_barriers= false,
+                  std::size_t queue_size= SHARD_QUEUE_SIZE);
+
+  /**
+   * Waits for all rows to be applied.
+   */
+  ~Sharded_applier();
+
+  /**
+   * Set the key columns of a table, by their index in the table map.
+   */
+  void set_key(const std::string &db_name, const std::string &table_name,
+               const std::vector<unsigned int> &columns)
+  {
+    m_keys.set_key(db_name, table_name, columns);
+  }
+
+  void set_key_lookup(const Key_lookup &lookup)
+  {
+    m_keys.set_key_lookup(lookup);
+  }
+
+  /**
+   * Wait until all rows handed to the workers are applied.
+   */
+  void drain();
+
+  unsigned int workers() const { return m_shards.size(); }
+  bool transaction_barriers() const { return m_barriers; }
+
+  Binary_log_event *process_event(Table_map_event *ev);
+  Binary_log_event *process_event(Row_event *ev);
+  Binary_log_event *process_event(Xid *ev);
+  Binary_log_event *process_event(Query_event *ev);
+  bool handles(Log_event_type type) const;
+
+private:
+  struct Shard
+  {
+    Shard(std::size_t queue_size) : queue(queue_size), queued(0), applied(0),
+                                    thread(0) {}
+
+    /*
+      Rows to apply, ended by 0 when the applier is deleted.
+    */
+    spsc_bounded_buffer<Sharded_row *> queue;
+    unsigned long queued;
+    boost::atomic<unsigned long> applied;
+    boost::thread *thread;
+  };
+
+  struct Table
+  {
+    boost::shared_ptr<Table_map_event> map;
+    std::vector<unsigned int> key;
+    std::size_t name_hash;
+  };
+
+  /**
+   * Run by each worker.
+   */
+  void work(unsigned int worker);
+
+  /**
+   * The worker of a row image.
+   */
+  unsigned int shard_of(const Table &table, const Row_of_fields &row) const;
+
+  void dispatch(unsigned int worker, Sharded_row *row);
+
+  std::vector<Shard *> m_shards;
+  Row_applier m_apply;
+  bool m_barriers;
+  Row_keys m_keys;
+
+  /*
+    The tables by id as given by the last table map.
+  */
+  std::map<boost::uint64_t, Table> m_tables;
+
+  /*
+    Set while drain() waits, so workers wake it up.
+  */
+  boost::atomic<bool> m_draining;
+  boost::mutex m_mutex;
+  boost::condition m_applied;
+};
+
+} // end namespace
+
+#endif	/* _SHARDED_APPLIER_H */
@@ -0,0 +1,343 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _SPSC_BOUNDED_BUFFER_H
+#define	_SPSC_BOUNDED_BUFFER_H
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/thread_time.hpp>
+
+#define CACHE_LINE_SIZE 64
+
+/**
+  A bounded FIFO queue between exactly one producer thread, calling
+  push_front(), and one consumer thread, calling pop_back().
+
+  Handing over an item takes no lock. Each side owns one index, kept on
+  a cache line of its own together with a cached copy of the other
+  side's index, so the threads only share a line when the cached copy
+  runs out.
+
+  Besides the number of items the queue can limit their total weight,
+  for example their size in bytes. An item is weighed when it is pushed
+  and always fits in an empty queue, whatever its weight.
+
+  A side that has to wait first spins spin_count times re-checking the
+  queue and then parks on a condition. The other side only takes the
+  mutex to wake it up when it is known to be parked. Spinning is skipped
+  on a single processor, where it would only delay the other side.
+*/
+template <class T>
+class spsc_bounded_buffer
+{
+public:
+
+  typedef std::size_t size_type;
+  typedef T value_type;
+
+  /**
+    @param capacity The largest number of items in the queue
+    @param spin_count The number of re-checks before a side parks
+    @param max_weight The largest total weight of the items in the
+                      queue, or 0 for no limit
+  */
+  explicit spsc_bounded_buffer(size_type capacity, unsigned long spin_count= 0,
+                               boost::uint64_t max_weight= 0)
+    : m_head(0), m_cached_tail(0), m_pushed_weight(0),
+      m_cached_popped_weight(0),
+      m_tail(0), m_cached_head(0), m_popped_weight(0),
+      m_slots(capacity + 1), m_container(capacity + 1),
+      m_weights(capacity + 1), m_max_weight(max_weight),
+      m_spin_count(boost::thread::hardware_concurrency() > 1 ? spin_count : 0),
+      m_consumer_parked(false), m_producer_parked(false)
+  {
+  }
+
+  /**
+    Add an item to the queue, waiting while it is full.
+  */
+  void push_front(const value_type& item, size_type weight= 0)
+  {
+    if (!spin_push(item, weight))
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_producer_parked.store(true);
+      boost::atomic_thread_fence(boost::memory_order_seq_cst);
+      while (!try_push(item, weight))
+        m_not_full.wait(lock);
+      m_producer_parked.store(false);
+    }
+    if (m_consumer_parked.load())
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_not_empty.notify_one();
+    }
+  }
+
+  /**
+    Remove the oldest item from the queue, waiting while it is empty.
+  */
+  void pop_back(value_type* pItem)
+  {
+    if (!spin_pop(pItem))
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_consumer_parked.store(true);
+      boost::atomic_thread_fence(boost::memory_order_seq_cst);
+      while (!try_pop(pItem))
+        m_not_empty.wait(lock);
+      m_consumer_parked.store(false);
+    }
+    if (m_producer_parked.load())
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_not_full.notify_one();
+    }
+  }
+
+  /**
+    Remove up to max_items of the oldest items and append them to items.
+    Waits at most timeout_ms milliseconds for the first item, or forever
+    if timeout_ms is (unsigned long) -1. All items which are ready are
+    taken with a single update of the consumer index.
+
+    @return The number of items appended, 0 if the timeout expired.
+  */
+  size_type pop_back_n(std::vector<value_type> *items, size_type max_items,
+                       unsigned long timeout_ms)
+  {
+    size_type count= 0;
+    if (max_items == 0)
+      return 0;
+    if (timeout_ms == 0)
+      count= try_pop_n(items, max_items);
+    else if ((count= spin_pop_n(items, max_items)) == 0)
+    {
+      boost::system_time deadline= boost::get_system_time() +
+        boost::posix_time::milliseconds(timeout_ms);
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_consumer_parked.store(true);
+      boost::atomic_thread_fence(boost::memory_order_seq_cst);
+      while ((count= try_pop_n(items, max_items)) == 0)
+      {
+        if (timeout_ms == (unsigned long) -1)
+          m_not_empty.wait(lock);
+        else if (!m_not_empty.timed_wait(lock, deadline))
+        {
+          count= try_pop_n(items, max_items);
+          break;
+        }
+      }
+      m_consumer_parked.store(false);
+    }
+    if (count > 0 && m_producer_parked.load())
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_not_full.notify_one();
+    }
+    return count;
+  }
+
+  /**
+    True if an item of the given weight can be added without waiting.
+    Producer side only.
+  */
+  bool has_room(size_type weight= 0)
+  {
+    size_type head= m_head.load(boost::memory_order_relaxed);
+    size_type next= head + 1 == m_slots ? 0 : head + 1;
+    if (next == m_cached_tail || !weight_fits(weight))
+    {
+      m_cached_tail= m_tail.load(boost::memory_order_acquire);
+      m_cached_popped_weight= m_popped_weight.load(boost::memory_order_acquire);
+      if (next == m_cached_tail || !weight_fits(weight))
+        return false;
+    }
+    return true;
+  }
+
+  /**
+    Add an item if there is room for it. Producer side only.
+  */
+  bool try_push(const value_type& item, size_type weight= 0)
+  {
+    if (!has_room(weight))
+      return false;
+    size_type head= m_head.load(boost::memory_order_relaxed);
+    m_container[head]= item;
+    m_weights[head]= weight;
+    m_pushed_weight.store(m_pushed_weight.load(boost::memory_order_relaxed) + weight,
+                          boost::memory_order_relaxed);
+    m_head.store(head + 1 == m_slots ? 0 : head + 1, boost::memory_order_release);
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    return true;
+  }
+
+  /**
+    Remove the oldest item if there is one. Consumer side only.
+  */
+  bool try_pop(value_type* pItem)
+  {
+    size_type tail= m_tail.load(boost::memory_order_relaxed);
+    if (tail == m_cached_head)
+    {
+      m_cached_head= m_head.load(boost::memory_order_acquire);
+      if (tail == m_cached_head)
+        return false;
+    }
+    *pItem= m_container[tail];
+    m_popped_weight.store(m_popped_weight.load(boost::memory_order_relaxed) +
+                          m_weights[tail], boost::memory_order_relaxed);
+    m_tail.store(tail + 1 == m_slots ? 0 : tail + 1, boost::memory_order_release);
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    return true;
+  }
+
+  /**
+    Remove up to max_items of the oldest items, if there are any, and
+    append them to items. Consumer side only.
+  */
+  size_type try_pop_n(std::vector<value_type> *items, size_type max_items)
+  {
+    size_type tail= m_tail.load(boost::memory_order_relaxed);
+    m_cached_head= m_head.load(boost::memory_order_acquire);
+    size_type count= 0;
+    boost::uint64_t weight= 0;
+    while (tail != m_cached_head && count < max_items)
+    {
+      items->push_back(m_container[tail]);
+      weight+= m_weights[tail];
+      tail= tail + 1 == m_slots ? 0 : tail + 1;
+      ++count;
+    }
+    if (count > 0)
+    {
+      m_popped_weight.store(m_popped_weight.load(boost::memory_order_relaxed) +
+                            weight, boost::memory_order_relaxed);
+      m_tail.store(tail, boost::memory_order_release);
+      boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    }
+    return count;
+  }
+
+  /**
+    True if there are items in the queue. Consumer side only.
+  */
+  bool has_unread()
+  {
+    return m_tail.load(boost::memory_order_relaxed) !=
+           m_head.load(boost::memory_order_acquire);
+  }
+
+private:
+  spsc_bounded_buffer(const spsc_bounded_buffer&);              // Disabled copy constructor
+  spsc_bounded_buffer& operator = (const spsc_bounded_buffer&); // Disabled assign operator
+
+  bool weight_fits(size_type weight) const
+  {
+    boost::uint64_t queued= m_pushed_weight.load(boost::memory_order_relaxed) -
+                            m_cached_popped_weight;
+    return m_max_weight == 0 || queued == 0 || queued + weight <= m_max_weight;
+  }
+
+  bool spin_push(const value_type& item, size_type weight)
+  {
+    if (try_push(item, weight))
+      return true;
+    for (unsigned long spin= 0; spin < m_spin_count; ++spin)
+    {
+      cpu_relax();
+      if (try_push(item, weight))
+        return true;
+    }
+    return false;
+  }
+
+  bool spin_pop(value_type* pItem)
+  {
+    if (try_pop(pItem))
+      return true;
+    for (unsigned long spin= 0; spin < m_spin_count; ++spin)
+    {
+      cpu_relax();
+      if (try_pop(pItem))
+        return true;
+    }
+    return false;
+  }
+
+  size_type spin_pop_n(std::vector<value_type> *items, size_type max_items)
+  {
+    size_type count= try_pop_n(items, max_items);
+    for (unsigned long spin= 0; count == 0 && spin < m_spin_count; ++spin)
+    {
+      cpu_relax();
+      count= try_pop_n(items, max_items);
+    }
+    return count;
+  }
+
+  static void cpu_relax()
+  {
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__("pause");
+#endif
+  }
+
+  char m_pad0[CACHE_LINE_SIZE];
+
+  /* Written by the producer */
+  boost::atomic<size_type> m_head;
+  size_type m_cached_tail;
+  boost::atomic<boost::uint64_t> m_pushed_weight;
+  boost::uint64_t m_cached_popped_weight;
+  char m_pad1[CACHE_LINE_SIZE - 2 * sizeof(size_type) - 2 * sizeof(boost::uint64_t)];
+
+  /* Written by the consumer */
+  boost::atomic<size_type> m_tail;
+  size_type m_cached_head;
+  boost::atomic<boost::uint64_t> m_popped_weight;
+  char m_pad2[CACHE_LINE_SIZE - 2 * sizeof(size_type) - sizeof(boost::uint64_t)];
+
+  const size_type m_slots;
+  std::vector<value_type> m_container;
+  std::vector<size_type> m_weights;
+  const boost::uint64_t m_max_weight;
+  const unsigned long m_spin_count;
+
+  /*
+    A side sets its parked flag under the mutex and then re-checks the
+    queue, while the other side moves its index and then reads the flag.
+    Both put a full fence between the store and the load, so at least
+    one of them sees the other and the wake-up can't be lost.
+  */
+  boost::atomic<bool> m_consumer_parked;
+  boost::atomic<bool> m_producer_parked;
+  boost::mutex m_mutex;
+  boost::condition m_not_empty;
+  boost::condition m_not_full;
+};
+
+#endif	/* _SPSC_BOUNDED_BUFFER_H */
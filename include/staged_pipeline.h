@@ -0,0 +1,168 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _STAGED_PIPELINE_H
+#define	_STAGED_PIPELINE_H
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+
+#include "binlog_api.h"
+
+/**
+ * The number of events which can wait between two stages before the
+ * stage in front waits for the one behind.
+ */
+#define STAGE_QUEUE_SIZE 1024
+
+/**
+ * The largest number of events a stage takes at once.
+ */
+#define STAGE_BATCH_SIZE 64
+
+/**
+ * How long the first stage waits for events before it checks whether it
+ * should stop, in milliseconds.
+ */
+#define STAGE_POLL_MS 100
+
+namespace mysql {
+
+class Stage_queue;
+
+/**
+ * Runs the content handlers of a Binary_log as a pipeline of stages, each
+ * on a thread of its own, so handlers which are CPU bound use more than
+ * one core.
+ *
+ * The first stage is the Binary_log itself: its thread reads the events
+ * and runs them through the handlers in content_handler_pipeline(). Each
+ * call of add_stage() marks a boundary, after which the handlers in the
+ * returned pipeline run on another thread. The stages are connected by
+ * bounded single producer, single consumer queues, and the application
+ * takes the events coming out of the last stage with
+ * wait_for_next_event() or wait_for_next_events().
+ *
+ * The events leave the pipeline in the order they were read. A full
+ * queue makes the stage in front of it wait, so a slow stage or
+ * application holds up reading from the driver.
+ *
+ * Events injected by a handler run through the handlers of its stage
+ * from the first one, and then through the later stages. An error from
+ * the driver, such as ERR_EOF at the end of a file, follows the events
+ * read before it and ends the pipeline; it is then returned by every
+ * call.
+ *
+ * The threads start at the first call for events. Handlers must not be
+ * added to or removed from the pipelines after that, and the Binary_log
+ * must not be used by the application until the Staged_pipeline is
+ * deleted. Events still in the stages when it is deleted are dropped.
+ *
+ * To stop, the first stage relies on its driver returning from
+ * wait_for_next_events() within STAGE_POLL_MS when no events arrive.
+ * The drivers of this library do; with a driver which keeps the default
+ * implementation, which ignores the timeout, the destructor waits for
+ * the next event or error from it.
+ */
+class Staged_pipeline
+{
+public:
+  /**
+   * @param binlog The first stage, which reads the events
+   * @param queue_size The number of events which can wait between two
+   *                   stages
+   */
+  Staged_pipeline(Binary_log *binlog,
+                  std::size_t queue_size= STAGE_QUEUE_SIZE);
+  ~Staged_pipeline();
+
+  /**
+   * Add a stage after the ones added before.
+   *
+   * @return The handlers of the stage, or 0 if the threads have already
+   *         started.
+   */
+  Content_handler_pipeline *add_stage();
+
+  /**
+   * The number of stages, including the first one.
+   */
+  std::size_t stages() const { return m_stages.size() + 1; }
+
+  /**
+   * Take the next event out of the last stage, waiting for it.
+   */
+  int wait_for_next_event(Binary_log_event **event);
+
+  /**
+   * Take the events which came out of the last stage, up to max_events.
+   * Waits at most timeout_ms for the first one.
+   *
+   * @retval ERR_OK Events were appended, or the timeout expired.
+   * @retval >0 The error which ended the pipeline. No events are
+   *         appended.
+   */
+  int wait_for_next_events(std::vector<Binary_log_event *> *events,
+                           std::size_t max_events,
+                           unsigned long timeout_ms= WAIT_FOREVER);
+
+private:
+  /**
+   * The handlers after a boundary, which take their events from the
+   * queue in front of them.
+   */
+  struct Stage
+  {
+    Stage_queue *input;
+    Binary_log *binlog;
+  };
+
+  /**
+   * Start a thread for each stage.
+   */
+  void start();
+
+  /**
+   * Run by the thread of the first stage.
+   */
+  void read_events(Stage_queue *output);
+
+  /**
+   * Run by the thread of each later stage.
+   */
+  void run_stage(Binary_log *binlog, Stage_queue *output);
+
+  Binary_log *m_binlog;
+  std::size_t m_queue_size;
+  std::vector<Stage> m_stages;
+
+  /*
+    The queue the application takes the events from.
+  */
+  Stage_queue *m_output;
+
+  std::vector<boost::thread *> m_threads;
+  boost::atomic<bool> m_stop;
+};
+
+} // end namespace
+
+#endif	/* _STAGED_PIPELINE_H */
@@ -0,0 +1,173 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _STATIC_PIPELINE_H
+#define	_STATIC_PIPELINE_H
+
+#include <boost/tuple/tuple.hpp>
+#include "basic_content_handler.h"
+
+namespace mysql {
+
+/**
+ * Fills the places of a Static_pipeline which hold no handler.
+ */
+struct No_handler {};
+
+/**
+ * A chain of up to five content handlers which is fixed when the program
+ * is compiled, such as
+ * <code>Static_pipeline<Table_index, Filter, Applier></code>.
+ *
+ * The pipeline is itself a content handler, so it takes the place of its
+ * handlers in the Content_handler_pipeline of a Binary_log. An event
+ * passes through the handlers in order, as it would through the list,
+ * and a handler which returns 0 consumes it. The handlers see the
+ * injection queue of the pipeline, and injected events run through the
+ * whole pipeline again. A handler only gets the event types it
+ * handles().
+ *
+ * The handlers are copied into the pipeline and held by value. Their
+ * types are known at every call, so the compiler can resolve the
+ * process_event() calls without virtual dispatch and inline the chain.
+ * Only the call into the pipeline goes through the list.
+ */
+template <class H1, class H2= No_handler, class H3= No_handler,
+          class H4= No_handler, class H5= No_handler>
+class Static_pipeline : public Content_handler
+{
+public:
+  typedef boost::tuple<H1, H2, H3, H4, H5> Handlers;
+
+  Static_pipeline(const H1 &h1= H1(), const H2 &h2= H2(),
+                  const H3 &h3= H3(), const H4 &h4= H4(),
+                  const H5 &h5= H5())
+    : m_handlers(h1, h2, h3, h4, h5), m_queue(0)
+  {
+    for (int type= 0; type < 256; ++type)
+    {
+      Log_event_type event_type= (Log_event_type) type;
+      m_stages[type]=
+        stage_handles(boost::get<0>(m_handlers), event_type) << 0 |
+        stage_handles(boost::get<1>(m_handlers), event_type) << 1 |
+        stage_handles(boost::get<2>(m_handlers), event_type) << 2 |
+        stage_handles(boost::get<3>(m_handlers), event_type) << 3 |
+        stage_handles(boost::get<4>(m_handlers), event_type) << 4;
+    }
+  }
+
+  /**
+   * The handlers, in order. The Nth one is
+   * <code>boost::get<N>(pipeline.handlers())</code>.
+   */
+  Handlers &handlers() { return m_handlers; }
+
+  /**
+   * Run an event through the handlers.
+   *
+   * @return The event to hand on, or 0 if a handler consumed it.
+   */
+  Binary_log_event *run(Binary_log_event *ev)
+  {
+    if (get_injection_queue() != m_queue)
+    {
+      m_queue= get_injection_queue();
+      set_queue(boost::get<0>(m_handlers));
+      set_queue(boost::get<1>(m_handlers));
+      set_queue(boost::get<2>(m_handlers));
+      set_queue(boost::get<3>(m_handlers));
+      set_queue(boost::get<4>(m_handlers));
+    }
+    ev= stage(boost::get<0>(m_handlers), 0, ev);
+    ev= stage(boost::get<1>(m_handlers), 1, ev);
+    ev= stage(boost::get<2>(m_handlers), 2, ev);
+    ev= stage(boost::get<3>(m_handlers), 3, ev);
+    return stage(boost::get<4>(m_handlers), 4, ev);
+  }
+
+  Binary_log_event *process_event(Query_event *ev) { return run(ev); }
+  Binary_log_event *process_event(Row_event *ev) { return run(ev); }
+  Binary_log_event *process_event(Table_map_event *ev) { return run(ev); }
+  Binary_log_event *process_event(Xid *ev) { return run(ev); }
+  Binary_log_event *process_event(User_var_event *ev) { return run(ev); }
+  Binary_log_event *process_event(Incident_event *ev) { return run(ev); }
+  Binary_log_event *process_event(Rotate_event *ev) { return run(ev); }
+  Binary_log_event *process_event(Int_var_event *ev) { return run(ev); }
+  Binary_log_event *process_event(Binary_log_event *ev) { return run(ev); }
+
+  /**
+   * The pipeline handles the types which any of its handlers handles.
+   */
+  bool handles(Log_event_type type) const
+  {
+    return m_stages[type] != 0;
+  }
+
+private:
+  template <class Handler>
+  Binary_log_event *stage(Handler &handler, int index, Binary_log_event *ev)
+  {
+    if (ev == 0 || !(m_stages[ev->header()->type_code] & (1 << index)))
+      return ev;
+    return dispatch_event(handler, ev);
+  }
+
+  Binary_log_event *stage(No_handler &, int, Binary_log_event *ev)
+  {
+    return ev;
+  }
+
+  template <class Handler>
+  void set_queue(Handler &handler)
+  {
+    Content_handler &base= handler;
+    base.set_injection_queue(m_queue);
+  }
+
+  void set_queue(No_handler &) {}
+
+  template <class Handler>
+  static bool stage_handles(const Handler &handler, Log_event_type type)
+  {
+    const Content_handler &base= handler;
+    return base.handles(type);
+  }
+
+  static bool stage_handles(const No_handler &, Log_event_type)
+  {
+    return false;
+  }
+
+  Handlers m_handlers;
+
+  /**
+   * Bit N is set for the types which the handler at place N handles.
+   */
+  boost::uint8_t m_stages[256];
+
+  /**
+   * The injection queue last handed to the handlers.
+   */
+  Injection_queue *m_queue;
+};
+
+} // end namespace
+
+#endif	/* _STATIC_PIPELINE_H */
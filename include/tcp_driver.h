@@ -21,18 +21,54 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 #ifndef _TCP_DRIVER_H
 #define	_TCP_DRIVER_H
 #include "binlog_driver.h"
-#include "bounded_buffer.h"
+#include "spsc_bounded_buffer.h"
+#include "event_spill.h"
+#include "relay_log.h"
 #include "protocol.h"
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <deque>
 
 
 #define MAX_PACKAGE_SIZE 0xffffff
 
-#define GET_NEXT_PACKET_HEADER   \
-   boost::asio::async_read(*m_socket, boost::asio::buffer(m_net_header, 4), \
-     boost::bind(&Binlog_tcp_driver::handle_net_packet_header, this, \
-     boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)) \
+/**
+ * Size of the blocks the binlog stream is read in. A block holds many
+ * small packets, which are all framed from the same read.
+ */
+#define RECEIVE_BUFFER_SIZE (128 * 1024)
+
+/**
+ * The largest event accepted from the server, which is the upper limit
+ * of max_allowed_packet. Events larger than MAX_PACKAGE_SIZE arrive
+ * split over several packets.
+ */
+#define MAX_EVENT_SIZE 0x40000000
+
+/**
+ * Default number of events which can be waiting for the user application.
+ */
+#define EVENT_QUEUE_SIZE 1000
+
+/**
+ * Default number of event bytes which can be waiting for the user
+ * application.
+ */
+#define EVENT_QUEUE_BYTES (16 * 1024 * 1024)
+
+/**
+ * Number of events which can be waiting when the queue is only limited
+ * in bytes, and the largest event limit.
+ */
+#define EVENT_QUEUE_MAX_SIZE 65536
+
+/**
+ * Number of times a thread waiting on the event queue re-checks it
+ * before it goes to sleep.
+ */
+#define EVENT_QUEUE_SPIN_COUNT 1000
 
 using boost::asio::ip::tcp;
 
@@ -42,18 +78,64 @@ class Binlog_tcp_driver : public Binary_log_driver
 {
 public:
 
+    /**
+     * @param queue_events The largest number of received events waiting
+     *                     for the application, at most
+     *                     EVENT_QUEUE_MAX_SIZE, or 0 to only limit bytes.
+     * @param queue_bytes The largest size of the received events waiting
+     *                    for the application, or 0 for no limit. An event
+     *                    larger than this is queued on its own.
+     * @param spill Where to put events while the queue is full, or 0 to
+     *              stop reading until the application has made room.
+     *              The driver takes ownership of it.
+     * @param compress Use the compressed protocol if the server supports
+     *                 it.
+     * @param inline_io Read and decode events on the thread calling
+     *                  wait_for_next_event() instead of a thread of the
+     *                  driver. There is no event queue then, so the queue
+     *                  limits and the spill are not used.
+     */
     Binlog_tcp_driver(const std::string& user, const std::string& passwd,
-                      const std::string& host, unsigned long port)
+                      const std::string& host, unsigned long port,
+                      std::size_t queue_events= EVENT_QUEUE_SIZE,
+                      boost::uint64_t queue_bytes= EVENT_QUEUE_BYTES,
+                      Event_spill *spill= 0, bool compress= false,
+                      bool inline_io= false)
       : Binary_log_driver("", 4), m_host(host), m_user(user), m_passwd(passwd),
         m_port(port), m_socket(NULL), m_waiting_event(0), m_event_loop(0),
+        m_receive_begin(0), m_receive_end(0),
+        m_compress(compress), m_compressed(false),
+        m_compressed_begin(0), m_compressed_end(0), m_packet_pending(0),
+        m_event_buffer_size(0), m_event_buffer_used(0),
         m_total_bytes_transferred(0), m_shutdown(false),
-        m_event_queue(new bounded_buffer<Binary_log_event*>(50))
+        m_inline(inline_io), m_receiving(false), m_inline_wait(0),
+        m_inline_timed_out(false),
+        m_queue_events(std::min(queue_events,
+                                (std::size_t) EVENT_QUEUE_MAX_SIZE)),
+        m_queue_bytes(queue_bytes),
+        m_event_queue(inline_io ? 0 :
+                      new spsc_bounded_buffer<Binary_log_event*>(m_queue_events ?
+                                                                 m_queue_events :
+                                                                 EVENT_QUEUE_MAX_SIZE,
+                                                                 EVENT_QUEUE_SPIN_COUNT,
+                                                                 queue_bytes)),
+        m_spill(spill), m_spill_depth(0), m_spill_bytes(0),
+        m_refill_posted(false), m_queued_position(0), m_spill_lost(false),
+        m_relay(0), m_server_id(0)
     {
     }
 
     ~Binlog_tcp_driver()
     {
+        stop_event_loop();
+        while (!m_ready_events.empty())
+        {
+          delete m_ready_events.front();
+          m_ready_events.pop_front();
+        }
         delete m_event_queue;
+        delete m_spill;
+        delete m_relay;
         delete m_socket;
     }
 
@@ -67,6 +149,14 @@ public:
      */
     int wait_for_next_event(mysql::Binary_log_event **event);
 
+    /**
+     * Takes all events waiting in the event queue, up to max_events, at
+     * once. Waits for the first one at most timeout_ms milliseconds.
+     */
+    int wait_for_next_events(std::vector<mysql::Binary_log_event *> *events,
+                             std::size_t max_events,
+                             unsigned long timeout_ms= WAIT_FOREVER);
+
     /**
      * Reconnects to the master with a new binlog dump request.
      */
@@ -78,6 +168,54 @@ public:
     const std::string& password() const { return m_passwd; }
     const std::string& host() const { return m_host; }
     unsigned long port() const { return m_port; }
+    std::size_t queue_events() const { return m_queue_events; }
+    boost::uint64_t queue_bytes() const { return m_queue_bytes; }
+    const Event_spill *spill() const { return m_spill; }
+
+    /**
+     * True if the compressed protocol is used when the server supports it.
+     */
+    bool compress() const { return m_compress; }
+
+    /**
+     * True if the current connection uses the compressed protocol.
+     */
+    bool compressed() const { return m_compressed; }
+
+    /**
+     * True if events are read on the thread waiting for them.
+     */
+    bool inline_io() const { return m_inline; }
+
+    /**
+     * Set the server id the driver registers and requests the binlog dump
+     * with, from the next connection on. The master ends a dump when
+     * another one is requested with the same server id, so drivers which
+     * dump at the same time need different ones. 0 stands for
+     * LIBREPLICATION_SERVER_ID from the environment, or 1.
+     */
+    void set_server_id(boost::uint32_t server_id) { m_server_id= server_id; }
+    boost::uint32_t server_id() const { return m_server_id; }
+
+    /**
+     * Write every event received into a relay log, before it is handed to
+     * the application. Set it before connecting; the driver takes
+     * ownership of it. An event the relay log fails to write is reported
+     * with an incident event before it.
+     */
+    void set_relay_log(Relay_log *relay) { m_relay= relay; }
+    Relay_log *relay_log() const { return m_relay; }
+
+    /**
+     * The number of events spilled because the event queue was full and
+     * not yet handed to the application.
+     */
+    std::size_t spill_depth() const { return m_spill_depth.load(); }
+
+    /**
+     * The number of bytes held by the spilled events.
+     */
+    boost::uint64_t spill_bytes() const { return m_spill_bytes.load(); }
 
 protected:
     /**
@@ -108,37 +246,129 @@ private:
     void start_binlog_dump(const std::string &binlog_file_name, size_t offset);
 
     /**
-     * Handles a completed mysql server package header and put a
-     * request for the body in the job queue.
+     * Issues a read of as many bytes as fit in the receive buffer, or in
+     * the compressed buffer if the compressed protocol is used.
+     */
+    void start_receive(void);
+
+    /**
+     * Moves a partially received packet to the front of the receive
+     * buffer if possible, or to a new buffer if the old one is still in
+     * use and running out of room.
      */
-    void handle_net_packet_header(const boost::system::error_code& err, std::size_t bytes_transferred);
+    void prepare_receive_buffer(void);
 
     /**
-     * Handles a completed network package with the assumption that it contains
-     * a binlog event.
+     * Handles a completed read into the receive buffer. A packet too
+     * large for the buffer is read directly into the event buffer.
+     */
+    void handle_net_read(const boost::system::error_code& err, std::size_t bytes_transferred);
+
+    /**
+     * Handles a completed read into the compressed buffer. The packets
+     * are inflated into the receive buffer, where they are handled as if
+     * they had been read, except for the rest of a packet too large for
+     * the receive buffer, which is inflated into the event buffer.
+     */
+    void handle_compressed_read(const boost::system::error_code& err, std::size_t bytes_transferred);
+
+    /**
+     * Hands every complete packet in the receive buffer to
+     * handle_event_packet().
      *
-     * TODO rename to handle_event_log_packet?
+     * @retval false A packet too large for the receive buffer was found.
+     *               What has arrived of it is moved to the event buffer
+     *               and m_packet_pending bytes of it remain.
+     */
+    bool handle_received_packets(void);
+
+    /**
+     * Handles the completed read of the remainder of a packet which was
+     * too large for the receive buffer.
      */
     void handle_net_packet(const boost::system::error_code& err, std::size_t bytes_transferred);
 
     /**
-     * Called from handle_net_packet(). The function handle a stream of bytes
-     * representing event packets which may or may not be complete.
-     * It uses m_waiting_event and the size of the stream as parameters
-     * in a state machine. If there is no m_waiting_event then the event
-     * header must be parsed for the event packet length. This can only
-     * be done if the accumulated stream of bytes are more than 19.
-     * Next, if there is a m_waiting_event, it can only be completed if
-     * event_length bytes are waiting on the stream.
+     * Handles the payload of one packet in the receive buffer. A packet
+     * carrying a whole event is decoded in place and the event shares the
+     * receive buffer. Anything else is appended to the event buffer.
+     *
+     * @param packet The first byte of the packet payload
+     * @param length The length of the payload
+     */
+    void handle_event_packet(const boost::uint8_t *packet, std::size_t length);
+
+    /**
+     * Makes room for length more bytes in the event buffer, starting a
+     * new event if none is waiting.
+     */
+    void reserve_event_buffer(std::size_t length);
+
+    /**
+     * Accounts for bytes_transferred new bytes in the event buffer. It uses
+     * m_waiting_event and the size of the buffer as parameters
+     * in a state machine. If the event header hasn't been parsed it is done
+     * once the buffer holds more than 19 bytes. Next, the event is
+     * complete when event_length bytes are in the buffer. An event with
+     * an impossible length is replaced by an incident event.
      *
      * If none of these conditions are fullfilled, the function exits without
      * any action.
+     */
+    void process_event_buffer(std::size_t bytes_transferred);
+
+    /**
+     * Drops the event being received and reports why with an incident
+     * event.
+     */
+    void discard_event_buffer(const std::string &message);
+
+    /**
+     * Decodes a received event and hands it to the application, or
+     * spills it if the event queue is full or there are spilled events
+     * already.
      *
-     * @param err Not used
-     * @param bytes_transferred The number of bytes waiting in the event stream
-     *
+     * @param owner Keeps the event bytes alive
+     * @param event The event, starting with the event header
+     * @param length The size of the event
+     * @param header The decoded event header
+     */
+    void queue_event(const Buffer_owner &owner, const boost::uint8_t *event,
+                     std::size_t length, Log_event_header *header);
+
+    /**
+     * Hands an event made by the driver, such as an incident, to the
+     * application after any spilled events.
+     */
+    void queue_event(Binary_log_event *event);
+
+    /**
+     * Moves spilled events to the event queue as long as there is room
+     * for them, or until the spill is empty if wait is true.
      */
-    void handle_event_packet(const boost::system::error_code& err, std::size_t bytes_transferred);
+    void refill_queue(bool wait);
+
+    /**
+     * Hands a decoded event to the application through the event queue
+     * and remembers the position after it.
+     */
+    void push_event(Binary_log_event *event, std::size_t length);
+
+    /**
+     * Called by the application thread after taking events off the
+     * queue. Asks the event loop to refill the queue from the spill.
+     */
+    void request_refill(void);
+
+    /**
+     * Runs the io service on the calling thread until events are ready
+     * in inline mode, or until timeout_ms milliseconds have passed.
+     * Reconnects if the connection was lost, like the event loop.
+     */
+    void run_inline(unsigned long timeout_ms);
+
+    void handle_inline_timeout(const boost::system::error_code& err,
+                               unsigned long wait);
 
     /**
      * Executes io_service in a loop.
@@ -155,7 +385,8 @@ private:
     /**
      * Disconnet from the server. The io service must have been stopped before
      * this function is called.
-     * The event queue is emptied.
+     * Events already in the event queue are left for the application, as
+     * this may run in the event loop thread which must not consume them.
      */
     void disconnect(void);
 
@@ -165,11 +396,38 @@ private:
      */
     void shutdown(void);
 
+    /**
+     * Shuts down the event loop and waits for its thread. The events
+     * still queued are deleted, as the thread may be waiting for room in
+     * the event queue.
+     */
+    void stop_event_loop();
+
     boost::thread *m_event_loop;
     boost::asio::io_service m_io_service;
     tcp::socket *m_socket;
     bool m_shutdown;
 
+    /**
+     * If events are read by the thread waiting for them, and if a read
+     * from the server is outstanding.
+     */
+    bool m_inline;
+    bool m_receiving;
+
+    /**
+     * Events read in inline mode and not yet taken by the application.
+     * A single read may complete many events.
+     */
+    std::deque<Binary_log_event *> m_ready_events;
+
+    /**
+     * Numbers the waits in inline mode, so a timer of an earlier wait
+     * which expires late is told apart.
+     */
+    unsigned long m_inline_wait;
+    bool m_inline_timed_out;
+
     /**
      * Temporary storage for a handshake package
      */
@@ -186,23 +444,48 @@ private:
     st_error_package m_error_package;
 
     /**
-     * each bin log event starts with a 19 byte long header
-     * We use this sturcture every time we initiate an async
-     * read.
+     * Bytes read from the server. The packets in [m_receive_begin,
+     * m_receive_end) have not been handled yet. Events decoded from
+     * the buffer share it, so a new one is allocated when it is still
+     * in use and running out of room.
      */
-    boost::uint8_t m_event_header[19];
+    boost::shared_ptr<boost::uint8_t> m_receive_buffer;
+    std::size_t m_receive_begin;
+    std::size_t m_receive_end;
 
     /**
-     *
+     * If the compressed protocol was asked for, and if it is used.
      */
-    boost::uint8_t m_net_header[4];
+    bool m_compress;
+    bool m_compressed;
 
     /**
-     *
+     * Bytes read from the server when the compressed protocol is used.
+     * The bytes in [m_compressed_begin, m_compressed_end) have not been
+     * inflated yet.
+     */
+    boost::shared_ptr<boost::uint8_t> m_compressed_buffer;
+    std::size_t m_compressed_begin;
+    std::size_t m_compressed_end;
+    Packet_inflater m_inflater;
+
+    /**
+     * The number of bytes still to come of a packet which is too large
+     * for the receive buffer.
      */
-    boost::uint8_t m_net_packet[MAX_PACKAGE_SIZE];
-    boost::asio::streambuf m_event_stream_buffer;
-    char * m_event_packet;
+    std::size_t m_packet_pending;
+
+    /**
+     * An event split over several packets, or in a packet larger than the
+     * receive buffer, starting with the packet marker byte.
+     * The buffer is sized to the event once its header has arrived.
+     * Decoded events refer to this buffer instead of copying out of it,
+     * so a new one is allocated for every such event and freed when the
+     * last event using it is deleted.
+     */
+    boost::shared_ptr<boost::uint8_t> m_event_buffer;
+    std::size_t m_event_buffer_size;
+    std::size_t m_event_buffer_used;
 
     /**
      * This pointer points to an object constructed from event
@@ -212,41 +495,102 @@ private:
      */
     Log_event_header *m_waiting_event;
     Log_event_header m_log_event_header;
+    std::size_t m_queue_events;
+    boost::uint64_t m_queue_bytes;
+    /**
+     * A ring buffer used to dispatch aggregated events to the user application.
+     * The event loop thread is the only producer and the thread calling
+     * wait_for_next_event() the only consumer.
+     */
+    spsc_bounded_buffer<Binary_log_event *> *m_event_queue;
+
     /**
-     * A ring buffer used to dispatch aggregated events to the user application
+     * Events received while the event queue was full, or 0 if the event
+     * loop waits instead. Only used by the event loop thread; the
+     * application thread reads the depth through m_spill_depth.
      */
-    bounded_buffer<Binary_log_event *> *m_event_queue;
+    Event_spill *m_spill;
+    boost::atomic<std::size_t> m_spill_depth;
+    boost::atomic<boost::uint64_t> m_spill_bytes;
+    boost::atomic<bool> m_refill_posted;
+
+    /**
+     * The position after the last event handed to the event queue, and
+     * whether receiving stopped because spilled events after it were
+     * lost. Only used by the event loop thread.
+     */
+    unsigned long m_queued_position;
+    bool m_spill_lost;
+
+    /**
+     * The relay log every received event is written to, or 0. Only used
+     * by the thread receiving the events.
+     */
+    Relay_log *m_relay;
 
     std::string m_user;
     std::string m_host;
     std::string m_passwd;
     long m_port;
+    boost::uint32_t m_server_id;
 
     boost::uint64_t m_total_bytes_transferred;
 
 
 };
 
+/**
+ * The server id to identify as when none is set, which is
+ * LIBREPLICATION_SERVER_ID from the environment, or 1.
+ */
+boost::uint32_t default_server_id();
+
+/**
+ * True for the artificial events a master starts a binlog dump with: a
+ * Rotate event to the requested position and, unless the dump starts at
+ * the beginning of a file, the Format description event of the file
+ * again. Unlike the events in the file both have a next position of 0.
+ */
+bool is_dump_preamble_event(Binary_log_event *event);
+
 /**
  * Sends a SHOW MASTER STATUS command to the server and retrieve the
  * current binlog position.
  *
  * @return False if the operation succeeded, true if it failed.
  */
-bool fetch_master_status(tcp::socket *socket, std::string *filename, unsigned long *position);
+bool fetch_master_status(tcp::socket *socket, std::string *filename, unsigned long *position,
+                         bool compressed= false);
 /**
  * Sends a SHOW BINARY LOGS command to the server and stores the file
  * names and sizes in a map.
  */
-bool fetch_binlogs_name_and_size(tcp::socket *socket, std::map<std::string, unsigned long> &binlog_map);
+bool fetch_binlogs_name_and_size(tcp::socket *socket, std::map<std::string, unsigned long> &binlog_map,
+                                 bool compressed= false);
 
+/**
+ * Sends the authentication packet and reads the reply. The compressed
+ * protocol is used from then on if compress is set and the server
+ * supports it.
+ */
 int authenticate(tcp::socket *socket, const std::string& user,
                  const std::string& passwd,
-                 const st_handshake_package &handshake_package);
+                 const st_handshake_package &handshake_package,
+                 bool compress= false);
 
+/**
+ * Connects, authenticates and registers as a slave.
+ *
+ * @param compress Use the compressed protocol if the server supports it
+ * @param compressed [out] If the connection uses the compressed protocol
+ * @param server_id The server id to register with, or 0 for
+ *                  LIBREPLICATION_SERVER_ID from the environment or 1
+ */
 tcp::socket *
 sync_connect_and_authenticate(boost::asio::io_service &io_service, const std::string &user,
-                              const std::string &passwd, const std::string &host, long port);
+                              const std::string &passwd, const std::string &host, long port,
+                              bool compress= false, bool *compressed= 0,
+                              boost::uint32_t server_id= 0);
 
 
 } }
@@ -0,0 +1,114 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _TIME_INDEX_H
+#define	_TIME_INDEX_H
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+/**
+ * Appended to the name of a binlog file to get the name of its time index.
+ */
+#define TIME_INDEX_SUFFIX ".tidx"
+
+/**
+ * Default distance in bytes between the entries of a time index.
+ */
+#define TIME_INDEX_INTERVAL (64 * 1024)
+
+namespace mysql {
+namespace system {
+
+/**
+ * A transaction in a binlog file, as recorded in its time index.
+ */
+struct Time_index_entry
+{
+  /*
+    The timestamp of the first event of the transaction.
+  */
+  boost::uint32_t timestamp;
+
+  /*
+    The position of the first event of the transaction.
+  */
+  boost::uint64_t position;
+
+  /*
+    The XID of the transaction before it, or 0 if that was not ended by an
+    XID event.
+  */
+  boost::uint64_t xid;
+};
+
+/**
+ * Build the time index of a binlog file, a file next to it with the
+ * suffix TIME_INDEX_SUFFIX. The index lists the start of the first
+ * transaction, and of the first transaction at least interval bytes
+ * after the last one listed, until the end of the file.
+ *
+ * A transaction starts at the beginning of the file and after each XID
+ * event or Query event other than BEGIN.
+ *
+ * @param binlog The binlog file
+ * @param interval The distance between entries, or 0 to list every
+ *                 transaction
+ *
+ * @retval ERR_OK Success
+ * @retval ERR_FAIL The binlog can't be read or the index can't be written
+ */
+int build_time_index(const std::string &binlog,
+                     unsigned long interval= TIME_INDEX_INTERVAL);
+
+/**
+ * Read the time index of a binlog file.
+ *
+ * @retval ERR_OK Success
+ * @retval ERR_FAIL There is no valid index
+ */
+int read_time_index(const std::string &binlog,
+                    std::vector<Time_index_entry> *entries);
+
+/**
+ * Find the first transaction which starts at or after a point in time.
+ * The file is found by a binary search over the timestamps of the first
+ * events of the files. Within the file the search starts at the last
+ * entry of its time index before that time, if there is an index, and
+ * continues by reading event headers.
+ *
+ * @param files The binlog files in order
+ * @param when The point in time
+ * @param file [out] The file of the transaction
+ * @param position [out] The position of the transaction
+ *
+ * @retval ERR_OK The transaction is found
+ * @retval ERR_EOF All transactions start before that time
+ * @retval ERR_FAIL A file can't be read
+ */
+int find_position_by_time(const std::vector<std::string> &files,
+                          boost::uint32_t when, std::string *file,
+                          unsigned long *position);
+
+} // namespace mysql::system
+} // namespace mysql
+
+#endif	/* _TIME_INDEX_H */
@@ -0,0 +1,201 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#ifndef _WRITESET_SCHEDULER_H
+#define	_WRITESET_SCHEDULER_H
+
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "basic_content_handler.h"
+#include "basic_transaction_parser.h"
+#include "row_keys.h"
+#include "spsc_bounded_buffer.h"
+
+/**
+ * The number of transactions which can wait for each worker of a
+ * Writeset_scheduler before the scheduler waits for it.
+ */
+#define WRITESET_QUEUE_SIZE 64
+
+/**
+ * The number of row hashes a Writeset_scheduler remembers the last
+ * writer of before it starts over.
+ */
+#define WRITESET_HISTORY_SIZE 25000
+
+namespace mysql {
+
+/**
+ * A content handler which applies the transactions put together by a
+ * Basic_transaction_parser in front of it on a number of worker threads,
+ * running transactions which don't touch the same rows at the same time
+ * and committing all of them in binlog order. This is how the WRITESET
+ * dependency tracking of MySQL lets a slave apply transactions in
+ * parallel.
+ *
+ * The write-set of a transaction holds a hash of the table and the
+ * primary key of every row image in its row events, see Row_keys. A
+ * transaction depends on the last earlier one whose write-set shares a
+ * hash with its own, and is only handed to a worker once that one has
+ * committed. The hashes of a table without a known key stand for the
+ * whole table. When more than the history size of hashes are
+ * remembered, they are forgotten and the transactions after depend on
+ * the last one before.
+ *
+ * Each transaction is handed to the apply function on its worker, and
+ * then to the commit function, on the same thread, once all earlier
+ * transactions have committed. Neither must throw. The transactions are
+ * consumed. Queries other than BEGIN, such as DDL, wait until all
+ * transactions before them have committed and are passed on, as are all
+ * other events.
+ */
+class Writeset_scheduler : public Content_handler
+{
+public:
+  /**
+   * Applies or commits a transaction on the given worker, numbered
+   * from 0.
+   */
+  typedef boost::function<void (unsigned int worker,
+                                Transaction_log_event &transaction)>
+    Transaction_applier;
+
+  /**
+   * @param workers The number of worker threads
+   * @param apply Called for each transaction, in parallel
+   * @param commit Called for each transaction in binlog order after it
+   *               is applied, or empty
+   * @param queue_size The number of transactions which can wait for each
+   *                   worker
+   * @param history_size The number of row hashes remembered
+   */
+  Writeset_scheduler(unsigned int workers, const Transaction_applier &apply,
+                     const Transaction_applier &commit= Transaction_applier(),
+                     std::size_t queue_size= WRITESET_QUEUE_SIZE,
+                     std::size_t history_size= WRITESET_HISTORY_SIZE);
+
+  /**
+   * Waits for all transactions to be committed.
+   */
+  ~Writeset_scheduler();
+
+  void set_key(const std::string &db_name, const std::string &table_name,
+               const std::vector<unsigned int> &columns)
+  {
+    m_keys.set_key(db_name, table_name, columns);
+  }
+
+  void set_key_lookup(const Row_keys::Key_lookup &lookup)
+  {
+    m_keys.set_key_lookup(lookup);
+  }
+
+  /**
+   * Wait until all transactions handed to the workers are committed.
+   */
+  void drain();
+
+  unsigned int workers() const { return m_workers.size(); }
+
+  /**
+   * The number of transactions which had to wait for an earlier one
+   * before they could be handed to a worker.
+   */
+  unsigned long waits() const { return m_waits; }
+
+  Binary_log_event *process_event(Query_event *ev);
+  Binary_log_event *process_event(Binary_log_event *ev);
+  bool handles(Log_event_type type) const;
+
+private:
+  /**
+   * A transaction and its place in the binlog, counting from 1.
+   */
+  struct Scheduled
+  {
+    Transaction_log_event *transaction;
+    boost::uint64_t sequence;
+  };
+
+  struct Worker
+  {
+    Worker(std::size_t queue_size) : queue(queue_size), queued(0),
+                                     thread(0) {}
+
+    /*
+      Ended by 0 when the scheduler is deleted.
+    */
+    spsc_bounded_buffer<Scheduled *> queue;
+
+    /*
+      The sequence number of the last transaction queued.
+    */
+    boost::uint64_t queued;
+    boost::thread *thread;
+  };
+
+  /**
+   * Run by each worker.
+   */
+  void work(unsigned int worker);
+
+  /**
+   * The last earlier transaction the transaction depends on, or 0, and
+   * note it as the last writer of its rows.
+   */
+  boost::uint64_t depends_on(Transaction_log_event *transaction,
+                             boost::uint64_t sequence);
+
+  /**
+   * Wait until the transactions up to sequence have committed.
+   */
+  void wait_committed(boost::uint64_t sequence);
+
+  std::vector<Worker *> m_workers;
+  Transaction_applier m_apply;
+  Transaction_applier m_commit;
+  Row_keys m_keys;
+
+  /*
+    The sequence number of the last transaction which wrote each row
+    hash, and of the last one before the hashes were last forgotten.
+  */
+  boost::unordered_map<std::size_t, boost::uint64_t> m_writers;
+  std::size_t m_history_size;
+  boost::uint64_t m_history_start;
+
+  boost::uint64_t m_sequence;
+  unsigned long m_waits;
+
+  /*
+    The sequence number of the last committed transaction. All before it
+    have committed too.
+  */
+  boost::mutex m_mutex;
+  boost::condition m_committed_changed;
+  boost::uint64_t m_committed;
+};
+
+} // end namespace
+
+#endif	/* _WRITESET_SCHEDULER_H */
@@ -20,15 +20,200 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 #include "access_method_factory.h"
 #include "tcp_driver.h"
 #include "file_driver.h"
+#include "mmap_driver.h"
+#include "parallel_driver.h"
+#include "catchup_driver.h"
+#include "backfill_driver.h"
+#include "replay_driver.h"
+#include <algorithm>
+#include <cctype>
 
 using mysql::system::Binary_log_driver;
 using mysql::system::Binlog_tcp_driver;
 using mysql::system::Binlog_file_driver;
+using mysql::system::Binlog_mmap_driver;
+using mysql::system::Binlog_parallel_driver;
+using mysql::system::Binlog_catchup_driver;
+using mysql::system::Binlog_backfill_driver;
+using mysql::system::Binlog_replay_driver;
+using mysql::system::Event_spill;
+using mysql::system::Memory_spill;
+using mysql::system::Disk_spill;
+using mysql::system::Relay_log;
+
+/**
+   Parse a size with an optional K, M or G suffix.
+*/
+static bool parse_size(const char *value, const char *end,
+                       boost::uint64_t *size)
+{
+  char *unit;
+  if (value == end || !isdigit(*value))
+    return false;
+  *size= strtoull(value, &unit, 10);
+  if (unit < end)
+  {
+    switch (*unit++)
+    {
+    case 'K': *size*= 1024; break;
+    case 'M': *size*= 1024 * 1024; break;
+    case 'G': *size*= 1024 * 1024 * 1024; break;
+    default: return false;
+    }
+  }
+  return unit == end;
+}
+
+/**
+   Parse a positive number, which may have a fraction.
+*/
+static bool parse_speed(const char *value, const char *end, double *speed)
+{
+  char *number_end;
+  if (value == end || !isdigit(*value))
+    return false;
+  std::string number(value, end);
+  *speed= strtod(number.c_str(), &number_end);
+  return *number_end == '\0' && *speed > 0;
+}
+
+/**
+   The connection and event queue settings given in a MySQL URI.
+*/
+struct Mysql_options
+{
+  Mysql_options()
+    : events(EVENT_QUEUE_SIZE), bytes(EVENT_QUEUE_BYTES), spill(false),
+      spill_bytes(SPILL_MAX_BYTES), spill_segment(SPILL_SEGMENT_SIZE),
+      compress(false), inline_io(false), backfill(0), server_id(0),
+      relay_sync(0)
+  {
+  }
+
+  std::size_t events;
+  boost::uint64_t bytes;
+  bool spill;
+  std::string spill_dir;
+  boost::uint64_t spill_bytes;
+  boost::uint64_t spill_segment;
+  bool compress;
+  bool inline_io;
+  std::string catchup;
+  unsigned int backfill;
+  boost::uint32_t server_id;
+  std::string relay;
+  unsigned long relay_sync;
+};
+
+/**
+   Parse the options of a MySQL URI.
+
+   The format is <code>option=value[&option=value]...</code> with the
+   options
+
+   - <code>queue_events</code>: the largest number of events waiting
+     for the application, up to EVENT_QUEUE_MAX_SIZE; 0 to only limit
+     bytes.
+   - <code>queue_bytes</code>: the largest size of the events waiting for
+     the application, with an optional K, M or G suffix; 0 for no limit.
+   - <code>queue_full</code>: <code>block</code> to stop reading while the
+     queue is full, which is the default, or <code>spill</code> to keep
+     reading into memory, or into files if <code>spill_dir</code> is given.
+   - <code>spill_dir</code>: the directory where events are spilled.
+   - <code>spill_bytes</code>: the largest size of the spill files, with
+     an optional K, M or G suffix; 0 for no limit. Reading stops while the
+     files are full.
+   - <code>spill_segment</code>: the size at which a new spill file is
+     started, with an optional K, M or G suffix.
+   - <code>compress</code>: 1 to use the compressed protocol if the server
+     supports it, or 0 not to, which is the default.
+   - <code>inline</code>: 1 to read events on the thread waiting for them
+     instead of a thread of the driver, or 0 not to, which is the default.
+     The queue options have no effect then.
+   - <code>catchup</code>: an index file, a directory or the first file of
+     local copies of the master's binlog files. Events are read from them
+     as far as they reach before the binlog dump starts; see
+     Binlog_catchup_driver.
+   - <code>backfill</code>: the number of binlog files, from 1 to 64,
+     which are dumped at the same time over connections of their own; see
+     Binlog_backfill_driver. The queue options have no effect then, and
+     it can't be combined with <code>catchup</code>.
+   - <code>server_id</code>: the server id to register with, instead of
+     LIBREPLICATION_SERVER_ID from the environment or 1. With
+     <code>backfill</code> the connections count up from it.
+   - <code>relay</code>: a directory where the received binlog files are
+     copied to, to be read later with a file driver; see Relay_log. It
+     can't be combined with <code>backfill</code>.
+   - <code>relay_sync</code>: the shortest time in milliseconds between
+     two syncs of the relay log, or 0, the default, to sync as soon as
+     the last sync is done.
+*/
+static bool parse_mysql_options(const char *options, const char *end,
+                                Mysql_options *settings)
+{
+  while (options < end)
+  {
+    const char *option_end= std::find(options, end, '&');
+    const char *value= std::find(options, option_end, '=');
+    if (value == option_end)
+      return false;
+    std::string name(options, value++);
+    boost::uint64_t size;
+
+    if (name == "queue_events" && parse_size(value, option_end, &size) &&
+        size <= EVENT_QUEUE_MAX_SIZE)
+      settings->events= size;
+    else if (name == "queue_bytes" && parse_size(value, option_end, &size))
+      settings->bytes= size;
+    else if (name == "queue_full" && std::string(value, option_end) == "block")
+      settings->spill= false;
+    else if (name == "queue_full" && std::string(value, option_end) == "spill")
+      settings->spill= true;
+    else if (name == "spill_dir" && value < option_end)
+      settings->spill_dir.assign(value, option_end);
+    else if (name == "spill_bytes" && parse_size(value, option_end, &size))
+      settings->spill_bytes= size;
+    else if (name == "spill_segment" && parse_size(value, option_end, &size) &&
+             size > 0)
+      settings->spill_segment= size;
+    else if (name == "compress" && std::string(value, option_end) == "1")
+      settings->compress= true;
+    else if (name == "compress" && std::string(value, option_end) == "0")
+      settings->compress= false;
+    else if (name == "inline" && std::string(value, option_end) == "1")
+      settings->inline_io= true;
+    else if (name == "inline" && std::string(value, option_end) == "0")
+      settings->inline_io= false;
+    else if (name == "catchup" && value < option_end)
+      settings->catchup.assign(value, option_end);
+    else if (name == "backfill" && parse_size(value, option_end, &size) &&
+             size > 0 && size <= 64)
+      settings->backfill= size;
+    else if (name == "server_id" && parse_size(value, option_end, &size) &&
+             size > 0 && size <= 0xffffffffUL)
+      settings->server_id= size;
+    else if (name == "relay" && value < option_end)
+      settings->relay.assign(value, option_end);
+    else if (name == "relay_sync" && parse_size(value, option_end, &size))
+      settings->relay_sync= size;
+    else
+      return false;
+
+    options= option_end == end ? end : option_end + 1;
+  }
+  /*
+    The catch-up driver and the relay log go on with a single
+    connection.
+  */
+  return settings->backfill == 0 ||
+         (settings->catchup.empty() && settings->relay.empty());
+}
 
 /**
    Parse the body of a MySQL URI.
 
-   The format is <code>user[:password]@host[:port]</code>
+   The format is <code>user[:password]@host[:port][?options]</code>
+   where the options are described in parse_mysql_options().
 */
 static Binary_log_driver *parse_mysql_url(const char *body, size_t len)
 {
@@ -58,13 +243,12 @@ static Binary_log_driver *parse_mysql_url(const char *body, size_t len)
   /* Find the host name, which is mandatory */
   // Skip the '@', if there is one
   const char *host = *pass_end == '@' ? pass_end + 1 : pass_end;
-  const char *host_end = strchr(host, ':');
+  const char *options = strchr(host, '?');
+  if (options == 0)
+    options = body + len;
+  const char *host_end = std::find(host, options, ':');
   if (host == host_end)
     return 0;                                 // No hostname was found
-  /* If no ':' was found there is no port, so the host end at the end
-   * of the string */
-  if (host_end == 0)
-    host_end = body + len;
   assert(host_end - host >= 1);              // There has to be a host
 
   /* Find the port number */
@@ -72,29 +256,174 @@ static Binary_log_driver *parse_mysql_url(const char *body, size_t len)
   if (*host_end == ':')
     portno = strtoul(host_end + 1, NULL, 10);
 
+  /* Find the connection and event queue options */
+  Mysql_options settings;
+  if (*options == '?' &&
+      !parse_mysql_options(options + 1, body + len, &settings))
+    return 0;
+
+  if (settings.backfill > 0)
+    return new Binlog_backfill_driver(std::string(user, user_end - user),
+                                      std::string(pass, pass_end - pass),
+                                      std::string(host, host_end - host),
+                                      portno, settings.backfill,
+                                      settings.server_id, settings.compress);
+
+  Event_spill *spill = 0;
+  if (settings.spill && settings.spill_dir.empty())
+    spill = new Memory_spill();
+  else if (settings.spill)
+    spill = new Disk_spill(settings.spill_dir, settings.spill_bytes,
+                           settings.spill_segment);
+
   /* Host name is now the string [host, port-1) if port != NULL and [host, EOS) otherwise. */
   /* Port number is stored in portno, either the default, or a parsed one */
-  return new Binlog_tcp_driver(std::string(user, user_end - user),
-                               std::string(pass, pass_end - pass),
-                               std::string(host, host_end - host),
-                               portno);
+  Binlog_tcp_driver *driver=
+    new Binlog_tcp_driver(std::string(user, user_end - user),
+                          std::string(pass, pass_end - pass),
+                          std::string(host, host_end - host),
+                          portno, settings.events, settings.bytes, spill,
+                          settings.compress, settings.inline_io);
+  driver->set_server_id(settings.server_id);
+  if (!settings.relay.empty())
+    driver->set_relay_log(new Relay_log(settings.relay, settings.relay_sync));
+  if (!settings.catchup.empty())
+    return new Binlog_catchup_driver(settings.catchup, driver);
+  return driver;
 }
 
 
-static Binary_log_driver *parse_file_url(const char *body, size_t length)
+/**
+   The settings given in a file URI.
+*/
+struct File_options
+{
+  File_options() : follow(false), threads(0), tail(false), replay(false),
+                   speed(0) {}
+
+  bool follow;
+  unsigned int threads;
+  bool tail;
+  bool replay;
+  double speed;
+};
+
+
+/**
+   Parse the options of a file URI.
+   The format is <code>option=value[&option=value]...</code> with the
+   options
+   - <code>follow</code>: 1 to go on with the file named by the Rotate
+     event at the end of each file, or 0 not to, which is the default.
+     The files listed in an index file are always followed.
+   - <code>threads</code>: the number of files of an index file which
+     are decoded at the same time. Without it one file after another is
+     decoded on the thread waiting for the events.
+   - <code>tail</code>: 1 to wait for more events at the end of the last
+     file, like <code>tail -f</code>, or 0 to stop, which is the default.
+     Rotate events are followed then.
+   - <code>replay</code>: replay the events with the pacing of their
+     timestamps, a number of times faster, such as 1 for the original
+     pacing or 10 for ten times as fast, or <code>max</code> for as fast
+     as they can be read. See Binlog_replay_driver.
+*/
+static bool parse_file_options(const char *options, const char *end,
+                               File_options *settings)
+{
+  while (options < end)
+  {
+    const char *option_end= std::find(options, end, '&');
+    const char *value= std::find(options, option_end, '=');
+    if (value == option_end)
+      return false;
+    std::string name(options, value++);
+    boost::uint64_t size;
+    if (name == "follow" && std::string(value, option_end) == "1")
+      settings->follow= true;
+    else if (name == "follow" && std::string(value, option_end) == "0")
+      settings->follow= false;
+    else if (name == "threads" && parse_size(value, option_end, &size) &&
+             size > 0 && size <= 1024)
+      settings->threads= size;
+    else if (name == "tail" && std::string(value, option_end) == "1")
+      settings->tail= true;
+    else if (name == "tail" && std::string(value, option_end) == "0")
+      settings->tail= false;
+    else if (name == "replay" && std::string(value, option_end) == "max")
+    {
+      settings->replay= true;
+      settings->speed= 0;
+    }
+    else if (name == "replay" && parse_speed(value, option_end,
+                                             &settings->speed))
+      settings->replay= true;
+    else
+      return false;
+    options= option_end == end ? end : option_end + 1;
+  }
+  /*
+    Rotate events can't be followed before a file is decoded, and a
+    replay reads one file after another.
+  */
+  return !((settings->follow || settings->tail || settings->replay) &&
+           settings->threads > 0);
+}
+
+
+/**
+   Parse the body of a file URI.
+   The format is <code>//path[?options]</code>, where the path is
+   absolute and the options are described in parse_file_options().
+*/
+static bool parse_file_body(const char *body, size_t length,
+                            std::string *path, File_options *settings)
 {
   /* Find the beginning of the file name */
   if (strncmp(body, "//", 2) != 0)
-    return 0;
+    return false;
 
   /*
     Since we don't support host information yet, there should be a
     slash after the initial "//".
    */
   if (body[2] != '/')
+    return false;
+
+  const char *end= body + length;
+  const char *options= std::find(body + 2, end, '?');
+  path->assign(body + 2, options);
+  return options == end || parse_file_options(options + 1, end, settings);
+}
+
+static Binary_log_driver *parse_file_url(const char *body, size_t length)
+{
+  std::string path;
+  File_options settings;
+  if (!parse_file_body(body, length, &path, &settings))
     return 0;
+  if (settings.threads > 0)
+    return new Binlog_parallel_driver(path, settings.threads);
+  Binlog_file_driver *driver=
+    new Binlog_file_driver(path, 0, settings.follow, settings.tail);
+  if (settings.replay)
+    return new Binlog_replay_driver(driver, settings.speed);
+  return driver;
+}
 
-  return new Binlog_file_driver(body + 2);
+static Binary_log_driver *parse_mmap_url(const char *body, size_t length)
+{
+  std::string path;
+  File_options settings;
+  /*
+    A mapping doesn't follow a growing file, and replays are read with
+    the file driver.
+  */
+  if (!parse_file_body(body, length, &path, &settings) || settings.tail ||
+      settings.replay)
+    return 0;
+  if (settings.threads > 0)
+    return new Binlog_parallel_driver(path, settings.threads, true);
+  return new Binlog_mmap_driver(path, 0, settings.follow);
 }
 
 /**
@@ -110,6 +439,8 @@ struct Parser {
 */
 static Parser url_parser[] = {
   { "mysql", parse_mysql_url },
+  /* Before "file", which is a prefix of it. */
+  { "file+mmap", parse_mmap_url },
   { "file",  parse_file_url },
 };
 
@@ -0,0 +1,373 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#include "backfill_driver.h"
+#include "binlog_api.h"
+
+#include <algorithm>
+#include <map>
+#include <boost/bind.hpp>
+
+namespace mysql { namespace system {
+
+Binlog_backfill_driver::~Binlog_backfill_driver()
+{
+  stop();
+}
+
+
+int Binlog_backfill_driver::fetch_files(std::vector<std::string> *files)
+{
+  boost::asio::io_service io_service;
+  tcp::socket *socket;
+  bool compressed;
+  if ((socket= sync_connect_and_authenticate(io_service, m_user, m_passwd,
+                                             m_host, m_port, m_compress,
+                                             &compressed, m_server_id)) == 0)
+    return ERR_FAIL;
+
+  std::map<std::string, unsigned long> binlog_map;
+  fetch_binlogs_name_and_size(socket, binlog_map, compressed);
+  socket->close();
+  delete socket;
+  if (binlog_map.empty())
+    return ERR_FAIL;
+
+  files->clear();
+  for (std::map<std::string, unsigned long>::iterator it= binlog_map.begin();
+       it != binlog_map.end(); ++it)
+    files->push_back(it->first);
+  return ERR_OK;
+}
+
+
+int Binlog_backfill_driver::connect()
+{
+  std::vector<std::string> files;
+  if (fetch_files(&files))
+    return ERR_FAIL;
+  stop();
+  m_files.swap(files);
+  m_current= 0;
+  m_position= MAGIC_NUMBER_SIZE;
+  m_error= ERR_OK;
+  m_binlog_file_name= m_files[0];
+  return ERR_OK;
+}
+
+
+int Binlog_backfill_driver::disconnect()
+{
+  stop();
+  return ERR_OK;
+}
+
+
+void Binlog_backfill_driver::start(std::size_t file, unsigned long position)
+{
+  m_current= file;
+  m_position= position;
+  m_error= ERR_OK;
+  m_binlog_file_name= m_files[file];
+
+  m_queues.assign(m_files.size(), 0);
+  m_next_file= file;
+  m_first_file= file;
+  m_first_position= position;
+  m_stop= false;
+  for (unsigned int i= 0; i < m_connections; ++i)
+    m_pool.push_back(new boost::thread(boost::bind(&Binlog_backfill_driver::scan,
+                                                   this, i)));
+}
+
+
+void Binlog_backfill_driver::stop()
+{
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_stop= true;
+    m_changed.notify_all();
+  }
+  for (std::size_t i= 0; i < m_pool.size(); ++i)
+  {
+    /* The connection may wait for room in its queue. */
+    while (!m_pool[i]->timed_join(boost::posix_time::milliseconds(10)))
+      drain();
+    delete m_pool[i];
+  }
+  m_pool.clear();
+
+  drain();
+  for (std::size_t i= 0; i < m_queues.size(); ++i)
+    delete m_queues[i];
+  m_queues.clear();
+}
+
+
+void Binlog_backfill_driver::drain()
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  for (std::size_t i= 0; i < m_queues.size(); ++i)
+  {
+    /* Unlike try_pop(), this wakes up a connection waiting for room. */
+    while (m_queues[i] &&
+           m_queues[i]->pop_back_n(&m_batch, BACKFILL_QUEUE_SIZE, 0) > 0)
+    {
+      for (std::size_t j= 0; j < m_batch.size(); ++j)
+        delete m_batch[j].event;
+      m_batch.clear();
+    }
+  }
+}
+
+
+void Binlog_backfill_driver::scan(unsigned int slot)
+{
+  for (;;)
+  {
+    std::size_t file;
+    unsigned long position;
+    Scan_queue *queue;
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      while (!m_stop && m_next_file < m_files.size() &&
+             m_next_file >= m_current + 2 * m_connections)
+        m_changed.wait(lock);
+      if (m_stop || m_next_file == m_files.size())
+        return;
+      file= m_next_file++;
+      position= file == m_first_file ? m_first_position : MAGIC_NUMBER_SIZE;
+      queue= new Scan_queue(BACKFILL_QUEUE_SIZE);
+      m_queues[file]= queue;
+      m_changed.notify_all();
+    }
+
+    scan_file(slot, file, position, queue);
+  }
+}
+
+
+void Binlog_backfill_driver::scan_file(unsigned int slot, std::size_t file,
+                                       unsigned long position,
+                                       Scan_queue *queue)
+{
+  const std::string &name= m_files[file];
+  bool last= file + 1 == m_files.size();
+  Binlog_tcp_driver driver(m_user, m_passwd, m_host, m_port, 0, 0, 0,
+                           m_compress, true);
+  driver.set_server_id((m_server_id ? m_server_id : default_server_id()) +
+                       slot);
+
+  Scanned_event entry;
+  entry.event= 0;
+  entry.position= position;
+  entry.result= driver.set_position(name, position);
+  unsigned int retries= 0;
+  bool ended= false;
+  std::vector<Binary_log_event *> events;
+  while (entry.result == ERR_OK && !ended && !m_stop)
+  {
+    events.clear();
+    driver.wait_for_next_events(&events, BACKFILL_QUEUE_SIZE, BACKFILL_POLL_MS);
+    for (std::size_t i= 0; i < events.size(); ++i)
+    {
+      Binary_log_event *event= events[i];
+      int type= event->get_event_type();
+      if (ended || entry.result != ERR_OK || is_dump_preamble_event(event))
+      {
+        delete event;
+        continue;
+      }
+
+      if (type == INCIDENT_EVENT &&
+          static_cast<Incident_event *>(event)->type == 175)
+      {
+        /* The connection failed; go on where it stopped. */
+        delete event;
+        entry.result= ++retries > BACKFILL_RETRIES ? (int)ERR_FAIL :
+                      driver.set_position(name, entry.position);
+        continue;
+      }
+
+      /*
+        The next file is dumped by another connection. Only the file
+        which is written to when the driver connected goes on into the
+        files after it.
+      */
+      if (type == ROTATE_EVENT && !last &&
+          static_cast<Rotate_event *>(event)->binlog_file != name)
+        ended= true;
+
+      retries= 0;
+      if (event->header()->next_position != 0)
+        entry.position= event->header()->next_position;
+      entry.event= event;
+      queue->push_front(entry);
+    }
+  }
+  entry.event= 0;
+  if (ended)
+    entry.result= ERR_EOF;
+  queue->push_front(entry);
+}
+
+
+Binlog_backfill_driver::Scan_queue *Binlog_backfill_driver::current_queue()
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  while (m_queues[m_current] == 0)
+    m_changed.wait(lock);
+  return m_queues[m_current];
+}
+
+
+void Binlog_backfill_driver::event_taken(const Scanned_event &entry)
+{
+  if (entry.event->get_event_type() == ROTATE_EVENT)
+  {
+    const Rotate_event *rotate= static_cast<const Rotate_event *>(entry.event);
+    m_binlog_file_name= rotate->binlog_file;
+    m_position= (unsigned long) rotate->binlog_pos;
+  }
+  else
+    m_position= entry.position;
+}
+
+
+bool Binlog_backfill_driver::next_file(const Scanned_event &last)
+{
+  if (last.result != ERR_EOF)
+  {
+    m_error= last.result == ERR_OK ? (int)ERR_FAIL : last.result;
+    return false;
+  }
+
+  boost::mutex::scoped_lock lock(m_mutex);
+  delete m_queues[m_current];
+  m_queues[m_current]= 0;
+  ++m_current;
+  if (m_current < m_files.size())
+  {
+    m_binlog_file_name= m_files[m_current];
+    m_position= MAGIC_NUMBER_SIZE;
+  }
+  m_changed.notify_all();
+  return true;
+}
+
+
+int Binlog_backfill_driver::wait_for_next_event(mysql::Binary_log_event **event)
+{
+  if (m_files.empty())
+    return ERR_FAIL;                            // Not connected.
+  if (m_pool.empty() && m_current < m_files.size())
+    start(m_current, m_position);
+
+  while (m_error == ERR_OK && m_current < m_files.size())
+  {
+    Scanned_event entry;
+    current_queue()->pop_back(&entry);
+    if (entry.event)
+    {
+      event_taken(entry);
+      *event= entry.event;
+      return ERR_OK;
+    }
+    next_file(entry);
+  }
+  return m_error == ERR_OK ? (int)ERR_EOF : m_error;
+}
+
+
+int Binlog_backfill_driver::wait_for_next_events(std::vector<mysql::Binary_log_event *> *events,
+                                                 std::size_t max_events,
+                                                 unsigned long timeout_ms)
+{
+  if (m_files.empty())
+    return ERR_FAIL;                            // Not connected.
+  if (m_pool.empty() && m_current < m_files.size())
+    start(m_current, m_position);
+
+  std::size_t count= 0;
+  while (count < max_events && m_error == ERR_OK &&
+         m_current < m_files.size())
+  {
+    /* Only wait for the first event. */
+    m_batch.clear();
+    if (current_queue()->pop_back_n(&m_batch, max_events - count,
+                                    count > 0 ? 0 : timeout_ms) == 0)
+      break;
+    for (std::size_t i= 0; i < m_batch.size(); ++i)
+    {
+      if (m_batch[i].event)
+      {
+        events->push_back(m_batch[i].event);
+        event_taken(m_batch[i]);
+        ++count;
+      }
+      else
+        next_file(m_batch[i]);
+    }
+  }
+
+  /* An error is reported by the next call when events were taken. */
+  if (count > 0 || (m_error == ERR_OK && m_current < m_files.size()))
+    return ERR_OK;
+  return m_error == ERR_OK ? (int)ERR_EOF : m_error;
+}
+
+
+int Binlog_backfill_driver::set_position(const std::string &str,
+                                         unsigned long position)
+{
+  std::string name= str.empty() ? m_binlog_file_name : str;
+  if (position < MAGIC_NUMBER_SIZE)
+    return ERR_FAIL;
+
+  /* Files written since the list was fetched are not in it yet. */
+  std::vector<std::string> files;
+  if (std::find(m_files.begin(), m_files.end(), name) == m_files.end() &&
+      (fetch_files(&files) ||
+       std::find(files.begin(), files.end(), name) == files.end()))
+    return ERR_FAIL;
+
+  stop();
+  if (!files.empty())
+    m_files.swap(files);
+  m_current= std::find(m_files.begin(), m_files.end(), name) - m_files.begin();
+  m_position= position;
+  m_error= ERR_OK;
+  m_binlog_file_name= name;
+  return ERR_OK;
+}
+
+
+int Binlog_backfill_driver::get_position(std::string *str,
+                                         unsigned long *position)
+{
+  if (str)
+    *str= m_binlog_file_name;
+  if (position)
+    *position= m_position;
+  return ERR_OK;
+}
+
+}
+}
@@ -22,7 +22,9 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 
 namespace mysql {
 
-Content_handler::Content_handler () {}
+Content_handler::Content_handler () : m_reinject_queue(0) {}
+Content_handler::Content_handler (const Content_handler &orig)
+  : m_reinject_queue(orig.m_reinject_queue) {}
 Content_handler::~Content_handler () {}
 mysql::Binary_log_event *Content_handler::process_event(mysql::Query_event *ev) { return ev; }
 mysql::Binary_log_event *Content_handler::process_event(mysql::Row_event *ev) { return ev; }
@@ -33,70 +35,12 @@ mysql::Binary_log_event *Content_handler::process_event(mysql::Incident_event *e
 mysql::Binary_log_event *Content_handler::process_event(mysql::Rotate_event *ev) { return ev; }
 mysql::Binary_log_event *Content_handler::process_event(mysql::Int_var_event *ev) { return ev; }
 mysql::Binary_log_event *Content_handler::process_event(mysql::Binary_log_event *ev) { return ev; }
-
-Injection_queue *Content_handler::get_injection_queue(void)
-{
-  return m_reinject_queue;
-}
-
-void Content_handler::set_injection_queue(Injection_queue *queue)
-{
-  m_reinject_queue= queue;
-}
+bool Content_handler::handles(mysql::Log_event_type) const { return true; }
 
 mysql::Binary_log_event*
   Content_handler::internal_process_event(mysql::Binary_log_event *ev)
 {
- mysql::Binary_log_event *processed_event= 0;
- switch(ev->header ()->type_code) {
- case mysql::QUERY_EVENT:
-   processed_event= process_event(static_cast<mysql::Query_event*>(ev));
-   break;
- case mysql::WRITE_ROWS_EVENT:
- case mysql::UPDATE_ROWS_EVENT:
- case mysql::DELETE_ROWS_EVENT:
-   processed_event= process_event(static_cast<mysql::Row_event*>(ev));
-   break;
- case mysql::USER_VAR_EVENT:
-   processed_event= process_event(static_cast<mysql::User_var_event *>(ev));
-   break;
- case mysql::ROTATE_EVENT:
-   processed_event= process_event(static_cast<mysql::Rotate_event *>(ev));
-   break;
- case mysql::INCIDENT_EVENT:
-   processed_event= process_event(static_cast<mysql::Incident_event *>(ev));
-   break;
- case mysql::XID_EVENT:
-   processed_event= process_event(static_cast<mysql::Xid *>(ev));
-   break;
- case mysql::TABLE_MAP_EVENT:
-   processed_event= process_event(static_cast<mysql::Table_map_event *>(ev));
-   break;
- /* TODO ********************************************************************/
- case mysql::FORMAT_DESCRIPTION_EVENT:
-   processed_event= process_event(ev);
-   break;
- case mysql::BEGIN_LOAD_QUERY_EVENT:
-   processed_event= process_event(ev);
-   break;
- case mysql::EXECUTE_LOAD_QUERY_EVENT:
-   processed_event= process_event(ev);
-   break;
- case mysql::INTVAR_EVENT:
-   processed_event= process_event(ev);
-   break;
- case mysql::STOP_EVENT:
-   processed_event= process_event(ev);
-   break;
- case mysql::RAND_EVENT:
-   processed_event= process_event(ev);
-   break;
- /****************************************************************************/
- default:
-   processed_event= process_event(ev);
-   break;
- }
- return processed_event;
+  return dispatch_event(*this, ev);
 }
 
 } // end namespace
@@ -29,6 +29,22 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 
 namespace mysql {
 
+bool Basic_transaction_parser::handles(mysql::Log_event_type type) const
+{
+  switch (type)
+  {
+  case mysql::QUERY_EVENT:
+  case mysql::WRITE_ROWS_EVENT:
+  case mysql::UPDATE_ROWS_EVENT:
+  case mysql::DELETE_ROWS_EVENT:
+  case mysql::TABLE_MAP_EVENT:
+  case mysql::XID_EVENT:
+    return true;
+  default:
+    return false;
+  }
+}
+
 mysql::Binary_log_event *Basic_transaction_parser::process_event(mysql::Query_event *qev)
 {
   if (qev->query == "BEGIN")
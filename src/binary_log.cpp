@@ -18,6 +18,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 02110-1301  USA
 */
 
+#include <algorithm>
 #include <list>
 
 #include "binlog_api.h"
@@ -27,7 +28,9 @@ using namespace mysql;
 using namespace mysql::system;
 namespace mysql
 {
-Binary_log::Binary_log(Binary_log_driver *drv) : m_binlog_position(4), m_binlog_file("")
+Binary_log::Binary_log(Binary_log_driver *drv)
+  : m_binlog_position(4), m_binlog_file(""), m_until(0), m_at_boundary(true),
+    m_until_reached(false)
 {
   if (drv == NULL)
   {
@@ -50,6 +53,10 @@ int Binary_log::wait_for_next_event(mysql::Binary_log_event **event_ptr)
 
   mysql::Injection_queue reinjection_queue;
 
+  if (m_until_reached)
+    return ERR_EOF;
+
+  update_dispatch();
   do {
     handler_code= false;
     if (!reinjection_queue.empty())
@@ -62,18 +69,14 @@ int Binary_log::wait_for_next_event(mysql::Binary_log_event **event_ptr)
       // Return in case of non-ERR_OK.
       if(rc= m_driver->wait_for_next_event(&event))
         return rc;
-    }
-    m_binlog_position= event->header()->next_position;
-    mysql::Content_handler *handler;
-
-    BOOST_FOREACH(handler, m_content_handlers)
-    {
-      if (event)
+      if (reached_until(event))
       {
-        handler->set_injection_queue(&reinjection_queue);
-        event= handler->internal_process_event(event);
+        delete event;
+        return ERR_EOF;
       }
     }
+    m_binlog_position= event->header()->next_position;
+    event= process_event(event, &reinjection_queue);
   } while(event == 0 || !reinjection_queue.empty());
 
   if (event_ptr)
@@ -82,6 +85,94 @@ int Binary_log::wait_for_next_event(mysql::Binary_log_event **event_ptr)
   return 0;
 }
 
+int Binary_log::wait_for_next_events(std::vector<Binary_log_event *> *events,
+                                     std::size_t max_events,
+                                     unsigned long timeout_ms)
+{
+  int rc;
+  std::size_t first= events->size();
+  mysql::Injection_queue reinjection_queue;
+
+  if (m_until_reached)
+    return ERR_EOF;
+
+  update_dispatch();
+  /*
+    Keep fetching while the handlers consume everything, so that an
+    empty batch only means that the timeout expired.
+  */
+  do {
+    m_batch.clear();
+    if ((rc= m_driver->wait_for_next_events(&m_batch, max_events, timeout_ms)))
+      return rc;
+
+    for (std::size_t i= 0; i < m_batch.size(); ++i)
+    {
+      mysql::Binary_log_event *event= m_batch[i];
+      if (reached_until(event))
+      {
+        for (; i < m_batch.size(); ++i)
+          delete m_batch[i];
+        return events->size() > first ? (int)ERR_OK : (int)ERR_EOF;
+      }
+      m_binlog_position= event->header()->next_position;
+      if ((event= process_event(event, &reinjection_queue)))
+        events->push_back(event);
+
+      /* Injected events follow the event which caused them. */
+      while (!reinjection_queue.empty())
+      {
+        event= reinjection_queue.front();
+        reinjection_queue.pop_front();
+        m_binlog_position= event->header()->next_position;
+        if ((event= process_event(event, &reinjection_queue)))
+          events->push_back(event);
+      }
+    }
+  } while (events->size() == first && !m_batch.empty());
+
+  return ERR_OK;
+}
+
+void Binary_log::update_dispatch()
+{
+  if (m_dispatch_index.size() == DISPATCH_TYPES + 1 &&
+      m_dispatch_pipeline.size() == m_content_handlers.size() &&
+      std::equal(m_dispatch_pipeline.begin(), m_dispatch_pipeline.end(),
+                 m_content_handlers.begin()))
+    return;
+
+  m_dispatch_pipeline.assign(m_content_handlers.begin(),
+                             m_content_handlers.end());
+  m_dispatch.clear();
+  m_dispatch_index.resize(DISPATCH_TYPES + 1);
+  for (std::size_t type= 0; type < DISPATCH_TYPES; ++type)
+  {
+    m_dispatch_index[type]= m_dispatch.size();
+    mysql::Content_handler *handler;
+    BOOST_FOREACH(handler, m_dispatch_pipeline)
+    {
+      if (handler->handles((Log_event_type) type))
+        m_dispatch.push_back(handler);
+    }
+  }
+  m_dispatch_index[DISPATCH_TYPES]= m_dispatch.size();
+}
+
+Binary_log_event *Binary_log::process_event(Binary_log_event *event,
+                                            Injection_queue *reinjection_queue)
+{
+  boost::uint8_t type= event->header()->type_code;
+  std::size_t end= m_dispatch_index[type + 1];
+
+  for (std::size_t i= m_dispatch_index[type]; event && i < end; ++i)
+  {
+    m_dispatch[i]->set_injection_queue(reinjection_queue);
+    event= m_dispatch[i]->internal_process_event(event);
+  }
+  return event;
+}
+
 int Binary_log::set_position(const std::string &filename, unsigned long position)
 {
   int status= m_driver->set_position(filename, position);
@@ -89,10 +180,50 @@ int Binary_log::set_position(const std::string &filename, unsigned long position
   {
     m_binlog_file= filename;
     m_binlog_position= position;
+    m_until= 0;
+    m_until_reached= false;
   }
   return status;
 }
 
+int Binary_log::set_position_by_time(boost::uint32_t start,
+                                     boost::uint32_t until)
+{
+  int status= m_driver->set_position_by_time(start);
+  if (status == ERR_OK)
+  {
+    m_driver->get_position(&m_binlog_file, &m_binlog_position);
+    m_until= until;
+    m_at_boundary= true;
+    m_until_reached= false;
+  }
+  return status;
+}
+
+bool Binary_log::reached_until(Binary_log_event *event)
+{
+  if (m_until == 0)
+    return false;
+
+  bool boundary= m_at_boundary;
+  switch (event->get_event_type())
+  {
+  case XID_EVENT:
+    m_at_boundary= true;
+    break;
+  case QUERY_EVENT:
+    m_at_boundary= static_cast<Query_event *>(event)->query != "BEGIN";
+    break;
+  case FORMAT_DESCRIPTION_EVENT:
+  case ROTATE_EVENT:
+    break;
+  default:
+    m_at_boundary= false;
+  }
+  m_until_reached= boundary && event->header()->timestamp >= m_until;
+  return m_until_reached;
+}
+
 int Binary_log::set_position(unsigned long position)
 {
   std::string filename;
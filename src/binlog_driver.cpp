@@ -18,48 +18,93 @@
   02110-1301  USA
 */
 
+#include "binlog_api.h"
 #include "binlog_driver.h"
+#include <sstream>
+#include <vector>
 
 namespace mysql { namespace system {
 
-/*
-Binary_log_event* Binary_log_driver::parse_event(boost::asio::streambuf
-                                                 &sbuff, Log_event_header
-                                                 *header)
-                                                 */
+int Binary_log_driver::wait_for_next_events(std::vector<Binary_log_event *> *events,
+                                            std::size_t max_events,
+                                            unsigned long)
+{
+  Binary_log_event *event;
+  int rc;
+  if (max_events == 0)
+    return ERR_OK;
+  if ((rc= wait_for_next_event(&event)) == ERR_OK)
+    events->push_back(event);
+  return rc;
+}
+
+int Binary_log_driver::set_position_by_time(boost::uint32_t)
+{
+  return ERR_FAIL;
+}
+
 Binary_log_event* Binary_log_driver::parse_event(std::istream &is,
                                                  Log_event_header *header)
+{
+  /*
+    Read the whole event body with one call and decode it from memory.
+  */
+  std::size_t length= 0;
+  if (header->event_length > LOG_EVENT_HEADER_SIZE - 1)
+    length= header->event_length - (LOG_EVENT_HEADER_SIZE - 1);
+  std::vector<boost::uint8_t> body(length);
+  std::size_t bytes_read= 0;
+  if (length > 0)
+  {
+    is.read(reinterpret_cast<char *>(&body[0]), length);
+    bytes_read= (std::size_t)is.gcount();
+  }
+  return parse_event(length > 0 ? &body[0] : 0, bytes_read, header);
+}
+
+Binary_log_event* Binary_log_driver::parse_event(const boost::uint8_t *buf,
+                                                 std::size_t length,
+                                                 Log_event_header *header)
+{
+  return parse_event(Buffer_owner(), buf, length, header);
+}
+
+Binary_log_event* Binary_log_driver::parse_event(const Buffer_owner &owner,
+                                                 const boost::uint8_t *buf,
+                                                 std::size_t length,
+                                                 Log_event_header *header)
 {
   Binary_log_event *parsed_event= 0;
+  buffer_source src(owner, buf, length);
 
   switch (header->type_code) {
     case TABLE_MAP_EVENT:
-      parsed_event= proto_table_map_event(is, header);
+      parsed_event= proto_table_map_event(src, header);
       break;
     case QUERY_EVENT:
-      parsed_event= proto_query_event(is, header);
+      parsed_event= proto_query_event(src, header);
       break;
     case INCIDENT_EVENT:
-      parsed_event= proto_incident_event(is, header);
+      parsed_event= proto_incident_event(src, header);
       break;
     case WRITE_ROWS_EVENT:
     case UPDATE_ROWS_EVENT:
     case DELETE_ROWS_EVENT:
-      parsed_event= proto_rows_event(is, header);
+      parsed_event= proto_rows_event(src, header);
       break;
     case ROTATE_EVENT:
       {
-        Rotate_event *rot= proto_rotate_event(is, header);
+        Rotate_event *rot= proto_rotate_event(src, header);
         m_binlog_file_name= rot->binlog_file;
         m_binlog_offset= (unsigned long)rot->binlog_pos;
         parsed_event= rot;
       }
       break;
     case INTVAR_EVENT:
-      parsed_event= proto_intvar_event(is, header);
+      parsed_event= proto_intvar_event(src, header);
       break;
     case USER_VAR_EVENT:
-      parsed_event= proto_uservar_event(is, header);
+      parsed_event= proto_uservar_event(src, header);
       break;
     default:
       {
@@ -68,6 +113,23 @@ Binary_log_event* Binary_log_driver::parse_event(std::istream &is,
       }
   }
 
+  if (!src.good())
+  {
+    /*
+      The event claims to be longer than the bytes we were given; don't
+      hand out a half decoded event.
+    */
+    std::ostringstream os;
+    os << "Truncated "
+       << get_event_type_str((Log_event_type)header->type_code)
+       << " event; "
+       << length
+       << " bytes available.";
+    delete parsed_event;
+    parsed_event= create_incident_event(175, os.str().c_str(),
+                                        header->next_position);
+  }
+
   return parsed_event;
 }
 
@@ -0,0 +1,282 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#include "binlog_sequence.h"
+#include "binlog_api.h"
+#include "compressed_file.h"
+
+#include <fstream>
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mysql { namespace system {
+
+namespace {
+
+const char index_suffix[]= ".index";
+
+/**
+ * The directory part of path, including the trailing slash.
+ */
+std::string directory_of(const std::string &path)
+{
+  std::string::size_type slash= path.rfind('/');
+  return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+bool file_exists(const std::string &path)
+{
+  struct stat stat_buff;
+  return stat(path.c_str(), &stat_buff) == 0 && S_ISREG(stat_buff.st_mode);
+}
+
+bool directory_exists(const std::string &path)
+{
+  struct stat stat_buff;
+  return stat(path.c_str(), &stat_buff) == 0 && S_ISDIR(stat_buff.st_mode);
+}
+
+/**
+ * The file which holds the binlog file path: path itself, or else a
+ * compressed copy of it if there is one.
+ */
+std::string existing_copy(const std::string &path)
+{
+  if (path.empty() || file_exists(path) || Compressed_file::is_compressed(path))
+    return path;
+  const char *suffixes[]= { GZIP_SUFFIX, ZSTD_SUFFIX };
+  for (std::size_t i= 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i)
+  {
+    if (file_exists(path + suffixes[i]))
+      return path + suffixes[i];
+  }
+  return path;
+}
+
+/**
+ * The position of the dot before the number path ends with, like the
+ * names of binlog files, or npos.
+ */
+std::string::size_type number_suffix(const std::string &path)
+{
+  std::string::size_type dot= path.rfind('.');
+  if (dot == std::string::npos || dot + 1 == path.size() ||
+      path.find_first_not_of("0123456789", dot + 1) != std::string::npos)
+    return std::string::npos;
+  return dot;
+}
+
+/**
+ * Orders binlog files by their base name and then by their number, which
+ * gets another digit after 999999. A plain copy of a file comes before
+ * its compressed ones.
+ */
+bool binlog_order(const std::string &left_path, const std::string &right_path)
+{
+  std::string left= Compressed_file::plain_name(left_path);
+  std::string right= Compressed_file::plain_name(right_path);
+  std::string::size_type left_dot= number_suffix(left);
+  std::string::size_type right_dot= number_suffix(right);
+  int base= left.compare(0, left_dot, right, 0, right_dot);
+  if (base != 0)
+    return base < 0;
+  if (left.size() - left_dot != right.size() - right_dot)
+    return left.size() - left_dot < right.size() - right_dot;
+  return left != right ? left < right : left_path < right_path;
+}
+
+/**
+ * The name MySQL gives the file after path, which ends with a number.
+ */
+std::string successor(const std::string &path)
+{
+  std::string::size_type dot= number_suffix(path);
+  if (dot == std::string::npos)
+    return std::string();
+  std::string next= path;
+  std::string::size_type digit= next.size();
+  while (digit > dot + 1 && next[digit - 1] == '9')
+    next[--digit]= '0';
+  if (digit == dot + 1)
+    return std::string();
+  ++next[digit - 1];
+  return next;
+}
+
+} // anonymous namespace
+
+
+int Binlog_sequence::open(const std::string &path, bool follow,
+                          std::string *first)
+{
+  m_index_path.clear();
+  m_files.clear();
+  m_rotate_file.clear();
+  m_follow= follow;
+  m_directory= directory_exists(path);
+
+  if (m_directory)
+  {
+    m_index_path= path[path.size() - 1] == '/' ? path : path + '/';
+    if (load() || m_files.empty())
+      return ERR_FAIL;
+    *first= m_files.front();
+    return ERR_OK;
+  }
+
+  std::size_t suffix_length= sizeof(index_suffix) - 1;
+  if (path.size() <= suffix_length ||
+      path.compare(path.size() - suffix_length, suffix_length, index_suffix))
+  {
+    *first= path;
+    return ERR_OK;
+  }
+
+  m_index_path= path;
+  if (load() || m_files.empty())
+    return ERR_FAIL;
+  *first= m_files.front();
+  return ERR_OK;
+}
+
+
+int Binlog_sequence::load()
+{
+  if (m_directory)
+    return list_directory();
+
+  std::ifstream index(m_index_path.c_str());
+  if (!index)
+    return ERR_FAIL;
+  m_files.clear();
+  std::string name;
+  while (std::getline(index, name))
+  {
+    if (!name.empty())
+      m_files.push_back(resolve(m_index_path, name));
+  }
+  return ERR_OK;
+}
+
+
+int Binlog_sequence::list_directory()
+{
+  DIR *directory= opendir(m_index_path.c_str());
+  if (directory == 0)
+    return ERR_FAIL;
+  std::vector<std::string> files;
+  struct dirent *entry;
+  while ((entry= readdir(directory)) != 0)
+  {
+    std::string path= m_index_path + entry->d_name;
+    if (number_suffix(Compressed_file::plain_name(path)) != std::string::npos &&
+        file_exists(path))
+      files.push_back(path);
+  }
+  closedir(directory);
+  std::sort(files.begin(), files.end(), binlog_order);
+
+  /* A file which is there both plain and compressed is read plain. */
+  m_files.clear();
+  for (std::size_t i= 0; i < files.size(); ++i)
+  {
+    if (m_files.empty() ||
+        Compressed_file::plain_name(m_files.back()) !=
+          Compressed_file::plain_name(files[i]))
+      m_files.push_back(files[i]);
+  }
+  return ERR_OK;
+}
+
+
+void Binlog_sequence::event_read(const Binary_log_event *event)
+{
+  if (event->get_event_type() == ROTATE_EVENT)
+    m_rotate_file= static_cast<const Rotate_event *>(event)->binlog_file;
+  else
+    m_rotate_file.clear();
+}
+
+
+std::string Binlog_sequence::next(const std::string &current)
+{
+  if (!m_index_path.empty())
+  {
+    std::vector<std::string>::iterator it=
+      std::find(m_files.begin(), m_files.end(), current);
+    if (it != m_files.end() && it + 1 == m_files.end() && load() == ERR_OK)
+      it= std::find(m_files.begin(), m_files.end(), current);
+    if (it == m_files.end() || it + 1 == m_files.end())
+      return std::string();
+    return *(it + 1);
+  }
+
+  if (!m_follow || m_rotate_file.empty())
+    return std::string();
+  std::string next= resolve(current, m_rotate_file);
+  return file_exists(next) ? next : std::string();
+}
+
+
+std::string Binlog_sequence::resolve(const std::string &current,
+                                     const std::string &name) const
+{
+  if (name.empty() || name[0] == '/')
+    return existing_copy(name);
+  /*
+    MySQL writes the names in the index file relative to the data
+    directory, where the index file is, and the names in Rotate events
+    without a directory.
+  */
+  std::string base= name.compare(0, 2, "./") == 0 ? name.substr(2) : name;
+  return existing_copy(directory_of(current) + base);
+}
+
+
+void Binlog_sequence::prefetch(const std::string &current)
+{
+  if (!enabled())
+    return;
+
+  std::string next;
+  if (!m_index_path.empty())
+  {
+    std::vector<std::string>::iterator it=
+      std::find(m_files.begin(), m_files.end(), current);
+    if (it != m_files.end() && it + 1 != m_files.end())
+      next= *(it + 1);
+  }
+  else
+    next= existing_copy(successor(Compressed_file::plain_name(current)));
+  if (next.empty())
+    return;
+
+  int fd= ::open(next.c_str(), O_RDONLY);
+  if (fd == -1)
+    return;
+  posix_fadvise(fd, 0, BINLOG_PREFETCH_SIZE, POSIX_FADV_WILLNEED);
+  close(fd);
+}
+
+}
+}
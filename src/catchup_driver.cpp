@@ -0,0 +1,228 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#include "catchup_driver.h"
+#include "binlog_api.h"
+
+namespace mysql { namespace system {
+
+namespace {
+
+/**
+ * The file name of path without its directory, which is how the master
+ * names its binlog files.
+ */
+std::string base_name(const std::string &path)
+{
+  std::string::size_type slash= path.rfind('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+} // anonymous namespace
+
+
+Binlog_catchup_driver::Binlog_catchup_driver(const std::string &local,
+                                             Binlog_tcp_driver *remote)
+  : Binary_log_driver(local, 0), m_local(new Binlog_file_driver(local, 0, true)),
+    m_remote(remote), m_live(false), m_skip_preamble(false), m_position(0)
+{
+}
+
+
+Binlog_catchup_driver::~Binlog_catchup_driver()
+{
+  delete m_local;
+  delete m_remote;
+}
+
+
+int Binlog_catchup_driver::connect()
+{
+  m_live= false;
+  m_skip_preamble= false;
+  if (m_local->connect())
+    return ERR_FAIL;
+  std::string file;
+  m_local->get_position(&file, &m_position);
+  m_file= base_name(file);
+  return ERR_OK;
+}
+
+
+int Binlog_catchup_driver::switch_to_remote()
+{
+  if (m_remote->set_position(m_file, m_position))
+    return ERR_FAIL;
+  m_live= true;
+  m_skip_preamble= true;
+  return ERR_OK;
+}
+
+
+void Binlog_catchup_driver::local_event_read(const Binary_log_event *event)
+{
+  /*
+    The file driver has not opened the next file yet, so its position
+    would still be in the file the Rotate event ends.
+  */
+  if (event->get_event_type() == ROTATE_EVENT)
+  {
+    const Rotate_event *rotate= static_cast<const Rotate_event *>(event);
+    m_file= base_name(rotate->binlog_file);
+    m_position= (unsigned long) rotate->binlog_pos;
+    return;
+  }
+  std::string file;
+  m_local->get_position(&file, &m_position);
+  m_file= base_name(file);
+}
+
+
+bool Binlog_catchup_driver::remote_event_read(Binary_log_event *event)
+{
+  if (m_skip_preamble && is_dump_preamble_event(event))
+    return false;
+  m_skip_preamble= false;
+
+  Log_event_header *header= event->header();
+  if (event->get_event_type() == ROTATE_EVENT)
+  {
+    const Rotate_event *rotate= static_cast<const Rotate_event *>(event);
+    m_file= rotate->binlog_file;
+    m_position= (unsigned long) rotate->binlog_pos;
+  }
+  else if (header->next_position != 0)
+    m_position= header->next_position;
+  return true;
+}
+
+
+int Binlog_catchup_driver::wait_for_next_event(mysql::Binary_log_event **event)
+{
+  if (!m_live)
+  {
+    if (m_local->wait_for_next_event(event) == ERR_OK)
+    {
+      local_event_read(*event);
+      return ERR_OK;
+    }
+    /* The copies end here, or with an incomplete event. */
+    if (switch_to_remote())
+      return ERR_FAIL;
+  }
+
+  int rc;
+  while ((rc= m_remote->wait_for_next_event(event)) == ERR_OK &&
+         !remote_event_read(*event))
+    delete *event;
+  return rc;
+}
+
+
+int Binlog_catchup_driver::wait_for_next_events(std::vector<mysql::Binary_log_event *> *events,
+                                                std::size_t max_events,
+                                                unsigned long timeout_ms)
+{
+  std::size_t first= events->size();
+  if (!m_live)
+  {
+    if (m_local->wait_for_next_events(events, max_events, timeout_ms) == ERR_OK &&
+        events->size() > first)
+    {
+      local_event_read(events->back());
+      return ERR_OK;
+    }
+    if (switch_to_remote())
+      return ERR_FAIL;
+  }
+
+  int rc;
+  bool dropped;
+  do
+  {
+    rc= m_remote->wait_for_next_events(events, max_events, timeout_ms);
+    dropped= false;
+    std::vector<mysql::Binary_log_event *>::iterator kept= events->begin() + first;
+    for (std::vector<mysql::Binary_log_event *>::iterator it= kept;
+         it != events->end(); ++it)
+    {
+      if (remote_event_read(*it))
+        *kept++= *it;
+      else
+      {
+        delete *it;
+        dropped= true;
+      }
+    }
+    events->erase(kept, events->end());
+  } while (rc == ERR_OK && dropped && events->size() == first);
+  return rc;
+}
+
+
+int Binlog_catchup_driver::set_position(const std::string &str,
+                                        unsigned long position)
+{
+  if (!m_live && m_local->set_position(str, position) == ERR_OK)
+  {
+    std::string file;
+    m_local->get_position(&file, &m_position);
+    m_file= base_name(file);
+    return ERR_OK;
+  }
+
+  if (!str.empty())
+    m_file= base_name(str);
+  m_position= position;
+  if (m_live)
+  {
+    if (m_remote->set_position(m_file, m_position))
+      return ERR_FAIL;
+    m_skip_preamble= true;
+    return ERR_OK;
+  }
+  return switch_to_remote();
+}
+
+
+int Binlog_catchup_driver::get_position(std::string *str,
+                                        unsigned long *position)
+{
+  if (str)
+    *str= m_file;
+  if (position)
+    *position= m_position;
+  return ERR_OK;
+}
+
+
+int Binlog_catchup_driver::set_position_by_time(boost::uint32_t when)
+{
+  int rc= m_local->set_position_by_time(when);
+  if (rc != ERR_OK)
+    return rc;
+  std::string file;
+  unsigned long position;
+  m_local->get_position(&file, &position);
+  return set_position(base_name(file), position);
+}
+
+}
+}
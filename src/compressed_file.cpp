@@ -0,0 +1,578 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#include "compressed_file.h"
+#include "binlog_api.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace mysql { namespace system {
+
+namespace {
+
+const std::size_t buffer_size= 128 * 1024;
+const std::size_t window_size= 32 * 1024;
+
+const char index_magic[]= { 'Z', 'I', 'D', 'X' };
+const std::size_t index_header_size= sizeof(index_magic) + 8;
+const std::size_t index_entry_size= 8 + 8 + 1 + 4;
+
+boost::uint64_t read_le(const boost::uint8_t *data, int length)
+{
+  boost::uint64_t value= 0;
+  for (int i= length - 1; i >= 0; --i)
+    value= (value << 8) | data[i];
+  return value;
+}
+
+void write_le(std::string *out, boost::uint64_t value, int length)
+{
+  for (int i= 0; i < length; ++i, value>>= 8)
+    out->push_back((char) (value & 0xff));
+}
+
+bool has_suffix(const std::string &path, const char *suffix)
+{
+  std::size_t length= strlen(suffix);
+  return path.size() > length &&
+         path.compare(path.size() - length, length, suffix) == 0;
+}
+
+/**
+ * Reads a file compressed with gzip, which may hold several members one
+ * after the other like the output of <code>cat a.gz b.gz</code>.
+ *
+ * A new member is inflated with the gzip header. From an access point the
+ * deflate data is inflated raw, and the trailer at the end of the member
+ * is skipped by hand.
+ */
+class Gzip_file : public Compressed_file
+{
+public:
+  Gzip_file(int fd, unsigned long span)
+    : Compressed_file(fd, span), m_raw(false), m_member_end(false),
+      m_trailer_left(0)
+  {
+    memset(&m_stream, 0, sizeof(m_stream));
+    m_good= inflateInit2(&m_stream, 15 + 32) == Z_OK;
+  }
+
+  ~Gzip_file()
+  {
+    if (m_good)
+      inflateEnd(&m_stream);
+  }
+
+  bool good() const { return m_good; }
+
+protected:
+  long decompress(boost::uint8_t *output, std::size_t size);
+  int restart(const Access_point *point);
+
+private:
+  z_stream m_stream;
+  bool m_good;
+
+  /*
+    Whether the member being read is inflated raw, from an access point.
+  */
+  bool m_raw;
+
+  /*
+    Whether the end of a member has been reached, and how much of the
+    trailer after a raw member is still to be skipped.
+  */
+  bool m_member_end;
+  std::size_t m_trailer_left;
+};
+
+
+long Gzip_file::decompress(boost::uint8_t *output, std::size_t size)
+{
+  std::size_t produced= 0;
+  while (produced < size)
+  {
+    if (m_input_begin == m_input_end && !fill_input())
+      return produced > 0 || m_member_end ? (long) produced : -1;
+
+    if (m_member_end)
+    {
+      /* Anything after the end of a member is the next member. */
+      if (m_trailer_left > 0)
+      {
+        std::size_t skip= std::min(m_trailer_left, m_input_end - m_input_begin);
+        m_input_begin+= skip;
+        m_trailer_left-= skip;
+        continue;
+      }
+      if (inflateReset2(&m_stream, 15 + 32) != Z_OK)
+        return -1;
+      m_member_end= false;
+    }
+
+    m_stream.next_in= &m_input[m_input_begin];
+    m_stream.avail_in= m_input_end - m_input_begin;
+    m_stream.next_out= output + produced;
+    m_stream.avail_out= size - produced;
+    /* Z_BLOCK stops at each block boundary, where a point can be noted. */
+    int rc= inflate(&m_stream, Z_BLOCK);
+    m_input_begin= m_input_end - m_stream.avail_in;
+    produced= size - m_stream.avail_out;
+
+    if (rc == Z_STREAM_END)
+    {
+      m_member_end= true;
+      m_trailer_left= m_raw ? 8 : 0;
+      m_raw= false;
+    }
+    else if (rc != Z_OK && rc != Z_BUF_ERROR)
+      return -1;
+    else if ((m_stream.data_type & 128) && !(m_stream.data_type & 64) &&
+             point_due(output_position() + produced))
+    {
+      Access_point point;
+      point.in= input_position();
+      point.out= output_position() + produced;
+      point.bits= m_stream.data_type & 7;
+      point.window.resize(window_size);
+      uInt length= window_size;
+      if (inflateGetDictionary(&m_stream, &point.window[0], &length) == Z_OK)
+      {
+        point.window.resize(length);
+        add_point(point);
+      }
+    }
+  }
+  return produced;
+}
+
+
+int Gzip_file::restart(const Access_point *point)
+{
+  m_member_end= false;
+  m_trailer_left= 0;
+  if (point == 0)
+  {
+    m_raw= false;
+    return seek_input(0) == ERR_OK &&
+           inflateReset2(&m_stream, 15 + 32) == Z_OK ? (int)ERR_OK :
+                                                       (int)ERR_FAIL;
+  }
+
+  /* A point in the middle of a byte starts with its last bits. */
+  m_raw= true;
+  if (seek_input(point->in - (point->bits ? 1 : 0)) != ERR_OK ||
+      inflateReset2(&m_stream, -15) != Z_OK)
+    return ERR_FAIL;
+  if (point->bits)
+  {
+    if (!fill_input())
+      return ERR_FAIL;
+    int byte= m_input[m_input_begin++];
+    if (inflatePrime(&m_stream, point->bits, byte >> (8 - point->bits)) != Z_OK)
+      return ERR_FAIL;
+  }
+  if (!point->window.empty() &&
+      inflateSetDictionary(&m_stream, &point->window[0],
+                           point->window.size()) != Z_OK)
+    return ERR_FAIL;
+  return ERR_OK;
+}
+
+#ifdef HAVE_ZSTD
+
+/**
+ * Reads a file compressed with zstd. Each frame can be decompressed on
+ * its own, so the access points are the starts of frames and need no
+ * window.
+ */
+class Zstd_file : public Compressed_file
+{
+public:
+  Zstd_file(int fd, unsigned long span)
+    : Compressed_file(fd, span), m_stream(ZSTD_createDStream()),
+      m_frame_start(true)
+  {
+    if (m_stream && ZSTD_isError(ZSTD_initDStream(m_stream)))
+    {
+      ZSTD_freeDStream(m_stream);
+      m_stream= 0;
+    }
+  }
+
+  ~Zstd_file()
+  {
+    if (m_stream)
+      ZSTD_freeDStream(m_stream);
+  }
+
+  bool good() const { return m_stream != 0; }
+
+protected:
+  long decompress(boost::uint8_t *output, std::size_t size);
+  int restart(const Access_point *point);
+
+private:
+  ZSTD_DStream *m_stream;
+
+  /*
+    Whether the next input byte starts a frame.
+  */
+  bool m_frame_start;
+};
+
+
+long Zstd_file::decompress(boost::uint8_t *output, std::size_t size)
+{
+  std::size_t produced= 0;
+  while (produced < size)
+  {
+    if (m_input_begin == m_input_end && !fill_input())
+      return produced > 0 || m_frame_start ? (long) produced : -1;
+
+    if (m_frame_start && point_due(output_position() + produced))
+    {
+      Access_point point;
+      point.in= input_position();
+      point.out= output_position() + produced;
+      point.bits= 0;
+      add_point(point);
+    }
+    m_frame_start= false;
+
+    ZSTD_inBuffer in= { &m_input[0], m_input_end, m_input_begin };
+    ZSTD_outBuffer out= { output, size, produced };
+    std::size_t rc= ZSTD_decompressStream(m_stream, &out, &in);
+    if (ZSTD_isError(rc))
+      return -1;
+    m_input_begin= in.pos;
+    produced= out.pos;
+    /* 0 means that a frame is complete and all of it is in the output. */
+    if (rc == 0)
+      m_frame_start= true;
+  }
+  return produced;
+}
+
+
+int Zstd_file::restart(const Access_point *point)
+{
+  m_frame_start= true;
+  if (seek_input(point ? point->in : 0) != ERR_OK ||
+      ZSTD_isError(ZSTD_initDStream(m_stream)))
+    return ERR_FAIL;
+  return ERR_OK;
+}
+
+#endif
+
+} // anonymous namespace
+
+
+Compressed_file::Compressed_file(int fd, unsigned long span)
+  : m_fd(fd), m_input(buffer_size), m_input_begin(0), m_input_end(0),
+    m_input_eof(false), m_input_offset(0), m_output(buffer_size),
+    m_output_begin(0), m_output_end(0), m_corrupt(false), m_position(0),
+    m_span(span)
+{
+}
+
+
+Compressed_file::~Compressed_file()
+{
+  close(m_fd);
+}
+
+
+bool Compressed_file::is_compressed(const std::string &path)
+{
+  return has_suffix(path, GZIP_SUFFIX) || has_suffix(path, ZSTD_SUFFIX);
+}
+
+
+std::string Compressed_file::plain_name(const std::string &path)
+{
+  if (has_suffix(path, GZIP_SUFFIX))
+    return path.substr(0, path.size() - (sizeof(GZIP_SUFFIX) - 1));
+  if (has_suffix(path, ZSTD_SUFFIX))
+    return path.substr(0, path.size() - (sizeof(ZSTD_SUFFIX) - 1));
+  return path;
+}
+
+
+Compressed_file *Compressed_file::open(const std::string &path,
+                                       unsigned long span)
+{
+  if (!is_compressed(path))
+    return 0;
+  int fd= ::open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    return 0;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  Compressed_file *file= 0;
+  if (has_suffix(path, GZIP_SUFFIX))
+  {
+    Gzip_file *gzip= new Gzip_file(fd, span);
+    if (gzip->good())
+      file= gzip;
+    else
+      delete gzip;
+  }
+#ifdef HAVE_ZSTD
+  else
+  {
+    Zstd_file *zstd= new Zstd_file(fd, span);
+    if (zstd->good())
+      file= zstd;
+    else
+      delete zstd;
+  }
+#else
+  else
+    close(fd);                      // Built without zstd.
+#endif
+
+  if (file)
+    file->load_index(path);
+  return file;
+}
+
+
+bool Compressed_file::fill_input()
+{
+  if (m_input_begin < m_input_end)
+    return true;
+  if (m_input_eof)
+    return false;
+  ssize_t length;
+  while ((length= ::read(m_fd, &m_input[0], m_input.size())) == -1 &&
+         errno == EINTR)
+    ;
+  if (length <= 0)
+  {
+    m_input_eof= true;
+    return false;
+  }
+  m_input_begin= 0;
+  m_input_end= length;
+  m_input_offset+= length;
+  return true;
+}
+
+
+int Compressed_file::seek_input(boost::uint64_t offset)
+{
+  if (lseek(m_fd, offset, SEEK_SET) == (off_t) -1)
+    return ERR_FAIL;
+  m_input_begin= m_input_end= 0;
+  m_input_eof= false;
+  m_input_offset= offset;
+  return ERR_OK;
+}
+
+
+bool Compressed_file::point_due(boost::uint64_t out) const
+{
+  boost::uint64_t last= m_points.empty() ? 0 : m_points.back().out;
+  return out >= last + m_span;
+}
+
+
+void Compressed_file::add_point(const Access_point &point)
+{
+  m_points.push_back(point);
+}
+
+
+bool Compressed_file::fill_output()
+{
+  if (m_output_begin < m_output_end)
+    return true;
+  if (m_corrupt)
+    return false;
+  long length= decompress(&m_output[0], m_output.size());
+  if (length < 0)
+    m_corrupt= true;
+  if (length <= 0)
+    return false;
+  m_output_begin= 0;
+  m_output_end= length;
+  return true;
+}
+
+
+long Compressed_file::read(void *buffer, std::size_t size)
+{
+  boost::uint8_t *out= static_cast<boost::uint8_t *>(buffer);
+  std::size_t copied= 0;
+  while (copied < size && fill_output())
+  {
+    std::size_t length= std::min(size - copied, m_output_end - m_output_begin);
+    memcpy(out + copied, &m_output[m_output_begin], length);
+    m_output_begin+= length;
+    m_position+= length;
+    copied+= length;
+  }
+  return copied < size && m_corrupt ? -1 : (long) copied;
+}
+
+
+bool Compressed_file::at_end()
+{
+  return !fill_output() && !m_corrupt;
+}
+
+
+int Compressed_file::seek(boost::uint64_t position)
+{
+  if (position >= m_position && position <= output_position())
+  {
+    m_output_begin+= position - m_position;
+    m_position= position;
+    return ERR_OK;
+  }
+
+  /*
+    Go on from the read position if no access point is closer to the
+    new one, or else start again at the last point before it.
+  */
+  const Access_point *point= 0;
+  for (std::size_t i= 0; i < m_points.size() && m_points[i].out <= position;
+       ++i)
+    point= &m_points[i];
+  if (m_corrupt || position < m_position || (point && point->out > m_position))
+  {
+    boost::uint64_t start= point ? point->out : 0;
+    m_output_begin= m_output_end= 0;
+    m_corrupt= false;
+    if (restart(point) != ERR_OK)
+    {
+      m_corrupt= true;
+      return ERR_FAIL;
+    }
+    m_position= start;
+  }
+
+  while (m_position < position)
+  {
+    if (!fill_output())
+      return ERR_FAIL;
+    std::size_t skip= std::min<boost::uint64_t>(m_output_end - m_output_begin,
+                                                 position - m_position);
+    m_output_begin+= skip;
+    m_position+= skip;
+  }
+  return ERR_OK;
+}
+
+
+void Compressed_file::load_index(const std::string &path)
+{
+  std::ifstream in((path + ACCESS_INDEX_SUFFIX).c_str(), std::ios::binary);
+  boost::uint8_t header[index_header_size];
+  struct stat stat_buff;
+  if (!in.read(reinterpret_cast<char *>(header), index_header_size) ||
+      memcmp(header, index_magic, sizeof(index_magic)) ||
+      fstat(m_fd, &stat_buff) == -1 ||
+      read_le(header + sizeof(index_magic), 8) !=
+        (boost::uint64_t) stat_buff.st_size)
+    return;                             // No index, or an outdated one.
+
+  std::vector<Access_point> points;
+  boost::uint8_t buffer[index_entry_size];
+  while (in.read(reinterpret_cast<char *>(buffer), index_entry_size))
+  {
+    Access_point point;
+    point.in= read_le(buffer, 8);
+    point.out= read_le(buffer + 8, 8);
+    point.bits= buffer[16];
+    std::size_t length= read_le(buffer + 17, 4);
+    if (length > window_size || point.bits > 7)
+      return;
+    point.window.resize(length);
+    if (length > 0 &&
+        !in.read(reinterpret_cast<char *>(&point.window[0]), length))
+      return;
+    points.push_back(point);
+  }
+  if (in.gcount() == 0)
+    m_points.swap(points);
+}
+
+
+int build_access_index(const std::string &path, unsigned long span)
+{
+  Compressed_file *file= Compressed_file::open(path, span);
+  if (file == 0)
+    return ERR_FAIL;
+
+  /* Note the points again rather than keep those of an old index. */
+  file->m_points.clear();
+  std::vector<boost::uint8_t> buffer(buffer_size);
+  long length;
+  while ((length= file->read(&buffer[0], buffer.size())) > 0)
+    ;
+  struct stat stat_buff;
+  if (length < 0 || fstat(file->m_fd, &stat_buff) == -1)
+  {
+    delete file;
+    return ERR_FAIL;
+  }
+
+  std::string index(index_magic, sizeof(index_magic));
+  write_le(&index, stat_buff.st_size, 8);
+  const std::vector<Access_point> &points= file->access_points();
+  for (std::size_t i= 0; i < points.size(); ++i)
+  {
+    write_le(&index, points[i].in, 8);
+    write_le(&index, points[i].out, 8);
+    write_le(&index, points[i].bits, 1);
+    write_le(&index, points[i].window.size(), 4);
+    index.append(points[i].window.begin(), points[i].window.end());
+  }
+  delete file;
+
+  /* Replace an old index only once the new one is complete. */
+  std::string index_path= path + ACCESS_INDEX_SUFFIX;
+  std::string temporary= index_path + ".tmp";
+  {
+    std::ofstream out(temporary.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(index.data(), index.size());
+    if (!out.flush())
+      return ERR_FAIL;
+  }
+  return rename(temporary.c_str(), index_path.c_str()) == 0 ? (int)ERR_OK :
+                                                             (int)ERR_FAIL;
+}
+
+}
+}
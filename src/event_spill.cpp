@@ -0,0 +1,192 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+#include "event_spill.h"
+#include <sstream>
+#include <stdio.h>
+#include <unistd.h>
+
+namespace mysql { namespace system {
+
+boost::atomic<unsigned long> Disk_spill::s_segment_count(0);
+
+Disk_spill::Disk_spill(const std::string &directory,
+                       boost::uint64_t max_bytes,
+                       boost::uint64_t segment_size)
+  : m_directory(directory), m_max_bytes(max_bytes),
+    m_segment_size(segment_size), m_read_offset(0), m_has_front(false),
+    m_depth(0), m_bytes(0), m_disk_bytes(0)
+{
+}
+
+Disk_spill::~Disk_spill()
+{
+  clear();
+}
+
+bool Disk_spill::write(const Byte_view &event)
+{
+  boost::uint64_t record_size= 4 + event.size();
+  if (m_max_bytes != 0 && m_disk_bytes + record_size > m_max_bytes)
+    return false;
+
+  if (m_segments.empty() || m_segments.back().size >= m_segment_size ||
+      !m_writer.is_open())
+  {
+    Segment segment;
+    std::ostringstream path;
+    path << m_directory << "/spill." << getpid() << "."
+         << s_segment_count.fetch_add(1);
+    segment.path= path.str();
+    segment.size= 0;
+
+    if (m_writer.is_open())
+      m_writer.close();
+    m_writer.clear();
+    m_writer.open(segment.path.c_str(),
+                  std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!m_writer)
+      return false;
+    m_segments.push_back(segment);
+  }
+
+  boost::uint8_t length[4];
+  length[0]= event.size() & 0xff;
+  length[1]= (event.size() >> 8) & 0xff;
+  length[2]= (event.size() >> 16) & 0xff;
+  length[3]= (event.size() >> 24) & 0xff;
+  /*
+    Each record is flushed so that a failure can only tear the record
+    being written, which is then cut off again.
+  */
+  m_writer.write(reinterpret_cast<const char *>(length), 4);
+  m_writer.write(reinterpret_cast<const char *>(event.data()), event.size());
+  m_writer.flush();
+  if (!m_writer)
+  {
+    truncate_segment();
+    return false;
+  }
+
+  m_segments.back().size+= record_size;
+  m_disk_bytes+= record_size;
+  ++m_depth;
+  m_bytes+= event.size();
+  return true;
+}
+
+bool Disk_spill::front(Byte_view *event)
+{
+  if (m_has_front)
+  {
+    *event= m_front;
+    return true;
+  }
+  if (m_depth == 0)
+    return false;
+
+  /*
+    The segment which was being written when its last event was popped
+    has been finished since.
+  */
+  if (m_read_offset == m_segments.front().size && m_segments.size() > 1)
+    remove_segment();
+
+  if (!m_reader.is_open())
+  {
+    m_reader.clear();
+    m_reader.open(m_segments.front().path.c_str(),
+                  std::ios::in | std::ios::binary);
+    m_read_offset= 0;
+  }
+
+  boost::uint8_t length[4];
+  m_reader.read(reinterpret_cast<char *>(length), 4);
+  std::size_t size= length[0] | (length[1] << 8) | (length[2] << 16) |
+                    ((std::size_t) length[3] << 24);
+  if (!m_reader)
+    return false;
+  boost::shared_ptr<boost::uint8_t> buffer= make_buffer(size);
+  m_reader.read(reinterpret_cast<char *>(buffer.get()), size);
+  if (!m_reader)
+    return false;
+
+  m_read_offset+= 4 + size;
+  m_front= Byte_view(buffer, buffer.get(), size);
+  m_has_front= true;
+  *event= m_front;
+  return true;
+}
+
+void Disk_spill::pop()
+{
+  if (!m_has_front && !front(&m_front))
+    return;
+
+  --m_depth;
+  m_bytes-= m_front.size();
+  m_front= Byte_view();
+  m_has_front= false;
+
+  if (m_depth == 0)
+  {
+    /* Start over with no files once everything has been read. */
+    clear();
+  }
+  else if (m_read_offset == m_segments.front().size && m_segments.size() > 1)
+    remove_segment();
+}
+
+void Disk_spill::clear()
+{
+  if (m_writer.is_open())
+    m_writer.close();
+  while (!m_segments.empty())
+    remove_segment();
+  m_front= Byte_view();
+  m_has_front= false;
+  m_depth= 0;
+  m_bytes= 0;
+}
+
+void Disk_spill::truncate_segment()
+{
+  Segment &segment= m_segments.back();
+  m_writer.close();
+  m_writer.clear();
+  /*
+    If the torn record can't be cut off the writer stays closed and the
+    next write starts a new segment; the reader stops at the segment size.
+  */
+  if (truncate(segment.path.c_str(), (off_t) segment.size) == 0)
+    m_writer.open(segment.path.c_str(),
+                  std::ios::out | std::ios::binary | std::ios::app);
+}
+
+void Disk_spill::remove_segment()
+{
+  if (m_reader.is_open())
+    m_reader.close();
+  m_read_offset= 0;
+  m_disk_bytes-= m_segments.front().size;
+  unlink(m_segments.front().path.c_str());
+  m_segments.pop_front();
+}
+
+} } // end namespace mysql::system
@@ -19,19 +19,79 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 */
 
 #include "file_driver.h"
+#include "time_index.h"
+
+#include <poll.h>
+#include <sys/inotify.h>
 
 namespace mysql { namespace system {
 
 using namespace std;
 
+  Binlog_file_driver::~Binlog_file_driver()
+  {
+    disconnect();
+  }
+
 
   int Binlog_file_driver::connect()
+  {
+    std::string first;
+    disconnect();
+    if (m_sequence.open(m_path, m_follow, &first))
+      return ERR_FAIL;
+    if (m_tail)
+    {
+      /* New files and a replaced index file show up in the directory. */
+      std::string::size_type slash= first.rfind('/');
+      std::string directory= slash == std::string::npos ? "." :
+                                                          first.substr(0, slash + 1);
+      m_inotify= inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+      if (m_inotify == -1 ||
+          inotify_add_watch(m_inotify, directory.c_str(),
+                            IN_CREATE | IN_MOVED_TO) == -1)
+        return ERR_FAIL;
+      if (!m_sequence.files().empty() &&
+          inotify_add_watch(m_inotify, m_path.c_str(), IN_MODIFY) == -1)
+        return ERR_FAIL;
+    }
+    return open_file(first);
+  }
+
+
+  int Binlog_file_driver::open_file(const std::string &name)
   {
     struct stat stat_buff;
 
-    char magic[]= {0xfe, 0x62, 0x69, 0x6e, 0};
+    char magic[]= {(char)0xfe, 0x62, 0x69, 0x6e, 0};
     char magic_buf[MAGIC_NUMBER_SIZE];
 
+    if (m_binlog_file.is_open())
+      m_binlog_file.close();
+    m_binlog_file.clear();
+    delete m_compressed;
+    m_compressed= 0;
+    m_file= name;
+    m_binlog_file_name= Compressed_file::plain_name(name);
+
+    /* Watch before the size is taken so no growth is missed. */
+    if (m_tail && watch_file())
+      return ERR_FAIL;
+
+    if (Compressed_file::is_compressed(name))
+    {
+      /* The end is found by reading up to it. */
+      m_binlog_file_size= (unsigned long) -1;
+      m_compressed= Compressed_file::open(name);
+      if (m_compressed == 0 ||
+          m_compressed->read(magic_buf, MAGIC_NUMBER_SIZE) != MAGIC_NUMBER_SIZE ||
+          memcmp(magic, magic_buf, MAGIC_NUMBER_SIZE))
+        return ERR_FAIL;
+      m_bytes_read= MAGIC_NUMBER_SIZE;
+      m_sequence.prefetch(m_file);
+      return ERR_OK;
+    }
+
     // Get the file size.
     if (stat(m_binlog_file_name.c_str(), &stat_buff) == -1)
       return ERR_FAIL;                          // Can't stat binlog file.
@@ -60,19 +120,95 @@ using namespace std;
     {
       return ERR_FAIL;
     }
+    m_sequence.prefetch(m_file);
     return ERR_OK;
   }
 
 
   int Binlog_file_driver::disconnect()
   {
-    m_binlog_file.close();
+    if (m_binlog_file.is_open())
+      m_binlog_file.close();
+    delete m_compressed;
+    m_compressed= 0;
+    if (m_inotify != -1)
+      close(m_inotify);
+    m_inotify= -1;
+    m_file_watch= -1;
     return ERR_OK;
   }
 
 
+  int Binlog_file_driver::watch_file()
+  {
+    if (m_file_watch != -1)
+      inotify_rm_watch(m_inotify, m_file_watch);
+    m_file_watch= inotify_add_watch(m_inotify, m_file.c_str(), IN_MODIFY);
+    return m_file_watch == -1 ? (int)ERR_FAIL : (int)ERR_OK;
+  }
+
+
+  bool Binlog_file_driver::refresh_size()
+  {
+    struct stat stat_buff;
+    if (stat(m_file.c_str(), &stat_buff) == -1 ||
+        (unsigned long) stat_buff.st_size <= m_binlog_file_size)
+      return false;
+    m_binlog_file_size= stat_buff.st_size;
+    return true;
+  }
+
+
+  int Binlog_file_driver::wait_for_change(const boost::system_time &deadline,
+                                          bool forever)
+  {
+    struct pollfd watch;
+    watch.fd= m_inotify;
+    watch.events= POLLIN;
+    int timeout= -1;
+    if (!forever)
+    {
+      boost::posix_time::time_duration left= deadline - boost::get_system_time();
+      timeout= left.is_negative() ? 0 : left.total_milliseconds();
+    }
+
+    int rc;
+    while ((rc= poll(&watch, 1, timeout)) == -1 && errno == EINTR)
+      ;
+    if (rc <= 0)
+      return rc;
+
+    /* Only the wake-up matters, so the events themselves are dropped. */
+    char buffer[4096];
+    while (read(m_inotify, buffer, sizeof(buffer)) > 0)
+      ;
+    return 1;
+  }
+
+
   int Binlog_file_driver::set_position(const string &str, unsigned long position)
   {
+    /* Only a sequence of files can move to another file. */
+    if (m_sequence.enabled() && !str.empty())
+    {
+      std::string name= m_sequence.resolve(m_file, str);
+      if (name != m_file && open_file(name))
+        return ERR_FAIL;
+    }
+
+    if (m_compressed)
+    {
+      if (m_compressed->seek(position))
+        return ERR_FAIL;
+      m_bytes_read= position;
+      return ERR_OK;
+    }
+
+    if (!m_binlog_file.is_open() ||
+        (position > m_binlog_file_size && (!refresh_size() ||
+                                           position > m_binlog_file_size)))
+      return ERR_FAIL;
+
     m_binlog_file.exceptions(ifstream::failbit | ifstream::badbit |
                            ifstream::eofbit);
     try
@@ -91,86 +227,192 @@ using namespace std;
 
   int Binlog_file_driver::get_position(string *str, unsigned long *position)
   {
-    m_binlog_file.exceptions(ifstream::failbit | ifstream::badbit |
-                             ifstream::eofbit);
-    try
-    {
-      if(position)
-        *position= m_binlog_file.tellg();
-    } catch(...)
-    {
-      return ERR_FAIL;
-    }
+    if(str)
+      *str= m_binlog_file_name;
+    if(position)
+      *position= m_bytes_read;
 
     return ERR_OK;
   }
 
 
+  int Binlog_file_driver::set_position_by_time(boost::uint32_t when)
+  {
+    std::vector<std::string> files(m_sequence.files());
+    if (files.empty())
+      files.push_back(m_file);
+
+    std::string file;
+    unsigned long position;
+    int rc= find_position_by_time(files, when, &file, &position);
+    if (rc != ERR_OK)
+      return rc;
+    return set_position(file, position);
+  }
+
+
   int Binlog_file_driver::wait_for_next_event(mysql::Binary_log_event **event)
   {
+    return read_event(event, WAIT_FOREVER);
+  }
+
+
+  int Binlog_file_driver::read_event(mysql::Binary_log_event **event,
+                                     unsigned long timeout_ms)
+  {
+    const unsigned long header_size= LOG_EVENT_HEADER_SIZE - 1;
+    bool forever= timeout_ms == WAIT_FOREVER;
+    boost::system_time deadline;
+    if (m_tail && !forever)
+      deadline= boost::get_system_time() +
+                boost::posix_time::milliseconds(timeout_ms);
 
-    assert(m_binlog_file.tellg() >= 4 );
     m_binlog_file.exceptions(ifstream::failbit | ifstream::badbit |
                              ifstream::eofbit);
 
+    for (;;)
+    {
+      if (m_bytes_read >= m_binlog_file_size ||
+          (m_compressed && m_compressed->at_end()))
+      {
+        std::string next= m_sequence.next(m_file);
+        struct stat stat_buff;
+        if (!next.empty() && m_tail &&
+            (stat(next.c_str(), &stat_buff) == -1 ||
+             stat_buff.st_size < MAGIC_NUMBER_SIZE))
+        {
+          /* The writer has only just created it. */
+          if (m_file_watch != -1)
+            inotify_rm_watch(m_inotify, m_file_watch);
+          m_file_watch= inotify_add_watch(m_inotify, next.c_str(), IN_MODIFY);
+        }
+        else if (!next.empty())
+        {
+          if (open_file(next))
+            return ERR_FAIL;
+          continue;
+        }
+        else if (!m_tail)
+          return ERR_EOF;
+      }
+      else if (m_binlog_file_size - m_bytes_read >= header_size)
+      {
+        int rc= read_complete_event(event);
+        if (rc != ERR_EOF)
+          return rc;
+      }
+      else if (!m_tail)
+        return ERR_FAIL;
+
+      /*
+        The event is not complete yet or there is none; in tail mode wait
+        for the writer.
+      */
+      if (refresh_size())
+        continue;
+      int changed= wait_for_change(deadline, forever);
+      if (changed < 0)
+        return ERR_FAIL;
+      if (changed == 0 && !refresh_size())
+      {
+        *event= 0;
+        return ERR_OK;
+      }
+    }
+  }
+
+
+  int Binlog_file_driver::read_complete_event(mysql::Binary_log_event **event)
+  {
     try
     {
-      if(m_bytes_read < m_binlog_file_size && m_binlog_file.good())
+      boost::uint8_t header_buf[LOG_EVENT_HEADER_SIZE - 1];
+      read_bytes(header_buf, sizeof(header_buf));
+      buffer_source header_src(header_buf, sizeof(header_buf));
+      proto_event_header(header_src, &m_event_log_header);
+
+      /*
+        An event which is shorter than its own header or which extends past
+        the end of the file means that the file is corrupt, unless the
+        writer is still appending to it in tail mode.
+      */
+      boost::uint32_t event_length= m_event_log_header.event_length;
+      if (event_length < sizeof(header_buf))
+        return ERR_FAIL;
+      if (event_length > m_binlog_file_size - m_bytes_read)
       {
-        //Protocol_chunk<boost::uint8_t> prot_marker(m_event_log_header.marker);
-        Protocol_chunk<boost::uint32_t> prot_timestamp(m_event_log_header.timestamp);
-        Protocol_chunk<boost::uint8_t> prot_type_code(m_event_log_header.type_code);
-        Protocol_chunk<boost::uint32_t> prot_server_id(m_event_log_header.server_id);
-        Protocol_chunk<boost::uint32_t>
-          prot_event_length(m_event_log_header.event_length);
-        Protocol_chunk<boost::uint32_t>
-          prot_next_position(m_event_log_header.next_position);
-        Protocol_chunk<boost::uint16_t> prot_flags(m_event_log_header.flags);
-
-        m_binlog_file >> prot_timestamp
-                      >> prot_type_code
-                      >> prot_server_id
-                      >> prot_event_length
-                      >> prot_next_position
-                      >> prot_flags;
-
-        /*
-        m_binlog_file.read(reinterpret_cast<char*>(&m_event_log_header.timestamp),
-                           sizeof(boost::uint32_t));
-        m_binlog_file.read(reinterpret_cast<char*>(&m_event_log_header.type_code),
-                           sizeof(boost::uint8_t));
-        m_binlog_file.read(reinterpret_cast<char*>(&m_event_log_header.server_id),
-                           sizeof(boost::uint32_t));
-        m_binlog_file.read(reinterpret_cast<char*>(&m_event_log_header.event_length),
-                           sizeof(boost::uint32_t));
-        m_binlog_file.read(reinterpret_cast<char*>(&m_event_log_header.next_position),
-                           sizeof(boost::uint32_t));
-        m_binlog_file.read(reinterpret_cast<char*>(&m_event_log_header.flags),
-                           sizeof(boost::uint16_t));
-                           */
-
-        *event= parse_event(* static_cast<std::istream*> (&m_binlog_file),
-                            &m_event_log_header);
-
-        /*
-          Correction. Except for the default case (above), this condition should
-          always fail.
-        */
-        if (m_bytes_read + m_event_log_header.event_length !=
-            m_binlog_file.tellg())
-          m_binlog_file.seekg(m_bytes_read + m_event_log_header.event_length,
-                              ios::beg);
-
-        m_bytes_read= m_binlog_file.tellg();
-
-        if(*event)
-          return ERR_OK;
+        if (!m_tail)
+          return ERR_FAIL;
+        m_binlog_file.seekg(m_bytes_read, ios::beg);
+        return ERR_EOF;
+      }
+
+      std::size_t body_length= event_length - sizeof(header_buf);
+      switch (m_event_log_header.type_code)
+      {
+      case TABLE_MAP_EVENT:
+      case WRITE_ROWS_EVENT:
+      case UPDATE_ROWS_EVENT:
+      case DELETE_ROWS_EVENT:
+        {
+          /*
+            The body is read into a buffer of its own which the decoded
+            event refers to, so row images are not copied a second time.
+          */
+          boost::shared_ptr<boost::uint8_t> body= make_buffer(body_length);
+          if (body_length > 0)
+            read_bytes(body.get(), body_length);
+          *event= parse_event(body, body.get(), body_length,
+                              &m_event_log_header);
+        }
+        break;
+      default:
+        if (m_event_buffer.size() < body_length)
+          m_event_buffer.resize(body_length);
+        if (body_length > 0)
+          read_bytes(&m_event_buffer[0], body_length);
+        *event= parse_event(body_length > 0 ? &m_event_buffer[0] : 0,
+                            body_length, &m_event_log_header);
+      }
+      m_bytes_read+= event_length;
+
+      if(*event)
+      {
+        m_sequence.event_read(*event);
+        return ERR_OK;
       }
     } catch(...)
     {
       return ERR_FAIL;
     }
-    return ERR_EOF;
+    return ERR_FAIL;
+  }
+
+  void Binlog_file_driver::read_bytes(void *buffer, std::size_t size)
+  {
+    if (m_compressed == 0)
+      m_binlog_file.read(static_cast<char *>(buffer), size);
+    else if (m_compressed->read(buffer, size) != (long) size)
+      throw ios_base::failure("Compressed binlog file is truncated");
+  }
+
+  int Binlog_file_driver::wait_for_next_events(std::vector<mysql::Binary_log_event *> *events,
+                                               std::size_t max_events,
+                                               unsigned long timeout_ms)
+  {
+    mysql::Binary_log_event *event;
+    std::size_t count= 0;
+    int rc= ERR_OK;
+    /* Only wait for the first event. */
+    while (count < max_events &&
+           (rc= read_event(&event, count > 0 ? 0 : timeout_ms)) == ERR_OK &&
+           event != 0)
+    {
+      events->push_back(event);
+      ++count;
+    }
+    /* An error is reported by the next call when events were read. */
+    return count > 0 ? (int)ERR_OK : rc;
   }
 
 }
@@ -0,0 +1,244 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#include "mmap_driver.h"
+#include "time_index.h"
+#include "file_driver.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mysql { namespace system {
+
+namespace {
+
+/**
+ * Unmaps a mapping when the last reference to it goes away.
+ */
+class Unmapper
+{
+public:
+  Unmapper(std::size_t size) : m_size(size) {}
+
+  void operator()(const void *data) const
+  {
+    munmap(const_cast<void *>(data), m_size);
+  }
+
+private:
+  std::size_t m_size;
+};
+
+long page_size()
+{
+  static long size= sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+} // anonymous namespace
+
+
+  Binlog_mmap_driver::~Binlog_mmap_driver()
+  {
+    disconnect();
+  }
+
+
+  int Binlog_mmap_driver::connect()
+  {
+    std::string first;
+    if (m_sequence.open(m_path, m_follow, &first))
+      return ERR_FAIL;
+    return open_file(first);
+  }
+
+
+  int Binlog_mmap_driver::open_file(const std::string &name)
+  {
+    static const boost::uint8_t magic[]= { 0xfe, 0x62, 0x69, 0x6e };
+
+    disconnect();
+    m_file= name;
+    m_binlog_file_name= name;
+
+    int fd= open(m_binlog_file_name.c_str(), O_RDONLY);
+    if (fd == -1)
+      return ERR_FAIL;                          // Can't open binlog file.
+
+    struct stat stat_buff;
+    if (fstat(fd, &stat_buff) == -1 || stat_buff.st_size < MAGIC_NUMBER_SIZE)
+    {
+      close(fd);
+      return ERR_FAIL;
+    }
+
+    void *data= mmap(0, stat_buff.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    /* The mapping stays valid after the descriptor is closed. */
+    close(fd);
+    if (data == MAP_FAILED)
+      return ERR_FAIL;
+    madvise(data, stat_buff.st_size, MADV_SEQUENTIAL);
+
+    m_mapping.reset(data, Unmapper(stat_buff.st_size));
+    m_data= static_cast<const boost::uint8_t *>(data);
+    m_size= stat_buff.st_size;
+
+    // Check if a valid MySQL binlog file is provided, BINLOG_MAGIC.
+    if (memcmp(magic, m_data, MAGIC_NUMBER_SIZE))
+    {
+      disconnect();
+      return ERR_FAIL;                          // Not a valid binlog file.
+    }
+
+    m_bytes_read= MAGIC_NUMBER_SIZE;
+    m_released= 0;
+    m_sequence.prefetch(m_file);
+    return ERR_OK;
+  }
+
+
+  int Binlog_mmap_driver::disconnect()
+  {
+    m_mapping.reset();
+    m_data= 0;
+    m_size= 0;
+    return ERR_OK;
+  }
+
+
+  int Binlog_mmap_driver::set_position(const std::string &str,
+                                       unsigned long position)
+  {
+    /* Only a sequence of files can move to another file. */
+    if (m_sequence.enabled() && !str.empty())
+    {
+      std::string name= m_sequence.resolve(m_file, str);
+      if (name != m_file && open_file(name))
+        return ERR_FAIL;
+    }
+
+    if (m_data == 0 || position > m_size)
+      return ERR_FAIL;
+
+    m_bytes_read= position;
+    if (m_released > position)
+      m_released= position - position % page_size();
+
+    return ERR_OK;
+  }
+
+
+  int Binlog_mmap_driver::get_position(std::string *str,
+                                       unsigned long *position)
+  {
+    if(str)
+      *str= m_binlog_file_name;
+    if(position)
+      *position= m_bytes_read;
+
+    return ERR_OK;
+  }
+
+
+  int Binlog_mmap_driver::set_position_by_time(boost::uint32_t when)
+  {
+    std::vector<std::string> files(m_sequence.files());
+    if (files.empty())
+      files.push_back(m_file);
+
+    std::string file;
+    unsigned long position;
+    int rc= find_position_by_time(files, when, &file, &position);
+    if (rc != ERR_OK)
+      return rc;
+    return set_position(file, position);
+  }
+
+
+  void Binlog_mmap_driver::release_pages()
+  {
+    if (m_bytes_read - m_released < MMAP_RELEASE_SIZE)
+      return;
+    unsigned long end= m_bytes_read - m_bytes_read % page_size();
+    madvise(const_cast<boost::uint8_t *>(m_data) + m_released,
+            end - m_released, MADV_DONTNEED);
+    m_released= end;
+  }
+
+
+  int Binlog_mmap_driver::wait_for_next_event(mysql::Binary_log_event **event)
+  {
+    if (m_data == 0)
+      return ERR_FAIL;
+    while (m_bytes_read >= m_size)
+    {
+      std::string next= m_sequence.next(m_file);
+      if (next.empty())
+        return ERR_EOF;
+      if (open_file(next))
+        return ERR_FAIL;
+    }
+
+    const std::size_t header_size= LOG_EVENT_HEADER_SIZE - 1;
+    if (m_size - m_bytes_read < header_size)
+      return ERR_FAIL;
+    buffer_source header_src(m_data + m_bytes_read, header_size);
+    proto_event_header(header_src, &m_event_log_header);
+
+    /*
+      An event which is shorter than its own header or which extends past
+      the end of the file means that the file is corrupt.
+    */
+    boost::uint32_t event_length= m_event_log_header.event_length;
+    if (event_length < header_size ||
+        event_length > m_size - m_bytes_read)
+      return ERR_FAIL;
+
+    *event= parse_event(m_mapping, m_data + m_bytes_read + header_size,
+                        event_length - header_size, &m_event_log_header);
+    m_bytes_read+= event_length;
+    release_pages();
+
+    if (*event == 0)
+      return ERR_EOF;
+    m_sequence.event_read(*event);
+    return ERR_OK;
+  }
+
+  int Binlog_mmap_driver::wait_for_next_events(std::vector<mysql::Binary_log_event *> *events,
+                                               std::size_t max_events,
+                                               unsigned long)
+  {
+    mysql::Binary_log_event *event;
+    std::size_t count= 0;
+    int rc= ERR_OK;
+    while (count < max_events && (rc= wait_for_next_event(&event)) == ERR_OK)
+    {
+      events->push_back(event);
+      ++count;
+    }
+    /* An error is reported by the next call when events were read. */
+    return count > 0 ? (int)ERR_OK : rc;
+  }
+
+}
+}
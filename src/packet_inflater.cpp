@@ -0,0 +1,135 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+#include "packet_inflater.h"
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+namespace mysql { namespace system {
+
+static std::size_t uint3korr(const boost::uint8_t *p)
+{
+  return (std::size_t) p[0] | ((std::size_t) p[1] << 8) |
+         ((std::size_t) p[2] << 16);
+}
+
+Packet_inflater::Packet_inflater()
+  : m_stream(new z_stream), m_header_used(0), m_in_packet(false),
+    m_stored(false), m_input_left(0), m_output_left(0)
+{
+  memset(m_stream, 0, sizeof(z_stream));
+  inflateInit(m_stream);
+}
+
+Packet_inflater::~Packet_inflater()
+{
+  inflateEnd(m_stream);
+  delete m_stream;
+}
+
+void Packet_inflater::reset()
+{
+  m_header_used= 0;
+  m_in_packet= false;
+}
+
+bool Packet_inflater::inflate(const boost::uint8_t **input,
+                              const boost::uint8_t *input_end,
+                              boost::uint8_t *output, std::size_t output_size,
+                              std::size_t *produced)
+{
+  *produced= 0;
+  while (true)
+  {
+    if (!m_in_packet)
+    {
+      while (m_header_used < COMPRESSED_HEADER_SIZE && *input < input_end)
+        m_header[m_header_used++]= *(*input)++;
+      if (m_header_used < COMPRESSED_HEADER_SIZE)
+        return true;
+
+      m_header_used= 0;
+      m_in_packet= true;
+      m_input_left= uint3korr(m_header);
+      m_output_left= uint3korr(m_header + 4);
+      m_stored= m_output_left == 0;
+      if (m_stored)
+        m_output_left= m_input_left;
+      else if (inflateReset(m_stream) != Z_OK)
+        return false;
+    }
+
+    if (m_output_left == 0 && m_input_left == 0)
+    {
+      m_in_packet= false;
+      continue;
+    }
+    if (*produced == output_size)
+      return true;
+
+    std::size_t available= std::min(m_input_left,
+                                    (std::size_t) (input_end - *input));
+    if (m_stored)
+    {
+      std::size_t length= std::min(available, output_size - *produced);
+      if (length == 0)
+        return true;
+      memcpy(output + *produced, *input, length);
+      *input+= length;
+      *produced+= length;
+      m_input_left-= length;
+      m_output_left-= length;
+      continue;
+    }
+
+    std::size_t room= std::min(m_output_left, output_size - *produced);
+    m_stream->next_in= const_cast<Bytef *>(*input);
+    m_stream->avail_in= available;
+    m_stream->next_out= output + *produced;
+    m_stream->avail_out= room;
+    int ret= ::inflate(m_stream, Z_NO_FLUSH);
+    std::size_t consumed= available - m_stream->avail_in;
+    std::size_t inflated= room - m_stream->avail_out;
+    *input+= consumed;
+    *produced+= inflated;
+    m_input_left-= consumed;
+    m_output_left-= inflated;
+
+    if (ret == Z_STREAM_END)
+    {
+      /* The packet must end with its compressed data, at its length. */
+      if (m_input_left != 0 || m_output_left != 0)
+        return false;
+      continue;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR)
+      return false;
+    if (consumed == 0 && inflated == 0)
+    {
+      /*
+        Unless the rest of the packet has yet to arrive, it holds more or
+        less data than its header says.
+      */
+      return available == 0 && m_input_left > 0;
+    }
+  }
+}
+
+} } // end namespace mysql::system
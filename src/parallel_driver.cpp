@@ -0,0 +1,303 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#include "parallel_driver.h"
+#include "time_index.h"
+#include "file_driver.h"
+#include "mmap_driver.h"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+
+namespace mysql { namespace system {
+
+Binlog_parallel_driver::~Binlog_parallel_driver()
+{
+  stop();
+}
+
+
+int Binlog_parallel_driver::connect()
+{
+  std::string first;
+  stop();
+  if (m_sequence.open(m_path, false, &first) || m_sequence.files().empty())
+    return ERR_FAIL;                            // Only an index is scanned.
+  start(0, MAGIC_NUMBER_SIZE);
+  return ERR_OK;
+}
+
+
+int Binlog_parallel_driver::disconnect()
+{
+  stop();
+  return ERR_OK;
+}
+
+
+void Binlog_parallel_driver::start(std::size_t file, unsigned long position)
+{
+  const std::vector<std::string> &files= m_sequence.files();
+  m_current= file;
+  m_position= position;
+  m_error= ERR_OK;
+  m_binlog_file_name= Compressed_file::plain_name(files[file]);
+
+  m_queues.assign(files.size(), 0);
+  m_next_file= file;
+  m_first_file= file;
+  m_first_position= position;
+  m_stop= false;
+  for (unsigned int i= 0; i < m_threads; ++i)
+    m_pool.push_back(new boost::thread(boost::bind(&Binlog_parallel_driver::scan,
+                                                   this)));
+}
+
+
+void Binlog_parallel_driver::stop()
+{
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_stop= true;
+    m_changed.notify_all();
+  }
+  for (std::size_t i= 0; i < m_pool.size(); ++i)
+  {
+    /* The scanner may wait for room in its queue. */
+    while (!m_pool[i]->timed_join(boost::posix_time::milliseconds(10)))
+      drain();
+    delete m_pool[i];
+  }
+  m_pool.clear();
+
+  drain();
+  for (std::size_t i= 0; i < m_queues.size(); ++i)
+    delete m_queues[i];
+  m_queues.clear();
+}
+
+
+void Binlog_parallel_driver::drain()
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  for (std::size_t i= 0; i < m_queues.size(); ++i)
+  {
+    /* Unlike try_pop(), this wakes up a scanner waiting for room. */
+    while (m_queues[i] &&
+           m_queues[i]->pop_back_n(&m_batch, PARALLEL_QUEUE_SIZE, 0) > 0)
+    {
+      for (std::size_t j= 0; j < m_batch.size(); ++j)
+        delete m_batch[j].event;
+      m_batch.clear();
+    }
+  }
+}
+
+
+void Binlog_parallel_driver::scan()
+{
+  const std::vector<std::string> &files= m_sequence.files();
+  for (;;)
+  {
+    std::size_t file;
+    unsigned long position;
+    Scan_queue *queue;
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      while (!m_stop && m_next_file < files.size() &&
+             m_next_file >= m_current + 2 * m_threads)
+        m_changed.wait(lock);
+      if (m_stop || m_next_file == files.size())
+        return;
+      file= m_next_file++;
+      position= file == m_first_file ? m_first_position : MAGIC_NUMBER_SIZE;
+      queue= new Scan_queue(PARALLEL_QUEUE_SIZE);
+      m_queues[file]= queue;
+      m_changed.notify_all();
+    }
+
+    /* A compressed file can't be mapped, so it is always read. */
+    if (m_mmap && !Compressed_file::is_compressed(files[file]))
+    {
+      Binlog_mmap_driver driver(files[file]);
+      scan_file(&driver, files[file], position, queue);
+    }
+    else
+    {
+      Binlog_file_driver driver(files[file]);
+      scan_file(&driver, files[file], position, queue);
+    }
+  }
+}
+
+
+void Binlog_parallel_driver::scan_file(Binary_log_driver *driver,
+                                       const std::string &name,
+                                       unsigned long position,
+                                       Scan_queue *queue)
+{
+  Scanned_event entry;
+  entry.event= 0;
+  entry.position= position;
+  entry.result= driver->connect();
+  if (entry.result == ERR_OK && position != MAGIC_NUMBER_SIZE)
+    entry.result= driver->set_position(name, position);
+  while (entry.result == ERR_OK && !m_stop &&
+         (entry.result= driver->wait_for_next_event(&entry.event)) == ERR_OK)
+  {
+    driver->get_position(0, &entry.position);
+    queue->push_front(entry);
+  }
+  entry.event= 0;
+  queue->push_front(entry);
+}
+
+
+Binlog_parallel_driver::Scan_queue *Binlog_parallel_driver::current_queue()
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  while (m_queues[m_current] == 0)
+    m_changed.wait(lock);
+  return m_queues[m_current];
+}
+
+
+bool Binlog_parallel_driver::next_file(const Scanned_event &last)
+{
+  if (last.result != ERR_EOF)
+  {
+    m_error= last.result == ERR_OK ? (int)ERR_FAIL : last.result;
+    return false;
+  }
+
+  const std::vector<std::string> &files= m_sequence.files();
+  boost::mutex::scoped_lock lock(m_mutex);
+  delete m_queues[m_current];
+  m_queues[m_current]= 0;
+  ++m_current;
+  if (m_current < files.size())
+  {
+    m_binlog_file_name= Compressed_file::plain_name(files[m_current]);
+    m_position= MAGIC_NUMBER_SIZE;
+  }
+  m_changed.notify_all();
+  return true;
+}
+
+
+int Binlog_parallel_driver::wait_for_next_event(mysql::Binary_log_event **event)
+{
+  if (m_pool.empty())
+    return ERR_FAIL;                            // Not connected.
+
+  while (m_error == ERR_OK && m_current < m_sequence.files().size())
+  {
+    Scanned_event entry;
+    current_queue()->pop_back(&entry);
+    if (entry.event)
+    {
+      m_position= entry.position;
+      *event= entry.event;
+      return ERR_OK;
+    }
+    next_file(entry);
+  }
+  return m_error == ERR_OK ? (int)ERR_EOF : m_error;
+}
+
+
+int Binlog_parallel_driver::wait_for_next_events(std::vector<mysql::Binary_log_event *> *events,
+                                                 std::size_t max_events,
+                                                 unsigned long timeout_ms)
+{
+  if (m_pool.empty())
+    return ERR_FAIL;                            // Not connected.
+
+  std::size_t count= 0;
+  while (count < max_events && m_error == ERR_OK &&
+         m_current < m_sequence.files().size())
+  {
+    /* Only wait for the first event. */
+    m_batch.clear();
+    if (current_queue()->pop_back_n(&m_batch, max_events - count,
+                                    count > 0 ? 0 : timeout_ms) == 0)
+      break;
+    for (std::size_t i= 0; i < m_batch.size(); ++i)
+    {
+      if (m_batch[i].event)
+      {
+        events->push_back(m_batch[i].event);
+        m_position= m_batch[i].position;
+        ++count;
+      }
+      else
+        next_file(m_batch[i]);
+    }
+  }
+
+  /* An error is reported by the next call when events were taken. */
+  if (count > 0 || (m_error == ERR_OK && m_current < m_sequence.files().size()))
+    return ERR_OK;
+  return m_error == ERR_OK ? (int)ERR_EOF : m_error;
+}
+
+
+int Binlog_parallel_driver::set_position(const std::string &str,
+                                         unsigned long position)
+{
+  const std::vector<std::string> &files= m_sequence.files();
+  std::string name= Compressed_file::plain_name(str.empty() ?
+                                               m_binlog_file_name :
+                                               m_sequence.resolve(m_path, str));
+  std::size_t file= 0;
+  while (file < files.size() && Compressed_file::plain_name(files[file]) != name)
+    ++file;
+  if (file == files.size() || position < MAGIC_NUMBER_SIZE)
+    return ERR_FAIL;
+
+  stop();
+  start(file, position);
+  return ERR_OK;
+}
+
+
+int Binlog_parallel_driver::get_position(std::string *str,
+                                         unsigned long *position)
+{
+  if (str)
+    *str= m_binlog_file_name;
+  if (position)
+    *position= m_position;
+  return ERR_OK;
+}
+
+
+int Binlog_parallel_driver::set_position_by_time(boost::uint32_t when)
+{
+  std::string file;
+  unsigned long position;
+  int rc= find_position_by_time(m_sequence.files(), when, &file, &position);
+  if (rc != ERR_OK)
+    return rc;
+  return set_position(file, position);
+}
+
+}
+}
@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 
 #include "protocol.h"
 #include <iostream>
+#include <zlib.h>
 using namespace mysql;
 using namespace mysql::system;
 
@@ -46,7 +47,42 @@ int proto_read_package_header(tcp::socket *socket, unsigned long *packet_length,
   return 0;
 }
 
-int proto_read_package_header(tcp::socket *socket, boost::asio::streambuf &buff, unsigned long *packet_length, unsigned char *packet_no)
+/**
+  Read at least length more bytes of the packet stream into buff.
+  Compressed packets are inflated if there is an inflater.
+*/
+static void proto_read_stream(tcp::socket *socket, boost::asio::streambuf &buff,
+                              std::size_t length, Packet_inflater *inflater)
+{
+  if (inflater == 0)
+  {
+    boost::asio::read(*socket, buff, boost::asio::transfer_at_least(length));
+    return;
+  }
+
+  boost::uint8_t input[4096];
+  std::size_t inflated= 0;
+  while (inflated < length)
+  {
+    std::size_t input_length= socket->read_some(boost::asio::buffer(input));
+    const boost::uint8_t *next= input;
+    while (next < input + input_length)
+    {
+      boost::asio::streambuf::mutable_buffers_type output=
+        buff.prepare(sizeof(input));
+      std::size_t produced;
+      if (!inflater->inflate(&next, input + input_length,
+                             boost::asio::buffer_cast<boost::uint8_t *>(output),
+                             boost::asio::buffer_size(output), &produced))
+        throw boost::system::system_error(boost::asio::error::invalid_argument);
+      buff.commit(produced);
+      inflated+= produced;
+    }
+  }
+}
+
+int proto_read_package_header(tcp::socket *socket, boost::asio::streambuf &buff, unsigned long *packet_length, unsigned char *packet_no,
+                              Packet_inflater *inflater)
 {
   std::streamsize inbuff= buff.in_avail();
   if( inbuff < 0)
@@ -55,8 +91,7 @@ int proto_read_package_header(tcp::socket *socket, boost::asio::streambuf &buff,
   if (4 > inbuff)
   {
     try {
-      boost::asio::read(*socket, buff,
-                        boost::asio::transfer_at_least(4-inbuff));
+      proto_read_stream(socket, buff, 4 - inbuff, inflater);
     } catch (boost::system::system_error e)
     {
       return 1;
@@ -77,21 +112,64 @@ int proto_read_package_header(tcp::socket *socket, boost::asio::streambuf &buff,
 
 
 int proto_get_one_package(tcp::socket *socket, boost::asio::streambuf &buff,
-                          boost::uint8_t *packet_no)
+                          boost::uint8_t *packet_no, Packet_inflater *inflater)
 {
   unsigned long packet_length;
-  if (proto_read_package_header(socket, buff, &packet_length, packet_no))
+  if (proto_read_package_header(socket, buff, &packet_length, packet_no,
+                                inflater))
     return 0;
   std::streamsize inbuffer= buff.in_avail();
   if (inbuffer < 0)
     inbuffer= 0;
   if (packet_length > inbuffer)
-    boost::asio::read(*socket, buff,
-                      boost::asio::transfer_at_least(packet_length-inbuffer));
+    proto_read_stream(socket, buff, packet_length - inbuffer, inflater);
 
   return packet_length;
 }
 
+void proto_write_packet(tcp::socket *socket, boost::asio::streambuf &buff,
+                        boost::uint8_t packet_no, bool compressed)
+{
+  std::size_t size= buff.size();
+  char packet_header[4];
+  write_packet_header(packet_header, size, packet_no);
+
+  if (!compressed)
+  {
+    boost::asio::write(*socket, boost::asio::buffer(packet_header, 4),
+                       boost::asio::transfer_at_least(4));
+    boost::asio::write(*socket, buff, boost::asio::transfer_at_least(size));
+    return;
+  }
+
+  /*
+    The packet is the payload of a compressed packet, which is only
+    compressed if that makes sense for its size.
+  */
+  std::vector<boost::uint8_t> payload(4 + size);
+  memcpy(&payload[0], packet_header, 4);
+  buff.sgetn((char *) &payload[4], size);
+  std::vector<boost::uint8_t> packet(COMPRESSED_HEADER_SIZE +
+                                     compressBound(payload.size()));
+  uLongf compressed_length= packet.size() - COMPRESSED_HEADER_SIZE;
+  std::size_t uncompressed_length= payload.size();
+  if (payload.size() < MIN_COMPRESS_LENGTH ||
+      compress(&packet[COMPRESSED_HEADER_SIZE], &compressed_length,
+               &payload[0], payload.size()) != Z_OK ||
+      compressed_length >= payload.size())
+  {
+    memcpy(&packet[COMPRESSED_HEADER_SIZE], &payload[0], payload.size());
+    compressed_length= payload.size();
+    uncompressed_length= 0;
+  }
+  int3store(&packet[0], compressed_length);
+  packet[3]= 0;
+  int3store(&packet[4], uncompressed_length);
+  boost::asio::write(*socket,
+                     boost::asio::buffer(&packet[0], COMPRESSED_HEADER_SIZE +
+                                                     compressed_length));
+}
+
 void prot_parse_error_message(std::istream &is, struct st_error_package &err,
                               int packet_length)
 {
@@ -202,16 +280,107 @@ void write_packet_header(char *buff, boost::uint16_t size, boost::uint8_t packet
 
 buffer_source &operator>>(buffer_source &src, Protocol &chunk)
 {
-  char ch;
-  int ct= 0;
   char *ptr= (char*)chunk.data();
 
-  while(ct < chunk.size() && src.m_ptr < src.m_size)
+  if (chunk.is_length_encoded_binary())
   {
-    ptr[ct]= src.m_src[src.m_ptr];
-    ++ct;
-    ++src.m_ptr;
+    unsigned char byte;
+    if (!src.read(&byte, 1))
+      return src;
+    if (byte < 251)
+    {
+      *ptr= byte;
+      chunk.collapse_size(1);
+      return src;
+    }
+    else if (byte == 251)
+    {
+      // is this a row data packet? if so, then this column value is NULL
+      *ptr= byte;
+      chunk.collapse_size(1);
+      return src;
+    }
+    else if (byte == 252)
+      chunk.collapse_size(2);
+    else if (byte == 253)
+      chunk.collapse_size(3);
+
+    /*
+      Unlike the stream extraction the marker byte is not kept in the
+      storage, so the chunk holds the decoded integer.
+    */
+    src.read(ptr, chunk.size());
+    return src;
   }
+
+  /*
+    Fixed size chunks never pass the end of the buffer; a short read
+    copies what is left, like the stream extraction does.
+  */
+  std::size_t length= chunk.size();
+  if (length > src.remaining())
+  {
+    src.read(ptr, src.remaining());
+    src.m_fail= true;
+    return src;
+  }
+  src.read(ptr, length);
+  return src;
+}
+
+buffer_source &operator>>(buffer_source &src, std::string &str)
+{
+  /* The string is terminated by a '\0' which is kept in the storage. */
+  const char *begin= src.consume(0);
+  if (begin == 0)
+    return src;
+  const char *end= (const char *)memchr(begin, '\0', src.remaining());
+  std::size_t length= end ? end - begin + 1 : src.remaining();
+  str.append(src.consume(length), length);
+  return src;
+}
+
+buffer_source &operator>>(buffer_source &src, Protocol_chunk_string &str)
+{
+  std::size_t length= str.m_str->size();
+  const char *ptr= src.consume(length);
+  if (ptr)
+    str.m_str->assign(ptr, length);
+  return src;
+}
+
+buffer_source &operator>>(buffer_source &src, Protocol_chunk_string_len &lenstr)
+{
+  boost::uint8_t len;
+  std::string *str= lenstr.m_storage;
+  Protocol_chunk<boost::uint8_t> proto_str_len(len);
+  src >> proto_str_len;
+  if (!src.good())
+    return src;
+  Protocol_chunk_string   proto_str(*str, len);
+  src >> proto_str;
+  return src;
+}
+
+buffer_source &operator>>(buffer_source &src, Protocol_chunk_vector &chunk)
+{
+  const boost::uint8_t *ptr=
+    reinterpret_cast<const boost::uint8_t *>(src.consume(chunk.m_size));
+  if (ptr)
+    chunk.m_vec->insert(chunk.m_vec->end(), ptr, ptr + chunk.m_size);
+  return src;
+}
+
+buffer_source &operator>>(buffer_source &src, Protocol_chunk_view &chunk)
+{
+  const boost::uint8_t *ptr=
+    reinterpret_cast<const boost::uint8_t *>(src.consume(chunk.m_size));
+  if (ptr == 0)
+    return src;
+  if (src.owner())
+    *chunk.m_view= Byte_view(src.owner(), ptr, chunk.m_size);
+  else
+    chunk.m_view->assign(ptr, ptr + chunk.m_size);
   return src;
 }
 
@@ -319,7 +488,24 @@ std::ostream &operator<<(std::ostream &os, Protocol &chunk)
   return os;
 }
 
-Query_event *proto_query_event(std::istream &is, Log_event_header *header)
+void proto_event_header(buffer_source &src, Log_event_header *header)
+{
+  Protocol_chunk<boost::uint32_t> prot_timestamp(header->timestamp);
+  Protocol_chunk<boost::uint8_t>  prot_type_code(header->type_code);
+  Protocol_chunk<boost::uint32_t> prot_server_id(header->server_id);
+  Protocol_chunk<boost::uint32_t> prot_event_length(header->event_length);
+  Protocol_chunk<boost::uint32_t> prot_next_position(header->next_position);
+  Protocol_chunk<boost::uint16_t> prot_flags(header->flags);
+
+  src >> prot_timestamp
+      >> prot_type_code
+      >> prot_server_id
+      >> prot_event_length
+      >> prot_next_position
+      >> prot_flags;
+}
+
+Query_event *proto_query_event(buffer_source &src, Log_event_header *header)
 {
   boost::uint8_t db_name_len;
   boost::uint16_t var_size;
@@ -333,11 +519,11 @@ Query_event *proto_query_event(std::istream &is, Log_event_header *header)
   Protocol_chunk<boost::uint16_t> proto_query_event_error_code(qev->error_code);
   Protocol_chunk<boost::uint16_t> proto_query_event_var_size(var_size);
 
-  is >> proto_query_event_thread_id
-     >> proto_query_event_exec_time
-     >> proto_query_event_db_name_len
-     >> proto_query_event_error_code
-     >> proto_query_event_var_size;
+  src >> proto_query_event_thread_id
+      >> proto_query_event_exec_time
+      >> proto_query_event_db_name_len
+      >> proto_query_event_error_code
+      >> proto_query_event_var_size;
 
   //TODO : Implement it in a better way.
 
@@ -364,7 +550,7 @@ Query_event *proto_query_event(std::istream &is, Log_event_header *header)
 
   qev->variables.reserve(var_size);
   Protocol_chunk_vector proto_payload(qev->variables, var_size);
-  is >> proto_payload;
+  src >> proto_payload;
 
   Protocol_chunk_string proto_query_event_db_name(qev->db_name,
                                                   (unsigned long)db_name_len);
@@ -372,17 +558,18 @@ Query_event *proto_query_event(std::istream &is, Log_event_header *header)
   Protocol_chunk_string proto_query_event_query_str
     (qev->query, (unsigned long)query_len);
 
-  char zero_marker; // should always be 0;
-  is >> proto_query_event_db_name
-     >> zero_marker
-     >> proto_query_event_query_str;
+  boost::uint8_t zero_marker; // should always be 0;
+  Protocol_chunk<boost::uint8_t> proto_zero_marker(zero_marker);
+  src >> proto_query_event_db_name
+      >> proto_zero_marker
+      >> proto_query_event_query_str;
   // Following is not really required now,
   //qev->query.resize(qev->query.size() - 1); // Last character is a '\0' character.
 
   return qev;
 }
 
-Rotate_event *proto_rotate_event(std::istream &is, Log_event_header *header)
+Rotate_event *proto_rotate_event(buffer_source &src, Log_event_header *header)
 {
   Rotate_event *rev= new Rotate_event(header);
 
@@ -390,25 +577,25 @@ Rotate_event *proto_rotate_event(std::istream &is, Log_event_header *header)
 
   Protocol_chunk<boost::uint64_t > prot_position(rev->binlog_pos);
   Protocol_chunk_string prot_file_name(rev->binlog_file, file_name_length);
-  is >> prot_position
-     >> prot_file_name;
+  src >> prot_position
+      >> prot_file_name;
 
   return rev;
 }
 
-Incident_event *proto_incident_event(std::istream &is, Log_event_header *header)
+Incident_event *proto_incident_event(buffer_source &src, Log_event_header *header)
 {
   Incident_event *incident= new Incident_event(header);
   Protocol_chunk<boost::uint8_t> proto_incident_code(incident->type);
   Protocol_chunk_string_len      proto_incident_message(incident->message);
 
-  is >> proto_incident_code
-     >> proto_incident_message;
+  src >> proto_incident_code
+      >> proto_incident_message;
 
   return incident;
 }
 
-Row_event *proto_rows_event(std::istream &is, Log_event_header *header)
+Row_event *proto_rows_event(buffer_source &src, Log_event_header *header)
 {
   Row_event *rev=new Row_event(header);
 
@@ -424,60 +611,62 @@ Row_event *proto_rows_event(std::istream &is, Log_event_header *header)
   Protocol_chunk<boost::uint64_t> proto_column_len(rev->columns_len);
   proto_column_len.set_length_encoded_binary(true);
 
-  is >> proto_table_id
-     >> proto_flags
-     >> proto_column_len;
+  src >> proto_table_id
+      >> proto_flags
+      >> proto_column_len;
 
   rev->table_id=table_id.integer;
   int used_column_len=(int) ((rev->columns_len + 7) / 8);
-  Protocol_chunk_vector proto_used_columns(rev->used_columns, used_column_len);
+  Protocol_chunk_view proto_used_columns(rev->used_columns, used_column_len);
   rev->null_bits_len= used_column_len;
 
-  is >> proto_used_columns;
+  src >> proto_used_columns;
 
   if (header->type_code == UPDATE_ROWS_EVENT)
   {
-    Protocol_chunk_vector proto_columns_before_image(rev->columns_before_image, used_column_len);
-    is >> proto_columns_before_image;
+    Protocol_chunk_view proto_columns_before_image(rev->columns_before_image, used_column_len);
+    src >> proto_columns_before_image;
   }
 
-  int bytes_read=proto_table_id.size() + proto_flags.size() + proto_column_len.size() + used_column_len;
-  if (header->type_code == UPDATE_ROWS_EVENT)
-    bytes_read+=used_column_len;
+  /*
+    The length encoded column count takes one more byte than its chunk
+    size when it starts with a marker, so count what was consumed.
+  */
+  int bytes_read= (int) src.position();
 
   unsigned long row_len= header->event_length - bytes_read - LOG_EVENT_HEADER_SIZE + 1;
   //std::cout << "Bytes read: " << bytes_read << " Bytes expected: " << rev->row_len << std::endl;
-  Protocol_chunk_vector proto_row(rev->row, row_len);
-  is >> proto_row;
+  Protocol_chunk_view proto_row(rev->row, row_len);
+  src >> proto_row;
 
   return rev;
 }
 
-Int_var_event *proto_intvar_event(std::istream &is, Log_event_header *header)
+Int_var_event *proto_intvar_event(buffer_source &src, Log_event_header *header)
 {
   Int_var_event *event= new Int_var_event(header);
 
   Protocol_chunk<boost::uint8_t>  proto_type(event->type);
   Protocol_chunk<boost::uint64_t> proto_value(event->value);
-  is >> proto_type
-     >> proto_value;
+  src >> proto_type
+      >> proto_value;
 
   return event;
 }
 
-User_var_event *proto_uservar_event(std::istream &is, Log_event_header *header)
+User_var_event *proto_uservar_event(buffer_source &src, Log_event_header *header)
 {
   User_var_event *event= new User_var_event(header);
 
   boost::uint32_t name_len;
   Protocol_chunk<boost::uint32_t> proto_name_len(name_len);
 
-  is >> proto_name_len;
+  src >> proto_name_len;
 
   Protocol_chunk_string proto_name(event->name, name_len);
   Protocol_chunk<boost::uint8_t>  proto_null(event->is_null);
 
-  is >> proto_name >> proto_null;
+  src >> proto_name >> proto_null;
   if (event->is_null)
   {
     event->type = User_var_event::STRING_TYPE;
@@ -489,15 +678,15 @@ User_var_event *proto_uservar_event(std::istream &is, Log_event_header *header)
     Protocol_chunk<boost::uint8_t> proto_type(event->type);
     Protocol_chunk<boost::uint32_t> proto_charset(event->charset);
     Protocol_chunk<boost::uint32_t> proto_val_len(value_len);
-    is >> proto_type >> proto_charset >> proto_val_len;
+    src >> proto_type >> proto_charset >> proto_val_len;
     Protocol_chunk_string proto_value(event->value, value_len);
-    is >> proto_value;
+    src >> proto_value;
   }
 
   return event;
 }
 
-Table_map_event *proto_table_map_event(std::istream &is, Log_event_header *header)
+Table_map_event *proto_table_map_event(buffer_source &src, Log_event_header *header)
 {
   Table_map_event *tmev=new Table_map_event(header);
   boost::uint64_t columns_len= 0;
@@ -518,27 +707,27 @@ Table_map_event *proto_table_map_event(std::istream &is, Log_event_header *heade
   Protocol_chunk<boost::uint64_t> proto_columns_len(columns_len);
   proto_columns_len.set_length_encoded_binary(true);
 
-  is >> proto_table_id
-     >> proto_flags
-     >> proto_db_name
-     >> proto_marker
-     >> proto_table_name
-     >> proto_marker
-     >> proto_columns_len;
+  src >> proto_table_id
+      >> proto_flags
+      >> proto_db_name
+      >> proto_marker
+      >> proto_table_name
+      >> proto_marker
+      >> proto_columns_len;
   tmev->table_id=table_id.integer;
-  Protocol_chunk_vector proto_columns(tmev->columns, columns_len);
+  Protocol_chunk_view proto_columns(tmev->columns, columns_len);
   Protocol_chunk<boost::uint64_t> proto_metadata_len(metadata_len);
   proto_metadata_len.set_length_encoded_binary(true);
 
-  is >> proto_columns
-     >> proto_metadata_len;
-  Protocol_chunk_vector proto_metadata(tmev->metadata, (unsigned long)metadata_len);
-  is >> proto_metadata;
+  src >> proto_columns
+      >> proto_metadata_len;
+  Protocol_chunk_view proto_metadata(tmev->metadata, (unsigned long)metadata_len);
+  src >> proto_metadata;
   unsigned long null_bits_len=(int) ((tmev->columns.size() + 7) / 8);
 
-  Protocol_chunk_vector proto_null_bits(tmev->null_bits, null_bits_len);
+  Protocol_chunk_view proto_null_bits(tmev->null_bits, null_bits_len);
 
-  is >> proto_null_bits;
+  src >> proto_null_bits;
   return tmev;
 }
 
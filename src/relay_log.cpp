@@ -0,0 +1,400 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#include "relay_log.h"
+#include "binlog_api.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <boost/bind.hpp>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mysql { namespace system {
+
+namespace {
+
+/**
+ * Write all of [data, data + length) to fd.
+ */
+bool write_all(int fd, const boost::uint8_t *data, std::size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t written= ::write(fd, data, length);
+    if (written == -1 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    data+= written;
+    length-= written;
+  }
+  return true;
+}
+
+/**
+ * The file and position a Rotate event points to.
+ */
+void rotate_target(const boost::uint8_t *event, std::size_t length,
+                   std::string *file, unsigned long *position)
+{
+  const boost::uint8_t *body= event + LOG_EVENT_HEADER_SIZE - 1;
+  std::size_t body_length= length - (LOG_EVENT_HEADER_SIZE - 1);
+  boost::uint64_t value= 0;
+  for (int i= 7; i >= 0; --i)
+    value= (value << 8) | body[i];
+  *position= value;
+  file->assign(reinterpret_cast<const char *>(body) + 8, body_length - 8);
+}
+
+} // anonymous namespace
+
+
+Relay_log::Relay_log(const std::string &directory,
+                     unsigned long sync_interval_ms)
+  : m_directory(directory), m_sync_interval(sync_interval_ms), m_fd(-1),
+    m_offset(0), m_writing(false), m_failed(false),
+    m_buffer(RELAY_BUFFER_SIZE), m_buffer_used(0), m_appended(0),
+    m_sync_fd(-1), m_index_fd(-1), m_index_changed(false), m_flushed(0),
+    m_flushed_position(0), m_synced(0), m_synced_position(0), m_stop(false),
+    m_syncs(0), m_thread(boost::bind(&Relay_log::sync_files, this))
+{
+}
+
+
+Relay_log::~Relay_log()
+{
+  flush();
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_stop= true;
+    m_changed.notify_all();
+  }
+  m_thread.join();
+}
+
+
+bool Relay_log::write(const boost::uint8_t *event, std::size_t length,
+                      const Log_event_header *header)
+{
+  const std::size_t header_size= LOG_EVENT_HEADER_SIZE - 1;
+  bool artificial= header->next_position == 0 ||
+                   (header->flags & LOG_EVENT_ARTIFICIAL_F);
+  std::string file;
+  unsigned long position;
+
+  /* The Rotate event which starts a dump says where it starts. */
+  if (header->type_code == ROTATE_EVENT && artificial &&
+      length >= header_size + 8)
+  {
+    rotate_target(event, length, &file, &position);
+    switch_file(file, position);
+  }
+  else if (!artificial)
+  {
+    if (m_writing)
+    {
+      if (header->next_position == m_offset + length &&
+          append(event, length))
+        m_offset+= length;
+      else
+        fail();
+    }
+    /* The Rotate event at the end of a file names the next one. */
+    if (header->type_code == ROTATE_EVENT && length >= header_size + 8)
+    {
+      rotate_target(event, length, &file, &position);
+      switch_file(file, MAGIC_NUMBER_SIZE);
+    }
+  }
+
+  bool failed= m_failed;
+  m_failed= false;
+  return !failed;
+}
+
+
+void Relay_log::switch_file(const std::string &name, unsigned long position)
+{
+  /* A new dump from where the last one ended goes on with the file. */
+  if (m_writing && name == m_file && position == m_offset)
+    return;
+  retire_file();
+  if (open_file(name, position) == ERR_FAIL)
+    fail();
+}
+
+
+int Relay_log::open_file(const std::string &name, unsigned long position)
+{
+  std::string path= m_directory + "/" + name;
+  if (position <= MAGIC_NUMBER_SIZE)
+  {
+    const boost::uint8_t magic[]= { 0xfe, 0x62, 0x69, 0x6e };
+    m_fd= ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (m_fd == -1)
+      return ERR_FAIL;
+    m_file= name;
+    m_offset= 0;
+    if (list_file(name) || !append(magic, sizeof(magic)))
+      return ERR_FAIL;
+    m_offset= sizeof(magic);
+  }
+  else
+  {
+    /* Go on with a copy which reaches the position. */
+    struct stat stat_buff;
+    m_fd= ::open(path.c_str(), O_WRONLY);
+    if (m_fd == -1)
+      return errno == ENOENT ? (int)ERR_EOF : (int)ERR_FAIL;
+    m_file= name;
+    if (fstat(m_fd, &stat_buff) == -1 ||
+        (unsigned long) stat_buff.st_size < position)
+    {
+      retire_file();
+      return ERR_EOF;
+    }
+    if (ftruncate(m_fd, position) == -1 ||
+        lseek(m_fd, position, SEEK_SET) == (off_t) -1)
+      return ERR_FAIL;
+    m_offset= position;
+  }
+
+  boost::mutex::scoped_lock lock(m_mutex);
+  m_sync_fd= m_fd;
+  m_writing= true;
+  return ERR_OK;
+}
+
+
+int Relay_log::list_file(const std::string &name)
+{
+  std::string::size_type dot= name.rfind('.');
+  std::string index_path= m_directory + "/" +
+                          name.substr(0, dot) + ".index";
+  if (index_path != m_index_path)
+  {
+    /* Files already listed by an earlier run are not listed again. */
+    m_listed.clear();
+    std::ifstream index(index_path.c_str());
+    std::string line;
+    while (std::getline(index, line))
+      m_listed.insert(line);
+
+    int fd= ::open(index_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd == -1)
+      return ERR_FAIL;
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (m_index_fd != -1)
+      m_retired.push_back(m_index_fd);
+    m_index_fd= fd;
+    m_index_path= index_path;
+  }
+
+  std::string line= "./" + name;
+  if (m_listed.count(line))
+    return ERR_OK;
+  m_listed.insert(line);
+  line+= '\n';
+  if (!write_all(m_index_fd, reinterpret_cast<const boost::uint8_t *>(line.data()),
+                 line.size()))
+    return ERR_FAIL;
+  boost::mutex::scoped_lock lock(m_mutex);
+  m_index_changed= true;
+  return ERR_OK;
+}
+
+
+bool Relay_log::append(const boost::uint8_t *data, std::size_t length)
+{
+  if (m_buffer_used + length > m_buffer.size() && !write_buffer())
+    return false;
+  if (length > m_buffer.size())
+  {
+    if (!write_all(m_fd, data, length))
+      return false;
+  }
+  else
+  {
+    memcpy(&m_buffer[m_buffer_used], data, length);
+    m_buffer_used+= length;
+  }
+  m_appended.store(m_appended.load() + length);
+  return true;
+}
+
+
+bool Relay_log::write_buffer()
+{
+  bool written= write_all(m_fd, &m_buffer[0], m_buffer_used);
+  m_buffer_used= 0;
+  return written;
+}
+
+
+void Relay_log::flush()
+{
+  if (m_fd != -1 && m_buffer_used > 0 && !write_buffer())
+  {
+    fail();
+    return;
+  }
+  boost::mutex::scoped_lock lock(m_mutex);
+  if (m_flushed == m_appended.load())
+    return;
+  m_flushed= m_appended.load();
+  m_flushed_file= m_file;
+  m_flushed_position= m_offset;
+  m_changed.notify_all();
+}
+
+
+void Relay_log::fail()
+{
+  /* What could not be written won't be synced either. */
+  m_appended.store(m_appended.load() - m_buffer_used);
+  m_buffer_used= 0;
+  m_failed= true;
+  retire_file();
+}
+
+
+void Relay_log::retire_file()
+{
+  if (m_fd == -1)
+    return;
+  if (m_buffer_used > 0 && !write_buffer())
+    m_failed= true;
+  boost::mutex::scoped_lock lock(m_mutex);
+  m_retired.push_back(m_fd);
+  m_sync_fd= -1;
+  m_fd= -1;
+  m_writing= false;
+  m_flushed= m_appended.load();
+  if (!m_failed)
+  {
+    m_flushed_file= m_file;
+    m_flushed_position= m_offset;
+  }
+  m_changed.notify_all();
+}
+
+
+bool Relay_log::wait_synced(unsigned long timeout_ms)
+{
+  boost::uint64_t appended= m_appended.load();
+  boost::system_time deadline= boost::get_system_time() +
+    boost::posix_time::milliseconds(timeout_ms);
+  boost::mutex::scoped_lock lock(m_mutex);
+  while (m_synced < appended)
+  {
+    if (!m_changed.timed_wait(lock, deadline))
+      return m_synced >= appended;
+  }
+  return true;
+}
+
+
+void Relay_log::synced_position(std::string *file, unsigned long *position)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  if (file)
+    *file= m_synced_file;
+  if (position)
+    *position= m_synced_position;
+}
+
+
+void Relay_log::sync_files()
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  boost::system_time next_sync= boost::get_system_time();
+  boost::uint64_t attempted= 0;
+  for (;;)
+  {
+    /* A failed sync is tried again with the next data. */
+    while (!m_stop && m_flushed == attempted && m_retired.empty() &&
+           !m_index_changed)
+      m_changed.wait(lock);
+
+    /* Let more events pile up for the sync. */
+    while (!m_stop && m_sync_interval > 0 &&
+           m_changed.timed_wait(lock, next_sync))
+      ;
+
+    /*
+      Take what is to be synced now. The writer may go on while the sync
+      runs; what it writes is left for the next one.
+    */
+    bool last= m_stop;
+    int fd= m_sync_fd;
+    std::vector<int> retired;
+    retired.swap(m_retired);
+    int index_fd= m_index_changed ? m_index_fd : -1;
+    m_index_changed= false;
+    boost::uint64_t flushed= m_flushed;
+    std::string file= m_flushed_file;
+    unsigned long position= m_flushed_position;
+    lock.unlock();
+
+    next_sync= boost::get_system_time() +
+               boost::posix_time::milliseconds(m_sync_interval);
+    bool synced= true;
+    for (std::size_t i= 0; i < retired.size(); ++i)
+    {
+      synced= fdatasync(retired[i]) == 0 && synced;
+      close(retired[i]);
+    }
+    if (fd != -1)
+      synced= fdatasync(fd) == 0 && synced;
+    if (index_fd != -1)
+    {
+      /* The directory holds the names of new files. */
+      int directory= ::open(m_directory.c_str(), O_RDONLY);
+      synced= fsync(index_fd) == 0 && directory != -1 &&
+              fsync(directory) == 0 && synced;
+      if (directory != -1)
+        close(directory);
+    }
+
+    lock.lock();
+    attempted= flushed;
+    if (synced)
+    {
+      m_synced= flushed;
+      m_synced_file= file;
+      m_synced_position= position;
+    }
+    m_syncs.store(m_syncs.load() + 1);
+    m_changed.notify_all();
+    if (last)
+      break;
+  }
+
+  if (m_sync_fd != -1)
+    close(m_sync_fd);
+  if (m_index_fd != -1)
+    close(m_index_fd);
+}
+
+}
+}
@@ -0,0 +1,171 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#include "replay_driver.h"
+#include "binlog_api.h"
+#include <boost/thread/thread.hpp>
+
+namespace mysql { namespace system {
+
+Binlog_replay_driver::Binlog_replay_driver(Binlog_file_driver *source,
+                                           double speed)
+  : Binary_log_driver("", 0), m_source(source), m_speed(speed),
+    m_pending(0), m_position(0), m_start_timestamp(0), m_last_timestamp(0),
+    m_behind(0)
+{
+}
+
+
+Binlog_replay_driver::~Binlog_replay_driver()
+{
+  delete m_pending;
+  delete m_source;
+}
+
+
+void Binlog_replay_driver::restart()
+{
+  delete m_pending;
+  m_pending= 0;
+  m_start_time= boost::system_time();
+  m_behind= 0;
+}
+
+
+int Binlog_replay_driver::connect()
+{
+  restart();
+  return m_source->connect();
+}
+
+
+boost::system_time
+Binlog_replay_driver::due_time(Binary_log_event *event)
+{
+  boost::system_time now= boost::get_system_time();
+  boost::uint32_t timestamp= event->header()->timestamp;
+  if (m_speed <= 0 || timestamp == 0)
+    return now;
+  if (m_start_time.is_not_a_date_time())
+  {
+    m_start_timestamp= m_last_timestamp= timestamp;
+    m_start_time= now;
+    return now;
+  }
+  if (timestamp > m_last_timestamp)
+    m_last_timestamp= timestamp;
+  double delay_ms= (m_last_timestamp - m_start_timestamp) * 1000.0 / m_speed;
+  return m_start_time +
+         boost::posix_time::milliseconds((boost::int64_t) delay_ms);
+}
+
+
+int Binlog_replay_driver::wait_for_next_event(mysql::Binary_log_event **event)
+{
+  std::vector<mysql::Binary_log_event *> events;
+  int rc= wait_for_next_events(&events, 1, WAIT_FOREVER);
+  if (rc == ERR_OK && events.empty())
+    rc= ERR_EOF;
+  if (rc == ERR_OK)
+    *event= events[0];
+  return rc;
+}
+
+
+int Binlog_replay_driver::wait_for_next_events(std::vector<mysql::Binary_log_event *> *events,
+                                               std::size_t max_events,
+                                               unsigned long timeout_ms)
+{
+  bool forever= timeout_ms == WAIT_FOREVER;
+  boost::system_time deadline;
+  if (!forever)
+    deadline= boost::get_system_time() +
+              boost::posix_time::milliseconds(timeout_ms);
+
+  std::size_t count= 0;
+  while (count < max_events)
+  {
+    if (m_pending == 0)
+    {
+      unsigned long wait_ms= WAIT_FOREVER;
+      if (count > 0)
+        wait_ms= 0;
+      else if (!forever)
+        wait_ms= std::max<boost::int64_t>(0,
+          (deadline - boost::get_system_time()).total_milliseconds());
+      m_source->get_position(&m_file, &m_position);
+      std::vector<mysql::Binary_log_event *> read;
+      int rc= m_source->wait_for_next_events(&read, 1, wait_ms);
+      /* An error is reported by the next call when events were taken. */
+      if (rc != ERR_OK)
+        return count > 0 ? (int)ERR_OK : rc;
+      if (read.empty())
+        break;
+      m_pending= read[0];
+      m_pending_due= due_time(m_pending);
+    }
+
+    boost::system_time now= boost::get_system_time();
+    if (m_pending_due > now)
+    {
+      if (count > 0 || (!forever && now >= deadline))
+        break;
+      boost::this_thread::sleep(forever ? m_pending_due
+                                        : std::min(m_pending_due, deadline));
+      continue;
+    }
+    m_behind= (now - m_pending_due).total_milliseconds();
+    events->push_back(m_pending);
+    m_pending= 0;
+    ++count;
+  }
+  return ERR_OK;
+}
+
+
+int Binlog_replay_driver::set_position(const std::string &str,
+                                       unsigned long position)
+{
+  restart();
+  return m_source->set_position(str, position);
+}
+
+
+int Binlog_replay_driver::get_position(std::string *str,
+                                       unsigned long *position)
+{
+  if (m_pending == 0)
+    return m_source->get_position(str, position);
+  if (str)
+    *str= m_file;
+  if (position)
+    *position= m_position;
+  return ERR_OK;
+}
+
+
+int Binlog_replay_driver::set_position_by_time(boost::uint32_t when)
+{
+  restart();
+  return m_source->set_position_by_time(when);
+}
+
+}
+}
@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 #include "row_of_fields.h"
 
 using namespace mysql;
+using mysql::system::Packet_inflater;
 
 namespace mysql {
 
@@ -38,6 +39,7 @@ void Result_set::digest_row_set()
   m_current_state= RESULT_HEADER;
   boost::asio::streambuf resultbuff;
   std::istream response_stream(&resultbuff);
+  Packet_inflater inflater;
   unsigned field_count= 0;
   try {
   do
@@ -45,7 +47,8 @@ void Result_set::digest_row_set()
     /*
      * Get server response
      */
-    packet_length= system::proto_get_one_package(m_socket, resultbuff, &packet_no);
+    packet_length= system::proto_get_one_package(m_socket, resultbuff, &packet_no,
+                                                 m_compressed ? &inflater : 0);
 
     switch(m_current_state)
     {
@@ -0,0 +1,79 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#include "row_keys.h"
+#include <boost/functional/hash.hpp>
+
+namespace mysql {
+
+void Row_keys::set_key(const std::string &db_name,
+                       const std::string &table_name,
+                       const std::vector<unsigned int> &columns)
+{
+  m_keys[std::make_pair(db_name, table_name)]= columns;
+}
+
+
+const std::vector<unsigned int> &Row_keys::key(const Table_map_event &table)
+{
+  std::pair<std::string, std::string> name(table.db_name, table.table_name);
+  Key_map::iterator found= m_keys.find(name);
+  if (found != m_keys.end())
+    return found->second;
+  if (!m_key_lookup)
+    return m_no_key;
+
+  /* A table without a key is remembered too, so it is looked up once. */
+  std::vector<unsigned int> &columns= m_keys[name];
+  if (!m_key_lookup(table, &columns))
+    columns.clear();
+  return columns;
+}
+
+
+std::size_t Row_keys::table_hash(const Table_map_event &table)
+{
+  std::size_t hash= boost::hash_value(table.db_name);
+  boost::hash_combine(hash, table.table_name);
+  return hash;
+}
+
+
+std::size_t Row_keys::row_hash(std::size_t table_hash,
+                               const std::vector<unsigned int> &key,
+                               const Row_of_fields &row)
+{
+  std::size_t hash= table_hash;
+  for (std::size_t i= 0; i < key.size(); ++i)
+  {
+    if (key[i] >= row.size())
+      return table_hash;
+    const Value &value= row[key[i]];
+    if (value.is_null())
+      boost::hash_combine(hash, 0);
+    else
+      boost::hash_combine(hash, boost::hash_range(value.storage(),
+                                                  value.storage() +
+                                                  value.length()));
+  }
+  return hash;
+}
+
+} // end namespace
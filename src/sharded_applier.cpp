@@ -0,0 +1,199 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#include "sharded_applier.h"
+#include "rowset.h"
+#include <boost/bind.hpp>
+
+namespace mysql {
+
+Sharded_applier::Sharded_applier(unsigned int workers,
+                                 const Row_applier &apply,
+                                 bool transaction_barriers,
+                                 std::size_t queue_size)
+  : m_apply(apply), m_barriers(transaction_barriers), m_draining(false)
+{
+  if (workers == 0)
+    workers= 1;
+  for (unsigned int i= 0; i < workers; ++i)
+    m_shards.push_back(new Shard(queue_size));
+  for (unsigned int i= 0; i < workers; ++i)
+    m_shards[i]->thread=
+      new boost::thread(boost::bind(&Sharded_applier::work, this, i));
+}
+
+
+Sharded_applier::~Sharded_applier()
+{
+  for (std::size_t i= 0; i < m_shards.size(); ++i)
+    m_shards[i]->queue.push_front(0);
+  for (std::size_t i= 0; i < m_shards.size(); ++i)
+  {
+    m_shards[i]->thread->join();
+    delete m_shards[i]->thread;
+    delete m_shards[i];
+  }
+}
+
+
+void Sharded_applier::work(unsigned int worker)
+{
+  Shard *shard= m_shards[worker];
+  for (;;)
+  {
+    Sharded_row *row;
+    shard->queue.pop_back(&row);
+    if (row == 0)
+      return;
+    m_apply(worker, *row);
+    delete row;
+    shard->applied.fetch_add(1);
+    if (m_draining.load())
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_applied.notify_all();
+    }
+  }
+}
+
+
+void Sharded_applier::drain()
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  m_draining.store(true);
+  for (std::size_t i= 0; i < m_shards.size(); ++i)
+  {
+    while (m_shards[i]->applied.load() != m_shards[i]->queued)
+      m_applied.wait(lock);
+  }
+  m_draining.store(false);
+}
+
+
+void Sharded_applier::dispatch(unsigned int worker, Sharded_row *row)
+{
+  ++m_shards[worker]->queued;
+  m_shards[worker]->queue.push_front(row);
+}
+
+
+unsigned int Sharded_applier::shard_of(const Table &table,
+                                       const Row_of_fields &row) const
+{
+  return Row_keys::row_hash(table.name_hash, table.key, row) %
+         m_shards.size();
+}
+
+
+Binary_log_event *Sharded_applier::process_event(Table_map_event *ev)
+{
+  Table &table= m_tables[ev->table_id];
+  table.map.reset(new Table_map_event(*ev));
+  table.name_hash= Row_keys::table_hash(*ev);
+  table.key= m_keys.key(*ev);
+  return ev;
+}
+
+
+Binary_log_event *Sharded_applier::process_event(Row_event *ev)
+{
+  std::map<boost::uint64_t, Table>::iterator found= m_tables.find(ev->table_id);
+  if (found == m_tables.end())
+    return ev;
+  const Table &table= found->second;
+  boost::shared_ptr<Row_event> event(ev);
+  if (event->row.empty())
+    return 0;
+
+  Log_event_type type= ev->get_event_type();
+  Row_event_set rows(ev, table.map.get());
+  Row_event_set::iterator it= rows.begin();
+  do
+  {
+    Sharded_row *row= new Sharded_row;
+    row->type= type;
+    row->table= table.map;
+    row->event= event;
+    /* Row_of_fields only assigns rows of the same size. */
+    Row_of_fields image= *it;
+    if (type == WRITE_ROWS_EVENT)
+      row->after.swap(image);
+    else
+      row->before.swap(image);
+    if (type == UPDATE_ROWS_EVENT)
+    {
+      Row_of_fields after= *++it;
+      row->after.swap(after);
+    }
+
+    unsigned int worker= shard_of(table, type == WRITE_ROWS_EVENT
+                                         ? row->after : row->before);
+    if (type == UPDATE_ROWS_EVENT && shard_of(table, row->after) != worker)
+    {
+      /*
+        The key changes, so the row moves between workers. Both must be
+        done with what came before, and the worker of the new key must
+        not get ahead of the update.
+      */
+      drain();
+      dispatch(worker, row);
+      drain();
+    }
+    else
+      dispatch(worker, row);
+  } while (++it != rows.end());
+  return 0;
+}
+
+
+Binary_log_event *Sharded_applier::process_event(Xid *ev)
+{
+  if (m_barriers)
+    drain();
+  return ev;
+}
+
+
+Binary_log_event *Sharded_applier::process_event(Query_event *ev)
+{
+  if (m_barriers && ev->query != "BEGIN")
+    drain();
+  return ev;
+}
+
+
+bool Sharded_applier::handles(Log_event_type type) const
+{
+  switch (type)
+  {
+  case TABLE_MAP_EVENT:
+  case WRITE_ROWS_EVENT:
+  case UPDATE_ROWS_EVENT:
+  case DELETE_ROWS_EVENT:
+    return true;
+  case XID_EVENT:
+  case QUERY_EVENT:
+    return m_barriers;
+  default:
+    return false;
+  }
+}
+
+} // end namespace
@@ -0,0 +1,242 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#include "staged_pipeline.h"
+#include "spsc_bounded_buffer.h"
+
+namespace mysql {
+
+/**
+ * The events between two stages. It is the driver of the Binary_log of
+ * the stage behind it.
+ *
+ * The stage in front closes the queue with an entry without an event,
+ * which holds the error that ended it. Once the queue is discarding,
+ * the events taken from it are deleted instead of handed on, so the
+ * stages in front drain into it.
+ */
+class Stage_queue : public system::Binary_log_driver
+{
+public:
+  Stage_queue(std::size_t size)
+    : Binary_log_driver("", 0), m_queue(size), m_result(ERR_OK),
+      m_discarding(false)
+  {
+  }
+
+  int connect() { return ERR_OK; }
+
+  void push(Binary_log_event *event)
+  {
+    Entry entry= { event, ERR_OK };
+    m_queue.push_front(entry);
+  }
+
+  void close(int result)
+  {
+    Entry entry= { 0, result == ERR_OK ? (int) ERR_FAIL : result };
+    m_queue.push_front(entry);
+  }
+
+  void discard() { m_discarding.store(true); }
+
+  int wait_for_next_event(Binary_log_event **event)
+  {
+    std::vector<Binary_log_event *> events;
+    int rc;
+    while ((rc= wait_for_next_events(&events, 1, WAIT_FOREVER)) == ERR_OK &&
+           events.empty())
+      ;
+    if (rc == ERR_OK)
+      *event= events[0];
+    return rc;
+  }
+
+  int wait_for_next_events(std::vector<Binary_log_event *> *events,
+                           std::size_t max_events,
+                           unsigned long timeout_ms= WAIT_FOREVER)
+  {
+    if (m_result != ERR_OK)
+      return m_result;
+    m_entries.clear();
+    m_queue.pop_back_n(&m_entries, max_events, timeout_ms);
+    std::size_t first= events->size();
+    for (std::size_t i= 0; i < m_entries.size(); ++i)
+    {
+      if (m_entries[i].event == 0)
+        m_result= m_entries[i].result;
+      else if (m_discarding.load())
+        delete m_entries[i].event;
+      else
+        events->push_back(m_entries[i].event);
+    }
+    /* The error is reported by the next call when events were taken. */
+    return events->size() > first ? (int) ERR_OK : m_result;
+  }
+
+  /**
+   * The events between stages can't be positioned.
+   */
+  int set_position(const std::string &, unsigned long)
+  {
+    return ERR_FAIL;
+  }
+
+  int get_position(std::string *, unsigned long *)
+  {
+    return ERR_FAIL;
+  }
+
+private:
+  struct Entry
+  {
+    Binary_log_event *event;
+    int result;
+  };
+
+  spsc_bounded_buffer<Entry> m_queue;
+  std::vector<Entry> m_entries;
+
+  /*
+    The error which closed the queue, once the consumer has seen it.
+  */
+  int m_result;
+
+  boost::atomic<bool> m_discarding;
+};
+
+
+Staged_pipeline::Staged_pipeline(Binary_log *binlog, std::size_t queue_size)
+  : m_binlog(binlog), m_queue_size(queue_size), m_output(0), m_stop(false)
+{
+}
+
+
+Staged_pipeline::~Staged_pipeline()
+{
+  if (m_output)
+  {
+    /* Each stage drains into the one behind it, and the last into here. */
+    m_stop.store(true);
+    for (std::size_t i= 0; i < m_stages.size(); ++i)
+      m_stages[i].input->discard();
+    m_output->discard();
+    std::vector<Binary_log_event *> events;
+    while (m_output->wait_for_next_events(&events, STAGE_BATCH_SIZE) == ERR_OK)
+      ;
+    for (std::size_t i= 0; i < m_threads.size(); ++i)
+    {
+      m_threads[i]->join();
+      delete m_threads[i];
+    }
+  }
+  for (std::size_t i= 0; i < m_stages.size(); ++i)
+  {
+    delete m_stages[i].binlog;
+    delete m_stages[i].input;
+  }
+  delete m_output;
+}
+
+
+Content_handler_pipeline *Staged_pipeline::add_stage()
+{
+  if (m_output)
+    return 0;
+  Stage stage;
+  stage.input= new Stage_queue(m_queue_size);
+  stage.binlog= new Binary_log(stage.input);
+  m_stages.push_back(stage);
+  return stage.binlog->content_handler_pipeline();
+}
+
+
+void Staged_pipeline::start()
+{
+  m_output= new Stage_queue(m_queue_size);
+  Stage_queue *first_output= m_stages.empty() ? m_output : m_stages[0].input;
+  m_threads.push_back(new boost::thread(
+    boost::bind(&Staged_pipeline::read_events, this, first_output)));
+  for (std::size_t i= 0; i < m_stages.size(); ++i)
+  {
+    Stage_queue *output= i + 1 < m_stages.size() ? m_stages[i + 1].input
+                                                 : m_output;
+    m_threads.push_back(new boost::thread(
+      boost::bind(&Staged_pipeline::run_stage, this, m_stages[i].binlog,
+                  output)));
+  }
+}
+
+
+void Staged_pipeline::read_events(Stage_queue *output)
+{
+  std::vector<Binary_log_event *> events;
+  for (;;)
+  {
+    events.clear();
+    int rc= m_binlog->wait_for_next_events(&events, STAGE_BATCH_SIZE,
+                                           STAGE_POLL_MS);
+    for (std::size_t i= 0; i < events.size(); ++i)
+      output->push(events[i]);
+    if (rc != ERR_OK || m_stop.load())
+    {
+      output->close(rc);
+      return;
+    }
+  }
+}
+
+
+void Staged_pipeline::run_stage(Binary_log *binlog, Stage_queue *output)
+{
+  std::vector<Binary_log_event *> events;
+  for (;;)
+  {
+    events.clear();
+    int rc= binlog->wait_for_next_events(&events, STAGE_BATCH_SIZE);
+    for (std::size_t i= 0; i < events.size(); ++i)
+      output->push(events[i]);
+    if (rc != ERR_OK)
+    {
+      output->close(rc);
+      return;
+    }
+  }
+}
+
+
+int Staged_pipeline::wait_for_next_event(Binary_log_event **event)
+{
+  if (m_output == 0)
+    start();
+  return m_output->wait_for_next_event(event);
+}
+
+
+int Staged_pipeline::wait_for_next_events(std::vector<Binary_log_event *> *events,
+                                          std::size_t max_events,
+                                          unsigned long timeout_ms)
+{
+  if (m_output == 0)
+    start();
+  return m_output->wait_for_next_events(events, max_events, timeout_ms);
+}
+
+} // end namespace
@@ -53,6 +53,20 @@ static int encrypt_password(boost::uint8_t *reply,   /* buffer at least EVP_MAX_
                             const char *pass);
 static int hash_sha1(boost::uint8_t *output, ...);
 
+boost::uint32_t default_server_id()
+{
+  const char* env_libreplication_server_id = std::getenv("LIBREPLICATION_SERVER_ID");
+
+  if (env_libreplication_server_id != 0) {
+    try {
+      return boost::lexical_cast<boost::uint32_t>(env_libreplication_server_id);
+    } catch (boost::bad_lexical_cast e) {
+      // XXX: nothing to do
+    }
+  }
+  return 1;
+}
+
     int Binlog_tcp_driver::connect(const std::string& user, const std::string& passwd,
                                    const std::string& host, long port,
                                    const std::string& binlog_filename, size_t offset)
@@ -64,7 +78,9 @@ static int hash_sha1(boost::uint8_t *output, ...);
 
   if (!m_socket)
   {
-    if ((m_socket=sync_connect_and_authenticate(m_io_service, user, passwd, host, port)) == 0)
+    if ((m_socket=sync_connect_and_authenticate(m_io_service, user, passwd, host, port,
+                                                m_compress, &m_compressed,
+                                                m_server_id)) == 0)
       return 1;
   }
 
@@ -73,7 +89,8 @@ static int hash_sha1(boost::uint8_t *output, ...);
    */
   if (binlog_filename == "")
   {
-    if (fetch_master_status(m_socket, &m_binlog_file_name, &m_binlog_offset))
+    if (fetch_master_status(m_socket, &m_binlog_file_name, &m_binlog_offset,
+                            m_compressed))
       return 1;
   } else
   {
@@ -82,13 +99,18 @@ static int hash_sha1(boost::uint8_t *output, ...);
   }
 
 
+  m_queued_position= m_binlog_offset;
+  m_spill_lost= false;
+
   /* We're ready to start the io service and request the binlog dump. */
   start_binlog_dump(m_binlog_file_name, m_binlog_offset);
 
   return 0;
 }
 
-tcp::socket *sync_connect_and_authenticate(boost::asio::io_service &io_service, const std::string &user, const std::string &passwd, const std::string &host, long port)
+tcp::socket *sync_connect_and_authenticate(boost::asio::io_service &io_service, const std::string &user, const std::string &passwd, const std::string &host, long port,
+                                           bool compress, bool *compressed,
+                                           boost::uint32_t server_id)
 {
 
   tcp::resolver resolver(io_service);
@@ -164,8 +186,12 @@ tcp::socket *sync_connect_and_authenticate(boost::asio::io_service &io_service,
 
   proto_get_handshake_package(server_stream, handshake_package, packet_length);
 
-  if (authenticate(socket, user, passwd, handshake_package))
+  if (authenticate(socket, user, passwd, handshake_package, compress))
     return 0;
+  compress= compress &&
+            (handshake_package.server_capabilities & CLIENT_COMPRESS) != 0;
+  if (compressed)
+    *compressed= compress;
 
   /*
    * Register slave to master
@@ -175,7 +201,8 @@ tcp::socket *sync_connect_and_authenticate(boost::asio::io_service &io_service,
 
   
   static boost::uint8_t com_register_slave = COM_REGISTER_SLAVE;
-  boost::uint32_t server_id = 1;
+  if (server_id == 0)
+    server_id = default_server_id();
   boost::uint32_t rpl_recovery_rank = 0;
   
   Protocol_chunk<boost::uint8_t> prot_command(com_register_slave);
@@ -183,17 +210,6 @@ tcp::socket *sync_connect_and_authenticate(boost::asio::io_service &io_service,
   Protocol_chunk<boost::uint32_t> prot_rpl_recovery_rank(rpl_recovery_rank);
   Protocol_chunk<boost::uint32_t> prot_server_id(server_id);
 
-  const char* env_libreplication_server_id = std::getenv("LIBREPLICATION_SERVER_ID");
-
-  if (env_libreplication_server_id != 0) {
-    try {
-      boost::uint32_t libreplication_server_id = boost::lexical_cast<boost::uint32_t>(env_libreplication_server_id);
-      prot_server_id = libreplication_server_id;
-    } catch (boost::bad_lexical_cast e) {
-      // XXX: nothing to do
-    }
-  }
-
   boost::uint32_t master_server_id = 0;
   boost::uint8_t host_size = host.size();
   boost::uint8_t user_size = user.size();
@@ -216,24 +232,18 @@ tcp::socket *sync_connect_and_authenticate(boost::asio::io_service &io_service,
           << prot_rpl_recovery_rank
           << prot_master_server_id;
 
-  int size=server_messages.size();
-  char command_packet_header[4];
   try {
-    write_packet_header(command_packet_header, size, 0); // packet_no= 0
-
     // Send the request.
-    boost::asio::write(*socket,
-                       boost::asio::buffer(command_packet_header, 4),
-                       boost::asio::transfer_at_least(4));
-    boost::asio::write(*socket, server_messages,
-                       boost::asio::transfer_at_least(size));
+    proto_write_packet(socket, server_messages, 0, compress);
   } catch( boost::system::error_code e)
   {
     return 0;
   }
 
   // Get Ok-package
-  packet_length=proto_get_one_package(socket, server_messages, &packet_no);
+  Packet_inflater inflater;
+  packet_length=proto_get_one_package(socket, server_messages, &packet_no,
+                                      compress ? &inflater : 0);
 
   std::istream cmd_response_stream(&server_messages);
 
@@ -264,23 +274,12 @@ tcp::socket *sync_connect_and_authenticate(boost::asio::io_service &io_service,
 
   static boost::uint8_t com_binlog_dump = COM_BINLOG_DUMP;
   static boost::uint16_t binlog_flags = 0;
-  static boost::uint32_t server_id = 1;
+  boost::uint32_t server_id = m_server_id ? m_server_id : default_server_id();
   Protocol_chunk<boost::uint8_t>  prot_command(com_binlog_dump);
   Protocol_chunk<boost::uint32_t> prot_binlog_offset(offset); // binlog position to start at
   Protocol_chunk<boost::uint16_t> prot_binlog_flags(binlog_flags); // not used
   Protocol_chunk<boost::uint32_t> prot_server_id(server_id); // must not be 0; see handshake package
 
-  const char* env_libreplication_server_id = std::getenv("LIBREPLICATION_SERVER_ID");
-
-  if (env_libreplication_server_id != 0) {
-    try {
-      boost::uint32_t libreplication_server_id = boost::lexical_cast<boost::uint32_t>(env_libreplication_server_id);
-      prot_server_id = libreplication_server_id;
-    } catch (boost::bad_lexical_cast e) {
-      // XXX: nothing to do
-    }
-  }
-
   command_request_stream
           << prot_command
           << prot_binlog_offset
@@ -288,27 +287,19 @@ tcp::socket *sync_connect_and_authenticate(boost::asio::io_service &io_service,
           << prot_server_id
           << binlog_file_name;
 
-  int size=server_messages.size();
-  char command_packet_header[4];
-  write_packet_header(command_packet_header, size, 0);
-
   // Send the request.
-  boost::asio::write(*m_socket,
-                     boost::asio::buffer(command_packet_header, 4),
-                     boost::asio::transfer_at_least(4));
-  boost::asio::write(*m_socket, server_messages,
-                     boost::asio::transfer_at_least(size));
+  proto_write_packet(m_socket, server_messages, 0, m_compressed);
 
   /*
    Start receiving binlog events.
    */
   if (!m_shutdown)
-    GET_NEXT_PACKET_HEADER;
+    start_receive();
 
   /*
    Start the event loop in a new thread
    */
-  if (!m_event_loop)
+  if (!m_event_loop && !m_inline)
     m_event_loop= new boost::thread(boost::bind(&Binlog_tcp_driver::start_event_loop, this));
 
 }
@@ -316,146 +307,469 @@ tcp::socket *sync_connect_and_authenticate(boost::asio::io_service &io_service,
 /**
  Helper function used to extract the event header from a memory block
  */
-static void proto_event_packet_header(boost::asio::streambuf &event_src, Log_event_header *h)
+static void proto_event_packet_header(buffer_source &event_src, Log_event_header *h)
 {
-  std::istream is(&event_src);
-
   Protocol_chunk<boost::uint8_t> prot_marker(h->marker);
-  Protocol_chunk<boost::uint32_t> prot_timestamp(h->timestamp);
-  Protocol_chunk<boost::uint8_t> prot_type_code(h->type_code);
-  Protocol_chunk<boost::uint32_t> prot_server_id(h->server_id);
-  Protocol_chunk<boost::uint32_t> prot_event_length(h->event_length);
-  Protocol_chunk<boost::uint32_t> prot_next_position(h->next_position);
-  Protocol_chunk<boost::uint16_t> prot_flags(h->flags);
-
-  is >> prot_marker
-          >> prot_timestamp
-          >> prot_type_code
-          >> prot_server_id
-          >> prot_event_length
-          >> prot_next_position
-          >> prot_flags;
+
+  event_src >> prot_marker;
+  proto_event_header(event_src, h);
+}
+
+void Binlog_tcp_driver::start_receive()
+{
+  /* Nothing after the lost events is read from this connection. */
+  if (m_spill_lost)
+    return;
+
+  /* Everything received so far is handled; the relay log can catch up. */
+  if (m_relay)
+    m_relay->flush();
+  m_receiving= true;
+  if (m_compressed)
+  {
+    if (!m_compressed_buffer)
+      m_compressed_buffer= make_buffer(RECEIVE_BUFFER_SIZE);
+    std::size_t pending= m_compressed_end - m_compressed_begin;
+    memmove(m_compressed_buffer.get(),
+            m_compressed_buffer.get() + m_compressed_begin, pending);
+    m_compressed_begin= 0;
+    m_compressed_end= pending;
+
+    m_socket->async_read_some(boost::asio::buffer(m_compressed_buffer.get() + m_compressed_end,
+                                                  RECEIVE_BUFFER_SIZE - m_compressed_end),
+                              boost::bind(&Binlog_tcp_driver::handle_compressed_read,
+                                          this,
+                                          boost::asio::placeholders::error,
+                                          boost::asio::placeholders::bytes_transferred));
+    return;
+  }
+
+  prepare_receive_buffer();
+  m_socket->async_read_some(boost::asio::buffer(m_receive_buffer.get() + m_receive_end,
+                                                RECEIVE_BUFFER_SIZE - m_receive_end),
+                            boost::bind(&Binlog_tcp_driver::handle_net_read,
+                                        this,
+                                        boost::asio::placeholders::error,
+                                        boost::asio::placeholders::bytes_transferred));
+}
+
+void Binlog_tcp_driver::prepare_receive_buffer()
+{
+  std::size_t pending= m_receive_end - m_receive_begin;
+
+  if (!m_receive_buffer)
+    m_receive_buffer= make_buffer(RECEIVE_BUFFER_SIZE);
+
+  if (m_receive_buffer.unique())
+  {
+    memmove(m_receive_buffer.get(),
+            m_receive_buffer.get() + m_receive_begin, pending);
+    m_receive_begin= 0;
+    m_receive_end= pending;
+  }
+  else if (RECEIVE_BUFFER_SIZE - m_receive_end < RECEIVE_BUFFER_SIZE / 8)
+  {
+    /*
+      Events still refer to the bytes already handled, so the partial
+      packet is moved to a new buffer instead.
+    */
+    boost::shared_ptr<boost::uint8_t> buffer= make_buffer(RECEIVE_BUFFER_SIZE);
+    memcpy(buffer.get(), m_receive_buffer.get() + m_receive_begin, pending);
+    m_receive_buffer.swap(buffer);
+    m_receive_begin= 0;
+    m_receive_end= pending;
+  }
+}
+
+void Binlog_tcp_driver::handle_net_read(const boost::system::error_code& err, std::size_t bytes_transferred)
+{
+  m_receiving= false;
+  if (err)
+  {
+    Binary_log_event * ev= create_incident_event(175, err.message().c_str(), m_binlog_offset);
+    queue_event(ev);
+    return;
+  }
+
+  m_receive_end+= bytes_transferred;
+
+  if (!handle_received_packets())
+  {
+    /* The rest of the packet is read straight into the event buffer. */
+    m_receiving= true;
+    boost::asio::async_read(*m_socket,
+                            boost::asio::buffer(m_event_buffer.get() + m_event_buffer_used,
+                                                m_packet_pending),
+                            boost::bind(&Binlog_tcp_driver::handle_net_packet,
+                                        this,
+                                        boost::asio::placeholders::error,
+                                        boost::asio::placeholders::bytes_transferred));
+    return;
+  }
+
+  if (!m_shutdown)
+    start_receive();
 }
 
 void Binlog_tcp_driver::handle_net_packet(const boost::system::error_code& err, std::size_t bytes_transferred)
 {
+  m_receiving= false;
+  if (err)
+  {
+    Binary_log_event * ev= create_incident_event(175, err.message().c_str(), m_binlog_offset);
+    queue_event(ev);
+    return;
+  }
+
+  m_packet_pending= 0;
+  process_event_buffer(bytes_transferred);
+
+  if (!m_shutdown)
+    start_receive();
+}
+
+void Binlog_tcp_driver::handle_compressed_read(const boost::system::error_code& err, std::size_t bytes_transferred)
+{
+  m_receiving= false;
   if (err)
   {
     Binary_log_event * ev= create_incident_event(175, err.message().c_str(), m_binlog_offset);
-    m_event_queue->push_front(ev);
+    queue_event(ev);
     return;
   }
 
-  if (bytes_transferred > MAX_PACKAGE_SIZE || bytes_transferred == 0)
+  m_compressed_end+= bytes_transferred;
+  const boost::uint8_t *input= m_compressed_buffer.get() + m_compressed_begin;
+  const boost::uint8_t *input_end= m_compressed_buffer.get() + m_compressed_end;
+  std::size_t inflated;
+  bool valid;
+
+  /*
+    Inflate until the input runs out. There is always room for output, as
+    complete packets are handled as soon as they are inflated.
+  */
+  do
   {
-    std::ostringstream os;
-    os << "Expected byte size to be between 0 and "
-       << MAX_PACKAGE_SIZE
-       << " number of bytes; got "
-       << bytes_transferred
-       << " instead.";
-    Binary_log_event * ev= create_incident_event(175, os.str().c_str(), m_binlog_offset);
-    m_event_queue->push_front(ev);
+    if (m_packet_pending > 0)
+    {
+      valid= m_inflater.inflate(&input, input_end,
+                                m_event_buffer.get() + m_event_buffer_used,
+                                m_packet_pending, &inflated);
+      m_event_buffer_used+= inflated;
+      m_packet_pending-= inflated;
+      if (m_packet_pending == 0)
+        process_event_buffer(0);
+    }
+    else
+    {
+      prepare_receive_buffer();
+      valid= m_inflater.inflate(&input, input_end,
+                                m_receive_buffer.get() + m_receive_end,
+                                RECEIVE_BUFFER_SIZE - m_receive_end, &inflated);
+      m_receive_end+= inflated;
+      handle_received_packets();
+    }
+  } while (valid && inflated > 0);
+  m_compressed_begin= input - m_compressed_buffer.get();
+
+  if (!valid)
+  {
+    Binary_log_event * ev= create_incident_event(175, "Received an invalid compressed packet.",
+                                                 m_binlog_offset);
+    queue_event(ev);
+    return;
+  }
+
+  if (!m_shutdown)
+    start_receive();
+}
+
+bool Binlog_tcp_driver::handle_received_packets()
+{
+  while (m_receive_end - m_receive_begin >= 4)
+  {
+    const boost::uint8_t *net_header= m_receive_buffer.get() + m_receive_begin;
+    std::size_t packet_length= (std::size_t) net_header[0];
+    packet_length+= (std::size_t) (net_header[1] << 8);
+    packet_length+= (std::size_t) (net_header[2] << 16);
+
+    // TODO validate packet sequence numbers
+    //int packet_no=(unsigned char) net_header[3];
+
+    std::size_t available= m_receive_end - m_receive_begin - 4;
+    if (available < packet_length)
+    {
+      if (packet_length + 4 <= RECEIVE_BUFFER_SIZE)
+        break;
+
+      /* The packet will never fit in the receive buffer. */
+      m_receive_begin= m_receive_end;
+      reserve_event_buffer(packet_length);
+      memcpy(m_event_buffer.get() + m_event_buffer_used, net_header + 4, available);
+      m_event_buffer_used+= available;
+      m_packet_pending= packet_length - available;
+      return false;
+    }
+
+    m_receive_begin+= 4 + packet_length;
+    handle_event_packet(net_header + 4, packet_length);
+  }
+  return true;
+}
+
+void Binlog_tcp_driver::handle_event_packet(const boost::uint8_t *packet, std::size_t length)
+{
+  /*
+    An event filling its last packet exactly is followed by an empty one,
+    which ends the event that is already complete.
+  */
+  if (length == 0 && m_waiting_event == 0)
     return;
+
+  if (m_waiting_event == 0 && length >= LOG_EVENT_HEADER_SIZE)
+  {
+    Log_event_header header;
+    buffer_source header_src(packet, LOG_EVENT_HEADER_SIZE);
+    proto_event_packet_header(header_src, &header);
+    if (header.event_length == length - 1)
+    {
+      /*
+        The whole event is in this packet. It is decoded where it is and
+        shares the receive buffer.
+      */
+      queue_event(m_receive_buffer, packet + 1, length - 1, &header);
+      return;
+    }
+  }
+
+  reserve_event_buffer(length);
+  memcpy(m_event_buffer.get() + m_event_buffer_used, packet, length);
+  process_event_buffer(length);
+}
+
+void Binlog_tcp_driver::reserve_event_buffer(std::size_t length)
+{
+  if (m_waiting_event == 0)
+  {
+    m_waiting_event= new Log_event_header();
+    m_event_buffer= make_buffer(length);
+    m_event_buffer_size= length;
+    m_event_buffer_used= 0;
+  }
+  else if (m_event_buffer_used + length > m_event_buffer_size)
+  {
+    /* The event continues in this packet; make room for it. */
+    boost::shared_ptr<boost::uint8_t> buffer=
+      make_buffer(m_event_buffer_used + length);
+    memcpy(buffer.get(), m_event_buffer.get(), m_event_buffer_used);
+    m_event_buffer.swap(buffer);
+    m_event_buffer_size= m_event_buffer_used + length;
   }
+}
 
-  //assert(m_waiting_event != 0);
-  //std::cerr << "Committing '"<< bytes_transferred << "' bytes to the event stream." << std::endl;
-  m_event_stream_buffer.commit(bytes_transferred);
+void Binlog_tcp_driver::process_event_buffer(std::size_t bytes_transferred)
+{
+  m_event_buffer_used+= bytes_transferred;
   /*
     If the event object doesn't have an event length it means that the header
-    hasn't been parsed. If the event stream also contains enough bytes
-    we make the assumption that the next bytes waiting in the stream is
+    hasn't been parsed. If the buffer also contains enough bytes
+    we make the assumption that the first bytes in the buffer are
     the event header and attempt to parse it.
    */
-  if (m_waiting_event->event_length == 0 && m_event_stream_buffer.size() >= 19)
+  if (m_waiting_event->event_length == 0 &&
+      m_event_buffer_used >= LOG_EVENT_HEADER_SIZE)
   {
+    buffer_source header_src(m_event_buffer.get(), LOG_EVENT_HEADER_SIZE);
+    proto_event_packet_header(header_src, m_waiting_event);
+
+    std::size_t event_size= (std::size_t) m_waiting_event->event_length + 1;
+    if (event_size < LOG_EVENT_HEADER_SIZE || event_size > MAX_EVENT_SIZE)
+    {
+      std::ostringstream os;
+      os << "Expected event size to be between "
+         << LOG_EVENT_HEADER_SIZE - 1 << " and " << MAX_EVENT_SIZE
+         << " bytes; got " << m_waiting_event->event_length << " instead.";
+      discard_event_buffer(os.str());
+      return;
+    }
+
     /*
-      Copy and remove from the event stream, the remaining bytes might be
-      dynamic payload.
-     */
-    //std::cerr << "Consuming event stream for header. Size before: " << m_event_stream_buffer.size() << std::endl;
-    proto_event_packet_header(m_event_stream_buffer, m_waiting_event);
-    //std::cerr << " Size after: " << m_event_stream_buffer.size() << std::endl;
+      The rest of the event follows in continuation packets; make room
+      for all of it at once.
+    */
+    if (event_size > m_event_buffer_size)
+    {
+      boost::shared_ptr<boost::uint8_t> buffer= make_buffer(event_size);
+      memcpy(buffer.get(), m_event_buffer.get(), m_event_buffer_used);
+      m_event_buffer.swap(buffer);
+      m_event_buffer_size= event_size;
+    }
   }
 
-  //std::cerr << "Event length: " << m_waiting_event->header()->event_length << " and available payload size is " << m_event_stream_buffer.size()+LOG_EVENT_HEADER_SIZE-1 <<  std::endl;
-  if (m_waiting_event->event_length == m_event_stream_buffer.size() + LOG_EVENT_HEADER_SIZE - 1)
+  if (m_waiting_event->event_length != 0 &&
+      m_event_buffer_used - 1 > m_waiting_event->event_length)
+  {
+    std::ostringstream os;
+    os << "Received " << m_event_buffer_used - 1
+       << " bytes for an event of " << m_waiting_event->event_length
+       << " bytes.";
+    discard_event_buffer(os.str());
+    return;
+  }
+
+  if (m_event_buffer_used >= LOG_EVENT_HEADER_SIZE &&
+      m_waiting_event->event_length == m_event_buffer_used - 1)
   {
     /*
      If the header length equals the size of the payload plus the
      size of the header, the event object is complete.
-     Next we need to parse the payload buffer
+     Next we need to parse the payload, which the event will share
+     with us rather than copy.
      */
-    std::istream is(&m_event_stream_buffer);
-    Binary_log_event * event= parse_event(is, m_waiting_event);
+    boost::shared_ptr<boost::uint8_t> buffer;
+    buffer.swap(m_event_buffer);
+    std::size_t used= m_event_buffer_used;
+    m_event_buffer_size= 0;
+    m_event_buffer_used= 0;
 
-    m_event_stream_buffer.consume(m_event_stream_buffer.size());
+    queue_event(buffer, buffer.get() + 1, used - 1, m_waiting_event);
 
-    m_event_queue->push_front(event);
-
-    /*
-      Note on memory management: The pushed Binary_log_event will be
-      deleted in user land.
-    */
     delete m_waiting_event;
     m_waiting_event= 0;
   }
+}
 
-  if (!m_shutdown)
-    GET_NEXT_PACKET_HEADER;
-
+void Binlog_tcp_driver::discard_event_buffer(const std::string &message)
+{
+  Binary_log_event * ev= create_incident_event(175, message.c_str(), m_binlog_offset);
+  m_event_buffer.reset();
+  m_event_buffer_size= 0;
+  m_event_buffer_used= 0;
+  delete m_waiting_event;
+  m_waiting_event= 0;
+  queue_event(ev);
 }
 
-void Binlog_tcp_driver::handle_net_packet_header(const boost::system::error_code& err, std::size_t bytes_transferred)
+void Binlog_tcp_driver::queue_event(const Buffer_owner &owner,
+                                    const boost::uint8_t *event,
+                                    std::size_t length,
+                                    Log_event_header *header)
 {
-  if (err)
-  {
-    Binary_log_event * ev= create_incident_event(175, err.message().c_str(), m_binlog_offset);
-    m_event_queue->push_front(ev);
+  if (m_spill_lost)
     return;
+
+  if (m_relay && !m_relay->write(event, length, header))
+    queue_event(create_incident_event(175, "Failed to write the relay log.",
+                                      m_binlog_offset));
+
+  if (!m_inline && m_spill &&
+      (m_spill->depth() > 0 || !m_event_queue->has_room(length)))
+  {
+    if (m_spill->write(Byte_view(owner, event, length)))
+    {
+      m_spill_depth.store(m_spill->depth());
+      m_spill_bytes.store(m_spill->bytes());
+      /*
+        The application may have made room after the check above without
+        seeing the spilled event; see request_refill().
+      */
+      boost::atomic_thread_fence(boost::memory_order_seq_cst);
+      refill_queue(false);
+      return;
+    }
+    /* The spill is full; keep the order by waiting for all of it. */
+    refill_queue(true);
   }
 
-  if (bytes_transferred != 4)
+  Binary_log_event * ev=
+    parse_event(owner, event + LOG_EVENT_HEADER_SIZE - 1,
+                length - (LOG_EVENT_HEADER_SIZE - 1), header);
+  /*
+    Note on memory management: The pushed Binary_log_event will be
+    deleted in user land.
+  */
+  if (m_inline)
+    m_ready_events.push_back(ev);
+  else
+    push_event(ev, length);
+}
+
+void Binlog_tcp_driver::queue_event(Binary_log_event *event)
+{
+  if (m_inline)
   {
-    std::ostringstream os;
-    os << "Expected byte size to be between 0 and "
-       << MAX_PACKAGE_SIZE
-       << " number of bytes; got "
-       << bytes_transferred
-       << " instead.";
-    Binary_log_event * ev= create_incident_event(175, os.str().c_str(), m_binlog_offset);
-    m_event_queue->push_front(ev);
+    m_ready_events.push_back(event);
     return;
   }
+  if (m_spill && m_spill->depth() > 0)
+    refill_queue(true);
+  m_event_queue->push_front(event, event->header()->event_length);
+}
 
-  int packet_length=(unsigned long) (m_net_header[0] &0xFF);
-  packet_length+=(unsigned long) ((m_net_header[1] &0xFF) << 8);
-  packet_length+=(unsigned long) ((m_net_header[2] &0xFF) << 16);
-
-  // TODO validate packet sequence numbers
-  //int packet_no=(unsigned char) m_net_header[3];
+void Binlog_tcp_driver::refill_queue(bool wait)
+{
+  m_refill_posted.store(false);
+  if (!m_spill)
+    return;
 
-  if (m_waiting_event == 0)
+  Byte_view event;
+  while (m_spill->depth() > 0)
   {
-    //std::cerr << "event_stream_buffer.size= " << m_event_stream_buffer.size() << std::endl;
-    m_waiting_event= new Log_event_header();
-    m_event_packet=  boost::asio::buffer_cast<char *>(m_event_stream_buffer.prepare(packet_length));
-    //assert(m_event_stream_buffer.size() == 0);
-  }
+    if (!m_spill->front(&event))
+    {
+      /*
+        The rest of the spilled events are lost. Like after a network
+        error, tell the application where they start and stop receiving,
+        so none of the later events are delivered after the gap.
+      */
+      m_spill->clear();
+      m_spill_depth.store(0);
+      m_spill_bytes.store(0);
+      m_spill_lost= true;
+      std::ostringstream os;
+      os << "Failed to read the spilled events after "
+         << m_binlog_file_name << ":" << m_queued_position << ".";
+      Binary_log_event *incident=
+        create_incident_event(175, os.str().c_str(), m_queued_position);
+      m_event_queue->push_front(incident, incident->header()->event_length);
+      break;
+    }
+    if (!wait && !m_event_queue->has_room(event.size()))
+      break;
 
+    Log_event_header header;
+    buffer_source header_src(event.data(), LOG_EVENT_HEADER_SIZE - 1);
+    proto_event_header(header_src, &header);
+    Binary_log_event * ev=
+      parse_event(event.owner(), event.data() + LOG_EVENT_HEADER_SIZE - 1,
+                  event.size() - (LOG_EVENT_HEADER_SIZE - 1), &header);
+    m_spill->pop();
+    m_spill_depth.store(m_spill->depth());
+    m_spill_bytes.store(m_spill->bytes());
+    push_event(ev, event.size());
+  }
+}
 
-  boost::asio::async_read(*m_socket,
-                          boost::asio::buffer(m_event_packet, packet_length),
-                          boost::bind(&Binlog_tcp_driver::handle_net_packet,
-                                      this,
-                                      boost::asio::placeholders::error,
-                                      boost::asio::placeholders::bytes_transferred));
+void Binlog_tcp_driver::push_event(Binary_log_event *event, std::size_t length)
+{
+  if (event->header()->next_position != 0)
+    m_queued_position= event->header()->next_position;
+  m_event_queue->push_front(event, length);
+}
 
+void Binlog_tcp_driver::request_refill()
+{
+  /*
+    Taking events off the queue is followed by a full fence, which pairs
+    with the one in queue_event() after spilling: either the event loop
+    sees the room or we see the spilled event.
+  */
+  if (m_spill_depth.load() > 0 && !m_refill_posted.exchange(true))
+    m_io_service.post(boost::bind(&Binlog_tcp_driver::refill_queue, this, false));
 }
 
     int authenticate(tcp::socket *socket, const std::string& user, const std::string& passwd,
-                     const st_handshake_package &handshake_package)
+                     const st_handshake_package &handshake_package, bool compress)
 {
   try
   {
@@ -481,7 +795,9 @@ void Binlog_tcp_driver::handle_net_packet_header(const boost::system::error_code
     if (passwd.size() > 0)
       passwd_length= encrypt_password(reply, scramble_buff, passwd.c_str());
 
-    static boost::uint32_t client_basic_flags = CLIENT_BASIC_FLAGS;
+    boost::uint32_t client_basic_flags = CLIENT_BASIC_FLAGS;
+    if (compress && (handshake_package.server_capabilities & CLIENT_COMPRESS))
+      client_basic_flags|= CLIENT_COMPRESS;
     static boost::uint32_t max_packet_size = MAX_PACKAGE_SIZE;
     
     Protocol_chunk<boost::uint32_t> prot_client_flags(client_basic_flags);
@@ -555,10 +871,76 @@ int Binlog_tcp_driver::wait_for_next_event(mysql::Binary_log_event **event_ptr)
   // return the event
   if (event_ptr)
     *event_ptr= 0;
+  if (m_inline)
+  {
+    run_inline(WAIT_FOREVER);
+    *event_ptr= m_ready_events.front();
+    m_ready_events.pop_front();
+    return 0;
+  }
   m_event_queue->pop_back(event_ptr);
+  request_refill();
   return 0;
 }
 
+int Binlog_tcp_driver::wait_for_next_events(std::vector<mysql::Binary_log_event *> *events,
+                                            std::size_t max_events,
+                                            unsigned long timeout_ms)
+{
+  if (m_inline)
+  {
+    if (max_events > 0)
+      run_inline(timeout_ms);
+    for (std::size_t count= 0; count < max_events && !m_ready_events.empty(); ++count)
+    {
+      events->push_back(m_ready_events.front());
+      m_ready_events.pop_front();
+    }
+    return 0;
+  }
+  m_event_queue->pop_back_n(events, max_events, timeout_ms);
+  request_refill();
+  return 0;
+}
+
+void Binlog_tcp_driver::run_inline(unsigned long timeout_ms)
+{
+  boost::asio::deadline_timer timer(m_io_service);
+  m_inline_timed_out= false;
+  ++m_inline_wait;
+  if (timeout_ms != WAIT_FOREVER)
+  {
+    timer.expires_from_now(boost::posix_time::milliseconds(timeout_ms));
+    timer.async_wait(boost::bind(&Binlog_tcp_driver::handle_inline_timeout,
+                                 this, boost::asio::placeholders::error,
+                                 m_inline_wait));
+  }
+
+  while (m_ready_events.empty() && !m_inline_timed_out)
+  {
+    if (!m_receiving)
+    {
+      /* The last read failed, or connecting did. */
+      m_io_service.reset();
+      reconnect();
+      if (!m_receiving && timeout_ms != WAIT_FOREVER)
+        break;
+      continue;
+    }
+
+    boost::system::error_code err;
+    if (m_io_service.run_one(err) == 0)
+      m_io_service.reset();
+  }
+}
+
+void Binlog_tcp_driver::handle_inline_timeout(const boost::system::error_code& err,
+                                              unsigned long wait)
+{
+  if (!err && wait == m_inline_wait)
+    m_inline_timed_out= true;
+}
+
 void Binlog_tcp_driver::start_event_loop()
 {
   while (true)
@@ -609,16 +991,23 @@ void Binlog_tcp_driver::reconnect()
 
 void Binlog_tcp_driver::disconnect()
 {
-  Binary_log_event * event;
+  delete m_waiting_event;
   m_waiting_event= 0;
-  m_event_stream_buffer.consume(m_event_stream_buffer.in_avail());
-  while(m_event_queue->has_unread())
-  {
-    m_event_queue->pop_back(&event);
-    delete(event);
-  }
+  m_receive_buffer.reset();
+  m_receive_begin= 0;
+  m_receive_end= 0;
+  m_compressed_buffer.reset();
+  m_compressed_begin= 0;
+  m_compressed_end= 0;
+  m_compressed= false;
+  m_inflater.reset();
+  m_packet_pending= 0;
+  m_event_buffer.reset();
+  m_event_buffer_size= 0;
+  m_event_buffer_used= 0;
   if (m_socket)
     m_socket->close();
+  delete m_socket;
   m_socket= 0;
 }
 
@@ -629,6 +1018,26 @@ void Binlog_tcp_driver::shutdown(void)
   m_io_service.stop();
 }
 
+void Binlog_tcp_driver::stop_event_loop()
+{
+  if (!m_event_loop)
+    return;
+  m_io_service.post(boost::bind(&Binlog_tcp_driver::shutdown, this));
+  std::vector<Binary_log_event *> events;
+  while (!m_event_loop->timed_join(boost::posix_time::milliseconds(10)))
+  {
+    /* Unlike has_unread(), this wakes up a thread waiting for room. */
+    while (m_event_queue->pop_back_n(&events, EVENT_QUEUE_MAX_SIZE, 0) > 0)
+    {
+      for (std::size_t i= 0; i < events.size(); ++i)
+        delete events[i];
+      events.clear();
+    }
+  }
+  delete m_event_loop;
+  m_event_loop= 0;
+}
+
 int Binlog_tcp_driver::set_position(const std::string &str, unsigned long position)
 {
   /*
@@ -639,11 +1048,14 @@ int Binlog_tcp_driver::set_position(const std::string &str, unsigned long positi
   boost::asio::io_service io_service;
   tcp::socket *socket;
 
-  if ((socket= sync_connect_and_authenticate(io_service, m_user, m_passwd, m_host, m_port)) == 0)
+  bool compressed;
+  if ((socket= sync_connect_and_authenticate(io_service, m_user, m_passwd, m_host, m_port,
+                                             m_compress, &compressed,
+                                             m_server_id)) == 0)
     return ERR_FAIL;
 
   std::map<std::string, unsigned long > binlog_map;
-  fetch_binlogs_name_and_size(socket, binlog_map);
+  fetch_binlogs_name_and_size(socket, binlog_map, compressed);
   socket->close();
   delete socket;
 
@@ -667,14 +1079,33 @@ int Binlog_tcp_driver::set_position(const std::string &str, unsigned long positi
     By posting to the io service we guarantee that the operations are
     executed in the same thread as the io_service is running in.
   */
-  if (m_event_loop)
+  stop_event_loop();
+  disconnect();
+
+  /* Events from the old position are not wanted any more. */
+  Binary_log_event * event;
+  if (m_inline)
   {
-    m_io_service.post(boost::bind(&Binlog_tcp_driver::shutdown, this));
-    m_event_loop->join();
-    delete(m_event_loop);
+    /* Let the reads which were just cancelled finish. */
+    m_io_service.poll();
+    m_io_service.reset();
+    m_receiving= false;
+    while (!m_ready_events.empty())
+    {
+      delete m_ready_events.front();
+      m_ready_events.pop_front();
+    }
   }
-  m_event_loop= 0;
-  disconnect();
+  else while(m_event_queue->has_unread())
+  {
+    m_event_queue->pop_back(&event);
+    delete(event);
+  }
+  if (m_spill)
+    m_spill->clear();
+  m_spill_depth.store(0);
+  m_spill_bytes.store(0);
+
   /*
     Uppon return of connect we only know if we succesfully authenticated
     against the server. The binlog dump command is executed asynchronously
@@ -692,10 +1123,13 @@ int Binlog_tcp_driver::get_position(std::string *filename_ptr, unsigned long *po
 
   tcp::socket *socket;
 
-  if ((socket=sync_connect_and_authenticate(io_service, m_user, m_passwd, m_host, m_port)) == 0)
+  bool compressed;
+  if ((socket=sync_connect_and_authenticate(io_service, m_user, m_passwd, m_host, m_port,
+                                            m_compress, &compressed,
+                                            m_server_id)) == 0)
     return ERR_FAIL;
 
-  if (fetch_master_status(socket, &m_binlog_file_name, &m_binlog_offset))
+  if (fetch_master_status(socket, &m_binlog_file_name, &m_binlog_offset, compressed))
     return ERR_FAIL;
 
   socket->close();
@@ -707,7 +1141,15 @@ int Binlog_tcp_driver::get_position(std::string *filename_ptr, unsigned long *po
   return ERR_OK;
 }
 
-bool fetch_master_status(tcp::socket *socket, std::string *filename, unsigned long *position)
+bool is_dump_preamble_event(Binary_log_event *event)
+{
+  int type= event->get_event_type();
+  return event->header()->next_position == 0 &&
+         (type == ROTATE_EVENT || type == FORMAT_DESCRIPTION_EVENT);
+}
+
+bool fetch_master_status(tcp::socket *socket, std::string *filename, unsigned long *position,
+                         bool compressed)
 {
   boost::asio::streambuf server_messages;
 
@@ -719,15 +1161,10 @@ bool fetch_master_status(tcp::socket *socket, std::string *filename, unsigned lo
   command_request_stream << prot_command
           << "SHOW MASTER STATUS";
 
-  int size=server_messages.size();
-  char command_packet_header[4];
-  write_packet_header(command_packet_header, size, 0);
-
   // Send the request.
-  boost::asio::write(*socket, boost::asio::buffer(command_packet_header, 4), boost::asio::transfer_at_least(4));
-  boost::asio::write(*socket, server_messages, boost::asio::transfer_at_least(size));
+  proto_write_packet(socket, server_messages, 0, compressed);
 
-  Result_set result_set(socket);
+  Result_set result_set(socket, compressed);
 
   Converter conv;
   BOOST_FOREACH(Row_of_fields row, result_set)
@@ -741,7 +1178,8 @@ bool fetch_master_status(tcp::socket *socket, std::string *filename, unsigned lo
   return false;
 }
 
-bool fetch_binlogs_name_and_size(tcp::socket *socket, std::map<std::string, unsigned long> &binlog_map)
+bool fetch_binlogs_name_and_size(tcp::socket *socket, std::map<std::string, unsigned long> &binlog_map,
+                                 bool compressed)
 {
   boost::asio::streambuf server_messages;
 
@@ -753,15 +1191,10 @@ bool fetch_binlogs_name_and_size(tcp::socket *socket, std::map<std::string, unsi
   command_request_stream << prot_command
           << "SHOW BINARY LOGS";
 
-  int size=server_messages.size();
-  char command_packet_header[4];
-  write_packet_header(command_packet_header, size, 0);
-
   // Send the request.
-  boost::asio::write(*socket, boost::asio::buffer(command_packet_header, 4), boost::asio::transfer_at_least(4));
-  boost::asio::write(*socket, server_messages, boost::asio::transfer_at_least(size));
+  proto_write_packet(socket, server_messages, 0, compressed);
 
-  Result_set result_set(socket);
+  Result_set result_set(socket, compressed);
 
   Converter conv;
   BOOST_FOREACH(Row_of_fields row, result_set)
@@ -770,7 +1203,7 @@ bool fetch_binlogs_name_and_size(tcp::socket *socket, std::map<std::string, unsi
     long position;
     conv.to(filename, row[0]);
     conv.to(position, row[1]);
-    binlog_map.insert(std::make_pair<std::string, unsigned long>(filename, (unsigned long)position));
+    binlog_map.insert(std::make_pair(filename, (unsigned long)position));
   }
   return false;
 }
@@ -0,0 +1,320 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#include "time_index.h"
+#include "binlog_api.h"
+#include "file_driver.h"
+#include "compressed_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mysql { namespace system {
+
+namespace {
+
+const char index_magic[]= { 'T', 'I', 'D', 'X' };
+const std::size_t index_header_size= sizeof(index_magic);
+const std::size_t index_entry_size= 4 + 8 + 8;
+
+boost::uint64_t read_le(const boost::uint8_t *data, int length)
+{
+  boost::uint64_t value= 0;
+  for (int i= length - 1; i >= 0; --i)
+    value= (value << 8) | data[i];
+  return value;
+}
+
+void write_le(std::string *out, boost::uint64_t value, int length)
+{
+  for (int i= 0; i < length; ++i, value>>= 8)
+    out->push_back((char) (value & 0xff));
+}
+
+/**
+ * A binlog file mapped into memory for as long as the object lives.
+ */
+class Mapped_file
+{
+public:
+  Mapped_file(const std::string &path) : m_data(0), m_size(0)
+  {
+    /* The events of a compressed file can't be walked in place. */
+    if (Compressed_file::is_compressed(path))
+      return;
+    int fd= open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+      return;
+    struct stat stat_buff;
+    if (fstat(fd, &stat_buff) == 0 && stat_buff.st_size >= MAGIC_NUMBER_SIZE)
+    {
+      void *data= mmap(0, stat_buff.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (data != MAP_FAILED)
+      {
+        m_data= static_cast<const boost::uint8_t *>(data);
+        m_size= stat_buff.st_size;
+      }
+    }
+    close(fd);
+  }
+
+  ~Mapped_file()
+  {
+    if (m_data)
+      munmap(const_cast<boost::uint8_t *>(m_data), m_size);
+  }
+
+  bool good() const { return m_data != 0; }
+  const boost::uint8_t *data() const { return m_data; }
+  unsigned long size() const { return m_size; }
+
+private:
+  Mapped_file(const Mapped_file &);
+  Mapped_file &operator=(const Mapped_file &);
+
+  const boost::uint8_t *m_data;
+  unsigned long m_size;
+};
+
+/**
+ * Walks the events of a mapped binlog file by their headers, keeping
+ * track of where transactions start. It starts at a position where a
+ * transaction starts.
+ */
+class Event_walker
+{
+public:
+  Event_walker(const Mapped_file &file, unsigned long position)
+    : m_data(file.data()), m_size(file.size()), m_position(position),
+      m_boundary(true), m_xid(0)
+  {
+  }
+
+  /**
+   * True if a complete event starts at the position.
+   */
+  bool at_event() const
+  {
+    const unsigned long header_size= LOG_EVENT_HEADER_SIZE - 1;
+    if (m_position >= m_size || m_size - m_position < header_size)
+      return false;
+    boost::uint32_t length= event_length();
+    return length >= header_size && length <= m_size - m_position;
+  }
+
+  unsigned long position() const { return m_position; }
+  boost::uint32_t timestamp() const { return read_le(event(), 4); }
+
+  /**
+   * True if a transaction starts at the position.
+   */
+  bool boundary() const { return m_boundary; }
+
+  /**
+   * The XID of the last transaction ended by an XID event, if it ended
+   * right before the position.
+   */
+  boost::uint64_t xid() const { return m_xid; }
+
+  /**
+   * Move to the next event.
+   */
+  void next()
+  {
+    const boost::uint8_t *body= event() + LOG_EVENT_HEADER_SIZE - 1;
+    switch (event()[4])
+    {
+    case XID_EVENT:
+      m_boundary= true;
+      m_xid= event_length() >= LOG_EVENT_HEADER_SIZE - 1 + 8 ?
+             read_le(body, 8) : 0;
+      break;
+    case QUERY_EVENT:
+      m_boundary= !is_begin(body);
+      m_xid= 0;
+      break;
+    case FORMAT_DESCRIPTION_EVENT:
+    case ROTATE_EVENT:
+      break;
+    default:
+      m_boundary= false;
+      m_xid= 0;
+    }
+    m_position+= event_length();
+  }
+
+private:
+  const boost::uint8_t *event() const { return m_data + m_position; }
+  boost::uint32_t event_length() const { return read_le(event() + 9, 4); }
+
+  /**
+   * True if the body of a Query event holds BEGIN.
+   */
+  bool is_begin(const boost::uint8_t *body) const
+  {
+    const unsigned long fixed= 13;
+    unsigned long body_length= event_length() - (LOG_EVENT_HEADER_SIZE - 1);
+    if (body_length < fixed)
+      return false;
+    unsigned long query= fixed + read_le(body + 11, 2) + body[8] + 1;
+    return body_length - 5 == query && memcmp(body + query, "BEGIN", 5) == 0;
+  }
+
+  const boost::uint8_t *m_data;
+  unsigned long m_size;
+  unsigned long m_position;
+  bool m_boundary;
+  boost::uint64_t m_xid;
+};
+
+/**
+ * The timestamp of the first event of a file, or 0 if it has none.
+ */
+boost::uint32_t first_timestamp(const Mapped_file &file)
+{
+  Event_walker walker(file, MAGIC_NUMBER_SIZE);
+  return walker.at_event() ? walker.timestamp() : 0;
+}
+
+} // anonymous namespace
+
+
+int build_time_index(const std::string &binlog, unsigned long interval)
+{
+  Mapped_file file(binlog);
+  if (!file.good())
+    return ERR_FAIL;
+
+  std::string index(index_magic, index_header_size);
+  unsigned long last= 0;
+  bool first= true;
+  for (Event_walker walker(file, MAGIC_NUMBER_SIZE); walker.at_event();
+       walker.next())
+  {
+    if (!walker.boundary() ||
+        (!first && walker.position() - last < interval))
+      continue;
+    write_le(&index, walker.timestamp(), 4);
+    write_le(&index, walker.position(), 8);
+    write_le(&index, walker.xid(), 8);
+    last= walker.position();
+    first= false;
+  }
+
+  /* Replace an old index only once the new one is complete. */
+  std::string path= binlog + TIME_INDEX_SUFFIX;
+  std::string temporary= path + ".tmp";
+  {
+    std::ofstream out(temporary.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(index.data(), index.size());
+    if (!out.flush())
+      return ERR_FAIL;
+  }
+  return rename(temporary.c_str(), path.c_str()) == 0 ? (int)ERR_OK :
+                                                        (int)ERR_FAIL;
+}
+
+
+int read_time_index(const std::string &binlog,
+                    std::vector<Time_index_entry> *entries)
+{
+  std::ifstream in((binlog + TIME_INDEX_SUFFIX).c_str(), std::ios::binary);
+  char magic[index_header_size];
+  if (!in.read(magic, index_header_size) ||
+      memcmp(magic, index_magic, index_header_size))
+    return ERR_FAIL;
+
+  entries->clear();
+  boost::uint8_t buffer[index_entry_size];
+  while (in.read(reinterpret_cast<char *>(buffer), index_entry_size))
+  {
+    Time_index_entry entry;
+    entry.timestamp= read_le(buffer, 4);
+    entry.position= read_le(buffer + 4, 8);
+    entry.xid= read_le(buffer + 12, 8);
+    entries->push_back(entry);
+  }
+  return in.gcount() == 0 ? (int)ERR_OK : (int)ERR_FAIL;
+}
+
+
+int find_position_by_time(const std::vector<std::string> &files,
+                          boost::uint32_t when, std::string *file,
+                          unsigned long *position)
+{
+  if (files.empty())
+    return ERR_FAIL;
+
+  /*
+    Find the last file which starts before the point in time. Timestamps
+    grow through the sequence, so the transaction is in that file or at
+    the start of the next one.
+  */
+  std::size_t low= 0, high= files.size();
+  while (high - low > 1)
+  {
+    std::size_t middle= low + (high - low) / 2;
+    Mapped_file mapped(files[middle]);
+    if (!mapped.good())
+      return ERR_FAIL;
+    if (first_timestamp(mapped) < when)
+      low= middle;
+    else
+      high= middle;
+  }
+
+  Mapped_file mapped(files[low]);
+  if (!mapped.good())
+    return ERR_FAIL;
+
+  unsigned long start= MAGIC_NUMBER_SIZE;
+  std::vector<Time_index_entry> entries;
+  if (read_time_index(files[low], &entries) == ERR_OK)
+  {
+    for (std::size_t i= 0; i < entries.size() &&
+         entries[i].timestamp < when &&
+         entries[i].position < mapped.size(); ++i)
+      start= entries[i].position;
+  }
+
+  for (Event_walker walker(mapped, start); walker.at_event(); walker.next())
+  {
+    if (walker.boundary() && walker.timestamp() >= when)
+    {
+      *file= files[low];
+      *position= walker.position();
+      return ERR_OK;
+    }
+  }
+
+  if (low + 1 == files.size())
+    return ERR_EOF;
+  *file= files[low + 1];
+  *position= MAGIC_NUMBER_SIZE;
+  return ERR_OK;
+}
+
+}
+}
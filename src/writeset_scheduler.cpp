@@ -0,0 +1,202 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#include "writeset_scheduler.h"
+#include "rowset.h"
+#include <boost/bind.hpp>
+
+namespace mysql {
+
+Writeset_scheduler::Writeset_scheduler(unsigned int workers,
+                                       const Transaction_applier &apply,
+                                       const Transaction_applier &commit,
+                                       std::size_t queue_size,
+                                       std::size_t history_size)
+  : m_apply(apply), m_commit(commit), m_history_size(history_size),
+    m_history_start(0), m_sequence(0), m_waits(0), m_committed(0)
+{
+  if (workers == 0)
+    workers= 1;
+  for (unsigned int i= 0; i < workers; ++i)
+    m_workers.push_back(new Worker(queue_size));
+  for (unsigned int i= 0; i < workers; ++i)
+    m_workers[i]->thread=
+      new boost::thread(boost::bind(&Writeset_scheduler::work, this, i));
+}
+
+
+Writeset_scheduler::~Writeset_scheduler()
+{
+  for (std::size_t i= 0; i < m_workers.size(); ++i)
+    m_workers[i]->queue.push_front(0);
+  for (std::size_t i= 0; i < m_workers.size(); ++i)
+  {
+    m_workers[i]->thread->join();
+    delete m_workers[i]->thread;
+    delete m_workers[i];
+  }
+}
+
+
+void Writeset_scheduler::work(unsigned int worker)
+{
+  Worker *self= m_workers[worker];
+  for (;;)
+  {
+    Scheduled *scheduled;
+    self->queue.pop_back(&scheduled);
+    if (scheduled == 0)
+      return;
+    m_apply(worker, *scheduled->transaction);
+
+    /* Only the next transaction in binlog order goes on from here. */
+    wait_committed(scheduled->sequence - 1);
+    if (m_commit)
+      m_commit(worker, *scheduled->transaction);
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_committed= scheduled->sequence;
+      m_committed_changed.notify_all();
+    }
+    delete scheduled->transaction;
+    delete scheduled;
+  }
+}
+
+
+void Writeset_scheduler::wait_committed(boost::uint64_t sequence)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  while (m_committed < sequence)
+    m_committed_changed.wait(lock);
+}
+
+
+void Writeset_scheduler::drain()
+{
+  wait_committed(m_sequence);
+}
+
+
+boost::uint64_t
+Writeset_scheduler::depends_on(Transaction_log_event *transaction,
+                               boost::uint64_t sequence)
+{
+  boost::uint64_t last= m_history_start;
+  std::list<Binary_log_event *>::iterator event;
+  for (event= transaction->m_events.begin();
+       event != transaction->m_events.end(); ++event)
+  {
+    Log_event_type type= (*event)->get_event_type();
+    if (type != WRITE_ROWS_EVENT && type != UPDATE_ROWS_EVENT &&
+        type != DELETE_ROWS_EVENT)
+      continue;
+    Row_event *rows= static_cast<Row_event *>(*event);
+    Int_to_Event_map::iterator found=
+      transaction->m_table_map.find(rows->table_id);
+    if (found == transaction->m_table_map.end())
+    {
+      /* The rows can't be told apart, so they may touch any row. */
+      last= sequence - 1;
+      continue;
+    }
+    if (rows->row.empty())
+      continue;
+
+    Table_map_event *table= static_cast<Table_map_event *>(found->second);
+    const std::vector<unsigned int> &key= m_keys.key(*table);
+    std::size_t table_hash= Row_keys::table_hash(*table);
+    Row_event_set images(rows, table);
+    Row_event_set::iterator image= images.begin();
+    do
+    {
+      std::size_t hash= Row_keys::row_hash(table_hash, key, *image);
+      boost::uint64_t &writer= m_writers[hash];
+      /* An earlier image of the transaction itself is no dependency. */
+      if (writer != sequence && writer > last)
+        last= writer;
+      writer= sequence;
+    } while (++image != images.end());
+  }
+
+  if (m_writers.size() > m_history_size)
+  {
+    m_writers.clear();
+    m_history_start= sequence;
+  }
+  return last;
+}
+
+
+Binary_log_event *Writeset_scheduler::process_event(Binary_log_event *ev)
+{
+  if (ev->get_event_type() != USER_DEFINED)
+    return ev;
+
+  Scheduled *scheduled= new Scheduled;
+  scheduled->transaction= static_cast<Transaction_log_event *>(ev);
+  scheduled->sequence= ++m_sequence;
+  boost::uint64_t dependency= depends_on(scheduled->transaction,
+                                         scheduled->sequence);
+
+  /*
+    Any worker would do once the dependency has committed. Pick an idle
+    one if there is one, or else the one given work the longest ago.
+  */
+  Worker *worker= m_workers[0];
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (m_committed < dependency)
+    {
+      ++m_waits;
+      while (m_committed < dependency)
+        m_committed_changed.wait(lock);
+    }
+    for (std::size_t i= 0; i < m_workers.size(); ++i)
+    {
+      if (m_workers[i]->queued <= m_committed)
+      {
+        worker= m_workers[i];
+        break;
+      }
+      if (m_workers[i]->queued < worker->queued)
+        worker= m_workers[i];
+    }
+  }
+  worker->queued= scheduled->sequence;
+  worker->queue.push_front(scheduled);
+  return 0;
+}
+
+
+Binary_log_event *Writeset_scheduler::process_event(Query_event *ev)
+{
+  if (ev->query != "BEGIN")
+    drain();
+  return ev;
+}
+
+
+bool Writeset_scheduler::handles(Log_event_type type) const
+{
+  return type == USER_DEFINED || type == QUERY_EVENT;
+}
+
+} // end namespace
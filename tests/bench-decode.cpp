@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+/*
+  Measures the event decode throughput of the file driver.
+
+  Every binlog file given on the command line is read from the beginning to
+  the end a number of times and the number of events and bytes decoded per
+  second is printed.
+*/
+#include <stdlib.h>
+#include <iostream>
+#include <sys/time.h>
+#include "binlog_api.h"
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 3)
+  {
+    fprintf(stderr,"Usage:\n\tbench-decode ITERATIONS FILE...\n\nExample:\n\tbench-decode 1000 tests/std-data/searchbin.000001\n\n");
+    return (EXIT_FAILURE);
+  }
+
+  unsigned long iterations= strtoul(argv[1], NULL, 10);
+  unsigned long long events= 0;
+  unsigned long long bytes= 0;
+  double start= now();
+
+  for (unsigned long i= 0; i < iterations; ++i)
+  {
+    for (int arg= 2; arg < argc; ++arg)
+    {
+      mysql::system::Binlog_file_driver driver(std::string(argv[arg]));
+      if (driver.connect())
+      {
+        fprintf(stderr,"Can't open %s.\n", argv[arg]);
+        return (EXIT_FAILURE);
+      }
+
+      mysql::Binary_log_event *event;
+      int result;
+      while ((result= driver.wait_for_next_event(&event)) == ERR_OK)
+      {
+        ++events;
+        bytes+= event->header()->event_length;
+        delete event;
+      }
+      if (result != ERR_EOF)
+      {
+        fprintf(stderr,"Failed to decode %s.\n", argv[arg]);
+        return (EXIT_FAILURE);
+      }
+      driver.disconnect();
+    }
+  }
+
+  double elapsed= now() - start;
+  std::cout << events << " events, "
+            << bytes << " bytes in "
+            << elapsed << " s: "
+            << (unsigned long long)(events / elapsed) << " events/s, "
+            << (bytes / elapsed) / (1024 * 1024) << " MB/s"
+            << std::endl;
+  return (EXIT_SUCCESS);
+}
@@ -0,0 +1,181 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+/*
+  Measures the cost of running events through content handlers.
+
+  The same three handlers run once in a Content_handler_pipeline and
+  once in a Static_pipeline, each time in a Binary_log reading a number
+  of events from memory. The events form transactions of a BEGIN query,
+  a table map, a number of row events and an XID event.
+*/
+#include <stdlib.h>
+#include <iostream>
+#include <sys/time.h>
+#include "binlog_api.h"
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/**
+  Hands out the same events over and over, which are not deleted.
+*/
+class Memory_driver : public mysql::Dummy_driver
+{
+public:
+  Memory_driver(const std::vector<mysql::Binary_log_event *> &events,
+                unsigned long count)
+    : m_events(events), m_next(0), m_count(count)
+  {
+  }
+
+  int wait_for_next_event(mysql::Binary_log_event **event)
+  {
+    if (m_count == 0)
+      return mysql::ERR_EOF;
+    --m_count;
+    *event= m_events[m_next];
+    m_next= m_next + 1 == m_events.size() ? 0 : m_next + 1;
+    return mysql::ERR_OK;
+  }
+
+private:
+  const std::vector<mysql::Binary_log_event *> &m_events;
+  std::size_t m_next;
+  unsigned long m_count;
+};
+
+class Table_counter : public mysql::Content_handler
+{
+public:
+  Table_counter() : count(0) {}
+  mysql::Binary_log_event *process_event(mysql::Table_map_event *event)
+  {
+    ++count;
+    return event;
+  }
+  unsigned long count;
+};
+
+class Row_counter : public mysql::Content_handler
+{
+public:
+  Row_counter() : count(0) {}
+  mysql::Binary_log_event *process_event(mysql::Row_event *event)
+  {
+    ++count;
+    return event;
+  }
+  unsigned long count;
+};
+
+class Commit_counter : public mysql::Content_handler
+{
+public:
+  Commit_counter() : count(0) {}
+  mysql::Binary_log_event *process_event(mysql::Xid *event)
+  {
+    ++count;
+    return event;
+  }
+  unsigned long count;
+};
+
+static void run(const char *name, mysql::Binary_log *binlog,
+                unsigned long events)
+{
+  double start= now();
+  mysql::Binary_log_event *event;
+  while (binlog->wait_for_next_event(&event) == mysql::ERR_OK)
+    ;
+  double elapsed= now() - start;
+  std::cout << name << ": "
+            << events << " events in "
+            << elapsed << " s: "
+            << (unsigned long long)(events / elapsed) << " events/s"
+            << std::endl;
+}
+
+static mysql::Log_event_header make_header(mysql::Log_event_type type)
+{
+  mysql::Log_event_header header;
+  memset(&header, 0, sizeof(header));
+  header.type_code= type;
+  return header;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr,"Usage:\n\tbench-pipeline EVENTS [ROWS]\n\nExample:\n\tbench-pipeline 10000000 5\n\n");
+    return (EXIT_FAILURE);
+  }
+
+  unsigned long count= strtoul(argv[1], NULL, 10);
+  unsigned long rows= argc > 2 ? strtoul(argv[2], NULL, 10) : 5;
+
+  mysql::Log_event_header query= make_header(mysql::QUERY_EVENT);
+  mysql::Log_event_header table_map= make_header(mysql::TABLE_MAP_EVENT);
+  mysql::Log_event_header row= make_header(mysql::WRITE_ROWS_EVENT);
+  mysql::Log_event_header xid= make_header(mysql::XID_EVENT);
+  std::vector<mysql::Binary_log_event *> events;
+  events.push_back(new mysql::Query_event(&query));
+  events.push_back(new mysql::Table_map_event(&table_map));
+  for (unsigned long i= 0; i < rows; ++i)
+    events.push_back(new mysql::Row_event(&row));
+  events.push_back(new mysql::Xid(&xid));
+
+  Table_counter tables;
+  Row_counter row_events;
+  Commit_counter commits;
+  {
+    Memory_driver driver(events, count);
+    mysql::Binary_log binlog(&driver);
+    binlog.content_handler_pipeline()->push_back(&tables);
+    binlog.content_handler_pipeline()->push_back(&row_events);
+    binlog.content_handler_pipeline()->push_back(&commits);
+    run("Content_handler_pipeline", &binlog, count);
+  }
+
+  typedef mysql::Static_pipeline<Table_counter, Row_counter, Commit_counter>
+    Counters;
+  Counters pipeline;
+  {
+    Memory_driver driver(events, count);
+    mysql::Binary_log binlog(&driver);
+    binlog.content_handler_pipeline()->push_back(&pipeline);
+    run("Static_pipeline", &binlog, count);
+  }
+
+  bool same= boost::get<0>(pipeline.handlers()).count == tables.count &&
+             boost::get<1>(pipeline.handlers()).count == row_events.count &&
+             boost::get<2>(pipeline.handlers()).count == commits.count;
+  if (!same)
+    std::cout << "THE PIPELINES COUNTED DIFFERENTLY" << std::endl;
+
+  for (std::size_t i= 0; i < events.size(); ++i)
+    delete events[i];
+  return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,99 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+/*
+  Measures the hand-over rate of the event queues.
+
+  One thread pushes a number of items through a queue of the size used by
+  the TCP driver and another thread pops them, checking that they arrive
+  in order. Each queue is timed in turn.
+*/
+#include <stdlib.h>
+#include <iostream>
+#include <sys/time.h>
+#include <boost/thread.hpp>
+#include "bounded_buffer.h"
+#include "spsc_bounded_buffer.h"
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+template <class Queue>
+static void produce(Queue *queue, unsigned long items)
+{
+  for (unsigned long i= 1; i <= items; ++i)
+    queue->push_front(reinterpret_cast<void *>(i));
+}
+
+template <class Queue>
+static bool run(const char *name, Queue *queue, unsigned long items)
+{
+  double start= now();
+  boost::thread producer(boost::bind(&produce<Queue>, queue, items));
+  bool in_order= true;
+  for (unsigned long i= 1; i <= items; ++i)
+  {
+    void *item;
+    queue->pop_back(&item);
+    if (item != reinterpret_cast<void *>(i))
+      in_order= false;
+  }
+  producer.join();
+  double elapsed= now() - start;
+
+  std::cout << name << ": "
+            << items << " items in "
+            << elapsed << " s: "
+            << (unsigned long long)(items / elapsed) << " items/s"
+            << (in_order ? "" : " OUT OF ORDER")
+            << std::endl;
+  return in_order;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr,"Usage:\n\tbench-queue ITEMS [CAPACITY]\n\nExample:\n\tbench-queue 10000000\n\n");
+    return (EXIT_FAILURE);
+  }
+
+  unsigned long items= strtoul(argv[1], NULL, 10);
+  unsigned long capacity= argc > 2 ? strtoul(argv[2], NULL, 10) : 50;
+  bool in_order= true;
+
+  {
+    bounded_buffer<void *> queue(capacity);
+    in_order&= run("bounded_buffer", &queue, items);
+  }
+  {
+    spsc_bounded_buffer<void *> queue(capacity);
+    in_order&= run("spsc_bounded_buffer", &queue, items);
+  }
+  {
+    spsc_bounded_buffer<void *> queue(capacity, 1000);
+    in_order&= run("spsc_bounded_buffer, spin 1000", &queue, items);
+  }
+  return in_order ? EXIT_SUCCESS : EXIT_FAILURE;
+}
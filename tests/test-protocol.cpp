@@ -0,0 +1,298 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#include "binlog_api.h"
+#include <gtest/gtest.h>
+#include <iostream>
+#include <stdlib.h>
+#include <zlib.h>
+
+using mysql::system::buffer_source;
+using mysql::system::Protocol_chunk;
+using mysql::system::Packet_inflater;
+
+class TestProtocol : public ::testing::Test {
+protected:
+  TestProtocol() { }
+  virtual ~TestProtocol() { }
+
+  /**
+    Build a header for an event with the given type and body size.
+  */
+  static mysql::Log_event_header make_header(mysql::Log_event_type type,
+                                             size_t body_length)
+  {
+    mysql::Log_event_header header;
+    memset(&header, 0, sizeof(header));
+    header.type_code= type;
+    header.event_length= body_length + LOG_EVENT_HEADER_SIZE - 1;
+    header.next_position= 4 + header.event_length;
+    return header;
+  }
+
+  mysql::Dummy_driver m_driver;
+};
+
+/*
+  Table map for `test`.`t1` (c1 INT, c2 VARCHAR(10)) with table id 17.
+*/
+static const boost::uint8_t table_map_body[]= {
+  0x11, 0, 0, 0, 0, 0,                          // table id
+  0x01, 0x00,                                   // flags
+  4, 't', 'e', 's', 't', 0,                     // db name
+  2, 't', '1', 0,                               // table name
+  2,                                            // column count
+  mysql::system::MYSQL_TYPE_LONG,
+  mysql::system::MYSQL_TYPE_VARCHAR,
+  2,                                            // metadata length
+  10, 0,                                        // VARCHAR max length
+  0x02                                          // null bits
+};
+
+/*
+  Two rows (42, 'abc') and (7, NULL) for the table above.
+*/
+static const boost::uint8_t write_rows_body[]= {
+  0x11, 0, 0, 0, 0, 0,                          // table id
+  0x01, 0x00,                                   // flags
+  2,                                            // column count
+  0x03,                                         // columns present
+  0x00, 42, 0, 0, 0, 3, 'a', 'b', 'c',          // row 1
+  0x02, 7, 0, 0, 0                              // row 2
+};
+
+TEST_F(TestProtocol, BufferSource_Bounds)
+{
+  const char data[]= { 1, 2, 3, 4, 5 };
+  buffer_source src(data, sizeof(data));
+  boost::uint32_t value= 0;
+  Protocol_chunk<boost::uint32_t> prot_value(value);
+
+  src >> prot_value;
+  EXPECT_TRUE(src.good());
+  EXPECT_EQ(value, 0x04030201U);
+  EXPECT_EQ(src.remaining(), 1U);
+
+  src >> prot_value;
+  EXPECT_FALSE(src.good());
+  EXPECT_TRUE(src.consume(0) == 0);
+}
+
+TEST_F(TestProtocol, BufferSource_LengthEncoded)
+{
+  const boost::uint8_t data[]= { 0xfc, 0x34, 0x12, 0x05 };
+  buffer_source src(data, sizeof(data));
+  boost::uint64_t first= 0, second= 0;
+  Protocol_chunk<boost::uint64_t> prot_first(first);
+  Protocol_chunk<boost::uint64_t> prot_second(second);
+  prot_first.set_length_encoded_binary(true);
+  prot_second.set_length_encoded_binary(true);
+
+  src >> prot_first >> prot_second;
+  EXPECT_TRUE(src.good());
+  EXPECT_EQ(first, 0x1234U);
+  EXPECT_EQ(second, 5U);
+}
+
+TEST_F(TestProtocol, ParseEvent_Rows)
+{
+  mysql::Log_event_header tm_header=
+    make_header(mysql::TABLE_MAP_EVENT, sizeof(table_map_body));
+  mysql::Binary_log_event *event=
+    m_driver.parse_event(table_map_body, sizeof(table_map_body), &tm_header);
+  ASSERT_EQ(event->get_event_type(), mysql::TABLE_MAP_EVENT);
+  mysql::Table_map_event *tm= static_cast<mysql::Table_map_event *>(event);
+  EXPECT_EQ(tm->table_id, 17U);
+  EXPECT_EQ(tm->db_name, "test");
+  EXPECT_EQ(tm->table_name, "t1");
+  EXPECT_EQ(tm->columns.size(), 2U);
+  EXPECT_EQ(tm->metadata.size(), 2U);
+  EXPECT_EQ(tm->null_bits.size(), 1U);
+
+  mysql::Log_event_header rows_header=
+    make_header(mysql::WRITE_ROWS_EVENT, sizeof(write_rows_body));
+  event= m_driver.parse_event(write_rows_body, sizeof(write_rows_body),
+                              &rows_header);
+  ASSERT_EQ(event->get_event_type(), mysql::WRITE_ROWS_EVENT);
+  mysql::Row_event *rows= static_cast<mysql::Row_event *>(event);
+  EXPECT_EQ(rows->table_id, 17U);
+  EXPECT_EQ(rows->columns_len, 2U);
+  EXPECT_EQ(rows->row.size(), 14U);
+
+  mysql::Converter converter;
+  mysql::Row_event_set rowset(rows, tm);
+  mysql::Row_event_set::iterator it= rowset.begin();
+  mysql::Row_of_fields fields= *it;
+  long c1;
+  std::string c2;
+  converter.to(c1, fields[0]);
+  converter.to(c2, fields[1]);
+  EXPECT_EQ(c1, 42);
+  EXPECT_EQ(c2, "abc");
+
+  ++it;
+  mysql::Row_of_fields fields2= *it;
+  converter.to(c1, fields2[0]);
+  EXPECT_EQ(c1, 7);
+  EXPECT_TRUE(fields2[1].is_null());
+  EXPECT_TRUE(++it == rowset.end());
+
+  delete rows;
+  delete tm;
+}
+
+TEST_F(TestProtocol, ParseEvent_WideRows)
+{
+  /*
+    A row of 300 NULL columns; the column count needs a length encoded
+    marker byte.
+  */
+  const std::size_t bitmap_len= (300 + 7) / 8;
+  const boost::uint8_t prefix[]= {
+    0x11, 0, 0, 0, 0, 0,                        // table id
+    0x01, 0x00,                                 // flags
+    0xfc, 0x2c, 0x01                            // column count
+  };
+  std::vector<boost::uint8_t> body(prefix, prefix + sizeof(prefix));
+  body.insert(body.end(), bitmap_len, 0xff);    // columns present
+  body.insert(body.end(), bitmap_len, 0xff);    // null bits of the row
+
+  mysql::Log_event_header header=
+    make_header(mysql::WRITE_ROWS_EVENT, body.size());
+  mysql::Binary_log_event *event=
+    m_driver.parse_event(&body[0], body.size(), &header);
+  ASSERT_EQ(event->get_event_type(), mysql::WRITE_ROWS_EVENT);
+  mysql::Row_event *rows= static_cast<mysql::Row_event *>(event);
+  EXPECT_EQ(rows->columns_len, 300U);
+  EXPECT_EQ(rows->row.size(), bitmap_len);
+  delete rows;
+}
+
+TEST_F(TestProtocol, ParseEvent_SharedBuffer)
+{
+  boost::shared_ptr<boost::uint8_t> buffer=
+    mysql::make_buffer(sizeof(write_rows_body));
+  memcpy(buffer.get(), write_rows_body, sizeof(write_rows_body));
+  mysql::Log_event_header header=
+    make_header(mysql::WRITE_ROWS_EVENT, sizeof(write_rows_body));
+  mysql::Binary_log_event *event=
+    m_driver.parse_event(buffer, buffer.get(), sizeof(write_rows_body),
+                         &header);
+  ASSERT_EQ(event->get_event_type(), mysql::WRITE_ROWS_EVENT);
+  mysql::Row_event *rows= static_cast<mysql::Row_event *>(event);
+
+  /* The row image is not copied and keeps the buffer alive. */
+  EXPECT_TRUE(rows->row.data() == buffer.get() + 10);
+  EXPECT_GT(buffer.use_count(), 1);
+  boost::weak_ptr<boost::uint8_t> weak(buffer);
+  buffer.reset();
+  EXPECT_FALSE(weak.expired());
+  delete rows;
+  EXPECT_TRUE(weak.expired());
+}
+
+TEST_F(TestProtocol, ParseEvent_Truncated)
+{
+  /* The header claims the full table map but only half of it arrived. */
+  mysql::Log_event_header header=
+    make_header(mysql::TABLE_MAP_EVENT, sizeof(table_map_body));
+  mysql::Binary_log_event *event=
+    m_driver.parse_event(table_map_body, sizeof(table_map_body) / 2, &header);
+  EXPECT_EQ(event->get_event_type(), mysql::INCIDENT_EVENT);
+  delete event;
+}
+
+/**
+  Wraps stream in compressed packets of at most chunk bytes each,
+  alternately compressed and stored.
+*/
+static std::vector<boost::uint8_t>
+compress_stream(const std::vector<boost::uint8_t> &stream, std::size_t chunk)
+{
+  std::vector<boost::uint8_t> packets;
+  bool store= false;
+  for (std::size_t pos= 0; pos < stream.size(); pos+= chunk, store= !store)
+  {
+    std::size_t length= std::min(chunk, stream.size() - pos);
+    std::vector<boost::uint8_t> body(compressBound(length));
+    uLongf body_length= body.size();
+    std::size_t uncompressed_length= length;
+    if (store)
+    {
+      memcpy(&body[0], &stream[pos], length);
+      body_length= length;
+      uncompressed_length= 0;
+    }
+    else
+      compress(&body[0], &body_length, &stream[pos], length);
+    boost::uint8_t header[COMPRESSED_HEADER_SIZE];
+    int3store(header, body_length);
+    header[3]= 0;
+    int3store(header + 4, uncompressed_length);
+    packets.insert(packets.end(), header, header + COMPRESSED_HEADER_SIZE);
+    packets.insert(packets.end(), body.begin(), body.begin() + body_length);
+  }
+  return packets;
+}
+
+TEST_F(TestProtocol, PacketInflater_Pieces)
+{
+  std::vector<boost::uint8_t> stream(300000);
+  for (std::size_t i= 0; i < stream.size(); ++i)
+    stream[i]= (i / 7) % 251;
+  std::vector<boost::uint8_t> packets= compress_stream(stream, 70000);
+
+  /* Input and output in small pieces which don't line up with packets. */
+  Packet_inflater inflater;
+  std::vector<boost::uint8_t> output(stream.size());
+  std::size_t used= 0;
+  const boost::uint8_t *input= &packets[0];
+  const boost::uint8_t *end= input + packets.size();
+  while (input < end || used < output.size())
+  {
+    const boost::uint8_t *input_end= std::min(input + 1001, end);
+    std::size_t produced;
+    ASSERT_TRUE(inflater.inflate(&input, input_end, &output[used],
+                                 std::min<std::size_t>(333, output.size() - used),
+                                 &produced));
+    used+= produced;
+  }
+  EXPECT_TRUE(output == stream);
+}
+
+TEST_F(TestProtocol, PacketInflater_Corrupt)
+{
+  std::vector<boost::uint8_t> stream(1000, 'x');
+  std::vector<boost::uint8_t> packets= compress_stream(stream, 1000);
+  std::vector<boost::uint8_t> output(2000);
+  std::size_t produced;
+
+  /* The packet claims to hold more than it inflates to. */
+  packets[4]+= 1;
+  Packet_inflater inflater;
+  const boost::uint8_t *input= &packets[0];
+  EXPECT_FALSE(inflater.inflate(&input, input + packets.size(), &output[0],
+                                output.size(), &produced));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,686 @@
+/*
+Copyright (c) 2003, 2011, Oracle and/or its affiliates. All rights
+reserved.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of
+the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301  USA
+*/
+
+#include "binlog_api.h"
+#include "spsc_bounded_buffer.h"
+#include "event_spill.h"
+#include "staged_pipeline.h"
+#include "sharded_applier.h"
+#include "writeset_scheduler.h"
+#include <gtest/gtest.h>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <stdlib.h>
+#include <unistd.h>
+
+class TestQueue : public ::testing::Test {
+protected:
+  TestQueue() { }
+  virtual ~TestQueue() { }
+
+  /**
+    Build a header for an event with the given type and body size.
+  */
+  static mysql::Log_event_header make_header(mysql::Log_event_type type,
+                                             size_t body_length)
+  {
+    mysql::Log_event_header header;
+    memset(&header, 0, sizeof(header));
+    header.type_code= type;
+    header.event_length= body_length + LOG_EVENT_HEADER_SIZE - 1;
+    header.next_position= 4 + header.event_length;
+    return header;
+  }
+
+  /**
+    Decode an event with the given type from its body.
+  */
+  mysql::Binary_log_event *parse_event(mysql::Log_event_type type,
+                                       const boost::uint8_t *body,
+                                       size_t length)
+  {
+    mysql::Log_event_header header= make_header(type, length);
+    return m_driver.parse_event(body, length, &header);
+  }
+
+  mysql::Dummy_driver m_driver;
+};
+
+/*
+  Table map for `test`.`t1` (c1 INT, c2 VARCHAR(10)) with table id 17.
+*/
+static const boost::uint8_t table_map_body[]= {
+  0x11, 0, 0, 0, 0, 0,                          // table id
+  0x01, 0x00,                                   // flags
+  4, 't', 'e', 's', 't', 0,                     // db name
+  2, 't', '1', 0,                               // table name
+  2,                                            // column count
+  mysql::system::MYSQL_TYPE_LONG,
+  mysql::system::MYSQL_TYPE_VARCHAR,
+  2,                                            // metadata length
+  10, 0,                                        // VARCHAR max length
+  0x02                                          // null bits
+};
+
+/*
+  The start of a Write_rows event for the table above.
+*/
+static const boost::uint8_t write_rows_head[]= {
+  0x11, 0, 0, 0, 0, 0,                          // table id
+  0x01, 0x00,                                   // flags
+  2,                                            // column count
+  0x03                                          // columns present
+};
+
+/**
+  Append the row (key, 'sequence') to the body of a Write_rows event.
+*/
+static void add_row(std::vector<boost::uint8_t> *body, int key, int sequence)
+{
+  char text[8];
+  int length= snprintf(text, sizeof(text), "%d", sequence);
+  boost::uint8_t row[]= { 0x00, (boost::uint8_t) key, 0, 0, 0,
+                          (boost::uint8_t) length };
+  body->insert(body->end(), row, row + sizeof(row));
+  body->insert(body->end(), text, text + length);
+}
+
+static void produce(spsc_bounded_buffer<unsigned long> *queue,
+                    unsigned long items)
+{
+  for (unsigned long i= 1; i <= items; ++i)
+    queue->push_front(i);
+}
+
+TEST_F(TestQueue, Spsc_Bounds)
+{
+  spsc_bounded_buffer<unsigned long> queue(2);
+  unsigned long item= 0;
+
+  EXPECT_FALSE(queue.has_unread());
+  EXPECT_FALSE(queue.try_pop(&item));
+  EXPECT_TRUE(queue.try_push(1));
+  EXPECT_TRUE(queue.try_push(2));
+  EXPECT_FALSE(queue.try_push(3));
+  EXPECT_TRUE(queue.has_unread());
+
+  queue.pop_back(&item);
+  EXPECT_EQ(item, 1U);
+  EXPECT_TRUE(queue.try_push(3));
+  queue.pop_back(&item);
+  EXPECT_EQ(item, 2U);
+  queue.pop_back(&item);
+  EXPECT_EQ(item, 3U);
+  EXPECT_FALSE(queue.has_unread());
+}
+
+TEST_F(TestQueue, Spsc_Threads)
+{
+  const unsigned long items= 50000;
+  unsigned long spin_counts[]= { 0, 100 };
+
+  for (int i= 0; i < 2; ++i)
+  {
+    /* A small queue makes both sides wait for each other often. */
+    spsc_bounded_buffer<unsigned long> queue(3, spin_counts[i]);
+    boost::thread producer(boost::bind(&produce, &queue, items));
+    unsigned long out_of_order= 0;
+    for (unsigned long expected= 1; expected <= items; ++expected)
+    {
+      unsigned long item;
+      queue.pop_back(&item);
+      if (item != expected)
+        ++out_of_order;
+    }
+    producer.join();
+    EXPECT_EQ(out_of_order, 0U);
+    EXPECT_FALSE(queue.has_unread());
+  }
+}
+
+TEST_F(TestQueue, Spsc_PopMany)
+{
+  spsc_bounded_buffer<unsigned long> queue(4);
+  std::vector<unsigned long> items;
+
+  EXPECT_EQ(queue.pop_back_n(&items, 10, 0), 0U);
+  EXPECT_EQ(queue.pop_back_n(&items, 10, 10), 0U);
+  for (unsigned long i= 1; i <= 3; ++i)
+    queue.push_front(i);
+  EXPECT_EQ(queue.pop_back_n(&items, 2, WAIT_FOREVER), 2U);
+  EXPECT_EQ(queue.pop_back_n(&items, 2, WAIT_FOREVER), 1U);
+  ASSERT_EQ(items.size(), 3U);
+  EXPECT_EQ(items[0], 1U);
+  EXPECT_EQ(items[2], 3U);
+  EXPECT_FALSE(queue.has_unread());
+}
+
+TEST_F(TestQueue, Spsc_Weight)
+{
+  spsc_bounded_buffer<unsigned long> queue(10, 0, 100);
+  unsigned long item;
+
+  /* An item heavier than the limit still fits in an empty queue. */
+  EXPECT_TRUE(queue.try_push(1, 150));
+  EXPECT_FALSE(queue.has_room(1));
+  queue.pop_back(&item);
+
+  EXPECT_TRUE(queue.try_push(2, 60));
+  EXPECT_TRUE(queue.try_push(3, 40));
+  EXPECT_FALSE(queue.try_push(4, 1));
+  EXPECT_TRUE(queue.try_push(4, 0));
+  queue.pop_back(&item);
+  EXPECT_EQ(item, 2U);
+  EXPECT_TRUE(queue.has_room(60));
+  EXPECT_FALSE(queue.has_room(61));
+}
+
+/**
+  Hands out incident events at the positions 1 to m_count.
+*/
+class Counting_driver : public mysql::Dummy_driver
+{
+public:
+  Counting_driver(unsigned long count) : m_position(0), m_count(count) {}
+
+  virtual int wait_for_next_event(mysql::Binary_log_event **event)
+  {
+    if (m_position == m_count)
+      return mysql::ERR_EOF;
+    *event= mysql::create_incident_event(175, "", ++m_position);
+    return mysql::ERR_OK;
+  }
+
+private:
+  unsigned long m_position;
+  unsigned long m_count;
+};
+
+/**
+  Consumes events at positions divisible by 3 and injects a copy of
+  those divisible by 5 at the position plus 1000.
+*/
+class Filter_handler : public mysql::Content_handler
+{
+public:
+  mysql::Binary_log_event *process_event(mysql::Incident_event *event)
+  {
+    unsigned long position= event->header()->next_position;
+    if (position < 1000 && position % 3 == 0)
+    {
+      delete event;
+      return 0;
+    }
+    if (position < 1000 && position % 5 == 0)
+      get_injection_queue()->push_back(
+        mysql::create_incident_event(175, "", position + 1000));
+    return event;
+  }
+};
+
+TEST_F(TestQueue, Binary_log_Batch)
+{
+  Counting_driver driver(10);
+  Filter_handler handler;
+  mysql::Binary_log binlog(&driver);
+  binlog.content_handler_pipeline()->push_back(&handler);
+
+  std::vector<mysql::Binary_log_event *> events;
+  std::vector<unsigned long> positions;
+  int rc;
+  while ((rc= binlog.wait_for_next_events(&events, 4)) == mysql::ERR_OK)
+  {
+    EXPECT_FALSE(events.empty());
+    for (std::size_t i= 0; i < events.size(); ++i)
+    {
+      positions.push_back(events[i]->header()->next_position);
+      delete events[i];
+    }
+    events.clear();
+  }
+  EXPECT_EQ(rc, mysql::ERR_EOF);
+
+  unsigned long expected[]= { 1, 2, 4, 5, 1005, 7, 8, 10, 1010 };
+  ASSERT_EQ(positions.size(), sizeof(expected) / sizeof(*expected));
+  for (std::size_t i= 0; i < positions.size(); ++i)
+    EXPECT_EQ(positions[i], expected[i]);
+}
+
+/**
+  Counts the events it is called for, of which it only handles one type.
+*/
+class Type_counter : public mysql::Content_handler
+{
+public:
+  Type_counter(mysql::Log_event_type type) : m_type(type), m_count(0) {}
+
+  mysql::Binary_log_event *process_event(mysql::Binary_log_event *event)
+  {
+    ++m_count;
+    return event;
+  }
+
+  mysql::Binary_log_event *process_event(mysql::Incident_event *event)
+  {
+    ++m_count;
+    return event;
+  }
+
+  bool handles(mysql::Log_event_type type) const { return type == m_type; }
+
+  unsigned long count() const { return m_count; }
+
+private:
+  mysql::Log_event_type m_type;
+  unsigned long m_count;
+};
+
+TEST_F(TestQueue, Binary_log_Dispatch)
+{
+  Counting_driver driver(10);
+  Type_counter xids(mysql::XID_EVENT);
+  Type_counter incidents(mysql::INCIDENT_EVENT);
+  mysql::Binary_log binlog(&driver);
+  binlog.content_handler_pipeline()->push_back(&xids);
+  binlog.content_handler_pipeline()->push_back(&incidents);
+
+  mysql::Binary_log_event *event;
+  for (int i= 0; i < 3; ++i)
+  {
+    ASSERT_EQ(binlog.wait_for_next_event(&event), mysql::ERR_OK);
+    delete event;
+  }
+  EXPECT_EQ(xids.count(), 0U);
+  EXPECT_EQ(incidents.count(), 3U);
+
+  /* A change of the pipeline is picked up by the next call. */
+  Type_counter more_incidents(mysql::INCIDENT_EVENT);
+  binlog.content_handler_pipeline()->push_front(&more_incidents);
+  std::vector<mysql::Binary_log_event *> events;
+  while (events.size() < 4)
+    ASSERT_EQ(binlog.wait_for_next_events(&events, 4), mysql::ERR_OK);
+  for (std::size_t i= 0; i < events.size(); ++i)
+    delete events[i];
+  EXPECT_EQ(xids.count(), 0U);
+  EXPECT_EQ(incidents.count(), 7U);
+  EXPECT_EQ(more_incidents.count(), 4U);
+}
+
+TEST_F(TestQueue, Static_pipeline)
+{
+  Counting_driver driver(10);
+  typedef mysql::Static_pipeline<Type_counter, Filter_handler, Type_counter>
+    Pipeline;
+  Pipeline pipeline(Type_counter(mysql::XID_EVENT), Filter_handler(),
+                    Type_counter(mysql::INCIDENT_EVENT));
+  mysql::Binary_log binlog(&driver);
+  binlog.content_handler_pipeline()->push_back(&pipeline);
+
+  /* The events come out as from the same handlers in a list. */
+  std::vector<mysql::Binary_log_event *> events;
+  std::vector<unsigned long> positions;
+  while (binlog.wait_for_next_events(&events, 4) == mysql::ERR_OK)
+  {
+    for (std::size_t i= 0; i < events.size(); ++i)
+    {
+      positions.push_back(events[i]->header()->next_position);
+      delete events[i];
+    }
+    events.clear();
+  }
+  unsigned long expected[]= { 1, 2, 4, 5, 1005, 7, 8, 10, 1010 };
+  ASSERT_EQ(positions.size(), sizeof(expected) / sizeof(*expected));
+  for (std::size_t i= 0; i < positions.size(); ++i)
+    EXPECT_EQ(positions[i], expected[i]);
+  EXPECT_EQ(boost::get<0>(pipeline.handlers()).count(), 0U);
+  EXPECT_EQ(boost::get<2>(pipeline.handlers()).count(), 9U);
+}
+
+/**
+  Notes the thread it runs on.
+*/
+class Thread_recorder : public mysql::Content_handler
+{
+public:
+  mysql::Binary_log_event *process_event(mysql::Binary_log_event *event)
+  {
+    thread= boost::this_thread::get_id();
+    return event;
+  }
+
+  mysql::Binary_log_event *process_event(mysql::Incident_event *event)
+  {
+    thread= boost::this_thread::get_id();
+    return event;
+  }
+
+  boost::thread::id thread;
+};
+
+TEST_F(TestQueue, Staged_pipeline)
+{
+  Counting_driver driver(10);
+  mysql::Binary_log binlog(&driver);
+  Filter_handler filter;
+  Thread_recorder first, second;
+  Type_counter incidents(mysql::INCIDENT_EVENT);
+  binlog.content_handler_pipeline()->push_back(&filter);
+  binlog.content_handler_pipeline()->push_back(&first);
+
+  mysql::Staged_pipeline pipeline(&binlog, 2);
+  pipeline.add_stage()->push_back(&second);
+  pipeline.add_stage()->push_back(&incidents);
+  EXPECT_EQ(pipeline.stages(), 3U);
+
+  /* The events come out in order, as from a single stage. */
+  std::vector<unsigned long> positions;
+  mysql::Binary_log_event *event;
+  int rc;
+  while ((rc= pipeline.wait_for_next_event(&event)) == mysql::ERR_OK)
+  {
+    positions.push_back(event->header()->next_position);
+    delete event;
+  }
+  EXPECT_EQ(rc, mysql::ERR_EOF);
+  EXPECT_EQ(pipeline.wait_for_next_event(&event), mysql::ERR_EOF);
+  EXPECT_FALSE(pipeline.add_stage());
+  unsigned long expected[]= { 1, 2, 4, 5, 1005, 7, 8, 10, 1010 };
+  ASSERT_EQ(positions.size(), sizeof(expected) / sizeof(*expected));
+  for (std::size_t i= 0; i < positions.size(); ++i)
+    EXPECT_EQ(positions[i], expected[i]);
+  EXPECT_EQ(incidents.count(), 9U);
+  EXPECT_NE(first.thread, second.thread);
+  EXPECT_NE(first.thread, boost::this_thread::get_id());
+}
+
+TEST_F(TestQueue, Staged_pipeline_Stop)
+{
+  /* Deleting a pipeline with full queues drops the events in them. */
+  Counting_driver driver(1000000);
+  mysql::Binary_log binlog(&driver);
+  Type_counter incidents(mysql::INCIDENT_EVENT);
+  {
+    mysql::Staged_pipeline pipeline(&binlog, 16);
+    pipeline.add_stage()->push_back(&incidents);
+    std::vector<mysql::Binary_log_event *> events;
+    while (events.size() < 5)
+      ASSERT_EQ(pipeline.wait_for_next_events(&events, 5), mysql::ERR_OK);
+    for (std::size_t i= 0; i < events.size(); ++i)
+      delete events[i];
+    usleep(10000);
+  }
+  EXPECT_LT(incidents.count(), 1000000U);
+}
+
+/**
+  Records the rows each worker applies as (c1, c2) pairs. Each worker
+  only touches its own list.
+*/
+static void record_row(std::vector<std::vector<std::pair<long, long> > > *applied,
+                       unsigned int worker, const mysql::Sharded_row &row)
+{
+  mysql::Converter converter;
+  long key;
+  std::string sequence;
+  converter.to(key, row.after[0]);
+  converter.to(sequence, row.after[1]);
+  (*applied)[worker].push_back(std::make_pair(key, atol(sequence.c_str())));
+}
+
+TEST_F(TestQueue, Sharded_applier)
+{
+  /* Rows (i % 10, 'i') of the table above. */
+  std::vector<boost::uint8_t> body(write_rows_head,
+                                   write_rows_head + sizeof(write_rows_head));
+  for (int i= 0; i < 1000; ++i)
+    add_row(&body, i % 10, i);
+
+  std::vector<std::vector<std::pair<long, long> > > applied(4);
+  mysql::Sharded_applier applier(4, boost::bind(&record_row, &applied, _1, _2),
+                                 true);
+  std::vector<unsigned int> key(1, 0);
+  applier.set_key("test", "t1", key);
+  EXPECT_TRUE(applier.handles(mysql::XID_EVENT));
+  EXPECT_FALSE(applier.handles(mysql::ROTATE_EVENT));
+
+  mysql::Binary_log_event *tm= parse_event(mysql::TABLE_MAP_EVENT,
+                                           table_map_body,
+                                           sizeof(table_map_body));
+  EXPECT_EQ(applier.process_event(static_cast<mysql::Table_map_event *>(tm)),
+            tm);
+  delete tm;
+
+  mysql::Binary_log_event *rows= parse_event(mysql::WRITE_ROWS_EVENT,
+                                             &body[0], body.size());
+  EXPECT_TRUE(applier.process_event(static_cast<mysql::Row_event *>(rows)) == 0);
+
+  /* The barrier waits for the rows. */
+  mysql::Log_event_header xid_header= make_header(mysql::XID_EVENT, 8);
+  mysql::Xid xid(&xid_header);
+  EXPECT_EQ(applier.process_event(&xid), &xid);
+
+  std::size_t total= 0, busy= 0;
+  std::map<long, unsigned int> worker_of;
+  for (unsigned int worker= 0; worker < applied.size(); ++worker)
+  {
+    total+= applied[worker].size();
+    busy+= !applied[worker].empty();
+    std::map<long, long> last;
+    for (std::size_t i= 0; i < applied[worker].size(); ++i)
+    {
+      long key= applied[worker][i].first;
+      long sequence= applied[worker][i].second;
+      /* A key stays with one worker, which applies its rows in order. */
+      EXPECT_EQ(sequence % 10, key);
+      if (worker_of.count(key))
+      {
+        EXPECT_EQ(worker_of[key], worker);
+      }
+      worker_of[key]= worker;
+      if (last.count(key))
+      {
+        EXPECT_GT(sequence, last[key]);
+      }
+      last[key]= sequence;
+    }
+  }
+  EXPECT_EQ(total, 1000U);
+  EXPECT_GT(busy, 1U);
+}
+
+/**
+  Notes when transactions are applied and committed. Each transaction
+  writes one row (key, 'sequence').
+
+  Transaction 1 is held in apply until transaction 2 has started, which
+  shows that transactions without conflicts are applied at the same
+  time.
+*/
+class Transaction_log
+{
+public:
+  Transaction_log() : overlapped(false) {}
+
+  void apply(unsigned int, mysql::Transaction_log_event &transaction)
+  {
+    long sequence= note(transaction, 1);
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (sequence == 2)
+    {
+      overlapped= true;
+      m_second_started.notify_all();
+    }
+    else if (sequence == 1)
+    {
+      boost::system_time deadline= boost::get_system_time() +
+        boost::posix_time::seconds(10);
+      while (!overlapped &&
+             m_second_started.timed_wait(lock, deadline))
+        ;
+    }
+  }
+
+  void commit(unsigned int, mysql::Transaction_log_event &transaction)
+  {
+    note(transaction, -1);
+  }
+
+  /*
+    The steps in the order they happened, as the sequence number of the
+    transaction, negative for commits.
+  */
+  std::vector<long> steps;
+
+  /*
+    Whether transaction 2 started while transaction 1 was applied.
+  */
+  bool overlapped;
+
+private:
+  long note(mysql::Transaction_log_event &transaction, int sign)
+  {
+    mysql::Row_event *rows=
+      static_cast<mysql::Row_event *>(transaction.m_events.back());
+    mysql::Table_map_event *table=
+      static_cast<mysql::Table_map_event *>(transaction.m_events.front());
+    mysql::Row_event_set images(rows, table);
+    mysql::Row_of_fields fields= *images.begin();
+    mysql::Converter converter;
+    std::string sequence;
+    converter.to(sequence, fields[1]);
+    boost::mutex::scoped_lock lock(m_mutex);
+    steps.push_back(sign * atol(sequence.c_str()));
+    return atol(sequence.c_str());
+  }
+
+  boost::mutex m_mutex;
+  boost::condition m_second_started;
+};
+
+TEST_F(TestQueue, Writeset_scheduler)
+{
+  Transaction_log log;
+  mysql::Writeset_scheduler scheduler(4,
+    boost::bind(&Transaction_log::apply, &log, _1, _2),
+    boost::bind(&Transaction_log::commit, &log, _1, _2));
+  scheduler.set_key("test", "t1", std::vector<unsigned int>(1, 0));
+
+  /* Transaction i writes the key i % 3. */
+  const int count= 30;
+  for (int i= 1; i <= count; ++i)
+  {
+    mysql::Transaction_log_event *transaction=
+      mysql::create_transaction_log_event();
+    mysql::Table_map_event *tm= static_cast<mysql::Table_map_event *>(
+      parse_event(mysql::TABLE_MAP_EVENT, table_map_body,
+                  sizeof(table_map_body)));
+    transaction->m_table_map.insert(mysql::Event_index_element(tm->table_id, tm));
+    transaction->m_events.push_back(tm);
+
+    std::vector<boost::uint8_t> body(write_rows_head,
+                                     write_rows_head + sizeof(write_rows_head));
+    add_row(&body, i % 3, i);
+    transaction->m_events.push_back(
+      parse_event(mysql::WRITE_ROWS_EVENT, &body[0], body.size()));
+    EXPECT_TRUE(scheduler.process_event(transaction) == 0);
+  }
+  scheduler.drain();
+  EXPECT_TRUE(log.overlapped);
+
+  std::vector<long> commits;
+  std::map<long, std::size_t> applied_at, committed_at;
+  for (std::size_t i= 0; i < log.steps.size(); ++i)
+  {
+    if (log.steps[i] < 0)
+    {
+      commits.push_back(-log.steps[i]);
+      committed_at[-log.steps[i]]= i;
+    }
+    else
+      applied_at[log.steps[i]]= i;
+  }
+
+  /* All commit in order, and a writer of a key waits for the one before. */
+  ASSERT_EQ(commits.size(), (std::size_t) count);
+  for (int i= 1; i <= count; ++i)
+  {
+    EXPECT_EQ(commits[i - 1], i);
+    if (i > 3)
+    {
+      EXPECT_GT(applied_at[i], committed_at[i - 3]) << i;
+    }
+  }
+}
+
+TEST_F(TestQueue, Disk_spill)
+{
+  char directory[]= "/tmp/test-queue.XXXXXX";
+  ASSERT_TRUE(mkdtemp(directory) != 0);
+  {
+    /* Room for 20 events of 100 bytes, 3 to a segment. */
+    mysql::system::Disk_spill spill(directory, 20 * 104, 250);
+    boost::shared_ptr<boost::uint8_t> buffer= mysql::make_buffer(100);
+    mysql::Byte_view event;
+    std::size_t written= 0, read= 0;
+
+    /* Reading while writing crosses into later segments. */
+    for (int round= 0; round < 3; ++round)
+    {
+      for (int i= 0; i < 8; ++i, ++written)
+      {
+        memset(buffer.get(), written & 0xff, 100);
+        ASSERT_TRUE(spill.write(mysql::Byte_view(buffer, buffer.get(), 100)));
+      }
+      for (int i= 0; i < 5; ++i, ++read)
+      {
+        ASSERT_TRUE(spill.front(&event));
+        ASSERT_EQ(event.size(), 100U);
+        EXPECT_EQ(event[0], read & 0xff);
+        EXPECT_EQ(event[99], read & 0xff);
+        spill.pop();
+      }
+    }
+    EXPECT_EQ(spill.depth(), written - read);
+    EXPECT_EQ(spill.bytes(), (written - read) * 100);
+    EXPECT_LE(spill.segments(), 4U);
+
+    /* The disk limit is reached. */
+    while (spill.write(mysql::Byte_view(buffer, buffer.get(), 100)))
+      ++written;
+    EXPECT_LE(spill.disk_bytes(), 20U * 104);
+    EXPECT_GT(spill.disk_bytes() + 104, 20U * 104);
+
+    while (spill.front(&event))
+    {
+      spill.pop();
+      ++read;
+    }
+    EXPECT_EQ(read, written);
+    EXPECT_EQ(spill.segments(), 0U);
+    EXPECT_EQ(spill.disk_bytes(), 0U);
+  }
+  /* All segment files are gone, so the directory can be removed. */
+  EXPECT_EQ(rmdir(directory), 0);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
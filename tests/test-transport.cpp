@@ -22,11 +22,27 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 #include <gtest/gtest.h>
 #include <iostream>
 #include <stdlib.h>
+#include <fstream>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/lexical_cast.hpp>
 
 using mysql::system::create_transport;
 using mysql::system::Binary_log_driver;
 using mysql::system::Binlog_tcp_driver;
 using mysql::system::Binlog_file_driver;
+using mysql::system::Binlog_mmap_driver;
+using mysql::system::Binlog_catchup_driver;
+using mysql::system::Binlog_backfill_driver;
+using mysql::system::Compressed_file;
+using mysql::system::Relay_log;
+using mysql::system::Binlog_replay_driver;
+using mysql::system::build_access_index;
 
 class TestTransport : public ::testing::Test {
 protected:
@@ -104,6 +120,107 @@ TEST_F(TestTransport, CreateTransport_TcpIp) {
   EXPECT_FALSE(create_transport("mysql://somebody:xyzzy"));
 }
 
+TEST_F(TestTransport, CreateTransport_QueueOptions) {
+  Binary_log_driver *drv=
+    create_transport("mysql://somebody@128.0.0.1:3306?queue_events=0&queue_bytes=64M&queue_full=spill");
+  Binlog_tcp_driver* tcp = dynamic_cast<Binlog_tcp_driver*>(drv);
+  ASSERT_TRUE(tcp);
+  CheckTcpValues(tcp, "somebody", "", "128.0.0.1", 3306);
+  EXPECT_EQ(tcp->queue_events(), 0U);
+  EXPECT_EQ(tcp->queue_bytes(), 64U * 1024 * 1024);
+  EXPECT_TRUE(tcp->spill());
+  EXPECT_EQ(tcp->spill_depth(), 0U);
+  delete drv;
+
+  drv= create_transport("mysql://somebody@example.com?queue_events=10");
+  tcp = dynamic_cast<Binlog_tcp_driver*>(drv);
+  ASSERT_TRUE(tcp);
+  CheckTcpValues(tcp, "somebody", "", "example.com", 3306);
+  EXPECT_EQ(tcp->queue_events(), 10U);
+  EXPECT_EQ(tcp->queue_bytes(), (boost::uint64_t) EVENT_QUEUE_BYTES);
+  EXPECT_FALSE(tcp->spill());
+  EXPECT_FALSE(tcp->compress());
+  delete drv;
+
+  /* A larger event limit is cut to what the queue can hold. */
+  Binlog_tcp_driver large("somebody", "", "example.com", 3306, 1UL << 30);
+  EXPECT_EQ(large.queue_events(), (std::size_t) EVENT_QUEUE_MAX_SIZE);
+
+  drv= create_transport("mysql://somebody@example.com?compress=1");
+  tcp = dynamic_cast<Binlog_tcp_driver*>(drv);
+  ASSERT_TRUE(tcp);
+  EXPECT_TRUE(tcp->compress());
+  EXPECT_FALSE(tcp->inline_io());
+  delete drv;
+
+  drv= create_transport("mysql://somebody@example.com?inline=1");
+  tcp = dynamic_cast<Binlog_tcp_driver*>(drv);
+  ASSERT_TRUE(tcp);
+  EXPECT_TRUE(tcp->inline_io());
+  delete drv;
+
+  drv= create_transport("mysql://somebody@example.com?queue_full=spill&spill_dir=/tmp&spill_bytes=1G&spill_segment=16M");
+  tcp = dynamic_cast<Binlog_tcp_driver*>(drv);
+  ASSERT_TRUE(tcp);
+  const mysql::system::Disk_spill *disk=
+    dynamic_cast<const mysql::system::Disk_spill*>(tcp->spill());
+  ASSERT_TRUE(disk);
+  EXPECT_EQ(disk->directory(), "/tmp");
+  delete drv;
+
+  drv= create_transport("mysql://somebody@example.com?compress=1&catchup=/var/lib/mysql/archive");
+  Binlog_catchup_driver *catchup= dynamic_cast<Binlog_catchup_driver*>(drv);
+  ASSERT_TRUE(catchup);
+  CheckTcpValues(const_cast<Binlog_tcp_driver*>(catchup->remote()),
+                 "somebody", "", "example.com", 3306);
+  EXPECT_TRUE(catchup->remote()->compress());
+  EXPECT_FALSE(catchup->live());
+  delete catchup;
+
+  drv= create_transport("mysql://somebody@example.com?server_id=42");
+  tcp = dynamic_cast<Binlog_tcp_driver*>(drv);
+  ASSERT_TRUE(tcp);
+  EXPECT_EQ(tcp->server_id(), 42U);
+  delete drv;
+
+  drv= create_transport("mysql://somebody:pw@example.com:3307?backfill=4&server_id=100&compress=1");
+  Binlog_backfill_driver *backfill= dynamic_cast<Binlog_backfill_driver*>(drv);
+  ASSERT_TRUE(backfill);
+  EXPECT_EQ(backfill->user(), "somebody");
+  EXPECT_EQ(backfill->password(), "pw");
+  EXPECT_EQ(backfill->host(), "example.com");
+  EXPECT_EQ(backfill->port(), 3307U);
+  EXPECT_EQ(backfill->connections(), 4U);
+  EXPECT_EQ(backfill->server_id(), 100U);
+  EXPECT_TRUE(backfill->compress());
+  delete backfill;
+
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?backfill=0"));
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?backfill=65"));
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?backfill=2&catchup=/tmp"));
+  drv= create_transport("mysql://somebody@example.com?relay=/tmp&relay_sync=5");
+  tcp = dynamic_cast<Binlog_tcp_driver*>(drv);
+  ASSERT_TRUE(tcp);
+  ASSERT_TRUE(tcp->relay_log());
+  EXPECT_EQ(tcp->relay_log()->directory(), "/tmp");
+  EXPECT_EQ(tcp->relay_log()->sync_interval(), 5UL);
+  delete tcp;
+
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?backfill=2&relay=/tmp"));
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?relay="));
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?server_id=0"));
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?catchup="));
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?queue_events"));
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?queue_events=x"));
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?queue_events=4G"));
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?queue_bytes=10X"));
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?queue_full=drop"));
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?no_such_option=1"));
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?spill_segment=0"));
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?compress=yes"));
+  EXPECT_FALSE(create_transport("mysql://somebody@128.0.0.1?inline=2"));
+}
+
 TEST_F(TestTransport, CreateTransport_File) {
   TestFileTransport("file:///master-bin.000003", "/master-bin.000003");
   TestFileTransport("file:///etc/foo/master-bin.000003", "/etc/foo/master-bin.000003");
@@ -121,6 +238,506 @@ TEST_F(TestTransport, CreateTransport_File) {
     EXPECT_FALSE(create_transport(bad_urls[i]));
 }
 
+TEST_F(TestTransport, CreateTransport_Mmap) {
+  Binary_log_driver *drv= create_transport("file+mmap:///etc/foo/master-bin.000003");
+  Binlog_mmap_driver *mmap= dynamic_cast<Binlog_mmap_driver*>(drv);
+  ASSERT_TRUE(mmap);
+  std::string filename;
+  mmap->get_position(&filename, 0);
+  EXPECT_EQ(filename, "/etc/foo/master-bin.000003");
+  delete drv;
+
+  EXPECT_FALSE(create_transport("file+mmap://master-bin.000003"));
+  EXPECT_FALSE(create_transport("file+mmap:master-bin.000003"));
+}
+
+/**
+  Builds a binlog file with the given number of XID events, followed by a
+  Rotate event to the file next unless that is empty. The events have the
+  timestamps timestamp, timestamp + 1 and so on.
+*/
+static std::vector<boost::uint8_t> make_binlog(int events,
+                                               const std::string &next,
+                                               boost::uint32_t timestamp= 0)
+{
+  std::vector<boost::uint8_t> binlog;
+  const boost::uint8_t magic[]= { 0xfe, 0x62, 0x69, 0x6e };
+  binlog.insert(binlog.end(), magic, magic + sizeof(magic));
+  for (int i= 0; i <= events; ++i)
+  {
+    bool rotate= i == events;
+    if (rotate && next.empty())
+      break;
+    std::vector<boost::uint8_t> event(LOG_EVENT_HEADER_SIZE - 1 + 8);
+    int3store(&event[0], timestamp + i);
+    event[3]= (timestamp + i) >> 24;
+    event[4]= rotate ? mysql::ROTATE_EVENT : mysql::XID_EVENT;
+    if (rotate)
+    {
+      event[LOG_EVENT_HEADER_SIZE - 1]= 4;
+      event.insert(event.end(), next.begin(), next.end());
+    }
+    int3store(&event[9], event.size());
+    int3store(&event[13], binlog.size() + event.size());
+    binlog.insert(binlog.end(), event.begin(), event.end());
+  }
+  return binlog;
+}
+
+/**
+  Writes a binlog file built by make_binlog().
+*/
+static void write_binlog(const std::string &path, int events,
+                         const std::string &next,
+                         boost::uint32_t timestamp= 0)
+{
+  std::vector<boost::uint8_t> binlog= make_binlog(events, next, timestamp);
+  std::ofstream file(path.c_str(), std::ios::binary);
+  file.write(reinterpret_cast<const char *>(&binlog[0]), binlog.size());
+}
+
+/**
+  Reads all events and returns their types, with the file each one was
+  read from.
+*/
+static std::vector<std::pair<std::string, int> > read_all(Binary_log_driver *drv)
+{
+  std::vector<std::pair<std::string, int> > events;
+  mysql::Binary_log_event *event;
+  while (drv->wait_for_next_event(&event) == 0)
+  {
+    std::string file;
+    drv->get_position(&file, 0);
+    events.push_back(std::make_pair(file, (int) event->get_event_type()));
+    delete event;
+  }
+  return events;
+}
+
+TEST_F(TestTransport, FileDriver_Sequence)
+{
+  char dir_template[]= "/tmp/test-transport.XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir_template));
+  std::string dir(dir_template);
+  write_binlog(dir + "/seq-bin.000001", 2, "seq-bin.000002");
+  write_binlog(dir + "/seq-bin.000002", 1, "seq-bin.000003");
+  write_binlog(dir + "/seq-bin.000003", 1, "");
+  {
+    std::ofstream index((dir + "/seq-bin.index").c_str());
+    index << "./seq-bin.000001\n./seq-bin.000002\n./seq-bin.000003\n";
+  }
+
+  const char *urls[]= {
+    "file://%s/seq-bin.index",
+    "file+mmap://%s/seq-bin.index",
+    "file://%s",
+    "file://%s/seq-bin.000001?follow=1",
+    "file+mmap://%s/seq-bin.000001?follow=1",
+    "file://%s/seq-bin.index?threads=2",
+    "file+mmap://%s/seq-bin.index?threads=3",
+  };
+  for (int i = 0 ; i < sizeof(urls)/sizeof(*urls) ; ++i)
+  {
+    char url[256];
+    snprintf(url, sizeof(url), urls[i], dir.c_str());
+    Binary_log_driver *drv= create_transport(url);
+    ASSERT_TRUE(drv) << url;
+    ASSERT_EQ(drv->connect(), 0) << url;
+    std::vector<std::pair<std::string, int> > events= read_all(drv);
+    ASSERT_EQ(events.size(), 6U) << url;
+    EXPECT_EQ(events[1].first, dir + "/seq-bin.000001");
+    EXPECT_EQ(events[2].second, mysql::ROTATE_EVENT);
+    EXPECT_EQ(events[3].first, dir + "/seq-bin.000002");
+    EXPECT_EQ(events[5].first, dir + "/seq-bin.000003");
+    EXPECT_EQ(events[5].second, mysql::XID_EVENT);
+
+    /* Move to the start of the second file. */
+    ASSERT_EQ(drv->set_position("seq-bin.000002", 4), 0) << url;
+    EXPECT_EQ(read_all(drv).size(), 3U) << url;
+    delete drv;
+  }
+
+  /* Without follow only the first file is read. */
+  Binary_log_driver *drv= create_transport(("file://" + dir + "/seq-bin.000001").c_str());
+  ASSERT_EQ(drv->connect(), 0);
+  EXPECT_EQ(read_all(drv).size(), 3U);
+  delete drv;
+
+  EXPECT_FALSE(create_transport(("file://" + dir + "/seq-bin.000001?follow=2").c_str()));
+  EXPECT_FALSE(create_transport(("file://" + dir + "/seq-bin.index?threads=0").c_str()));
+  EXPECT_FALSE(create_transport(("file://" + dir + "/seq-bin.index?threads=2&follow=1").c_str()));
+
+  const char *files[]= { "seq-bin.000001", "seq-bin.000002", "seq-bin.000003",
+                         "seq-bin.index" };
+  for (int i = 0 ; i < sizeof(files)/sizeof(*files) ; ++i)
+    unlink((dir + "/" + files[i]).c_str());
+  rmdir(dir.c_str());
+}
+
+/**
+  Appends the events of the binlog file more to tail-bin.000001 in two
+  pieces which split an event, and then creates tail-bin.000002.
+*/
+static void append_binlog(const std::string &dir)
+{
+  std::ifstream in((dir + "/more").c_str(), std::ios::binary);
+  std::string more((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  more.erase(0, 4);
+  std::string binlog= dir + "/tail-bin.000001";
+  const std::size_t split= 10;
+  boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+  {
+    std::ofstream out(binlog.c_str(), std::ios::binary | std::ios::app);
+    out.write(more.data(), split);
+  }
+  boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+  {
+    std::ofstream out(binlog.c_str(), std::ios::binary | std::ios::app);
+    out.write(more.data() + split, more.size() - split);
+  }
+  boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+  write_binlog(dir + "/tail-bin.000002", 1, "");
+}
+
+TEST_F(TestTransport, FileDriver_Tail)
+{
+  char dir_template[]= "/tmp/test-transport.XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir_template));
+  std::string dir(dir_template);
+  write_binlog(dir + "/tail-bin.000001", 2, "");
+  write_binlog(dir + "/more", 1, "tail-bin.000002");
+
+  std::string url= "file://" + dir + "/tail-bin.000001?tail=1";
+  Binary_log_driver *drv= create_transport(url.c_str());
+  ASSERT_TRUE(drv);
+  ASSERT_EQ(drv->connect(), 0);
+  std::vector<mysql::Binary_log_event *> events;
+  ASSERT_EQ(drv->wait_for_next_events(&events, 10), 0);
+  EXPECT_EQ(events.size(), 2U);
+  for (std::size_t i= 0; i < events.size(); ++i)
+    delete events[i];
+  events.clear();
+
+  /* At the end the driver waits instead of returning ERR_EOF. */
+  EXPECT_EQ(drv->wait_for_next_events(&events, 10, 50), 0);
+  EXPECT_TRUE(events.empty());
+
+  boost::thread writer(boost::bind(append_binlog, dir));
+  const int types[]= { mysql::XID_EVENT, mysql::ROTATE_EVENT, mysql::XID_EVENT };
+  for (int i= 0; i < 3; ++i)
+  {
+    mysql::Binary_log_event *event;
+    ASSERT_EQ(drv->wait_for_next_event(&event), 0);
+    EXPECT_EQ(event->get_event_type(), types[i]);
+    delete event;
+  }
+  std::string file;
+  drv->get_position(&file, 0);
+  EXPECT_EQ(file, dir + "/tail-bin.000002");
+  writer.join();
+  delete drv;
+
+  EXPECT_FALSE(create_transport(("file+mmap://" + dir + "/tail-bin.000001?tail=1").c_str()));
+
+  unlink((dir + "/tail-bin.000001").c_str());
+  unlink((dir + "/tail-bin.000002").c_str());
+  unlink((dir + "/more").c_str());
+  rmdir(dir.c_str());
+}
+
+TEST_F(TestTransport, FileDriver_Time)
+{
+  char dir_template[]= "/tmp/test-transport.XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir_template));
+  std::string dir(dir_template);
+  std::vector<std::string> files;
+  files.push_back(dir + "/time-bin.000001");
+  files.push_back(dir + "/time-bin.000002");
+  files.push_back(dir + "/time-bin.000003");
+  write_binlog(files[0], 10, "time-bin.000002", 100);
+  write_binlog(files[1], 10, "time-bin.000003", 200);
+  write_binlog(files[2], 10, "", 300);
+  {
+    std::ofstream index((dir + "/time-bin.index").c_str());
+    index << "./time-bin.000001\n./time-bin.000002\n./time-bin.000003\n";
+  }
+
+  /* Without a time index, with one of every transaction and a sparse one. */
+  const unsigned long intervals[]= { 0, 0, 100 };
+  for (int i= 0; i < 3; ++i)
+  {
+    if (i > 0)
+    {
+      for (std::size_t j= 0; j < files.size(); ++j)
+        ASSERT_EQ(mysql::system::build_time_index(files[j], intervals[i]), 0);
+    }
+    std::string file;
+    unsigned long position;
+    ASSERT_EQ(mysql::system::find_position_by_time(files, 205, &file, &position), 0);
+    EXPECT_EQ(file, files[1]);
+    EXPECT_EQ(position, 4U + 5 * 27);
+    ASSERT_EQ(mysql::system::find_position_by_time(files, 50, &file, &position), 0);
+    EXPECT_EQ(file, files[0]);
+    EXPECT_EQ(position, 4U);
+    ASSERT_EQ(mysql::system::find_position_by_time(files, 250, &file, &position), 0);
+    EXPECT_EQ(file, files[2]);
+    EXPECT_EQ(position, 4U);
+    EXPECT_EQ(mysql::system::find_position_by_time(files, 400, &file, &position),
+              (int) mysql::ERR_EOF);
+  }
+
+  std::vector<mysql::system::Time_index_entry> entries;
+  ASSERT_EQ(mysql::system::read_time_index(files[0], &entries), 0);
+  EXPECT_EQ(entries.size(), 3U);
+  EXPECT_EQ(entries[1].position, 4U + 4 * 27);
+  EXPECT_EQ(entries[1].timestamp, 104U);
+
+  /* From 205 up to the transaction at 302. */
+  mysql::Binary_log binlog(create_transport(("file://" + dir + "/time-bin.index").c_str()));
+  ASSERT_EQ(binlog.connect(), 0);
+  ASSERT_EQ(binlog.set_position_by_time(205, 302), 0);
+  std::string file;
+  EXPECT_EQ(binlog.get_position(file), 4U + 5 * 27);
+  EXPECT_EQ(file, files[1]);
+  mysql::Binary_log_event *event;
+  std::vector<boost::uint32_t> timestamps;
+  while (binlog.wait_for_next_event(&event) == 0)
+  {
+    timestamps.push_back(event->header()->timestamp);
+    delete event;
+  }
+  ASSERT_EQ(timestamps.size(), 8U);
+  EXPECT_EQ(timestamps.front(), 205U);
+  EXPECT_EQ(timestamps.back(), 301U);
+
+  for (std::size_t i = 0 ; i < files.size() ; ++i)
+  {
+    unlink(files[i].c_str());
+    unlink((files[i] + TIME_INDEX_SUFFIX).c_str());
+  }
+  unlink((dir + "/time-bin.index").c_str());
+  rmdir(dir.c_str());
+}
+
+TEST_F(TestTransport, FileDriver_Parallel)
+{
+  char dir_template[]= "/tmp/test-transport.XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir_template));
+  std::string dir(dir_template);
+  std::vector<std::string> files;
+  {
+    std::ofstream index((dir + "/par-bin.index").c_str());
+    for (int i= 1; i <= 20; ++i)
+    {
+      char name[32], next[32];
+      snprintf(name, sizeof(name), "par-bin.%06d", i);
+      snprintf(next, sizeof(next), "par-bin.%06d", i + 1);
+      files.push_back(dir + "/" + name);
+      write_binlog(files.back(), 1000 * ((i + 1) % 4), i < 20 ? next : "");
+      index << "./" << name << "\n";
+    }
+  }
+
+  Binary_log_driver *drv= create_transport(("file+mmap://" + dir +
+                                            "/par-bin.index?threads=4").c_str());
+  ASSERT_TRUE(drv);
+  ASSERT_EQ(drv->connect(), 0);
+  std::vector<mysql::Binary_log_event *> events;
+  std::size_t file= 0, count= 0;
+  unsigned long last_position= 0;
+  while (drv->wait_for_next_events(&events, 100) == 0)
+  {
+    ASSERT_FALSE(events.empty());
+    for (std::size_t i= 0; i < events.size(); ++i, ++count)
+    {
+      unsigned long position= events[i]->header()->next_position;
+      if (position < last_position)
+        ++file;
+      last_position= position;
+      if (events[i]->get_event_type() == mysql::ROTATE_EVENT)
+      {
+        EXPECT_EQ(static_cast<mysql::Rotate_event *>(events[i])->binlog_file,
+                  files[file + 1].substr(dir.size() + 1));
+      }
+      delete events[i];
+    }
+    events.clear();
+  }
+  EXPECT_EQ(file, files.size() - 1);
+  EXPECT_EQ(count, 30000U + 19U);
+  delete drv;
+
+  for (std::size_t i = 0 ; i < files.size() ; ++i)
+    unlink(files[i].c_str());
+  unlink((dir + "/par-bin.index").c_str());
+  rmdir(dir.c_str());
+}
+
+/**
+  Writes data to a gzip file made of the given number of members, one
+  after the other.
+*/
+static void write_gzip(const std::string &path,
+                       const std::vector<boost::uint8_t> &data, int members)
+{
+  std::size_t piece= data.size() / members + 1;
+  for (int i= 0; i < members; ++i)
+  {
+    gzFile file= gzopen(path.c_str(), i == 0 ? "wb" : "ab");
+    std::size_t begin= std::min(i * piece, data.size());
+    std::size_t end= std::min(begin + piece, data.size());
+    if (end > begin)
+      gzwrite(file, &data[begin], end - begin);
+    gzclose(file);
+  }
+}
+
+/**
+  Seeks to positions in a compressed file, before and after the read
+  position, and checks the bytes found there.
+*/
+static void check_seeks(Compressed_file *file,
+                        const std::vector<boost::uint8_t> &data)
+{
+  const std::size_t positions[]= { data.size() - 100, 12345, 0, 300000,
+                                   300001, 299000, data.size() };
+  for (std::size_t i= 0; i < sizeof(positions) / sizeof(*positions); ++i)
+  {
+    ASSERT_EQ(file->seek(positions[i]), 0) << positions[i];
+    EXPECT_EQ(file->position(), positions[i]);
+    std::size_t length= std::min<std::size_t>(100, data.size() - positions[i]);
+    boost::uint8_t buffer[100];
+    ASSERT_EQ(file->read(buffer, sizeof(buffer)), (long) length);
+    EXPECT_EQ(memcmp(buffer, &data[positions[i]], length), 0) << positions[i];
+  }
+  EXPECT_TRUE(file->at_end());
+  EXPECT_NE(file->seek(data.size() + 1), 0);
+}
+
+TEST_F(TestTransport, FileDriver_Compressed)
+{
+  char dir_template[]= "/tmp/test-transport.XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir_template));
+  std::string dir(dir_template);
+  std::vector<boost::uint8_t> first= make_binlog(20000, "gz-bin.000002");
+  write_gzip(dir + "/gz-bin.000001.gz", first, 2);
+  write_gzip(dir + "/gz-bin.000002.gz", make_binlog(3, ""), 1);
+  {
+    std::ofstream index((dir + "/gz-bin.index").c_str());
+    index << "./gz-bin.000001\n./gz-bin.000002\n";
+  }
+
+  /* The compressed files stand in for the plain ones. */
+  const char *urls[]= {
+    "file://%s",
+    "file://%s/gz-bin.index",
+    "file://%s/gz-bin.000001.gz?follow=1",
+    "file://%s/gz-bin.index?threads=2",
+  };
+  const unsigned long event_size= LOG_EVENT_HEADER_SIZE - 1 + 8;
+  for (int i = 0 ; i < sizeof(urls)/sizeof(*urls) ; ++i)
+  {
+    char url[256];
+    snprintf(url, sizeof(url), urls[i], dir.c_str());
+    Binary_log_driver *drv= create_transport(url);
+    ASSERT_TRUE(drv) << url;
+    ASSERT_EQ(drv->connect(), 0) << url;
+    std::vector<std::pair<std::string, int> > events= read_all(drv);
+    ASSERT_EQ(events.size(), 20001U + 3U) << url;
+    EXPECT_EQ(events[0].first, dir + "/gz-bin.000001");
+    EXPECT_EQ(events[20000].second, mysql::ROTATE_EVENT);
+    EXPECT_EQ(events.back().first, dir + "/gz-bin.000002");
+
+    /* Move back into the first file, and forward again. */
+    ASSERT_EQ(drv->set_position("gz-bin.000001", 4 + 19990 * event_size), 0)
+      << url;
+    EXPECT_EQ(read_all(drv).size(), 10U + 1U + 3U) << url;
+    ASSERT_EQ(drv->set_position("gz-bin.000001", 4 + 5 * event_size), 0)
+      << url;
+    ASSERT_EQ(drv->set_position("gz-bin.000001", 4 + 19000 * event_size), 0)
+      << url;
+    EXPECT_EQ(read_all(drv).size(), 1000U + 1U + 3U) << url;
+    delete drv;
+  }
+
+  /* Access points are noted while reading and used to seek. */
+  std::string path= dir + "/gz-bin.000001.gz";
+  Compressed_file *file= Compressed_file::open(path, 64 * 1024);
+  ASSERT_TRUE(file);
+  std::vector<boost::uint8_t> data(first.size() + 1);
+  EXPECT_EQ(file->read(&data[0], data.size()), (long) first.size());
+  data.resize(first.size());
+  EXPECT_TRUE(data == first);
+  EXPECT_GT(file->access_points().size(), 2U);
+  check_seeks(file, first);
+  delete file;
+
+  /* A saved index is used from the first seek on. */
+  ASSERT_EQ(build_access_index(path, 64 * 1024), 0);
+  file= Compressed_file::open(path);
+  ASSERT_TRUE(file);
+  EXPECT_GT(file->access_points().size(), 2U);
+  check_seeks(file, first);
+  delete file;
+
+  /* A file cut short is an error rather than the end of the binlog. */
+  {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    std::string whole((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+    std::ofstream out((dir + "/cut.gz").c_str(), std::ios::binary);
+    out.write(whole.data(), whole.size() / 2);
+  }
+  Binary_log_driver *drv= create_transport(("file://" + dir + "/cut.gz").c_str());
+  ASSERT_EQ(drv->connect(), 0);
+  mysql::Binary_log_event *event;
+  int rc;
+  while ((rc= drv->wait_for_next_event(&event)) == 0)
+    delete event;
+  EXPECT_EQ(rc, (int) mysql::ERR_FAIL);
+  delete drv;
+
+#ifdef HAVE_ZSTD
+  /* A zstd file of several frames is entered at the frames. */
+  std::vector<boost::uint8_t> compressed;
+  for (std::size_t begin= 0; begin < first.size(); begin+= 100000)
+  {
+    std::size_t length= std::min<std::size_t>(100000, first.size() - begin);
+    std::vector<boost::uint8_t> frame(ZSTD_compressBound(length));
+    frame.resize(ZSTD_compress(&frame[0], frame.size(), &first[begin],
+                               length, 3));
+    compressed.insert(compressed.end(), frame.begin(), frame.end());
+  }
+  {
+    std::ofstream out((dir + "/zst-bin.000001.zst").c_str(), std::ios::binary);
+    out.write(reinterpret_cast<const char *>(&compressed[0]), compressed.size());
+  }
+  file= Compressed_file::open(dir + "/zst-bin.000001.zst", 64 * 1024);
+  ASSERT_TRUE(file);
+  data.assign(first.size(), 0);
+  EXPECT_EQ(file->read(&data[0], data.size()), (long) first.size());
+  EXPECT_TRUE(data == first);
+  EXPECT_GT(file->access_points().size(), 2U);
+  check_seeks(file, first);
+  delete file;
+  unlink((dir + "/zst-bin.000001.zst").c_str());
+#endif
+
+  const char *files[]= { "gz-bin.000001.gz", "gz-bin.000002.gz",
+                         "gz-bin.000001.gz" ACCESS_INDEX_SUFFIX,
+                         "gz-bin.index", "cut.gz" };
+  for (int i = 0 ; i < sizeof(files)/sizeof(*files) ; ++i)
+    unlink((dir + "/" + files[i]).c_str());
+  rmdir(dir.c_str());
+}
+
+TEST_F(TestTransport, TcpDriver_Footprint)
+{
+  /* Receive buffers are allocated on demand, not inside the driver. */
+  EXPECT_LT(sizeof(Binlog_tcp_driver), 64 * 1024U);
+}
+
 TEST_F(TestTransport, CreateTransport_Bogus)
 {
   EXPECT_FALSE(create_transport("bogus-url"));
@@ -130,6 +747,876 @@ TEST_F(TestTransport, CreateTransport_Bogus)
   EXPECT_FALSE(create_transport("mysq:"));
 }
 
+/**
+  Appends payload as one or, if it is too large for that, more packets.
+*/
+static void append_packet(std::vector<boost::uint8_t> *stream,
+                          const boost::uint8_t *payload, std::size_t length,
+                          boost::uint8_t packet_no)
+{
+  std::size_t part;
+  do
+  {
+    part= std::min(length, (std::size_t) MAX_PACKAGE_SIZE);
+    boost::uint8_t header[4];
+    int3store(header, part);
+    header[3]= packet_no++;
+    stream->insert(stream->end(), header, header + 4);
+    stream->insert(stream->end(), payload, payload + part);
+    payload+= part;
+    length-= part;
+  } while (part == MAX_PACKAGE_SIZE);
+}
+
+/**
+  Sends stream as it is or in compressed packets of 16K before
+  compression, which don't line up with the packets in it.
+*/
+static void write_stream(tcp::socket &socket,
+                         const std::vector<boost::uint8_t> &stream,
+                         bool compressed)
+{
+  if (!compressed)
+  {
+    boost::asio::write(socket, boost::asio::buffer(stream));
+    return;
+  }
+
+  const std::size_t chunk= 16 * 1024;
+  for (std::size_t pos= 0; pos < stream.size(); pos+= chunk)
+  {
+    std::size_t length= std::min(chunk, stream.size() - pos);
+    std::vector<boost::uint8_t> packet(COMPRESSED_HEADER_SIZE +
+                                       compressBound(length));
+    uLongf compressed_length= packet.size() - COMPRESSED_HEADER_SIZE;
+    compress(&packet[COMPRESSED_HEADER_SIZE], &compressed_length,
+             &stream[pos], length);
+    int3store(&packet[0], compressed_length);
+    packet[3]= pos / chunk;
+    int3store(&packet[4], length);
+    boost::asio::write(socket,
+                       boost::asio::buffer(&packet[0], COMPRESSED_HEADER_SIZE +
+                                                       compressed_length));
+  }
+}
+
+/**
+  Reads a command in a single packet and returns the packet, which
+  starts with the command code.
+*/
+static std::vector<boost::uint8_t> read_command(tcp::socket &socket,
+                                                bool compressed)
+{
+  if (!compressed)
+  {
+    boost::uint8_t header[4];
+    boost::asio::read(socket, boost::asio::buffer(header));
+    std::vector<boost::uint8_t> body(header[0] | (header[1] << 8));
+    boost::asio::read(socket, boost::asio::buffer(body));
+    return body;
+  }
+
+  boost::uint8_t header[COMPRESSED_HEADER_SIZE];
+  boost::asio::read(socket, boost::asio::buffer(header));
+  std::vector<boost::uint8_t> body(header[0] | (header[1] << 8));
+  boost::asio::read(socket, boost::asio::buffer(body));
+  uLongf length= header[4] | (header[5] << 8);
+  if (length == 0)
+    return std::vector<boost::uint8_t>(body.begin() + 4, body.end());
+  std::vector<boost::uint8_t> packet(length);
+  uncompress(&packet[0], &length, &body[0], body.size());
+  return std::vector<boost::uint8_t>(packet.begin() + 4, packet.end());
+}
+
+static const boost::uint8_t ok_packet[]= { 0, 0, 0, 2, 0, 0, 0 };
+
+/**
+  Sends the handshake of a master which offers the compressed protocol,
+  accepts any authentication and returns the client flags of the slave.
+*/
+static boost::uint32_t greet_slave(tcp::socket &socket)
+{
+  static const boost::uint8_t handshake[]= {
+    10, '5', '.', '5', 0,                       // protocol and version
+    1, 0, 0, 0,                                 // thread id
+    'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 0,  // scramble
+    0xff, 0xf7 & ~0x800, 8, 2, 0,               // capabilities
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 0
+  };
+
+  std::vector<boost::uint8_t> stream;
+  append_packet(&stream, handshake, sizeof(handshake), 0);
+  boost::asio::write(socket, boost::asio::buffer(stream));
+  boost::uint8_t header[4];
+  boost::asio::read(socket, boost::asio::buffer(header));
+  std::vector<boost::uint8_t> auth(header[0] | (header[1] << 8));
+  boost::asio::read(socket, boost::asio::buffer(auth));
+  stream.clear();
+  append_packet(&stream, ok_packet, sizeof(ok_packet), 2);
+  boost::asio::write(socket, boost::asio::buffer(stream));
+  return auth[0] | (auth[1] << 8) | (auth[2] << 16) | (auth[3] << 24);
+}
+
+/**
+  Appends the events a master starts a binlog dump with: an artificial
+  Rotate event to the requested position and, after the start of a file,
+  the Format description event of the file without its position.
+*/
+static void append_preamble(std::vector<boost::uint8_t> *stream,
+                            const std::string &file, unsigned long position)
+{
+  std::vector<boost::uint8_t> rotate(1 + LOG_EVENT_HEADER_SIZE - 1 + 8);
+  rotate[5]= mysql::ROTATE_EVENT;
+  rotate[18]= 0x20;
+  int3store(&rotate[LOG_EVENT_HEADER_SIZE], position);
+  rotate.insert(rotate.end(), file.begin(), file.end());
+  int3store(&rotate[10], rotate.size() - 1);
+  append_packet(stream, &rotate[0], rotate.size(), 0);
+
+  if (position > 4)
+  {
+    std::vector<boost::uint8_t> format(1 + LOG_EVENT_HEADER_SIZE - 1 + 84);
+    format[5]= mysql::FORMAT_DESCRIPTION_EVENT;
+    int3store(&format[10], format.size() - 1);
+    append_packet(stream, &format[0], format.size(), 0);
+  }
+}
+
+/**
+  Stands in for a master which offers the compressed protocol. It accepts
+  one connection, expects a slave registration and a binlog dump, and
+  sends events with bodies of the given sizes. With preamble set these
+  are preceded by the artificial events a master starts a dump with.
+  The headers claim the lengths in event_lengths where those are not 0,
+  and the real lengths otherwise.
+*/
+class Master_stand_in
+{
+public:
+  Master_stand_in(const std::vector<std::size_t> &body_sizes,
+                  bool preamble= false,
+                  const std::vector<boost::uint32_t> &event_lengths=
+                    std::vector<boost::uint32_t>())
+    : m_acceptor(m_io_service,
+                 tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+      m_body_sizes(body_sizes), m_event_lengths(event_lengths),
+      m_preamble(preamble), m_client_flags(0),
+      m_commands(0), m_dump_position(0),
+      m_thread(boost::bind(&Master_stand_in::serve, this))
+  {
+  }
+
+  ~Master_stand_in() { m_thread.join(); }
+
+  unsigned short port() const { return m_acceptor.local_endpoint().port(); }
+  boost::uint32_t client_flags() const { return m_client_flags; }
+  int commands() const { return m_commands; }
+  const std::string &dump_file() const { return m_dump_file; }
+  unsigned long dump_position() const { return m_dump_position; }
+
+private:
+  void serve()
+  {
+    tcp::socket socket(m_io_service);
+    m_acceptor.accept(socket);
+
+    m_client_flags= greet_slave(socket);
+    std::vector<boost::uint8_t> stream;
+
+    /* From here on everything is compressed if the slave asked for it. */
+    bool compressed= (m_client_flags & CLIENT_COMPRESS) != 0;
+    if (read_command(socket, compressed)[0] == mysql::system::COM_REGISTER_SLAVE)
+      ++m_commands;
+    stream.clear();
+    append_packet(&stream, ok_packet, sizeof(ok_packet), 1);
+    write_stream(socket, stream, compressed);
+    std::vector<boost::uint8_t> dump= read_command(socket, compressed);
+    if (dump[0] == mysql::system::COM_BINLOG_DUMP)
+      ++m_commands;
+    m_dump_position= dump[1] | (dump[2] << 8) | (dump[3] << 16) |
+                     ((unsigned long) dump[4] << 24);
+    m_dump_file.assign(dump.begin() + 11, dump.end());
+
+    stream.clear();
+    if (m_preamble)
+      append_preamble(&stream, m_dump_file, m_dump_position);
+    for (std::size_t i= 0; i < m_body_sizes.size(); ++i)
+    {
+      std::vector<boost::uint8_t> event(1 + LOG_EVENT_HEADER_SIZE - 1 +
+                                        m_body_sizes[i]);
+      event[5]= mysql::XID_EVENT;
+      boost::uint32_t event_length= event.size() - 1;
+      if (i < m_event_lengths.size() && m_event_lengths[i] != 0)
+        event_length= m_event_lengths[i];
+      int3store(&event[10], event_length);
+      event[13]= event_length >> 24;
+      int3store(&event[14], i + 1);
+      for (std::size_t j= LOG_EVENT_HEADER_SIZE; j < event.size(); ++j)
+        event[j]= (j * 31 + i) % 253;
+      append_packet(&stream, &event[0], event.size(), i + 1);
+    }
+    write_stream(socket, stream, compressed);
+
+    /* Wait for the driver to hang up. */
+    boost::uint8_t header[4];
+    boost::system::error_code err;
+    boost::asio::read(socket, boost::asio::buffer(header), err);
+  }
+
+  boost::asio::io_service m_io_service;
+  tcp::acceptor m_acceptor;
+  std::vector<std::size_t> m_body_sizes;
+  std::vector<boost::uint32_t> m_event_lengths;
+  bool m_preamble;
+  boost::uint32_t m_client_flags;
+  int m_commands;
+  std::string m_dump_file;
+  unsigned long m_dump_position;
+  boost::thread m_thread;
+};
+
+/**
+  Connects to a given binlog position instead of asking for the master
+  status.
+*/
+class Positioned_tcp_driver : public Binlog_tcp_driver
+{
+public:
+  Positioned_tcp_driver(unsigned short port, bool compress, bool inline_io)
+    : Binlog_tcp_driver("root", "", "127.0.0.1", port, EVENT_QUEUE_SIZE,
+                        EVENT_QUEUE_BYTES, 0, compress, inline_io)
+  {
+  }
+
+  int connect()
+  {
+    return Binlog_tcp_driver::connect(user(), password(), host(), port(),
+                                      "master-bin.000001", 4);
+  }
+};
+
+TEST_F(TestTransport, TcpDriver_Compressed) {
+  /* Small events, and ones too large for the receive buffer. */
+  std::vector<std::size_t> body_sizes;
+  for (std::size_t i= 0; i < 2000; ++i)
+    body_sizes.push_back(i % 100 == 50 ? 300000 + i : i % 300);
+
+  Master_stand_in master(body_sizes);
+  {
+    Positioned_tcp_driver driver(master.port(), true, false);
+    ASSERT_EQ(driver.connect(), 0);
+    EXPECT_TRUE(driver.compressed());
+    EXPECT_TRUE(master.client_flags() & CLIENT_COMPRESS);
+
+    for (std::size_t i= 0; i < body_sizes.size(); ++i)
+    {
+      mysql::Binary_log_event *event;
+      driver.wait_for_next_event(&event);
+      ASSERT_EQ(event->get_event_type(), mysql::XID_EVENT);
+      EXPECT_EQ(event->header()->next_position, i + 1);
+      EXPECT_EQ(event->header()->event_length,
+                LOG_EVENT_HEADER_SIZE - 1 + body_sizes[i]);
+      delete event;
+    }
+  }
+  EXPECT_EQ(master.commands(), 2);
+}
+
+TEST_F(TestTransport, TcpDriver_LargeEvents) {
+  /*
+    Events over several packets, and ones filling their packets exactly,
+    which are followed by an empty packet.
+  */
+  std::vector<std::size_t> body_sizes;
+  body_sizes.push_back(10);
+  body_sizes.push_back(2 * MAX_PACKAGE_SIZE + 1000);
+  body_sizes.push_back(10);
+  body_sizes.push_back(MAX_PACKAGE_SIZE - LOG_EVENT_HEADER_SIZE);
+  body_sizes.push_back(10);
+  body_sizes.push_back(2 * MAX_PACKAGE_SIZE - LOG_EVENT_HEADER_SIZE);
+  body_sizes.push_back(10);
+
+  Master_stand_in master(body_sizes);
+  {
+    Positioned_tcp_driver driver(master.port(), false, false);
+    ASSERT_EQ(driver.connect(), 0);
+    for (std::size_t i= 0; i < body_sizes.size(); ++i)
+    {
+      mysql::Binary_log_event *event;
+      ASSERT_EQ(driver.wait_for_next_event(&event), 0);
+      ASSERT_EQ(event->get_event_type(), mysql::XID_EVENT) << i;
+      EXPECT_EQ(event->header()->next_position, i + 1);
+      EXPECT_EQ(event->header()->event_length,
+                LOG_EVENT_HEADER_SIZE - 1 + body_sizes[i]);
+      delete event;
+    }
+  }
+}
+
+TEST_F(TestTransport, TcpDriver_BadEventLength) {
+  /* Events claiming to be too large and smaller than their header. */
+  std::vector<std::size_t> body_sizes(5, 10);
+  std::vector<boost::uint32_t> event_lengths(5, 0);
+  event_lengths[1]= MAX_EVENT_SIZE + 1;
+  event_lengths[3]= LOG_EVENT_HEADER_SIZE - 2;
+  const int types[]= { mysql::XID_EVENT, mysql::INCIDENT_EVENT,
+                       mysql::XID_EVENT, mysql::INCIDENT_EVENT,
+                       mysql::XID_EVENT };
+
+  Master_stand_in master(body_sizes, false, event_lengths);
+  {
+    Positioned_tcp_driver driver(master.port(), false, false);
+    ASSERT_EQ(driver.connect(), 0);
+    for (std::size_t i= 0; i < body_sizes.size(); ++i)
+    {
+      mysql::Binary_log_event *event;
+      ASSERT_EQ(driver.wait_for_next_event(&event), 0);
+      EXPECT_EQ(event->get_event_type(), types[i]) << i;
+      delete event;
+    }
+  }
+}
+
+TEST_F(TestTransport, TcpDriver_DeleteFull) {
+  /* The event loop waits for room when the driver is deleted. */
+  std::vector<std::size_t> body_sizes(3 * EVENT_QUEUE_SIZE, 10);
+  Master_stand_in master(body_sizes);
+  {
+    Positioned_tcp_driver driver(master.port(), false, false);
+    ASSERT_EQ(driver.connect(), 0);
+    mysql::Binary_log_event *event;
+    ASSERT_EQ(driver.wait_for_next_event(&event), 0);
+    delete event;
+    usleep(100000);
+  }
+}
+
+TEST_F(TestTransport, TcpDriver_Inline) {
+  std::vector<std::size_t> body_sizes;
+  for (std::size_t i= 0; i < 2000; ++i)
+    body_sizes.push_back(i % 100 == 50 ? 300000 + i : i % 300);
+
+  Master_stand_in master(body_sizes);
+  {
+    Positioned_tcp_driver driver(master.port(), false, true);
+    ASSERT_EQ(driver.connect(), 0);
+    EXPECT_FALSE(driver.compressed());
+
+    std::vector<mysql::Binary_log_event *> events;
+    std::size_t count= 0;
+    while (count < body_sizes.size())
+    {
+      driver.wait_for_next_events(&events, 64);
+      ASSERT_FALSE(events.empty());
+      EXPECT_LE(events.size(), 64U);
+      for (std::size_t i= 0; i < events.size(); ++i, ++count)
+      {
+        ASSERT_EQ(events[i]->get_event_type(), mysql::XID_EVENT);
+        EXPECT_EQ(events[i]->header()->next_position, count + 1);
+        EXPECT_EQ(events[i]->header()->event_length,
+                  LOG_EVENT_HEADER_SIZE - 1 + body_sizes[count]);
+        delete events[i];
+      }
+      events.clear();
+    }
+
+    /* Nothing more is sent, so waiting times out. */
+    driver.wait_for_next_events(&events, 64, 50);
+    EXPECT_TRUE(events.empty());
+  }
+  EXPECT_EQ(master.commands(), 2);
+}
+
+/**
+  Starts the binlog dump wherever it is told to. The stand-in only takes
+  the dump connection, so the master is not asked for its binlog files
+  first.
+*/
+class Unchecked_tcp_driver : public Binlog_tcp_driver
+{
+public:
+  Unchecked_tcp_driver(unsigned short port)
+    : Binlog_tcp_driver("root", "", "127.0.0.1", port)
+  {
+  }
+
+  int set_position(const std::string &str, unsigned long position)
+  {
+    return Binlog_tcp_driver::connect(user(), password(), host(), port(),
+                                      str, position);
+  }
+};
+
+TEST_F(TestTransport, CatchupDriver_Switch)
+{
+  char dir_template[]= "/tmp/test-transport.XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir_template));
+  std::string dir(dir_template);
+  write_binlog(dir + "/master-bin.000001", 3, "master-bin.000002");
+  write_binlog(dir + "/master-bin.000002", 2, "");
+  {
+    /* The copy of the active file ends within an event. */
+    std::ofstream active((dir + "/master-bin.000002").c_str(),
+                         std::ios::binary | std::ios::app);
+    const char partial[7]= { 0 };
+    active.write(partial, sizeof(partial));
+  }
+  const unsigned long copied= 4 + 2 * (LOG_EVENT_HEADER_SIZE - 1 + 8);
+
+  std::vector<std::size_t> body_sizes(50, 8);
+  Master_stand_in master(body_sizes, true);
+  {
+    Binlog_catchup_driver driver(dir, new Unchecked_tcp_driver(master.port()));
+    ASSERT_EQ(driver.connect(), 0);
+
+    /* Skip the first event of the copies. */
+    ASSERT_EQ(driver.set_position("master-bin.000001",
+                                  4 + LOG_EVENT_HEADER_SIZE - 1 + 8), 0);
+    const int local_types[]= { mysql::XID_EVENT, mysql::XID_EVENT,
+                               mysql::ROTATE_EVENT, mysql::XID_EVENT,
+                               mysql::XID_EVENT };
+    mysql::Binary_log_event *event;
+    for (int i= 0; i < sizeof(local_types)/sizeof(*local_types); ++i)
+    {
+      ASSERT_EQ(driver.wait_for_next_event(&event), 0);
+      EXPECT_EQ(event->get_event_type(), local_types[i]);
+      delete event;
+    }
+    EXPECT_FALSE(driver.live());
+    std::string file;
+    unsigned long position;
+    driver.get_position(&file, &position);
+    EXPECT_EQ(file, "master-bin.000002");
+    EXPECT_EQ(position, copied);
+
+    /* The rest comes from the master, without its preamble. */
+    std::vector<mysql::Binary_log_event *> events;
+    while (events.size() < body_sizes.size())
+      ASSERT_EQ(driver.wait_for_next_events(&events, 16), 0);
+    EXPECT_TRUE(driver.live());
+    ASSERT_EQ(events.size(), body_sizes.size());
+    for (std::size_t i= 0; i < events.size(); ++i)
+    {
+      EXPECT_EQ(events[i]->get_event_type(), mysql::XID_EVENT);
+      delete events[i];
+    }
+    driver.get_position(&file, &position);
+    EXPECT_EQ(file, "master-bin.000002");
+    EXPECT_EQ(position, body_sizes.size());
+  }
+  EXPECT_EQ(master.commands(), 2);
+  EXPECT_EQ(master.dump_file(), "master-bin.000002");
+  EXPECT_EQ(master.dump_position(), copied);
+
+  unlink((dir + "/master-bin.000001").c_str());
+  unlink((dir + "/master-bin.000002").c_str());
+  rmdir(dir.c_str());
+}
+
+typedef std::vector<std::pair<std::string, std::vector<boost::uint8_t> > >
+  Binlog_files;
+
+/**
+  Stands in for a master with the given binlog files. It takes any number
+  of connections, each served on a thread of its own, answers SHOW BINARY
+  LOGS and dumps the files like a master does: from the requested
+  position on through all the files after it, until the slave hangs up.
+*/
+class Files_master_stand_in
+{
+public:
+  Files_master_stand_in(const Binlog_files &files)
+    : m_acceptor(m_io_service,
+                 tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+      m_files(files), m_stop(false),
+      m_thread(boost::bind(&Files_master_stand_in::accept_all, this))
+  {
+  }
+
+  ~Files_master_stand_in()
+  {
+    m_stop= true;
+    m_thread.join();
+  }
+
+  unsigned short port() const { return m_acceptor.local_endpoint().port(); }
+
+  /**
+    The server ids the binlog dumps were requested with.
+  */
+  std::vector<boost::uint32_t> dump_server_ids()
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_dump_server_ids;
+  }
+
+private:
+  void accept_all()
+  {
+    boost::thread_group connections;
+    m_acceptor.non_blocking(true);
+    while (!m_stop)
+    {
+      tcp::socket *socket= new tcp::socket(m_io_service);
+      boost::system::error_code err;
+      m_acceptor.accept(*socket, err);
+      if (err)
+      {
+        delete socket;
+        boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+        continue;
+      }
+      connections.create_thread(boost::bind(&Files_master_stand_in::serve,
+                                            this, socket));
+    }
+    connections.join_all();
+  }
+
+  void serve(tcp::socket *socket)
+  {
+    try
+    {
+      greet_slave(*socket);
+      read_command(*socket, false);
+      std::vector<boost::uint8_t> stream;
+      append_packet(&stream, ok_packet, sizeof(ok_packet), 1);
+      boost::asio::write(*socket, boost::asio::buffer(stream));
+
+      std::vector<boost::uint8_t> command= read_command(*socket, false);
+      if (command[0] == mysql::system::COM_QUERY)
+        list_files(*socket);
+      else if (command[0] == mysql::system::COM_BINLOG_DUMP)
+        dump(*socket, command);
+
+      /* Wait for the driver to hang up. */
+      boost::uint8_t header[4];
+      boost::system::error_code err;
+      boost::asio::read(*socket, boost::asio::buffer(header), err);
+    } catch (boost::system::system_error &)
+    {
+    }
+    delete socket;
+  }
+
+  /**
+    Sends the result set of SHOW BINARY LOGS.
+  */
+  void list_files(tcp::socket &socket)
+  {
+    std::vector<boost::uint8_t> stream;
+    boost::uint8_t packet_no= 1;
+    const boost::uint8_t field_count[]= { 2 };
+    append_packet(&stream, field_count, sizeof(field_count), packet_no++);
+    const char *names[]= { "Log_name", "File_size" };
+    const boost::uint8_t types[]= { mysql::system::MYSQL_TYPE_VAR_STRING,
+                                    mysql::system::MYSQL_TYPE_LONGLONG };
+    for (int i= 0; i < 2; ++i)
+    {
+      std::vector<boost::uint8_t> field;
+      append_string(&field, "def");
+      for (int j= 0; j < 3; ++j)
+        append_string(&field, "");
+      append_string(&field, names[i]);
+      append_string(&field, names[i]);
+      const boost::uint8_t rest[]= { 0x0c, 8, 0, 20, 0, 0, 0, types[i],
+                                     0, 0, 0, 0, 0 };
+      field.insert(field.end(), rest, rest + sizeof(rest));
+      append_packet(&stream, &field[0], field.size(), packet_no++);
+    }
+    const boost::uint8_t eof[]= { 0xfe, 0, 0, 2, 0 };
+    append_packet(&stream, eof, sizeof(eof), packet_no++);
+    for (std::size_t i= 0; i < m_files.size(); ++i)
+    {
+      std::vector<boost::uint8_t> row;
+      append_string(&row, m_files[i].first);
+      append_string(&row,
+                    boost::lexical_cast<std::string>(m_files[i].second.size()));
+      append_packet(&stream, &row[0], row.size(), packet_no++);
+    }
+    append_packet(&stream, eof, sizeof(eof), packet_no++);
+    boost::asio::write(socket, boost::asio::buffer(stream));
+  }
+
+  /**
+    Sends the events from the requested position to the end of the last
+    file, with the preamble of a dump and another one at each new file.
+  */
+  void dump(tcp::socket &socket, const std::vector<boost::uint8_t> &command)
+  {
+    unsigned long position= command[1] | (command[2] << 8) |
+                            (command[3] << 16) | ((unsigned long) command[4] << 24);
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_dump_server_ids.push_back(command[7] | (command[8] << 8) |
+                                  (command[9] << 16) |
+                                  ((boost::uint32_t) command[10] << 24));
+    }
+    std::string name(command.begin() + 11, command.end());
+    std::size_t file= 0;
+    while (file < m_files.size() && m_files[file].first != name)
+      ++file;
+
+    std::vector<boost::uint8_t> stream;
+    for (; file < m_files.size(); ++file, position= 4)
+    {
+      append_preamble(&stream, m_files[file].first, position);
+      const std::vector<boost::uint8_t> &binlog= m_files[file].second;
+      while (position < binlog.size())
+      {
+        std::size_t length= binlog[position + 9] | (binlog[position + 10] << 8);
+        std::vector<boost::uint8_t> event(1, 0);
+        event.insert(event.end(), &binlog[position], &binlog[position] + length);
+        append_packet(&stream, &event[0], event.size(), 0);
+        position+= length;
+      }
+    }
+    boost::asio::write(socket, boost::asio::buffer(stream));
+  }
+
+  static void append_string(std::vector<boost::uint8_t> *packet,
+                            const std::string &value)
+  {
+    packet->push_back(value.size());
+    packet->insert(packet->end(), value.begin(), value.end());
+  }
+
+  boost::asio::io_service m_io_service;
+  tcp::acceptor m_acceptor;
+  Binlog_files m_files;
+  boost::mutex m_mutex;
+  std::vector<boost::uint32_t> m_dump_server_ids;
+  boost::atomic<bool> m_stop;
+  boost::thread m_thread;
+};
+
+TEST_F(TestTransport, BackfillDriver_Files)
+{
+  Binlog_files files;
+  const int file_count= 6;
+  std::size_t total= 0;
+  for (int i= 0; i < file_count; ++i)
+  {
+    char name[32];
+    snprintf(name, sizeof(name), "master-bin.%06d", i + 1);
+    char next[32];
+    snprintf(next, sizeof(next), "master-bin.%06d", i + 2);
+    int events= 100 * (i + 1);
+    files.push_back(std::make_pair(std::string(name),
+                                   make_binlog(events,
+                                               i + 1 < file_count ? next : "",
+                                               1000 * (i + 1))));
+    total+= events + (i + 1 < file_count);
+  }
+
+  Files_master_stand_in master(files);
+  {
+    Binlog_backfill_driver driver("root", "", "127.0.0.1", master.port(), 2,
+                                  100);
+    ASSERT_EQ(driver.connect(), 0);
+    ASSERT_EQ(driver.files().size(), (std::size_t) file_count);
+
+    /* The events of all files arrive in order, each one once. */
+    std::vector<mysql::Binary_log_event *> events;
+    boost::uint32_t last_time= 0;
+    std::size_t count= 0;
+    while (count < total)
+    {
+      events.clear();
+      ASSERT_EQ(driver.wait_for_next_events(&events, 64), 0);
+      for (std::size_t i= 0; i < events.size(); ++i, ++count)
+      {
+        EXPECT_GT(events[i]->header()->timestamp, last_time);
+        last_time= events[i]->header()->timestamp;
+        delete events[i];
+      }
+    }
+    EXPECT_EQ(count, total);
+    std::string file;
+    unsigned long position;
+    driver.get_position(&file, &position);
+    EXPECT_EQ(file, files.back().first);
+    EXPECT_EQ(position, files.back().second.size());
+
+    /* Start again in the middle of a file. */
+    const unsigned long event_size= LOG_EVENT_HEADER_SIZE - 1 + 8;
+    ASSERT_EQ(driver.set_position(files[2].first, 4 + 10 * event_size), 0);
+    mysql::Binary_log_event *event;
+    ASSERT_EQ(driver.wait_for_next_event(&event), 0);
+    EXPECT_EQ(event->get_event_type(), mysql::XID_EVENT);
+    EXPECT_EQ(event->header()->timestamp, 3010U);
+    delete event;
+    driver.get_position(&file, &position);
+    EXPECT_EQ(file, files[2].first);
+    EXPECT_EQ(position, 4 + 11 * event_size);
+
+    EXPECT_NE(driver.set_position("master-bin.000099", 4), 0);
+  }
+
+  std::vector<boost::uint32_t> server_ids= master.dump_server_ids();
+  EXPECT_GE(server_ids.size(), (std::size_t) file_count);
+  for (std::size_t i= 0; i < server_ids.size(); ++i)
+  {
+    EXPECT_GE(server_ids[i], 100U);
+    EXPECT_LE(server_ids[i], 101U);
+  }
+}
+
+TEST_F(TestTransport, ReplayDriver_Pacing)
+{
+  char dir_template[]= "/tmp/test-transport.XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir_template));
+  std::string dir(dir_template);
+  std::string path= dir + "/replay-bin.000001";
+  write_binlog(path, 4, "", 1300000000);
+
+  /* Ten times as fast, the events are 100ms apart. */
+  Binary_log_driver *drv=
+    create_transport(("file://" + path + "?replay=10").c_str());
+  Binlog_replay_driver *replay= dynamic_cast<Binlog_replay_driver*>(drv);
+  ASSERT_TRUE(replay);
+  EXPECT_EQ(replay->speed(), 10);
+  ASSERT_EQ(replay->connect(), 0);
+  boost::system_time start= boost::get_system_time();
+  std::vector<mysql::Binary_log_event *> events;
+  ASSERT_EQ(replay->wait_for_next_events(&events, 10, 50), 0);
+  EXPECT_EQ(events.size(), 1U);
+  ASSERT_EQ(replay->wait_for_next_events(&events, 10, 50), 0);
+  EXPECT_EQ(events.size(), 1U);
+  std::string file;
+  unsigned long position;
+  replay->get_position(&file, &position);
+  EXPECT_EQ(position, 4 + LOG_EVENT_HEADER_SIZE - 1 + 8);
+  EXPECT_EQ(read_all(replay).size(), 3U);
+  boost::int64_t elapsed=
+    (boost::get_system_time() - start).total_milliseconds();
+  EXPECT_GE(elapsed, 300);
+  EXPECT_LT(elapsed, 1000);
+  EXPECT_LT(replay->behind(), 100UL);
+  delete events[0];
+  delete replay;
+
+  /* As fast as they are read. */
+  drv= create_transport(("file://" + path + "?replay=max").c_str());
+  replay= dynamic_cast<Binlog_replay_driver*>(drv);
+  ASSERT_TRUE(replay);
+  ASSERT_EQ(replay->connect(), 0);
+  start= boost::get_system_time();
+  EXPECT_EQ(read_all(replay).size(), 4U);
+  EXPECT_LT((boost::get_system_time() - start).total_milliseconds(), 100);
+  delete replay;
+
+  EXPECT_FALSE(create_transport(("file://" + path + "?replay=0").c_str()));
+  EXPECT_FALSE(create_transport(("file://" + path + "?replay=x2").c_str()));
+  EXPECT_FALSE(create_transport(("file://" + path + "?replay=2&threads=2").c_str()));
+  EXPECT_FALSE(create_transport(("file+mmap://" + path + "?replay=2").c_str()));
+  unlink(path.c_str());
+  rmdir(dir.c_str());
+}
+
+/**
+  Reads a whole file.
+*/
+static std::vector<boost::uint8_t> read_file(const std::string &path)
+{
+  std::ifstream in(path.c_str(), std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  return std::vector<boost::uint8_t>(data.begin(), data.end());
+}
+
+/**
+  Dumps the files of the master from a position on with a relay log in
+  dir, until count events which are not made up by the master arrived.
+*/
+static void relay_dump(unsigned short port, const std::string &dir,
+                       const std::string &file, unsigned long position,
+                       std::size_t count)
+{
+  Binlog_tcp_driver driver("root", "", "127.0.0.1", port);
+  Relay_log *relay= new Relay_log(dir);
+  driver.set_relay_log(relay);
+  ASSERT_EQ(driver.set_position(file, position), 0);
+  while (count > 0)
+  {
+    mysql::Binary_log_event *event;
+    ASSERT_EQ(driver.wait_for_next_event(&event), 0);
+    ASSERT_NE(event->get_event_type(), mysql::INCIDENT_EVENT);
+    if (event->header()->next_position != 0)
+      --count;
+    delete event;
+  }
+  EXPECT_TRUE(relay->wait_synced(5000));
+  EXPECT_GT(relay->syncs(), 0UL);
+}
+
+TEST_F(TestTransport, RelayLog_Copies)
+{
+  Binlog_files files;
+  std::size_t total= 0;
+  for (int i= 0; i < 3; ++i)
+  {
+    char name[32], next[32];
+    snprintf(name, sizeof(name), "master-bin.%06d", i + 1);
+    snprintf(next, sizeof(next), "master-bin.%06d", i + 2);
+    files.push_back(std::make_pair(std::string(name),
+                                   make_binlog(1000 * (i + 1),
+                                               i < 2 ? next : "")));
+    total+= 1000 * (i + 1) + (i < 2);
+  }
+  Files_master_stand_in master(files);
+
+  char dir_template[]= "/tmp/test-transport.XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir_template));
+  std::string dir(dir_template);
+
+  /* The copies hold the same bytes as the master's files. */
+  relay_dump(master.port(), dir, files[0].first, 4, total);
+  for (std::size_t i= 0; i < files.size(); ++i)
+    EXPECT_TRUE(read_file(dir + "/" + files[i].first) == files[i].second)
+      << files[i].first;
+  EXPECT_EQ(read_file(dir + "/master-bin.index").size(),
+            files.size() * sizeof("./master-bin.000001"));
+
+  /* A dump in the middle of a file goes on with its copy. */
+  const unsigned long event_size= LOG_EVENT_HEADER_SIZE - 1 + 8;
+  unsigned long middle= 4 + 500 * event_size;
+  {
+    std::ofstream out((dir + "/" + files[1].first).c_str(),
+                      std::ios::binary | std::ios::app);
+    out << "garbage";
+  }
+  relay_dump(master.port(), dir, files[1].first, middle,
+             total - 1001 - 500);
+  EXPECT_TRUE(read_file(dir + "/" + files[1].first) == files[1].second);
+  EXPECT_EQ(read_file(dir + "/master-bin.index").size(),
+            files.size() * sizeof("./master-bin.000001"));
+
+  /* The copies can be read with a file driver. */
+  Binary_log_driver *drv=
+    create_transport(("file://" + dir + "/master-bin.index").c_str());
+  ASSERT_TRUE(drv);
+  ASSERT_EQ(drv->connect(), 0);
+  EXPECT_EQ(read_all(drv).size(), total);
+  delete drv;
+
+  /* Without a copy to go on with, writing starts at the next file. */
+  for (std::size_t i= 0; i < files.size(); ++i)
+    unlink((dir + "/" + files[i].first).c_str());
+  unlink((dir + "/master-bin.index").c_str());
+  relay_dump(master.port(), dir, files[1].first, middle,
+             total - 1001 - 500);
+  struct stat stat_buff;
+  EXPECT_NE(stat((dir + "/" + files[1].first).c_str(), &stat_buff), 0);
+  EXPECT_TRUE(read_file(dir + "/" + files[2].first) == files[2].second);
+  EXPECT_EQ(read_file(dir + "/master-bin.index").size(),
+            sizeof("./master-bin.000001"));
+
+  unlink((dir + "/" + files[2].first).c_str());
+  unlink((dir + "/master-bin.index").c_str());
+  rmdir(dir.c_str());
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();